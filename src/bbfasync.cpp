@@ -0,0 +1,514 @@
+#include "bbfasync.h"
+
+#include <string.h>
+#include <errno.h>
+
+#if defined(__linux__) && defined(__has_include)
+    #if __has_include(<linux/io_uring.h>)
+        #include <linux/io_uring.h>
+        #include <sys/syscall.h>
+        #define BBF_HAVE_IO_URING 1
+    #endif
+#endif
+
+// Largest single read. IORING_OP_READ and pread both take 32-bit-ish lengths.
+constexpr static uint64_t MAX_READ_CHUNK = 0x40000000;
+
+BBFAsyncFetcher::BBFAsyncFetcher(uint32_t qDepth, uint32_t wCount, bool allowIoUring)
+{
+    this->queueDepth = (qDepth == 0) ? 1 : qDepth;
+    this->inFlight = 0;
+    this->freeHead = 0xFFFFFFFF;
+
+    this->doneHead = 0;
+    this->doneCount = 0;
+
+    this->ringFd = -1;
+    this->sqRing = nullptr;
+    this->sqRingSize = 0;
+    this->cqRing = nullptr;
+    this->cqRingSize = 0;
+    this->sqEntries = nullptr;
+    this->sqEntriesSize = 0;
+    this->pendingSubmit = 0;
+
+    this->workers = nullptr;
+    this->workerCount = 0;
+    this->workHead = 0;
+    this->workCount = 0;
+    this->stopping = false;
+
+    this->requests = (FetchRequest*)calloc(this->queueDepth, sizeof(FetchRequest));
+    this->doneQueue = (uint32_t*)malloc(sizeof(uint32_t) * this->queueDepth);
+    this->workQueue = (uint32_t*)malloc(sizeof(uint32_t) * this->queueDepth);
+    if (!this->requests || !this->doneQueue || !this->workQueue)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate fetch queue of %u.\n", this->queueDepth);
+        this->queueDepth = 0;
+        return;
+    }
+
+    // Every slot starts on the free list
+    uint32_t requestIterator = this->queueDepth;
+    while (requestIterator > 0)
+    {
+        requestIterator--;
+        this->requests[requestIterator].nextFree = this->freeHead;
+        this->freeHead = requestIterator;
+    }
+
+    // Kept with io_uring too, in case the ring fails later on
+    this->workerCount = (wCount == 0) ? 1 : wCount;
+    if (allowIoUring && setupRing())
+    {
+        return;
+    }
+
+    // No io_uring (old kernel, seccomp, not Linux). Block in worker threads instead.
+    startWorkers();
+}
+
+void BBFAsyncFetcher::startWorkers()
+{
+    this->workers = new std::thread[this->workerCount];
+
+    uint32_t workerIterator = 0;
+    for (; workerIterator < this->workerCount; workerIterator++)
+    {
+        this->workers[workerIterator] = std::thread(&BBFAsyncFetcher::workerLoop, this);
+    }
+}
+
+BBFAsyncFetcher::~BBFAsyncFetcher()
+{
+    // Buffers belong to the caller, so nothing can be abandoned mid-read.
+    while (this->inFlight > 0)
+    {
+        poll(1);
+    }
+
+    if (this->workers)
+    {
+        {
+            std::lock_guard<std::mutex> guard(this->queueLock);
+            this->stopping = true;
+        }
+        this->workReady.notify_all();
+
+        uint32_t workerIterator = 0;
+        for (; workerIterator < this->workerCount; workerIterator++)
+        {
+            this->workers[workerIterator].join();
+        }
+
+        delete[] this->workers;
+        this->workers = nullptr;
+    }
+
+    closeRing();
+
+    free(this->requests);
+    free(this->doneQueue);
+    free(this->workQueue);
+    this->requests = nullptr;
+    this->doneQueue = nullptr;
+    this->workQueue = nullptr;
+}
+
+bool BBFAsyncFetcher::fetchAsset(BBFReader* reader, uint64_t assetIndex, void* buffer, uint64_t bufferSize, BBFFetchCallback callback, void* userData)
+{
+    if (!reader || !buffer || !callback || this->freeHead == 0xFFFFFFFF)
+    {
+        return false;
+    }
+
+    int fileDescriptor = -1;
+    uint64_t fileOffset = 0;
+    uint64_t length = 0;
+    if (!reader->getAssetFileRange(assetIndex, &fileDescriptor, &fileOffset, &length) || bufferSize < length)
+    {
+        return false;
+    }
+
+    uint32_t requestIndex = this->freeHead;
+    FetchRequest* request = &this->requests[requestIndex];
+    this->freeHead = request->nextFree;
+
+    request->fileDescriptor = fileDescriptor;
+    request->fileOffset = fileOffset;
+    request->buffer = (uint8_t*)buffer;
+    request->length = length;
+    request->bytesDone = 0;
+    request->assetIndex = assetIndex;
+    request->result = 0;
+    request->callback = callback;
+    request->userData = userData;
+    this->inFlight++;
+
+    // No file behind this reader (memory, callback, range backends). Read it now, report it on the next poll.
+    if (fileDescriptor == -1 || length == 0)
+    {
+        request->result = (length == 0 || reader->getBackend()->read(fileOffset, buffer, length)) ? (int64_t)length : -EIO;
+        finishRequest(requestIndex);
+        return true;
+    }
+
+    if (this->ringFd != -1)
+    {
+        return submitRead(requestIndex);
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(this->queueLock);
+        this->workQueue[(this->workHead + this->workCount) % this->queueDepth] = requestIndex;
+        this->workCount++;
+    }
+    this->workReady.notify_one();
+    return true;
+}
+
+void BBFAsyncFetcher::finishRequest(uint32_t requestIndex)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->queueLock);
+        this->doneQueue[(this->doneHead + this->doneCount) % this->queueDepth] = requestIndex;
+        this->doneCount++;
+    }
+    this->doneReady.notify_one();
+}
+
+uint32_t BBFAsyncFetcher::runCallbacks()
+{
+    uint32_t ranCount = 0;
+
+    while (true)
+    {
+        uint32_t requestIndex = 0;
+        {
+            std::lock_guard<std::mutex> guard(this->queueLock);
+            if (this->doneCount == 0)
+            {
+                break;
+            }
+            requestIndex = this->doneQueue[this->doneHead];
+            this->doneHead = (this->doneHead + 1) % this->queueDepth;
+            this->doneCount--;
+        }
+
+        // Free the slot first, so the callback can queue the next read.
+        FetchRequest finished = this->requests[requestIndex];
+        this->requests[requestIndex].nextFree = this->freeHead;
+        this->freeHead = requestIndex;
+        this->inFlight--;
+
+        finished.callback(finished.userData, finished.assetIndex, finished.buffer, finished.result);
+        ranCount++;
+    }
+
+    return ranCount;
+}
+
+uint32_t BBFAsyncFetcher::poll(uint32_t minComplete)
+{
+    uint32_t ranCount = runCallbacks();
+
+    if (this->ringFd != -1)
+    {
+        return ranCount + reapRing((minComplete > ranCount) ? minComplete - ranCount : 0);
+    }
+
+    while (ranCount < minComplete && this->inFlight > 0)
+    {
+        {
+            std::unique_lock<std::mutex> lock(this->queueLock);
+            this->doneReady.wait(lock, [this] { return this->doneCount > 0; });
+        }
+        ranCount += runCallbacks();
+    }
+
+    return ranCount;
+}
+
+void BBFAsyncFetcher::workerLoop()
+{
+    while (true)
+    {
+        uint32_t requestIndex = 0;
+        {
+            std::unique_lock<std::mutex> lock(this->queueLock);
+            this->workReady.wait(lock, [this] { return this->stopping || this->workCount > 0; });
+            if (this->workCount == 0)
+            {
+                return;
+            }
+            requestIndex = this->workQueue[this->workHead];
+            this->workHead = (this->workHead + 1) % this->queueDepth;
+            this->workCount--;
+        }
+
+        FetchRequest* request = &this->requests[requestIndex];
+
+        #ifdef _WIN32
+            request->result = -ENOSYS;
+        #else
+            while (request->bytesDone < request->length)
+            {
+                uint64_t chunkSize = request->length - request->bytesDone;
+                chunkSize = (chunkSize > MAX_READ_CHUNK) ? MAX_READ_CHUNK : chunkSize;
+
+                ssize_t bytesRead = pread(request->fileDescriptor, request->buffer + request->bytesDone, (size_t)chunkSize, (off_t)(request->fileOffset + request->bytesDone));
+                if (bytesRead < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (bytesRead <= 0)
+                {
+                    break;
+                }
+                request->bytesDone += (uint64_t)bytesRead;
+            }
+
+            request->result = (request->bytesDone == request->length) ? (int64_t)request->length : -EIO;
+        #endif
+
+        finishRequest(requestIndex);
+    }
+}
+
+// IO_URING
+
+#ifdef BBF_HAVE_IO_URING
+
+bool BBFAsyncFetcher::setupRing()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+
+    int fd = (int)syscall(__NR_io_uring_setup, this->queueDepth, &params);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // IORING_OP_READ arrived in 5.6, same as IORING_FEAT_RW_CUR_POS.
+    if (!(params.features & IORING_FEAT_RW_CUR_POS))
+    {
+        close(fd);
+        return false;
+    }
+
+    this->ringFd = fd;
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap)
+    {
+        this->sqRingSize = (this->cqRingSize > this->sqRingSize) ? this->cqRingSize : this->sqRingSize;
+        this->cqRingSize = this->sqRingSize;
+    }
+
+    void* sqMap = mmap(NULL, (size_t)this->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sqMap == MAP_FAILED)
+    {
+        closeRing();
+        return false;
+    }
+    this->sqRing = (uint8_t*)sqMap;
+
+    if (singleMap)
+    {
+        this->cqRing = this->sqRing;
+    }
+    else
+    {
+        void* cqMap = mmap(NULL, (size_t)this->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED)
+        {
+            closeRing();
+            return false;
+        }
+        this->cqRing = (uint8_t*)cqMap;
+    }
+
+    this->sqEntriesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqeMap = mmap(NULL, (size_t)this->sqEntriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqeMap == MAP_FAILED)
+    {
+        this->sqEntriesSize = 0;
+        closeRing();
+        return false;
+    }
+    this->sqEntries = sqeMap;
+
+    this->sqHead = (uint32_t*)(this->sqRing + params.sq_off.head);
+    this->sqTail = (uint32_t*)(this->sqRing + params.sq_off.tail);
+    this->sqMask = (uint32_t*)(this->sqRing + params.sq_off.ring_mask);
+    this->sqArray = (uint32_t*)(this->sqRing + params.sq_off.array);
+    this->cqHead = (uint32_t*)(this->cqRing + params.cq_off.head);
+    this->cqTail = (uint32_t*)(this->cqRing + params.cq_off.tail);
+    this->cqMask = (uint32_t*)(this->cqRing + params.cq_off.ring_mask);
+    this->cqEntries = this->cqRing + params.cq_off.cqes;
+
+    return true;
+}
+
+void BBFAsyncFetcher::closeRing()
+{
+    if (this->sqEntries)
+    {
+        munmap(this->sqEntries, (size_t)this->sqEntriesSize);
+        this->sqEntries = nullptr;
+    }
+
+    if (this->cqRing && this->cqRing != this->sqRing)
+    {
+        munmap(this->cqRing, (size_t)this->cqRingSize);
+    }
+    this->cqRing = nullptr;
+
+    if (this->sqRing)
+    {
+        munmap(this->sqRing, (size_t)this->sqRingSize);
+        this->sqRing = nullptr;
+    }
+
+    if (this->ringFd != -1)
+    {
+        close(this->ringFd);
+        this->ringFd = -1;
+    }
+}
+
+bool BBFAsyncFetcher::submitRead(uint32_t requestIndex)
+{
+    FetchRequest* request = &this->requests[requestIndex];
+
+    // Only this thread produces, so the tail doesn't need an atomic load. inFlight <= queueDepth <= SQ size.
+    uint32_t tail = *this->sqTail;
+    uint32_t sqIndex = tail & *this->sqMask;
+
+    struct io_uring_sqe* sqe = &((struct io_uring_sqe*)this->sqEntries)[sqIndex];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    uint64_t chunkSize = request->length - request->bytesDone;
+    chunkSize = (chunkSize > MAX_READ_CHUNK) ? MAX_READ_CHUNK : chunkSize;
+
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = request->fileDescriptor;
+    sqe->off = request->fileOffset + request->bytesDone;
+    sqe->addr = (uint64_t)(uintptr_t)(request->buffer + request->bytesDone);
+    sqe->len = (uint32_t)chunkSize;
+    sqe->user_data = requestIndex;
+    request->inRing = true;
+
+    this->sqArray[sqIndex] = sqIndex;
+    __atomic_store_n(this->sqTail, tail + 1, __ATOMIC_RELEASE);
+    this->pendingSubmit++;
+
+    return true;
+}
+
+uint32_t BBFAsyncFetcher::reapRing(uint32_t minComplete)
+{
+    uint32_t completedCount = 0;
+
+    while (true)
+    {
+        uint32_t waitFor = (completedCount < minComplete && this->inFlight > 0) ? 1 : 0;
+
+        // Submit everything queued since the last poll in one syscall, and wait if asked to.
+        if (this->pendingSubmit > 0 || waitFor > 0)
+        {
+            int submitted = (int)syscall(__NR_io_uring_enter, this->ringFd, this->pendingSubmit, waitFor, waitFor ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+            if (submitted < 0)
+            {
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                {
+                    // Nothing more will come back from this ring. Waiting on it would never end.
+                    int enterError = errno;
+                    fprintf(stderr, "[BBFCODEC] io_uring_enter failed (errno %d). Falling back to pread threads.\n", enterError);
+                    failRing(enterError);
+                    return completedCount + runCallbacks();
+                }
+            }
+            else
+            {
+                this->pendingSubmit -= ((uint32_t)submitted > this->pendingSubmit) ? this->pendingSubmit : (uint32_t)submitted;
+            }
+        }
+
+        uint32_t head = *this->cqHead;
+        uint32_t tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+        bool resubmitted = false;
+
+        for (; head != tail; head++)
+        {
+            struct io_uring_cqe* cqe = &((struct io_uring_cqe*)this->cqEntries)[head & *this->cqMask];
+            uint32_t requestIndex = (uint32_t)cqe->user_data;
+            FetchRequest* request = &this->requests[requestIndex];
+
+            if (cqe->res > 0)
+            {
+                request->bytesDone += (uint64_t)cqe->res;
+
+                // Short read. Ask for the rest.
+                if (request->bytesDone < request->length)
+                {
+                    submitRead(requestIndex);
+                    resubmitted = true;
+                    continue;
+                }
+                request->result = (int64_t)request->length;
+            }
+            else
+            {
+                request->result = (cqe->res < 0) ? (int64_t)cqe->res : -EIO;
+            }
+
+            request->inRing = false;
+            finishRequest(requestIndex);
+        }
+
+        __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+
+        // Callbacks run here, on the polling thread, and may queue more reads.
+        completedCount += runCallbacks();
+
+        if (!resubmitted && this->pendingSubmit == 0 && (completedCount >= minComplete || this->inFlight == 0))
+        {
+            break;
+        }
+    }
+
+    return completedCount;
+}
+
+void BBFAsyncFetcher::failRing(int errorCode)
+{
+    // Everything the ring still holds fails with the error. Closing the ring cancels what the kernel took.
+    uint32_t requestIterator = 0;
+    for (; requestIterator < this->queueDepth; requestIterator++)
+    {
+        if (this->requests[requestIterator].inRing)
+        {
+            this->requests[requestIterator].inRing = false;
+            this->requests[requestIterator].result = -(int64_t)errorCode;
+            finishRequest(requestIterator);
+        }
+    }
+
+    this->pendingSubmit = 0;
+    closeRing();
+    startWorkers();
+}
+
+#else
+
+bool BBFAsyncFetcher::setupRing() { return false; }
+void BBFAsyncFetcher::closeRing() {}
+bool BBFAsyncFetcher::submitRead(uint32_t requestIndex) { (void)requestIndex; return false; }
+uint32_t BBFAsyncFetcher::reapRing(uint32_t minComplete) { (void)minComplete; return 0; }
+void BBFAsyncFetcher::failRing(int errorCode) { (void)errorCode; }
+
+#endif
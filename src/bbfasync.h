@@ -0,0 +1,103 @@
+// BBF Async Fetch
+// Keeps many asset reads in flight, across many books, from one thread.
+// io_uring (IORING_OP_READ) on Linux, a small pread thread pool everywhere else.
+#ifndef BBFASYNC_H
+#define BBFASYNC_H
+
+#include "bbfcodec.h"
+
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Runs on the thread that calls poll(). result is the byte count, or -errno.
+typedef void (*BBFFetchCallback)(void* userData, uint64_t assetIndex, uint8_t* buffer, int64_t result);
+
+class BBFAsyncFetcher
+{
+    public:
+        BBFAsyncFetcher(uint32_t qDepth = 256, uint32_t wCount = 4, bool allowIoUring = true);
+        ~BBFAsyncFetcher(); // Waits for everything in flight.
+        // Not copyable, it owns the ring, the worker threads and the request slots.
+        BBFAsyncFetcher(const BBFAsyncFetcher&) = delete;
+        BBFAsyncFetcher& operator=(const BBFAsyncFetcher&) = delete;
+
+        // Queue a read of a whole asset into buffer (at least the asset's size).
+        // False if the queue is full (poll and try again) or the asset doesn't exist.
+        bool fetchAsset(BBFReader* reader, uint64_t assetIndex, void* buffer, uint64_t bufferSize, BBFFetchCallback callback, void* userData);
+
+        // Run callbacks for finished reads, waiting for at least minComplete of them. Returns how many ran.
+        uint32_t poll(uint32_t minComplete = 0);
+
+        uint32_t getInFlight() const { return inFlight; }
+        uint32_t getQueueDepth() const { return queueDepth; }
+        bool isUsingIoUring() const { return ringFd != -1; }
+
+    private:
+        struct FetchRequest
+        {
+            int fileDescriptor;
+            uint64_t fileOffset;
+            uint8_t* buffer;
+            uint64_t length;
+            uint64_t bytesDone;
+            uint64_t assetIndex;
+            int64_t result;
+            BBFFetchCallback callback;
+            void* userData;
+            uint32_t nextFree;
+            bool inRing; // Submitted to io_uring and not reaped yet
+        };
+
+        uint32_t queueDepth;
+        uint32_t inFlight;
+        FetchRequest* requests;
+        uint32_t freeHead;
+
+        // Finished requests waiting for poll(). Pushed by workers, popped by poll().
+        uint32_t* doneQueue;
+        uint32_t doneHead;
+        uint32_t doneCount;
+
+        // io_uring
+        int ringFd;
+        uint8_t* sqRing;
+        uint64_t sqRingSize;
+        uint8_t* cqRing;
+        uint64_t cqRingSize;
+        void* sqEntries;
+        uint64_t sqEntriesSize;
+        uint32_t* sqHead;
+        uint32_t* sqTail;
+        uint32_t* sqMask;
+        uint32_t* sqArray;
+        uint32_t* cqHead;
+        uint32_t* cqTail;
+        uint32_t* cqMask;
+        void* cqEntries;
+        uint32_t pendingSubmit;
+
+        // Thread pool fallback
+        std::thread* workers;
+        uint32_t workerCount;
+        uint32_t* workQueue;
+        uint32_t workHead;
+        uint32_t workCount;
+        bool stopping;
+        std::mutex queueLock;
+        std::condition_variable workReady;
+        std::condition_variable doneReady;
+
+        bool setupRing();
+        void closeRing();
+        bool submitRead(uint32_t requestIndex);
+        uint32_t reapRing(uint32_t minComplete);
+        void failRing(int errorCode); // io_uring_enter broke: fail what's in the ring with -errorCode, switch to threads
+        void startWorkers();
+        void workerLoop();
+        void finishRequest(uint32_t requestIndex);
+        uint32_t runCallbacks();
+};
+
+#endif // BBFASYNC_H
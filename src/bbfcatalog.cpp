@@ -0,0 +1,708 @@
+#include "bbfcatalog.h"
+#include "bbfprobe.h"
+#include "bbfcodec.h"
+#include "stringpool.h"
+#include "xxhash.h"
+
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#include <algorithm>
+
+// HELPERS
+
+static bool statBook(const char* path, uint64_t* fileSize, int64_t* fileModified)
+{
+    struct stat fileStat;
+    if (stat(path, &fileStat) != 0 || (fileStat.st_mode & S_IFMT) != S_IFREG)
+    {
+        return false;
+    }
+
+    *fileSize = (uint64_t)fileStat.st_size;
+    #if defined(_WIN32)
+        *fileModified = (int64_t)fileStat.st_mtime * 1000000000LL;
+    #elif defined(__APPLE__)
+        *fileModified = (int64_t)fileStat.st_mtimespec.tv_sec * 1000000000LL + fileStat.st_mtimespec.tv_nsec;
+    #else
+        *fileModified = (int64_t)fileStat.st_mtim.tv_sec * 1000000000LL + fileStat.st_mtim.tv_nsec;
+    #endif
+    return true;
+}
+
+static bool growArray(void** array, uint64_t* capacity, uint64_t needed, size_t entrySize)
+{
+    if (needed <= *capacity)
+    {
+        return true;
+    }
+
+    uint64_t newCapacity = *capacity ? *capacity : 64;
+    while (newCapacity < needed)
+    {
+        newCapacity *= 2;
+    }
+
+    void* newArray = realloc(*array, (size_t)(newCapacity * entrySize));
+    if (!newArray)
+    {
+        return false;
+    }
+
+    *array = newArray;
+    *capacity = newCapacity;
+    return true;
+}
+
+// One (term, book) pair before they're grouped into postings
+struct TermHit
+{
+    uint64_t termOffset;
+    uint64_t bookIndex;
+};
+
+// Everything build() collects before writing
+struct CatalogDraft
+{
+    BBFStringPool stringPool;
+    bool poolFailed = false;
+
+    BBFCatalogBook* books = nullptr;
+    uint64_t bookCount = 0;
+    uint64_t bookCap = 0;
+
+    BBFCatalogMeta* metaEntries = nullptr;
+    uint64_t metaCount = 0;
+    uint64_t metaCap = 0;
+
+    TermHit* termHits = nullptr;
+    uint64_t hitCount = 0;
+    uint64_t hitCap = 0;
+
+    ~CatalogDraft()
+    {
+        free(books);
+        free(metaEntries);
+        free(termHits);
+    }
+
+    uint64_t addString(const char* str)
+    {
+        uint64_t strOffset = stringPool.addString(str);
+        poolFailed = poolFailed || (strOffset == 0xFFFFFFFFFFFFFFFF);
+        return strOffset;
+    }
+
+    // Adds the entry to the meta table and its words to the term hits
+    bool addMeta(uint64_t bookIndex, const char* key, const char* value)
+    {
+        if (!growArray((void**)&metaEntries, &metaCap, metaCount + 1, sizeof(BBFCatalogMeta)))
+        {
+            return false;
+        }
+
+        BBFCatalogMeta* metaEntry = &metaEntries[metaCount++];
+        metaEntry->keyOffset = addString(key);
+        metaEntry->valueOffset = addString(value);
+
+        char term[BBF::MAX_CATALOG_TERM + 1];
+        const char* textCursor = value;
+        while (BBFCatalog::nextTerm(&textCursor, term) > 0)
+        {
+            if (!growArray((void**)&termHits, &hitCap, hitCount + 1, sizeof(TermHit)))
+            {
+                return false;
+            }
+            termHits[hitCount].termOffset = addString(term);
+            termHits[hitCount].bookIndex = bookIndex;
+            hitCount++;
+        }
+        return true;
+    }
+};
+
+static bool writeCatalog(CatalogDraft* draft, const char* catalogPath)
+{
+    // Group the hits by term. Same term, same pool offset, so only different terms need a strcmp.
+    const char* poolData = draft->stringPool.getDataRaw();
+    std::sort(draft->termHits, draft->termHits + draft->hitCount, [poolData](const TermHit& left, const TermHit& right)
+    {
+        if (left.termOffset != right.termOffset)
+        {
+            return strcmp(poolData + left.termOffset, poolData + right.termOffset) < 0;
+        }
+        return left.bookIndex < right.bookIndex;
+    });
+
+    BBFCatalogTerm* terms = (BBFCatalogTerm*)malloc(sizeof(BBFCatalogTerm) * (draft->hitCount + 1));
+    uint64_t* postings = (uint64_t*)malloc(sizeof(uint64_t) * (draft->hitCount + 1));
+    if (!terms || !postings)
+    {
+        free(terms);
+        free(postings);
+        return false;
+    }
+
+    uint64_t termCount = 0;
+    uint64_t postingCount = 0;
+    uint64_t hitIterator = 0;
+    for (; hitIterator < draft->hitCount; hitIterator++)
+    {
+        const TermHit* termHit = &draft->termHits[hitIterator];
+        if (termCount == 0 || terms[termCount - 1].termOffset != termHit->termOffset)
+        {
+            terms[termCount].termOffset = termHit->termOffset;
+            terms[termCount].postingStart = postingCount;
+            terms[termCount].postingCount = 0;
+            termCount++;
+        }
+
+        // A word can show up more than once in the same book
+        BBFCatalogTerm* term = &terms[termCount - 1];
+        if (term->postingCount > 0 && postings[postingCount - 1] == termHit->bookIndex)
+        {
+            continue;
+        }
+        postings[postingCount++] = termHit->bookIndex;
+        term->postingCount++;
+    }
+
+    BBFCatalogHeader header = {};
+    header.magic[0] = 'B';
+    header.magic[1] = 'B';
+    header.magic[2] = 'F';
+    header.magic[3] = 'C';
+    header.version = BBF::CATALOG_VERSION;
+    header.headerLen = (uint16_t)sizeof(BBFCatalogHeader);
+
+    header.bookCount = draft->bookCount;
+    header.bookOffset = sizeof(BBFCatalogHeader);
+    header.metaCount = draft->metaCount;
+    header.metaOffset = header.bookOffset + sizeof(BBFCatalogBook) * draft->bookCount;
+    header.termCount = termCount;
+    header.termOffset = header.metaOffset + sizeof(BBFCatalogMeta) * draft->metaCount;
+    header.postingCount = postingCount;
+    header.postingOffset = header.termOffset + sizeof(BBFCatalogTerm) * termCount;
+    header.stringPoolOffset = header.postingOffset + sizeof(uint64_t) * postingCount;
+    header.stringPoolSize = draft->stringPool.getUsedSize();
+
+    const void* sectionData[5] = { draft->books, draft->metaEntries, terms, postings, poolData };
+    uint64_t sectionSizes[5] = {
+        sizeof(BBFCatalogBook) * draft->bookCount,
+        sizeof(BBFCatalogMeta) * draft->metaCount,
+        sizeof(BBFCatalogTerm) * termCount,
+        sizeof(uint64_t) * postingCount,
+        header.stringPoolSize
+    };
+
+    XXH3_state_t* hashState = XXH3_createState();
+    XXH3_64bits_reset(hashState);
+    int sectionIterator = 0;
+    for (; sectionIterator < 5; sectionIterator++)
+    {
+        if (sectionSizes[sectionIterator] > 0)
+        {
+            XXH3_64bits_update(hashState, sectionData[sectionIterator], (size_t)sectionSizes[sectionIterator]);
+        }
+    }
+    header.catalogHash = XXH3_64bits_digest(hashState);
+    XXH3_freeState(hashState);
+
+    // Write next to the destination and rename over it, so a reader never sees half a catalog
+    char* tempPath = nullptr;
+    bool writeOk = false;
+    FILE* catalogFile = BBFBuilder::openTempNear(catalogPath, &tempPath);
+    if (catalogFile)
+    {
+        writeOk = fwrite(&header, sizeof(BBFCatalogHeader), 1, catalogFile) == 1;
+        for (sectionIterator = 0; sectionIterator < 5 && writeOk; sectionIterator++)
+        {
+            if (sectionSizes[sectionIterator] > 0)
+            {
+                writeOk = fwrite(sectionData[sectionIterator], (size_t)sectionSizes[sectionIterator], 1, catalogFile) == 1;
+            }
+        }
+        writeOk = (fclose(catalogFile) == 0) && writeOk;
+    }
+
+    if (!writeOk && tempPath)
+    {
+        remove(tempPath);
+        free(tempPath);
+    }
+    writeOk = writeOk && BBFBuilder::replaceWithTemp(tempPath, catalogPath);
+
+    if (!writeOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to write catalog %s.\n", catalogPath);
+    }
+
+    free(terms);
+    free(postings);
+    return writeOk;
+}
+
+// BUILD
+
+bool BBFCatalog::build(const char* bookDir, const char* catalogPath, const char* previousCatalog, BBFCatalogStats* stats, uint32_t threadCount)
+{
+    BBFCatalogStats localStats;
+    stats = stats ? stats : &localStats;
+    *stats = BBFCatalogStats();
+
+    BBFProbeBatch listing;
+    if (!catalogPath || !BBFProbe::listBookFiles(bookDir, &listing))
+    {
+        return false;
+    }
+    stats->booksListed = listing.count;
+
+    // Only open the previous catalog if there is one. A first build has nothing to reuse.
+    BBFCatalog* previous = nullptr;
+    uint64_t previousSize = 0;
+    int64_t previousModified = 0;
+    if (previousCatalog && statBook(previousCatalog, &previousSize, &previousModified))
+    {
+        previous = new BBFCatalog(previousCatalog);
+    }
+
+    // Stat everything. Unchanged books point at their old entry, the rest get probed.
+    uint64_t listCount = listing.count ? listing.count : 1;
+    uint64_t* fileSizes = (uint64_t*)malloc(sizeof(uint64_t) * listCount);
+    int64_t* fileTimes = (int64_t*)malloc(sizeof(int64_t) * listCount);
+    uint64_t* sourceIndex = (uint64_t*)malloc(sizeof(uint64_t) * listCount); // Previous book, probe slot, or not a book
+
+    BBFProbeBatch changed;
+    changed.paths = (char**)malloc(sizeof(char*) * listCount);
+
+    if (!fileSizes || !fileTimes || !sourceIndex || !changed.paths)
+    {
+        fprintf(stderr, "[BBFCODEC] Out of memory while building catalog.\n");
+        delete previous;
+        free(fileSizes);
+        free(fileTimes);
+        free(sourceIndex);
+        BBFProbe::freeProbeBatch(&changed);
+        BBFProbe::freeProbeBatch(&listing);
+        return false;
+    }
+
+    const uint64_t notABook = 0xFFFFFFFFFFFFFFFF;
+    const uint64_t probedFlag = 0x8000000000000000;
+
+    uint64_t listIterator = 0;
+    for (; listIterator < listing.count; listIterator++)
+    {
+        const char* bookPath = listing.paths[listIterator];
+        sourceIndex[listIterator] = notABook;
+        if (!statBook(bookPath, &fileSizes[listIterator], &fileTimes[listIterator]))
+        {
+            stats->booksFailed++;
+            continue;
+        }
+
+        if (previous && previous->isValid())
+        {
+            uint64_t previousIndex = previous->findBook(bookPath);
+            const BBFCatalogBook* previousBook = previous->getBook(previousIndex);
+            if (previousBook && previousBook->fileSize == fileSizes[listIterator] && previousBook->fileModified == fileTimes[listIterator])
+            {
+                sourceIndex[listIterator] = previousIndex;
+                stats->booksReused++;
+                continue;
+            }
+        }
+
+        char* pathCopy = strdup(bookPath);
+        if (!pathCopy)
+        {
+            fprintf(stderr, "[BBFCODEC] Out of memory while building catalog.\n");
+            delete previous;
+            free(fileSizes);
+            free(fileTimes);
+            free(sourceIndex);
+            BBFProbe::freeProbeBatch(&changed);
+            BBFProbe::freeProbeBatch(&listing);
+            return false;
+        }
+
+        sourceIndex[listIterator] = changed.count | probedFlag;
+        changed.paths[changed.count++] = pathCopy;
+    }
+
+    BBFProbe::probeBatch(&changed, nullptr, 0, threadCount, true);
+    stats->booksProbed = changed.count;
+
+    // Assemble, in path order
+    CatalogDraft draft;
+    bool draftOk = growArray((void**)&draft.books, &draft.bookCap, listing.count, sizeof(BBFCatalogBook));
+    for (listIterator = 0; listIterator < listing.count && draftOk; listIterator++)
+    {
+        if (sourceIndex[listIterator] == notABook)
+        {
+            continue;
+        }
+
+        BBFCatalogBook book = {};
+        book.fileSize = fileSizes[listIterator];
+        book.fileModified = fileTimes[listIterator];
+        book.metaStart = draft.metaCount;
+        uint64_t bookIndex = draft.bookCount;
+
+        if (sourceIndex[listIterator] & probedFlag)
+        {
+            const BBFProbeResult* probe = &changed.results[sourceIndex[listIterator] & ~probedFlag];
+            if (!probe->valid)
+            {
+                stats->booksFailed++;
+                continue;
+            }
+
+            book.footerHash = probe->footerHash;
+            book.assetCount = probe->assetCount;
+            book.pageCount = probe->pageCount;
+            book.sectionCount = probe->sectionCount;
+            book.headerFlags = probe->headerFlags;
+
+            uint64_t pairIterator = 0;
+            for (; pairIterator < probe->metaPairCount && draftOk; pairIterator++)
+            {
+                draftOk = draft.addMeta(bookIndex, probe->metaPairs[pairIterator * 2], probe->metaPairs[pairIterator * 2 + 1]);
+            }
+        }
+        else
+        {
+            const BBFCatalogBook* previousBook = previous->getBook(sourceIndex[listIterator]);
+            book.footerHash = previousBook->footerHash;
+            book.assetCount = previousBook->assetCount;
+            book.pageCount = previousBook->pageCount;
+            book.sectionCount = previousBook->sectionCount;
+            book.headerFlags = previousBook->headerFlags;
+
+            uint64_t metaIterator = 0;
+            for (; metaIterator < previousBook->metaCount && draftOk; metaIterator++)
+            {
+                const BBFCatalogMeta* previousMeta = previous->getMetaEntry(sourceIndex[listIterator], metaIterator);
+                const char* key = previousMeta ? previous->getString(previousMeta->keyOffset) : nullptr;
+                const char* value = previousMeta ? previous->getString(previousMeta->valueOffset) : nullptr;
+                if (key && value)
+                {
+                    draftOk = draft.addMeta(bookIndex, key, value);
+                }
+            }
+        }
+
+        book.metaCount = draft.metaCount - book.metaStart;
+        book.pathOffset = draft.addString(listing.paths[listIterator]);
+        draft.books[draft.bookCount++] = book;
+    }
+
+    // Done with the old catalog. It has to be unmapped before Windows lets us replace it.
+    delete previous;
+    free(fileSizes);
+    free(fileTimes);
+    free(sourceIndex);
+    BBFProbe::freeProbeBatch(&changed);
+    BBFProbe::freeProbeBatch(&listing);
+
+    if (!draftOk || draft.poolFailed)
+    {
+        fprintf(stderr, "[BBFCODEC] Out of memory while building catalog.\n");
+        return false;
+    }
+
+    return writeCatalog(&draft, catalogPath);
+}
+
+// READER
+
+BBFCatalog::BBFCatalog(const char* catalogPath)
+    : backend(nullptr), catalogData(nullptr), catalogSize(0), header(nullptr),
+      books(nullptr), metaEntries(nullptr), terms(nullptr), postings(nullptr), stringPool(nullptr)
+{
+    this->backend = new BBFMmapBackend(catalogPath);
+    this->catalogData = this->backend->getMapping();
+    this->catalogSize = this->backend->getSize();
+
+    if (!this->catalogData || !validate())
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a valid catalog.\n", catalogPath);
+        this->header = nullptr;
+    }
+}
+
+BBFCatalog::~BBFCatalog()
+{
+    delete this->backend;
+}
+
+static bool catalogTableFits(uint64_t tableOffset, uint64_t entryCount, uint64_t entrySize, uint64_t catalogSize)
+{
+    if (entryCount > catalogSize / entrySize)
+    {
+        return false;
+    }
+    return tableOffset <= catalogSize && entryCount * entrySize <= catalogSize - tableOffset;
+}
+
+bool BBFCatalog::validate()
+{
+    if (this->catalogSize < sizeof(BBFCatalogHeader))
+    {
+        return false;
+    }
+
+    const BBFCatalogHeader* catalogHeader = (const BBFCatalogHeader*)this->catalogData;
+    if (memcmp(catalogHeader->magic, "BBFC", 4) != 0 || catalogHeader->version != BBF::CATALOG_VERSION || catalogHeader->headerLen != sizeof(BBFCatalogHeader))
+    {
+        return false;
+    }
+
+    if (!catalogTableFits(catalogHeader->bookOffset, catalogHeader->bookCount, sizeof(BBFCatalogBook), this->catalogSize) ||
+        !catalogTableFits(catalogHeader->metaOffset, catalogHeader->metaCount, sizeof(BBFCatalogMeta), this->catalogSize) ||
+        !catalogTableFits(catalogHeader->termOffset, catalogHeader->termCount, sizeof(BBFCatalogTerm), this->catalogSize) ||
+        !catalogTableFits(catalogHeader->postingOffset, catalogHeader->postingCount, sizeof(uint64_t), this->catalogSize) ||
+        !catalogTableFits(catalogHeader->stringPoolOffset, catalogHeader->stringPoolSize, 1, this->catalogSize))
+    {
+        return false;
+    }
+
+    // Postings are read in place as uint64_t
+    if (catalogHeader->postingOffset % sizeof(uint64_t) != 0)
+    {
+        return false;
+    }
+
+    // Every string ends before the pool does
+    if (catalogHeader->stringPoolSize > 0 && this->catalogData[catalogHeader->stringPoolOffset + catalogHeader->stringPoolSize - 1] != 0)
+    {
+        return false;
+    }
+
+    uint64_t bodySize = this->catalogSize - sizeof(BBFCatalogHeader);
+    if (XXH3_64bits(this->catalogData + sizeof(BBFCatalogHeader), (size_t)bodySize) != catalogHeader->catalogHash)
+    {
+        return false;
+    }
+
+    this->header = catalogHeader;
+    this->books = (const BBFCatalogBook*)(this->catalogData + catalogHeader->bookOffset);
+    this->metaEntries = (const BBFCatalogMeta*)(this->catalogData + catalogHeader->metaOffset);
+    this->terms = (const BBFCatalogTerm*)(this->catalogData + catalogHeader->termOffset);
+    this->postings = (const uint64_t*)(this->catalogData + catalogHeader->postingOffset);
+    this->stringPool = (const char*)(this->catalogData + catalogHeader->stringPoolOffset);
+    return true;
+}
+
+const BBFCatalogBook* BBFCatalog::getBook(uint64_t bookIndex) const
+{
+    if (!this->header || bookIndex >= this->header->bookCount)
+    {
+        return nullptr;
+    }
+    return &this->books[bookIndex];
+}
+
+const char* BBFCatalog::getString(uint64_t strOffset) const
+{
+    if (!this->header || strOffset >= this->header->stringPoolSize)
+    {
+        return nullptr;
+    }
+    return this->stringPool + strOffset;
+}
+
+const char* BBFCatalog::getBookPath(uint64_t bookIndex) const
+{
+    const BBFCatalogBook* book = getBook(bookIndex);
+    return book ? getString(book->pathOffset) : nullptr;
+}
+
+uint64_t BBFCatalog::findBook(const char* bookPath) const
+{
+    // Books are sorted by path
+    uint64_t lowIndex = 0;
+    uint64_t highIndex = getBookCount();
+    while (lowIndex < highIndex)
+    {
+        uint64_t midIndex = lowIndex + (highIndex - lowIndex) / 2;
+        const char* midPath = getBookPath(midIndex);
+        int pathOrder = midPath ? strcmp(midPath, bookPath) : 1;
+        if (pathOrder == 0)
+        {
+            return midIndex;
+        }
+
+        if (pathOrder < 0)
+        {
+            lowIndex = midIndex + 1;
+        }
+        else
+        {
+            highIndex = midIndex;
+        }
+    }
+    return 0xFFFFFFFFFFFFFFFF;
+}
+
+const BBFCatalogMeta* BBFCatalog::getMetaEntry(uint64_t bookIndex, uint64_t metaIndex) const
+{
+    const BBFCatalogBook* book = getBook(bookIndex);
+    if (!book || metaIndex >= book->metaCount || book->metaStart > this->header->metaCount || this->header->metaCount - book->metaStart <= metaIndex)
+    {
+        return nullptr;
+    }
+    return &this->metaEntries[book->metaStart + metaIndex];
+}
+
+const char* BBFCatalog::getMetaValue(uint64_t bookIndex, const char* key) const
+{
+    const BBFCatalogBook* book = getBook(bookIndex);
+    if (!book)
+    {
+        return nullptr;
+    }
+
+    uint64_t metaIterator = 0;
+    for (; metaIterator < book->metaCount; metaIterator++)
+    {
+        const BBFCatalogMeta* metaEntry = getMetaEntry(bookIndex, metaIterator);
+        const char* entryKey = metaEntry ? getString(metaEntry->keyOffset) : nullptr;
+        if (entryKey && strcmp(entryKey, key) == 0)
+        {
+            return getString(metaEntry->valueOffset);
+        }
+    }
+    return nullptr;
+}
+
+// SEARCH
+
+uint32_t BBFCatalog::nextTerm(const char** textCursor, char* term)
+{
+    // Words are runs of ASCII letters and digits, lowercased. UTF-8 bytes are kept as they are.
+    const unsigned char* cursor = (const unsigned char*)*textCursor;
+    while (*cursor && !(isalnum(*cursor) || *cursor >= 0x80))
+    {
+        cursor++;
+    }
+
+    uint32_t termLength = 0;
+    while (*cursor && (isalnum(*cursor) || *cursor >= 0x80))
+    {
+        if (termLength < BBF::MAX_CATALOG_TERM)
+        {
+            term[termLength++] = (char)((*cursor < 0x80) ? tolower(*cursor) : *cursor);
+        }
+        cursor++;
+    }
+
+    term[termLength] = '\0';
+    *textCursor = (const char*)cursor;
+    return termLength;
+}
+
+uint64_t BBFCatalog::findTerm(const char* word, const uint64_t** termPostings) const
+{
+    *termPostings = nullptr;
+
+    // Look the word up the way it was indexed
+    char term[BBF::MAX_CATALOG_TERM + 1];
+    const char* textCursor = word;
+    if (!this->header || nextTerm(&textCursor, term) == 0)
+    {
+        return 0;
+    }
+
+    uint64_t lowIndex = 0;
+    uint64_t highIndex = this->header->termCount;
+    while (lowIndex < highIndex)
+    {
+        uint64_t midIndex = lowIndex + (highIndex - lowIndex) / 2;
+        const BBFCatalogTerm* midTerm = &this->terms[midIndex];
+        const char* midString = getString(midTerm->termOffset);
+        int termOrder = midString ? strcmp(midString, term) : 1;
+        if (termOrder == 0)
+        {
+            if (midTerm->postingStart > this->header->postingCount || this->header->postingCount - midTerm->postingStart < midTerm->postingCount)
+            {
+                return 0;
+            }
+            *termPostings = this->postings + midTerm->postingStart;
+            return midTerm->postingCount;
+        }
+
+        if (termOrder < 0)
+        {
+            lowIndex = midIndex + 1;
+        }
+        else
+        {
+            highIndex = midIndex;
+        }
+    }
+    return 0;
+}
+
+uint64_t BBFCatalog::search(const char* query, uint64_t* results, uint64_t maxResults) const
+{
+    // Intersect the posting lists, smallest result so far against the next word
+    uint64_t* matches = nullptr;
+    uint64_t matchCount = 0;
+    bool firstTerm = true;
+
+    char term[BBF::MAX_CATALOG_TERM + 1];
+    const char* textCursor = query;
+    while (nextTerm(&textCursor, term) > 0)
+    {
+        const uint64_t* termPostings = nullptr;
+        uint64_t postingCount = findTerm(term, &termPostings);
+
+        if (firstTerm)
+        {
+            matches = (uint64_t*)malloc(sizeof(uint64_t) * (postingCount ? postingCount : 1));
+            if (!matches)
+            {
+                return 0;
+            }
+            if (postingCount > 0)
+            {
+                memcpy(matches, termPostings, (size_t)(sizeof(uint64_t) * postingCount));
+            }
+            matchCount = postingCount;
+            firstTerm = false;
+            continue;
+        }
+
+        uint64_t keptCount = 0;
+        uint64_t matchIterator = 0;
+        uint64_t postingIterator = 0;
+        while (matchIterator < matchCount && postingIterator < postingCount)
+        {
+            if (matches[matchIterator] < termPostings[postingIterator])
+            {
+                matchIterator++;
+            }
+            else if (matches[matchIterator] > termPostings[postingIterator])
+            {
+                postingIterator++;
+            }
+            else
+            {
+                matches[keptCount++] = matches[matchIterator];
+                matchIterator++;
+                postingIterator++;
+            }
+        }
+        matchCount = keptCount;
+    }
+
+    uint64_t copyCount = (matchCount < maxResults) ? matchCount : maxResults;
+    if (results && copyCount > 0)
+    {
+        memcpy(results, matches, (size_t)(sizeof(uint64_t) * copyCount));
+    }
+
+    free(matches);
+    return matchCount;
+}
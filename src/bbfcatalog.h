@@ -0,0 +1,136 @@
+// BBF Library Catalog
+// One file describing a whole directory of books: paths, sizes, counts, metadata, and a
+// word index over the metadata values. Mapped at startup instead of opening every book.
+#ifndef BBFCATALOG_H
+#define BBFCATALOG_H
+
+#include "libbbf.h"
+#include "bbfio.h"
+
+#include <stdint.h>
+
+// Layout: header, books, meta entries, terms, postings, string pool.
+// Every string is an offset into the pool. Books are sorted by path, terms by their bytes.
+#pragma pack(push, 1)
+
+struct BBFCatalogHeader
+{
+    uint8_t magic[4]; // BBFC
+    uint16_t version;
+    uint16_t headerLen;
+    uint32_t flags;
+    uint32_t reservedExtra;
+
+    uint64_t bookCount;
+    uint64_t bookOffset;
+    uint64_t metaCount;
+    uint64_t metaOffset;
+    uint64_t termCount;
+    uint64_t termOffset;
+    uint64_t postingCount;
+    uint64_t postingOffset;
+    uint64_t stringPoolOffset;
+    uint64_t stringPoolSize;
+
+    uint64_t catalogHash; // XXH3-64 of everything after the header
+
+    uint8_t reserved[24];
+};
+
+struct BBFCatalogBook
+{
+    uint64_t pathOffset;
+    uint64_t fileSize;
+    int64_t fileModified; // ns since the epoch
+    uint64_t footerHash;
+
+    uint64_t assetCount;
+    uint64_t pageCount;
+    uint64_t sectionCount;
+
+    uint64_t metaStart; // First entry in the meta table
+    uint64_t metaCount;
+
+    uint32_t headerFlags;
+    uint8_t reserved[4];
+};
+
+struct BBFCatalogMeta
+{
+    uint64_t keyOffset;
+    uint64_t valueOffset;
+};
+
+struct BBFCatalogTerm
+{
+    uint64_t termOffset;
+    uint64_t postingStart; // Index into the postings (uint64_t book indices, ascending)
+    uint64_t postingCount;
+};
+
+#pragma pack(pop)
+
+struct BBFCatalogStats
+{
+    uint64_t booksListed = 0;
+    uint64_t booksReused = 0; // Unchanged since the previous catalog
+    uint64_t booksProbed = 0;
+    uint64_t booksFailed = 0; // Not a BBF, or unreadable. Left out.
+};
+
+namespace BBF
+{
+    constexpr static uint16_t CATALOG_VERSION = 1;
+    constexpr static uint32_t MAX_CATALOG_TERM = 64; // Longer words are cut to this many bytes
+}
+
+class BBFCatalog
+{
+    public:
+        BBFCatalog(const char* catalogPath); // Check isValid()
+        ~BBFCatalog();
+        // Not copyable, it owns the mapping.
+        BBFCatalog(const BBFCatalog&) = delete;
+        BBFCatalog& operator=(const BBFCatalog&) = delete;
+
+        // Catalog every *.bbf in bookDir into catalogPath. With a previous catalog, books whose
+        // size and mtime haven't changed are copied from it instead of probed.
+        // previousCatalog may be catalogPath itself. The new file replaces the old one atomically.
+        static bool build(const char* bookDir, const char* catalogPath, const char* previousCatalog = nullptr, BBFCatalogStats* stats = nullptr, uint32_t threadCount = 8);
+
+        bool isValid() const { return header != nullptr; }
+
+        uint64_t getBookCount() const { return header ? header->bookCount : 0; }
+        const BBFCatalogBook* getBook(uint64_t bookIndex) const;
+        const char* getBookPath(uint64_t bookIndex) const;
+        uint64_t findBook(const char* bookPath) const; // 0xFFFFFFFFFFFFFFFF if it isn't catalogued
+
+        const BBFCatalogMeta* getMetaEntry(uint64_t bookIndex, uint64_t metaIndex) const;
+        const char* getMetaValue(uint64_t bookIndex, const char* key) const; // First match, nullptr if missing
+        const char* getString(uint64_t strOffset) const;
+
+        // Books whose metadata contains word (ASCII case-insensitive). Points into the catalog.
+        uint64_t findTerm(const char* word, const uint64_t** postings) const;
+
+        // Books containing every word in query. Writes up to maxResults indices, returns how many matched.
+        uint64_t search(const char* query, uint64_t* results, uint64_t maxResults) const;
+
+        // Split text into index terms. Returns the term length, 0 at the end. term needs MAX_CATALOG_TERM + 1 bytes.
+        static uint32_t nextTerm(const char** textCursor, char* term);
+
+    private:
+        BBFMmapBackend* backend;
+        const uint8_t* catalogData;
+        uint64_t catalogSize;
+        const BBFCatalogHeader* header;
+
+        const BBFCatalogBook* books;
+        const BBFCatalogMeta* metaEntries;
+        const BBFCatalogTerm* terms;
+        const uint64_t* postings;
+        const char* stringPool;
+
+        bool validate();
+};
+
+#endif // BBFCATALOG_H
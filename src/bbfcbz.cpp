@@ -0,0 +1,910 @@
+#include "bbfcbz.h"
+#include "bbfcodec.h"
+#include "miniz.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <windows.h>
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+// HELPERS
+
+static bool archiveLength(FILE* file, uint64_t* fileLength)
+{
+    #ifdef _WIN32
+        if (_fseeki64(file, 0, SEEK_END) != 0) { return false; }
+        __int64 endPos = _ftelli64(file);
+        if (_fseeki64(file, 0, SEEK_SET) != 0) { return false; }
+    #else
+        if (fseeko(file, 0, SEEK_END) != 0) { return false; }
+        off_t endPos = ftello(file);
+        if (fseeko(file, 0, SEEK_SET) != 0) { return false; }
+    #endif
+
+    if (endPos < 0)
+    {
+        return false;
+    }
+    *fileLength = (uint64_t)endPos;
+    return true;
+}
+
+// Length of the directory part, 0 for entries at the top of the archive
+static size_t entryDirLength(const char* entryName)
+{
+    const char* lastSep = nullptr;
+    const char* nameCursor = entryName;
+    for (; *nameCursor; nameCursor++)
+    {
+        if (*nameCursor == '/' || *nameCursor == '\\')
+        {
+            lastSep = nameCursor;
+        }
+    }
+    return lastSep ? (size_t)(lastSep - entryName) : 0;
+}
+
+// macOS resource forks ride along in a lot of archives and look like images
+static bool isJunkEntry(const char* entryName)
+{
+    if (strncmp(entryName, "__MACOSX/", 9) == 0 || strstr(entryName, "/__MACOSX/"))
+    {
+        return true;
+    }
+
+    const char* baseName = entryName + entryDirLength(entryName);
+    if (*baseName == '/' || *baseName == '\\')
+    {
+        baseName++;
+    }
+    return baseName[0] == '.';
+}
+
+static void crcHook(const uint8_t* chunk, size_t chunkSize, void* hookData)
+{
+    mz_ulong* entryCrc = (mz_ulong*)hookData;
+    *entryCrc = mz_crc32(*entryCrc, chunk, chunkSize);
+}
+
+int BBFCbz::compareNatural(const char* left, const char* right)
+{
+    while (*left && *right)
+    {
+        if (isdigit((unsigned char)*left) && isdigit((unsigned char)*right))
+        {
+            // Compare the numbers without their leading zeros: longer is bigger, then digit by digit
+            while (*left == '0') left++;
+            while (*right == '0') right++;
+
+            size_t leftDigits = 0;
+            size_t rightDigits = 0;
+            while (isdigit((unsigned char)left[leftDigits])) leftDigits++;
+            while (isdigit((unsigned char)right[rightDigits])) rightDigits++;
+
+            if (leftDigits != rightDigits)
+            {
+                return (leftDigits < rightDigits) ? -1 : 1;
+            }
+
+            int digitOrder = strncmp(left, right, leftDigits);
+            if (digitOrder != 0)
+            {
+                return digitOrder;
+            }
+
+            left += leftDigits;
+            right += rightDigits;
+            continue;
+        }
+
+        int leftChar = tolower((unsigned char)*left);
+        int rightChar = tolower((unsigned char)*right);
+        if (leftChar != rightChar)
+        {
+            return leftChar - rightChar;
+        }
+        left++;
+        right++;
+    }
+
+    return (unsigned char)*left - (unsigned char)*right;
+}
+
+// IMPORT
+
+struct CbzEntry
+{
+    mz_uint fileIndex;
+    char* entryName;
+};
+
+static bool importArchive(mz_zip_archive* zip, FILE* cbzFile, uint64_t archiveSize, const char* cbzPath, const char* bbfPath, const BBFCbzOptions* options, BBFCbzStats* stats)
+{
+    mz_uint entryCount = mz_zip_reader_get_num_files(zip);
+    CbzEntry* entries = (CbzEntry*)calloc(entryCount ? entryCount : 1, sizeof(CbzEntry));
+    if (!entries)
+    {
+        return false;
+    }
+
+    bool importOk = true;
+    mz_uint pageCount = 0;
+    mz_uint entryIterator = 0;
+    for (; importOk && entryIterator < entryCount; entryIterator++)
+    {
+        mz_zip_archive_file_stat entryStat;
+        if (!mz_zip_reader_file_stat(zip, entryIterator, &entryStat))
+        {
+            importOk = false;
+            break;
+        }
+
+        if (entryStat.m_is_directory || isJunkEntry(entryStat.m_filename) ||
+            BBFBuilder::detectType(entryStat.m_filename) == (uint8_t)BBF::BBFMediaType::UNKNOWN)
+        {
+            stats->entriesSkipped++;
+            continue;
+        }
+
+        if (entryStat.m_is_encrypted || !entryStat.m_is_supported)
+        {
+            fprintf(stderr, "[BBFCODEC] %s: %s is encrypted or uses an unsupported method.\n", cbzPath, entryStat.m_filename);
+            importOk = false;
+            break;
+        }
+
+        entries[pageCount].fileIndex = entryIterator;
+        entries[pageCount].entryName = strdup(entryStat.m_filename);
+        importOk = entries[pageCount].entryName != nullptr;
+        pageCount++;
+    }
+
+    if (importOk && pageCount == 0)
+    {
+        fprintf(stderr, "[BBFCODEC] %s has no pages.\n", cbzPath);
+        importOk = false;
+    }
+
+    if (importOk && !options->archiveOrder)
+    {
+        std::sort(entries, entries + pageCount, [](const CbzEntry& left, const CbzEntry& right)
+        {
+            return BBFCbz::compareNatural(left.entryName, right.entryName) < 0;
+        });
+    }
+
+    // Folders inside the archive become sections, unless everything sits in one folder
+    bool folderSections = false;
+    size_t firstDirLength = importOk ? entryDirLength(entries[0].entryName) : 0;
+    for (entryIterator = 1; importOk && entryIterator < pageCount && !folderSections; entryIterator++)
+    {
+        size_t dirLength = entryDirLength(entries[entryIterator].entryName);
+        folderSections = dirLength != firstDirLength || strncmp(entries[entryIterator].entryName, entries[0].entryName, dirLength) != 0;
+    }
+
+    bool bookStarted = importOk;
+    if (importOk)
+    {
+        // Not the exiting constructor: importFiles runs this on worker threads
+        BBFBuilder* builder = BBFBuilder::open(bbfPath, options->alignment, options->reamSize, options->hFlags);
+        importOk = builder != nullptr;
+        #ifdef _WIN32
+            int cbzFd = _fileno(cbzFile);
+        #else
+            int cbzFd = fileno(cbzFile);
+        #endif
+
+        uint8_t* inflateBuffer = nullptr;
+        size_t inflateCapacity = 0;
+        const char* lastDir = nullptr;
+        size_t lastDirLength = 0;
+
+        for (entryIterator = 0; importOk && entryIterator < pageCount; entryIterator++)
+        {
+            const CbzEntry* entry = &entries[entryIterator];
+            mz_zip_archive_file_stat entryStat;
+            importOk = mz_zip_reader_file_stat(zip, entry->fileIndex, &entryStat);
+            if (!importOk)
+            {
+                break;
+            }
+
+            size_t dirLength = entryDirLength(entry->entryName);
+            if (folderSections && dirLength > 0 && (!lastDir || dirLength != lastDirLength || strncmp(lastDir, entry->entryName, dirLength) != 0))
+            {
+                char* sectionName = (char*)malloc(dirLength + 1);
+                if (sectionName)
+                {
+                    memcpy(sectionName, entry->entryName, dirLength);
+                    sectionName[dirLength] = '\0';
+                    importOk = builder->addSection(sectionName, (uint64_t)builder->getPageCount());
+                    free(sectionName);
+                }
+                else
+                {
+                    importOk = false;
+                }
+
+                if (!importOk)
+                {
+                    fprintf(stderr, "[BBFCODEC] %s: unable to add a section for %s.\n", cbzPath, entry->entryName);
+                    break;
+                }
+                lastDir = entry->entryName;
+                lastDirLength = dirLength;
+            }
+
+            if (entryStat.m_method == 0)
+            {
+                // Stored: find the data behind the local header and copy it by range. CRC checked on the hashing pass.
+                uint8_t localHeader[30];
+                if (zip->m_pRead(zip->m_pIO_opaque, entryStat.m_local_header_ofs, localHeader, sizeof(localHeader)) != sizeof(localHeader) ||
+                    localHeader[0] != 'P' || localHeader[1] != 'K' || localHeader[2] != 3 || localHeader[3] != 4)
+                {
+                    fprintf(stderr, "[BBFCODEC] %s: bad local header for %s.\n", cbzPath, entry->entryName);
+                    importOk = false;
+                    break;
+                }
+
+                uint64_t dataOffset = entryStat.m_local_header_ofs + sizeof(localHeader) +
+                                      (uint64_t)(localHeader[26] | (localHeader[27] << 8)) + (uint64_t)(localHeader[28] | (localHeader[29] << 8));
+                if (entryStat.m_comp_size != entryStat.m_uncomp_size || dataOffset > archiveSize || entryStat.m_comp_size > archiveSize - dataOffset)
+                {
+                    fprintf(stderr, "[BBFCODEC] %s: %s runs past the end of the archive.\n", cbzPath, entry->entryName);
+                    importOk = false;
+                    break;
+                }
+
+                mz_ulong entryCrc = MZ_CRC32_INIT;
+                importOk = builder->addPageRange(cbzFd, dataOffset, entryStat.m_comp_size, entry->entryName, 0, 0, crcHook, &entryCrc);
+                if (importOk && entryCrc != (mz_ulong)entryStat.m_crc32)
+                {
+                    fprintf(stderr, "[BBFCODEC] %s: CRC mismatch in %s.\n", cbzPath, entry->entryName);
+                    importOk = false;
+                }
+                stats->pagesStored += importOk ? 1 : 0;
+            }
+            else
+            {
+                // Deflated: into one reused buffer. miniz checks the CRC.
+                if (entryStat.m_uncomp_size > inflateCapacity)
+                {
+                    uint8_t* newBuffer = (uint8_t*)realloc(inflateBuffer, (size_t)entryStat.m_uncomp_size);
+                    if (!newBuffer)
+                    {
+                        importOk = false;
+                        break;
+                    }
+                    inflateBuffer = newBuffer;
+                    inflateCapacity = (size_t)entryStat.m_uncomp_size;
+                }
+
+                importOk = mz_zip_reader_extract_to_mem(zip, entry->fileIndex, inflateBuffer, (size_t)entryStat.m_uncomp_size, 0) &&
+                           builder->addPageData(inflateBuffer, entryStat.m_uncomp_size, entry->entryName);
+                if (!importOk)
+                {
+                    fprintf(stderr, "[BBFCODEC] %s: unable to inflate %s.\n", cbzPath, entry->entryName);
+                }
+                stats->pagesInflated += importOk ? 1 : 0;
+            }
+        }
+
+        free(inflateBuffer);
+        importOk = importOk && builder->finalize();
+        delete builder;
+    }
+
+    // No half books
+    if (bookStarted && !importOk)
+    {
+        remove(bbfPath);
+    }
+
+    for (entryIterator = 0; entryIterator < pageCount; entryIterator++)
+    {
+        free(entries[entryIterator].entryName);
+    }
+    free(entries);
+    return importOk;
+}
+
+bool BBFCbz::importFile(const char* cbzPath, const char* bbfPath, const BBFCbzOptions* options, BBFCbzStats* stats)
+{
+    BBFCbzOptions defaultOptions;
+    BBFCbzStats localStats;
+    if (!options)
+    {
+        options = &defaultOptions;
+    }
+    if (!stats)
+    {
+        stats = &localStats;
+    }
+
+    FILE* cbzFile = fopen(cbzPath, "rb");
+    uint64_t archiveSize = 0;
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    if (!cbzFile || !archiveLength(cbzFile, &archiveSize) || !mz_zip_reader_init_cfile(&zip, cbzFile, archiveSize, 0))
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a readable CBZ.\n", cbzPath);
+        if (cbzFile)
+        {
+            fclose(cbzFile);
+        }
+        return false;
+    }
+
+    bool importOk = importArchive(&zip, cbzFile, archiveSize, cbzPath, bbfPath, options, stats);
+    mz_zip_reader_end(&zip);
+    fclose(cbzFile);
+
+    if (!importOk)
+    {
+        return false;
+    }
+
+    stats->archivesConverted++;
+    return true;
+}
+
+bool BBFCbz::importFiles(const char* const* cbzPaths, const char* const* bbfPaths, uint32_t archiveCount, const BBFCbzOptions* options, uint32_t threadCount, BBFCbzStats* stats)
+{
+    // Each worker takes the next archive. One book per worker at a time.
+    BBFCbzStats* archiveStats = new BBFCbzStats[archiveCount ? archiveCount : 1];
+    std::atomic<uint32_t> nextArchive(0);
+    std::atomic<bool> importOk(true);
+
+    auto importWorker = [&]()
+    {
+        uint32_t archiveIndex = 0;
+        while ((archiveIndex = nextArchive.fetch_add(1)) < archiveCount)
+        {
+            if (!importFile(cbzPaths[archiveIndex], bbfPaths[archiveIndex], options, &archiveStats[archiveIndex]))
+            {
+                importOk = false;
+            }
+        }
+    };
+
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+    uint32_t workerCount = (archiveCount < threadCount) ? archiveCount : threadCount;
+    std::thread* workers = (workerCount > 1) ? new std::thread[workerCount - 1] : nullptr;
+
+    uint32_t workerIterator = 0;
+    for (; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator] = std::thread(importWorker);
+    }
+    importWorker();
+    for (workerIterator = 0; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator].join();
+    }
+    delete[] workers;
+
+    if (stats)
+    {
+        uint32_t archiveIterator = 0;
+        for (; archiveIterator < archiveCount; archiveIterator++)
+        {
+            stats->archivesConverted += archiveStats[archiveIterator].archivesConverted;
+            stats->pagesStored += archiveStats[archiveIterator].pagesStored;
+            stats->pagesInflated += archiveStats[archiveIterator].pagesInflated;
+            stats->entriesSkipped += archiveStats[archiveIterator].entriesSkipped;
+        }
+    }
+    delete[] archiveStats;
+    return importOk;
+}
+
+// EXPORT
+
+struct CrcTables
+{
+    uint32_t table[8][256];
+
+    CrcTables()
+    {
+        uint32_t byteIterator = 0;
+        for (; byteIterator < 256; byteIterator++)
+        {
+            uint32_t crc = byteIterator;
+            int bitIterator = 0;
+            for (; bitIterator < 8; bitIterator++)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320u : 0);
+            }
+            table[0][byteIterator] = crc;
+        }
+
+        // table[k][b]: b followed by k zero bytes
+        int sliceIterator = 1;
+        for (; sliceIterator < 8; sliceIterator++)
+        {
+            for (byteIterator = 0; byteIterator < 256; byteIterator++)
+            {
+                uint32_t previous = table[sliceIterator - 1][byteIterator];
+                table[sliceIterator][byteIterator] = (previous >> 8) ^ table[0][previous & 0xFF];
+            }
+        }
+    }
+};
+
+uint32_t BBFCbz::crc32(uint32_t crc, const void* data, size_t length)
+{
+    static const CrcTables crcTables;
+    const uint32_t (*table)[256] = crcTables.table;
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    crc = ~crc;
+    while (length >= 8)
+    {
+        uint32_t low = crc ^ ((uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24));
+        uint32_t high = (uint32_t)bytes[4] | ((uint32_t)bytes[5] << 8) | ((uint32_t)bytes[6] << 16) | ((uint32_t)bytes[7] << 24);
+        crc = table[7][low & 0xFF] ^ table[6][(low >> 8) & 0xFF] ^ table[5][(low >> 16) & 0xFF] ^ table[4][low >> 24] ^
+              table[3][high & 0xFF] ^ table[2][(high >> 8) & 0xFF] ^ table[1][(high >> 16) & 0xFF] ^ table[0][high >> 24];
+        bytes += 8;
+        length -= 8;
+    }
+
+    while (length > 0)
+    {
+        crc = table[0][(crc ^ *bytes) & 0xFF] ^ (crc >> 8);
+        bytes++;
+        length--;
+    }
+    return ~crc;
+}
+
+static void putLE(uint8_t* dst, uint64_t value, int byteCount)
+{
+    int byteIterator = 0;
+    for (; byteIterator < byteCount; byteIterator++)
+    {
+        dst[byteIterator] = (uint8_t)(value >> (8 * byteIterator));
+    }
+}
+
+static const char* mediaExtension(uint8_t mediaType)
+{
+    switch ((BBF::BBFMediaType)mediaType)
+    {
+        case BBF::BBFMediaType::AVIF: return "avif";
+        case BBF::BBFMediaType::PNG: return "png";
+        case BBF::BBFMediaType::WEBP: return "webp";
+        case BBF::BBFMediaType::JXL: return "jxl";
+        case BBF::BBFMediaType::BMP: return "bmp";
+        case BBF::BBFMediaType::GIF: return "gif";
+        case BBF::BBFMediaType::TIFF: return "tiff";
+        case BBF::BBFMediaType::JPG: return "jpg";
+        default: return "dat";
+    }
+}
+
+// The book's modification time, as DOS date and time
+static void dosTimestamp(const char* bbfPath, uint16_t* dosTime, uint16_t* dosDate)
+{
+    *dosTime = 0;
+    *dosDate = (1 << 5) | 1; // 1980-01-01
+
+    struct stat bookStat;
+    struct tm localTime;
+    if (stat(bbfPath, &bookStat) != 0)
+    {
+        return;
+    }
+    time_t modified = bookStat.st_mtime;
+    #ifdef _WIN32
+        if (localtime_s(&localTime, &modified) != 0) { return; }
+    #else
+        if (!localtime_r(&modified, &localTime)) { return; }
+    #endif
+
+    if (localTime.tm_year < 80)
+    {
+        return;
+    }
+    *dosTime = (uint16_t)((localTime.tm_hour << 11) | (localTime.tm_min << 5) | (localTime.tm_sec / 2));
+    *dosDate = (uint16_t)(((localTime.tm_year - 80) << 9) | ((localTime.tm_mon + 1) << 5) | localTime.tm_mday);
+}
+
+// One ZIP entry per page
+struct CbzPageEntry
+{
+    char* entryName;
+    uint32_t crc;
+    uint64_t size;
+    uint64_t localOffset;
+};
+
+// Folder for each page: the innermost section it falls in, numbered so readers sorting by name keep the book's order
+// ("02 Chapter 2"). Flattened to one level, so names can't climb out. nullptr if the section table is damaged.
+static char** pageFolders(BBFReader* book, BBFFooter* footer)
+{
+    char** folders = (char**)calloc((size_t)(footer->pageCount ? footer->pageCount : 1), sizeof(char*));
+    if (!folders || footer->sectionCount == 0)
+    {
+        return folders;
+    }
+
+    // Sections by start page. Table order breaks ties, so Chapter 1 wins over the Volume 1 that starts with it.
+    uint64_t* sectionOrder = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)footer->sectionCount);
+    const uint8_t* sectionTable = book->getSectionTableView(footer->sectionOffset);
+    bool tableOk = sectionOrder && sectionTable;
+    uint64_t sectionIterator = 0;
+    for (; tableOk && sectionIterator < footer->sectionCount; sectionIterator++)
+    {
+        const BBFSection* section = book->getSectionEntryView(sectionTable, (int)sectionIterator);
+        tableOk = section && book->getStringView(section->sectionTitleOffset);
+        sectionOrder[sectionIterator] = sectionIterator;
+    }
+
+    if (!tableOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Damaged section table.\n");
+        free(sectionOrder);
+        free(folders);
+        return nullptr;
+    }
+    std::stable_sort(sectionOrder, sectionOrder + footer->sectionCount, [book, sectionTable](uint64_t left, uint64_t right)
+    {
+        return book->getSectionEntryView(sectionTable, (int)left)->sectionStartIndex < book->getSectionEntryView(sectionTable, (int)right)->sectionStartIndex;
+    });
+
+    int ordinalDigits = 2;
+    uint64_t ordinalLimit = 100;
+    for (; ordinalLimit <= footer->sectionCount && ordinalDigits < 20; ordinalLimit *= 10)
+    {
+        ordinalDigits++;
+    }
+
+    const char* currentTitle = nullptr;
+    uint64_t currentSection = 0xFFFFFFFFFFFFFFFF;
+    uint64_t folderSection = 0xFFFFFFFFFFFFFFFF;
+    uint64_t folderOrdinal = 0;
+    sectionIterator = 0;
+    uint64_t pageIterator = 0;
+    for (; pageIterator < footer->pageCount; pageIterator++)
+    {
+        while (sectionIterator < footer->sectionCount &&
+               book->getSectionEntryView(sectionTable, (int)sectionOrder[sectionIterator])->sectionStartIndex <= pageIterator)
+        {
+            const BBFSection* section = book->getSectionEntryView(sectionTable, (int)sectionOrder[sectionIterator]);
+            currentTitle = book->getStringView(section->sectionTitleOffset);
+            currentSection = sectionOrder[sectionIterator];
+            sectionIterator++;
+        }
+
+        if (!currentTitle)
+        {
+            continue;
+        }
+        if (currentSection != folderSection)
+        {
+            folderSection = currentSection;
+            folderOrdinal++;
+        }
+
+        size_t folderLength = strlen(currentTitle) + (size_t)ordinalDigits + 2;
+        char* folder = (char*)malloc(folderLength);
+        if (!folder)
+        {
+            uint64_t freeIterator = 0;
+            for (; freeIterator < pageIterator; freeIterator++)
+            {
+                free(folders[freeIterator]);
+            }
+            free(folders);
+            free(sectionOrder);
+            return nullptr;
+        }
+        int prefixLength = snprintf(folder, folderLength, "%0*llu ", ordinalDigits, (unsigned long long)folderOrdinal);
+        char* titleCursor = folder + prefixLength;
+        const char* sourceCursor = currentTitle;
+        for (; *sourceCursor; sourceCursor++, titleCursor++)
+        {
+            bool unsafe = *sourceCursor == '/' || *sourceCursor == '\\' || *sourceCursor == ':' || (uint8_t)*sourceCursor < 0x20;
+            *titleCursor = unsafe ? '_' : *sourceCursor;
+        }
+        *titleCursor = '\0';
+        folders[pageIterator] = folder;
+    }
+    free(sectionOrder);
+    return folders;
+}
+
+bool BBFCbz::exportFile(const char* bbfPath, const char* cbzPath, BBFCbzExportStats* stats)
+{
+    BBFCbzExportStats localStats;
+    if (!stats)
+    {
+        stats = &localStats;
+    }
+    *stats = BBFCbzExportStats();
+
+    BBFReader book(bbfPath);
+    BBFHeader* header = book.getHeaderView();
+    BBFFooter* footer = header ? book.getFooterView(header->footerOffset) : nullptr;
+    if (!footer)
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a readable book.\n", bbfPath);
+        return false;
+    }
+
+    bool toStdout = strcmp(cbzPath, "-") == 0;
+    char* tempPath = nullptr;
+    FILE* cbzFile = nullptr;
+    if (toStdout)
+    {
+        cbzFile = stdout;
+        #ifdef _WIN32
+            _setmode(_fileno(stdout), _O_BINARY);
+        #endif
+    }
+    else
+    {
+        cbzFile = BBFBuilder::openTempNear(cbzPath, &tempPath);
+    }
+
+    CbzPageEntry* pageEntries = (CbzPageEntry*)calloc((size_t)(footer->pageCount ? footer->pageCount : 1), sizeof(CbzPageEntry));
+    uint32_t* assetCrcs = (uint32_t*)malloc(sizeof(uint32_t) * (size_t)(footer->assetCount ? footer->assetCount : 1));
+    uint8_t* assetDone = (uint8_t*)calloc((size_t)(footer->assetCount ? footer->assetCount : 1), 1);
+    char** folders = pageFolders(&book, footer);
+    bool exportOk = cbzFile && pageEntries && assetCrcs && assetDone && folders;
+
+    uint16_t dosTime = 0;
+    uint16_t dosDate = 0;
+    dosTimestamp(bbfPath, &dosTime, &dosDate);
+
+    int digitCount = 4;
+    uint64_t digitLimit = 10000;
+    for (; digitLimit <= footer->pageCount && digitCount < 20; digitLimit *= 10)
+    {
+        digitCount++;
+    }
+
+    const uint8_t* pageTable = book.getPageTableView(footer->pageOffset);
+    const uint8_t* assetTable = book.getAssetTableView(footer->assetOffset);
+    BBFDataMover* mover = nullptr;
+    int moverSourceFd = -1;
+    uint8_t* readBuffer = nullptr;
+    uint64_t readCapacity = 0;
+    uint64_t outOffset = 0;
+
+    uint64_t pageIterator = 0;
+    for (; exportOk && pageIterator < footer->pageCount; pageIterator++)
+    {
+        const BBFPage* page = book.getPageEntryView(pageTable, (int)pageIterator);
+        const BBFAsset* asset = page ? book.getAssetEntryView(assetTable, (int)page->assetIndex) : nullptr;
+        if (!asset || asset->fileSize >= 0xFFFFFFFF)
+        {
+            fprintf(stderr, "[BBFCODEC] Page %llu can't go in a ZIP.\n", (unsigned long long)pageIterator);
+            exportOk = false;
+            break;
+        }
+
+        // The CRC goes in the local header, before the data. The first page of an asset is read once, summed,
+        // and written from the same bytes. Pages that share it reuse the sum, so a file can take them by range.
+        bool crcKnown = assetDone[page->assetIndex] != 0;
+        int sourceFd = -1;
+        uint64_t sourceOffset = 0;
+        uint64_t sourceLength = 0;
+        bool moveRange = crcKnown && !toStdout && book.getAssetFileRange(page->assetIndex, &sourceFd, &sourceOffset, &sourceLength) && sourceFd >= 0;
+
+        // Mapped books are read in place. Otherwise the asset comes into a buffer.
+        const uint8_t* assetData = moveRange ? nullptr : book.getAssetDataView(asset);
+        if (!moveRange && !assetData && asset->fileSize > 0)
+        {
+            if (asset->fileSize > readCapacity)
+            {
+                uint8_t* newBuffer = (uint8_t*)realloc(readBuffer, (size_t)asset->fileSize);
+                if (!newBuffer)
+                {
+                    exportOk = false;
+                    break;
+                }
+                readBuffer = newBuffer;
+                readCapacity = asset->fileSize;
+            }
+            if (!book.readAssetData(asset, readBuffer, asset->fileSize))
+            {
+                exportOk = false;
+                break;
+            }
+            assetData = readBuffer;
+        }
+
+        if (!crcKnown)
+        {
+            assetCrcs[page->assetIndex] = crc32(0, assetData, (size_t)asset->fileSize);
+            assetDone[page->assetIndex] = 1;
+            stats->assetsChecksummed++;
+        }
+
+        CbzPageEntry* entry = &pageEntries[pageIterator];
+        const char* folder = folders[pageIterator];
+        size_t nameLength = (folder ? strlen(folder) + 1 : 0) + (size_t)digitCount + 8;
+        entry->entryName = (char*)malloc(nameLength);
+        if (!entry->entryName)
+        {
+            exportOk = false;
+            break;
+        }
+        snprintf(entry->entryName, nameLength, "%s%s%0*llu.%s", folder ? folder : "", folder ? "/" : "", digitCount,
+                 (unsigned long long)(pageIterator + 1), mediaExtension(asset->type));
+        entry->crc = assetCrcs[page->assetIndex];
+        entry->size = asset->fileSize;
+        entry->localOffset = outOffset;
+
+        uint8_t localHeader[30] = {};
+        uint16_t entryNameLength = (uint16_t)strlen(entry->entryName);
+        putLE(localHeader, 0x04034b50, 4);
+        putLE(localHeader + 4, 20, 2); // Version needed
+        putLE(localHeader + 6, 0x0800, 2); // UTF-8 names
+        putLE(localHeader + 8, 0, 2); // Stored
+        putLE(localHeader + 10, dosTime, 2);
+        putLE(localHeader + 12, dosDate, 2);
+        putLE(localHeader + 14, entry->crc, 4);
+        putLE(localHeader + 18, entry->size, 4);
+        putLE(localHeader + 22, entry->size, 4);
+        putLE(localHeader + 26, entryNameLength, 2);
+        exportOk = fwrite(localHeader, sizeof(localHeader), 1, cbzFile) == 1 && fwrite(entry->entryName, 1, entryNameLength, cbzFile) == entryNameLength;
+        outOffset += sizeof(localHeader) + entryNameLength;
+
+        // Shared assets written to a file get the data mover (copy_file_range, reflink)
+        if (exportOk && moveRange)
+        {
+            if (!mover || sourceFd != moverSourceFd)
+            {
+                delete mover;
+                #ifdef _WIN32
+                    mover = new BBFDataMover(sourceFd, _fileno(cbzFile));
+                #else
+                    mover = new BBFDataMover(sourceFd, fileno(cbzFile));
+                #endif
+                moverSourceFd = sourceFd;
+            }
+
+            #ifdef _WIN32
+                exportOk = fflush(cbzFile) == 0 && mover->copy(sourceOffset, outOffset, entry->size) && _fseeki64(cbzFile, (__int64)(outOffset + entry->size), SEEK_SET) == 0;
+            #else
+                exportOk = fflush(cbzFile) == 0 && mover->copy(sourceOffset, outOffset, entry->size) && fseeko(cbzFile, (off_t)(outOffset + entry->size), SEEK_SET) == 0;
+            #endif
+        }
+        else if (exportOk && entry->size > 0)
+        {
+            exportOk = fwrite(assetData, 1, (size_t)entry->size, cbzFile) == (size_t)entry->size;
+        }
+        outOffset += entry->size;
+        stats->pagesWritten += exportOk ? 1 : 0;
+    }
+
+    if (mover)
+    {
+        stats->copyStats = mover->getStats();
+        delete mover;
+    }
+
+    // Central directory. Offsets past 4 GB go in a ZIP64 extra field.
+    uint64_t directoryStart = outOffset;
+    for (pageIterator = 0; exportOk && pageIterator < footer->pageCount; pageIterator++)
+    {
+        const CbzPageEntry* entry = &pageEntries[pageIterator];
+        bool offsetZip64 = entry->localOffset >= 0xFFFFFFFF;
+        uint16_t entryNameLength = (uint16_t)strlen(entry->entryName);
+
+        uint8_t centralHeader[46 + 12] = {};
+        putLE(centralHeader, 0x02014b50, 4);
+        putLE(centralHeader + 4, offsetZip64 ? 45 : 20, 2); // Made by
+        putLE(centralHeader + 6, offsetZip64 ? 45 : 20, 2); // Needed
+        putLE(centralHeader + 8, 0x0800, 2);
+        putLE(centralHeader + 10, 0, 2);
+        putLE(centralHeader + 12, dosTime, 2);
+        putLE(centralHeader + 14, dosDate, 2);
+        putLE(centralHeader + 16, entry->crc, 4);
+        putLE(centralHeader + 20, entry->size, 4);
+        putLE(centralHeader + 24, entry->size, 4);
+        putLE(centralHeader + 28, entryNameLength, 2);
+        putLE(centralHeader + 30, offsetZip64 ? 12 : 0, 2); // Extra length
+        putLE(centralHeader + 42, offsetZip64 ? 0xFFFFFFFF : entry->localOffset, 4);
+
+        uint8_t zip64Extra[12] = {};
+        putLE(zip64Extra, 0x0001, 2);
+        putLE(zip64Extra + 2, 8, 2);
+        putLE(zip64Extra + 4, entry->localOffset, 8);
+
+        exportOk = fwrite(centralHeader, 46, 1, cbzFile) == 1 && fwrite(entry->entryName, 1, entryNameLength, cbzFile) == entryNameLength &&
+                   (!offsetZip64 || fwrite(zip64Extra, sizeof(zip64Extra), 1, cbzFile) == 1);
+        outOffset += 46 + entryNameLength + (offsetZip64 ? sizeof(zip64Extra) : 0);
+    }
+
+    uint64_t directorySize = outOffset - directoryStart;
+    bool archiveZip64 = footer->pageCount >= 0xFFFF || directoryStart >= 0xFFFFFFFF || directorySize >= 0xFFFFFFFF;
+    if (exportOk && archiveZip64)
+    {
+        uint8_t zip64End[56 + 20] = {};
+        putLE(zip64End, 0x06064b50, 4);
+        putLE(zip64End + 4, 44, 8); // Size of the rest of the record
+        putLE(zip64End + 12, 45, 2);
+        putLE(zip64End + 14, 45, 2);
+        putLE(zip64End + 24, footer->pageCount, 8);
+        putLE(zip64End + 32, footer->pageCount, 8);
+        putLE(zip64End + 40, directorySize, 8);
+        putLE(zip64End + 48, directoryStart, 8);
+
+        // Locator
+        putLE(zip64End + 56, 0x07064b50, 4);
+        putLE(zip64End + 64, outOffset, 8);
+        putLE(zip64End + 72, 1, 4);
+
+        exportOk = fwrite(zip64End, sizeof(zip64End), 1, cbzFile) == 1;
+        outOffset += sizeof(zip64End);
+    }
+
+    if (exportOk)
+    {
+        uint8_t endRecord[22] = {};
+        putLE(endRecord, 0x06054b50, 4);
+        putLE(endRecord + 8, archiveZip64 ? 0xFFFF : footer->pageCount, 2);
+        putLE(endRecord + 10, archiveZip64 ? 0xFFFF : footer->pageCount, 2);
+        putLE(endRecord + 12, archiveZip64 ? 0xFFFFFFFF : directorySize, 4);
+        putLE(endRecord + 16, archiveZip64 ? 0xFFFFFFFF : directoryStart, 4);
+        exportOk = fwrite(endRecord, sizeof(endRecord), 1, cbzFile) == 1;
+        outOffset += sizeof(endRecord);
+    }
+    stats->archiveSize = outOffset;
+
+    if (toStdout)
+    {
+        exportOk = (fflush(stdout) == 0) && exportOk;
+    }
+    else
+    {
+        if (cbzFile)
+        {
+            exportOk = (fclose(cbzFile) == 0) && exportOk;
+        }
+
+        if (!exportOk && tempPath)
+        {
+            remove(tempPath);
+            free(tempPath);
+        }
+        exportOk = exportOk && BBFBuilder::replaceWithTemp(tempPath, cbzPath);
+    }
+
+    if (!exportOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to write %s.\n", toStdout ? "the archive" : cbzPath);
+    }
+
+    for (pageIterator = 0; pageEntries && pageIterator < footer->pageCount; pageIterator++)
+    {
+        free(pageEntries[pageIterator].entryName);
+        if (folders)
+        {
+            free(folders[pageIterator]);
+        }
+    }
+    free(folders);
+    free(pageEntries);
+    free(assetCrcs);
+    free(assetDone);
+    free(readBuffer);
+    return exportOk;
+}
@@ -0,0 +1,59 @@
+// BBF CBZ Import / Export
+// Converts comic archives (ZIP) straight into books, no temporary folder. Stored entries are
+// copied out of the archive by range, deflated entries are inflated in memory. Uses the vendored miniz.
+// Export writes a stored (uncompressed) ZIP straight from the book, no miniz needed.
+#ifndef BBFCBZ_H
+#define BBFCBZ_H
+
+#include "libbbf.h"
+#include "bbfmove.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+struct BBFCbzStats
+{
+    uint64_t archivesConverted = 0;
+    uint64_t pagesStored = 0; // Copied by range
+    uint64_t pagesInflated = 0;
+    uint64_t entriesSkipped = 0; // Directories, ComicInfo.xml and anything else that isn't an image
+};
+
+struct BBFCbzExportStats
+{
+    uint64_t pagesWritten = 0;
+    uint64_t assetsChecksummed = 0; // CRC32 once per asset, however many pages share it
+    uint64_t archiveSize = 0;
+    BBFCopyStats copyStats; // Pages that repeat an asset, when writing to a file
+};
+
+struct BBFCbzOptions
+{
+    bool archiveOrder = false; // Keep the archive's order instead of sorting names naturally
+    uint32_t alignment = BBF::DEFAULT_GUARD_ALIGNMENT;
+    uint32_t reamSize = BBF::DEFAULT_SMALL_REAM_THRESHOLD;
+    uint32_t hFlags = BBF::BBF_VARIABLE_REAM_SIZE_FLAG;
+};
+
+class BBFCbz
+{
+    public:
+        // One archive into one book. Subfolders inside the archive become sections.
+        static bool importFile(const char* cbzPath, const char* bbfPath, const BBFCbzOptions* options = nullptr, BBFCbzStats* stats = nullptr);
+
+        // Many archives, threadCount at a time. bbfPaths[i] is the book for cbzPaths[i].
+        // Keeps going past a bad archive, returns false if any failed.
+        static bool importFiles(const char* const* cbzPaths, const char* const* bbfPaths, uint32_t archiveCount, const BBFCbzOptions* options = nullptr, uint32_t threadCount = 4, BBFCbzStats* stats = nullptr);
+
+        // Book to stored ZIP. Pages are named by number (0001.png), in a folder per section when the book has them.
+        // cbzPath "-" writes to stdout. Files are written next to cbzPath and renamed into place.
+        static bool exportFile(const char* bbfPath, const char* cbzPath, BBFCbzExportStats* stats = nullptr);
+
+        // CRC-32 (ZIP, reflected 0xEDB88320), slice-by-8. Start with crc = 0 and feed the result back in.
+        static uint32_t crc32(uint32_t crc, const void* data, size_t length);
+
+        // strcmp, but runs of digits compare by value ("page2" < "page10") and letters ignore case
+        static int compareNatural(const char* left, const char* right);
+};
+
+#endif // BBFCBZ_H
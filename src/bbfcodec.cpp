@@ -4,10 +4,23 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 #include <cstring>
+#include <cstddef>
+#include <thread>
+#include <atomic>
 
 #ifdef _WIN32
     #include <windows.h>
+    #include <io.h>
+#endif
+
+#ifndef _WIN32
+    #include <poll.h>
+#endif
+
+#ifdef __linux__
+    #include <sys/sendfile.h>
 #endif
 
 // Macros to speed up media detection
@@ -32,17 +45,44 @@ static const uint32_t PACK4_JPEG_ = PACK4('j', 'p', 'e', 'g');
 
 // End Macros and things.
 
-BBFBuilder::BBFBuilder(const char* oFile, uint32_t alignment, uint32_t reamSize, uint32_t hFlags) : stringPool(4096), assetLookupTable(4096)
+BBFBuilder::BBFBuilder(const char* oFile, uint32_t alignment, uint32_t reamSize, uint32_t hFlags) : BBFBuilder(oFile, alignment, reamSize, hFlags, true)
+{
+}
+
+BBFBuilder* BBFBuilder::open(const char* oFile, uint32_t alignment, uint32_t reamSize, uint32_t hFlags)
+{
+    BBFBuilder* builder = new BBFBuilder(oFile, alignment, reamSize, hFlags, false);
+    if (!builder->file || !builder->assets || !builder->pages || !builder->sections || !builder->metadata)
+    {
+        delete builder;
+        return nullptr;
+    }
+    return builder;
+}
+
+BBFBuilder::BBFBuilder(const char* oFile, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool exitOnError) : stringPool(4096), assetLookupTable(4096)
 {
+    this->assets = nullptr;
+    this->pages = nullptr;
+    this->sections = nullptr;
+    this->metadata = nullptr;
+    this->dataMover = nullptr;
+    this->moverSourceFd = -1;
+    this->indexReserve = 0;
+
     // Open the file for writing
     this->file = fopen(oFile, "wb");
-    setvbuf(this->file, nullptr, _IOFBF, 64 * 1024);
 
     if ( !this->file )
     {
         fprintf(stderr, "[BBFCODEC] Could not open file: %s\n", oFile);
-        exit(1);
+        if (exitOnError)
+        {
+            exit(1);
+        }
+        return;
     }
+    setvbuf(this->file, nullptr, _IOFBF, 64 * 1024);
 
     this->guardValue = alignment;
     this->reamValue = reamSize;
@@ -71,7 +111,13 @@ BBFBuilder::BBFBuilder(const char* oFile, uint32_t alignment, uint32_t reamSize,
     if (written != sizeof(BBFHeader))
     {
         fprintf(stderr, "[BBFCODEC] Failed to write blank header to %s\n",oFile);
-        exit(1);
+        if (exitOnError)
+        {
+            exit(1);
+        }
+        fclose(this->file);
+        this->file = nullptr;
+        return;
     }
 
     // set current offset after writing header
@@ -103,6 +149,8 @@ BBFBuilder::~BBFBuilder()
         free(this->sections);
     }
 
+    delete this->dataMover;
+
     if (this->metadata)
     {
         free(this->metadata);
@@ -311,6 +359,50 @@ bool BBFBuilder::addPage(const char* fPath, uint32_t pFlags, uint32_t aFlags)
     }
 
     // If new asset...
+    writePadding(assetAlignment(fileSize));
+    uint64_t aStartOffset = this->currentOffset;
+
+    // write
+    while ((rBytes = fread(iBuffer, 1, sizeof(iBuffer), iImg)) > 0)
+    {
+        fwrite(iBuffer, 1, rBytes, this->file);
+        this->currentOffset += rBytes;
+    }
+
+    // close image
+    fclose(iImg);
+
+    // update builder
+    if (this->assetCount >= this->assetCap)
+    {
+        growAssets();
+    }
+
+    if (this->pageCount >= this->pageCap)
+    {
+        growPages();
+    }
+
+    this->assets[this->assetCount].fileOffset = aStartOffset;
+    this->assets[this->assetCount].assetHash[0] = iHash.low64;
+    this->assets[this->assetCount].assetHash[1] = iHash.high64;
+    this->assets[this->assetCount].fileSize = fileSize;
+    this->assets[this->assetCount].flags = aFlags;
+    this->assets[this->assetCount].type = mediaType;
+
+    this->assetLookupTable.addAsset(iHash, this->assetCount);
+
+    this->pages[this->pageCount].assetIndex = this->assetCount;
+    this->pages[this->pageCount].flags = pFlags;
+
+    this->assetCount++;
+    this->pageCount++;
+
+    return true;
+}
+
+uint64_t BBFBuilder::assetAlignment(uint64_t fileSize)
+{
     uint64_t alignmentBytes = 1ULL << this->guardValue;
     uint64_t thresholdBytes = 1ULL << this->reamValue;
 
@@ -323,21 +415,30 @@ bool BBFBuilder::addPage(const char* fPath, uint32_t pFlags, uint32_t aFlags)
             alignmentBytes = 8;
         }
     }
+    return alignmentBytes;
+}
 
-    writePadding(alignmentBytes);
-    uint64_t aStartOffset = this->currentOffset;
+bool BBFBuilder::addDuplicatePage(XXH128_hash_t assetHash, uint32_t pFlags)
+{
+    uint64_t aIndex = this->assetLookupTable.findAsset(assetHash);
+    if (aIndex == 0xFFFFFFFFFFFFFFFF)
+    {
+        return false;
+    }
 
-    // write
-    while ((rBytes = fread(iBuffer, 1, sizeof(iBuffer), iImg)) > 0)
+    if (this->pageCount >= this->pageCap)
     {
-        fwrite(iBuffer, 1, rBytes, this->file);
-        this->currentOffset += rBytes;
+        growPages();
     }
 
-    // close image
-    fclose(iImg);
+    this->pages[this->pageCount].assetIndex = aIndex;
+    this->pages[this->pageCount].flags = pFlags;
+    this->pageCount++;
+    return true;
+}
 
-    // update builder
+void BBFBuilder::addNewPage(XXH128_hash_t assetHash, uint64_t fileOffset, uint64_t fileSize, uint8_t mediaType, uint32_t pFlags, uint32_t aFlags)
+{
     if (this->assetCount >= this->assetCap)
     {
         growAssets();
@@ -348,21 +449,128 @@ bool BBFBuilder::addPage(const char* fPath, uint32_t pFlags, uint32_t aFlags)
         growPages();
     }
 
-    this->assets[this->assetCount].fileOffset = aStartOffset;
-    this->assets[this->assetCount].assetHash[0] = iHash.low64;
-    this->assets[this->assetCount].assetHash[1] = iHash.high64;
+    this->assets[this->assetCount].fileOffset = fileOffset;
+    this->assets[this->assetCount].assetHash[0] = assetHash.low64;
+    this->assets[this->assetCount].assetHash[1] = assetHash.high64;
     this->assets[this->assetCount].fileSize = fileSize;
     this->assets[this->assetCount].flags = aFlags;
     this->assets[this->assetCount].type = mediaType;
 
-    this->assetLookupTable.addAsset(iHash, this->assetCount);
+    this->assetLookupTable.addAsset(assetHash, this->assetCount);
 
     this->pages[this->pageCount].assetIndex = this->assetCount;
     this->pages[this->pageCount].flags = pFlags;
 
     this->assetCount++;
     this->pageCount++;
+}
+
+bool BBFBuilder::addPageData(const void* data, uint64_t dataSize, const char* nameHint, uint32_t pFlags, uint32_t aFlags, const XXH128_hash_t* knownHash)
+{
+    if (!this->file || (!data && dataSize > 0))
+    {
+        return false;
+    }
+
+    XXH128_hash_t assetHash = knownHash ? *knownHash : XXH3_128bits(data, (size_t)dataSize);
+    if (addDuplicatePage(assetHash, pFlags))
+    {
+        return true;
+    }
+
+    writePadding(assetAlignment(dataSize));
+    uint64_t aStartOffset = this->currentOffset;
+    if (dataSize > 0 && fwrite(data, 1, (size_t)dataSize, this->file) != (size_t)dataSize)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to write page %s.\n", nameHint ? nameHint : "(memory)");
+        return false;
+    }
+    this->currentOffset += dataSize;
+
+    addNewPage(assetHash, aStartOffset, dataSize, detectType(nameHint), pFlags, aFlags);
+    return true;
+}
+
+bool BBFBuilder::addPageRange(int sourceFd, uint64_t sourceOffset, uint64_t length, const char* nameHint, uint32_t pFlags, uint32_t aFlags, BBFChunkHook chunkHook, void* hookData)
+{
+    if (!this->file || sourceFd < 0)
+    {
+        return false;
+    }
+
+    // Hash first, the asset may already be here
+    uint8_t* iBuffer = (uint8_t*)malloc(BBF::MOVE_BUFFER_SIZE);
+    XXH3_state_t* state = XXH3_createState();
+    bool readOk = iBuffer && state;
+    if (readOk)
+    {
+        XXH3_128bits_reset(state);
+    }
+
+    uint64_t doneBytes = 0;
+    while (readOk && doneBytes < length)
+    {
+        uint64_t remaining = length - doneBytes;
+        size_t chunk = (size_t)((remaining > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : remaining);
+
+        #ifdef _WIN32
+            readOk = _lseeki64(sourceFd, (__int64)(sourceOffset + doneBytes), SEEK_SET) >= 0 &&
+                     _read(sourceFd, iBuffer, (unsigned int)chunk) == (int)chunk;
+        #else
+            size_t chunkDone = 0;
+            while (readOk && chunkDone < chunk)
+            {
+                ssize_t readBytes = pread(sourceFd, iBuffer + chunkDone, chunk - chunkDone, (off_t)(sourceOffset + doneBytes + chunkDone));
+                if (readBytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                readOk = readBytes > 0;
+                chunkDone += readOk ? (size_t)readBytes : 0;
+            }
+        #endif
+
+        if (readOk)
+        {
+            XXH3_128bits_update(state, iBuffer, chunk);
+            if (chunkHook)
+            {
+                chunkHook(iBuffer, chunk, hookData);
+            }
+            doneBytes += chunk;
+        }
+    }
+
+    XXH128_hash_t assetHash = {};
+    if (readOk)
+    {
+        assetHash = XXH3_128bits_digest(state);
+    }
+    XXH3_freeState(state);
+    free(iBuffer);
+
+    if (!readOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to read page %s.\n", nameHint ? nameHint : "(range)");
+        return false;
+    }
+
+    if (addDuplicatePage(assetHash, pFlags))
+    {
+        return true;
+    }
+
+    // Second pass comes out of the page cache, or never reaches user space at all
+    writePadding(assetAlignment(length));
+    uint64_t aStartOffset = this->currentOffset;
+    if (!copyFromFd(sourceFd, sourceOffset, aStartOffset, length))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to copy page %s.\n", nameHint ? nameHint : "(range)");
+        return false;
+    }
+    this->currentOffset += length;
 
+    addNewPage(assetHash, aStartOffset, length, detectType(nameHint), pFlags, aFlags);
     return true;
 }
 
@@ -457,6 +665,17 @@ bool BBFBuilder::finalize()
         return false;
     }
 
+    // Petrified in place when the index fits the room reserved for it. Otherwise it goes after the data.
+    uint64_t indexSize = sizeof(BBFAsset)*this->assetCount + sizeof(BBFPage)*this->pageCount + sizeof(BBFSection)*this->sectionCount +
+                         sizeof(BBFMeta)*this->keyCount + this->stringPool.getUsedSize();
+    bool petrified = this->indexReserve > 0 && indexSize <= this->indexReserve;
+    if (petrified)
+    {
+        fseek(this->file, (long)(sizeof(BBFHeader) + sizeof(BBFFooter)), SEEK_SET);
+        this->currentOffset = sizeof(BBFHeader) + sizeof(BBFFooter);
+        this->headerFlags |= BBF::BBF_PETRIFICATION_FLAG;
+    }
+
     XXH3_state_t* hashState = XXH3_createState();
     XXH3_64bits_reset(hashState);
 
@@ -537,6 +756,11 @@ bool BBFBuilder::finalize()
     footer.footerLen = (uint8_t)sizeof(BBFFooter);
     footer.footerHash = indexHash;
 
+    if (petrified)
+    {
+        footerOffset = sizeof(BBFHeader);
+        fseek(this->file, (long)footerOffset, SEEK_SET);
+    }
     fwrite(&footer, 1, sizeof(BBFFooter), this->file);
 
     // Write header
@@ -564,55 +788,150 @@ bool BBFBuilder::finalize()
     return true;
 }
 
-// Copy helper
-static bool copyRange(FILE* source, FILE* dest, uint64_t bToCopy)
+// PETRIFY
+
+// fseek/ftell with 64-bit offsets, so books over 2 GB petrify everywhere
+static bool seekFile(FILE* file, uint64_t offset)
+{
+    #ifdef _WIN32
+        return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+    #else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+    #endif
+}
+
+static bool getFileLength(FILE* file, uint64_t* fileLength)
 {
-    static uint8_t buffer[65536];
-    uint64_t remaining = bToCopy;
+    #ifdef _WIN32
+        if (_fseeki64(file, 0, SEEK_END) != 0) { return false; }
+        __int64 endPos = _ftelli64(file);
+    #else
+        if (fseeko(file, 0, SEEK_END) != 0) { return false; }
+        off_t endPos = ftello(file);
+    #endif
 
-    while ( remaining > 0)
+    if (endPos < 0)
     {
-        size_t fChunk = (remaining > sizeof(buffer)) ? sizeof(buffer) : (size_t)remaining;
+        return false;
+    }
+    *fileLength = (uint64_t)endPos;
+    return true;
+}
 
-        if (fread(buffer, 1, fChunk, source) != fChunk)
-        {
-            return false;
-        }
+static bool syncFile(FILE* file)
+{
+    if (fflush(file) != 0)
+    {
+        return false;
+    }
 
-        if (fwrite(buffer, 1, fChunk, dest) != fChunk)
-        {
-            return false;
-        }
+    #ifdef _WIN32
+        return _commit(_fileno(file)) == 0;
+    #else
+        return fsync(fileno(file)) == 0;
+    #endif
+}
 
-        remaining -= fChunk;
+static bool truncateFile(FILE* file, uint64_t fileLength)
+{
+    if (fflush(file) != 0)
+    {
+        return false;
     }
 
-    return true;
+    #ifdef _WIN32
+        return _chsize_s(_fileno(file), (__int64)fileLength) == 0;
+    #else
+        return ftruncate(fileno(file), (off_t)fileLength) == 0;
+    #endif
 }
 
-bool BBFBuilder::petrifyFile(const char* iPath, const char* oPath)
+static bool readAt(FILE* file, uint64_t offset, void* dst, uint64_t length)
 {
-    // if (this->file != nullptr)
-    // {
-    //     return false;
-    // }
+    return seekFile(file, offset) && fread(dst, 1, (size_t)length, file) == (size_t)length;
+}
 
-    FILE* sourceBBF = fopen(iPath, "rb");
-    const char* tmpPath = "petrified.bbf.tmp"; 
+static bool writeAt(FILE* file, uint64_t offset, const void* src, uint64_t length)
+{
+    return seekFile(file, offset) && fwrite(src, 1, (size_t)length, file) == (size_t)length;
+}
 
-    if (!sourceBBF)
+// A unique file next to destPath. Same directory, so the final rename never crosses filesystems,
+// and concurrent jobs never pick the same name.
+FILE* BBFBuilder::openTempNear(const char* destPath, char** tempPath)
+{
+    *tempPath = nullptr;
+
+    #ifdef _WIN32
+        char destDir[MAX_PATH];
+        snprintf(destDir, sizeof(destDir), "%s", destPath);
+        char* lastSep = strrchr(destDir, '\\');
+        char* lastSlash = strrchr(destDir, '/');
+        lastSep = (lastSlash > lastSep) ? lastSlash : lastSep;
+        if (lastSep)
+        {
+            *lastSep = '\0';
+        }
+        else
+        {
+            snprintf(destDir, sizeof(destDir), ".");
+        }
+
+        char* tempName = (char*)malloc(MAX_PATH);
+        if (!tempName || GetTempFileNameA(destDir, "bbf", 0, tempName) == 0)
+        {
+            free(tempName);
+            return nullptr;
+        }
+
+        FILE* tempFile = fopen(tempName, "wb+");
+    #else
+        size_t nameLength = strlen(destPath) + sizeof(".tmp.XXXXXX");
+        char* tempName = (char*)malloc(nameLength);
+        if (!tempName)
+        {
+            return nullptr;
+        }
+        snprintf(tempName, nameLength, "%s.tmp.XXXXXX", destPath);
+
+        int tempFd = mkstemp(tempName);
+        FILE* tempFile = (tempFd >= 0) ? fdopen(tempFd, "wb+") : nullptr;
+        if (tempFd >= 0 && !tempFile)
+        {
+            close(tempFd);
+        }
+    #endif
+
+    if (!tempFile)
     {
-        fprintf(stderr, "[BBFCODEC] Cannot petrify an already open file.\n");
-        return false;
+        remove(tempName);
+        free(tempName);
+        return nullptr;
     }
 
+    *tempPath = tempName;
+    return tempFile;
+}
+
+// Everything petrify writes in front of the data: the new header, the footer, the index with
+// every offset already moved, and padding. Data from dataStart moves up by shiftData, to frontSize.
+struct PetrifyPlan
+{
+    uint64_t dataStart;
+    uint64_t dataSize;
+    uint64_t shiftData;
+    uint8_t* front;
+    uint64_t frontSize;
+};
+
+static bool planPetrify(FILE* sourceBBF, PetrifyPlan* plan)
+{
+    plan->front = nullptr;
+
     // read header
     BBFHeader header;
-    size_t headerSize = fread(&header, 1, sizeof(BBFHeader), sourceBBF);
-
-    if (headerSize != sizeof(BBFHeader))
+    if (!readAt(sourceBBF, 0, &header, sizeof(BBFHeader)))
     {
-        fclose(sourceBBF);
         fprintf(stderr, "[BBFCODEC] Invalid Header.\n");
         return false;
     }
@@ -621,76 +940,127 @@ bool BBFBuilder::petrifyFile(const char* iPath, const char* oPath)
     if (header.magic[0] != 'B' || header.magic[1] != 'B' || header.magic[2] != 'F' || header.magic[3] != '3')
     {
         fprintf(stderr, "[BBFCODEC] Invalid Magic Detected. Closing File.\n");
-        fclose(sourceBBF);
         return false;
     }
 
     if (header.flags & BBF::BBF_PETRIFICATION_FLAG)
     {
         fprintf(stderr, "[BBFCODEC] File Already Petrified. Closing File.\n");
-        fclose(sourceBBF);
         return false;
     }
 
-    uint64_t oldFooter = header.footerOffset;
-    fseek(sourceBBF, (long)oldFooter, SEEK_SET);
     BBFFooter footer;
-
-    size_t footerSize = fread(&footer, 1, sizeof(BBFFooter), sourceBBF);
-    if (footerSize != sizeof(BBFFooter))
+    if (!readAt(sourceBBF, header.footerOffset, &footer, sizeof(BBFFooter)))
     {
-        // invalid footer
-        fclose(sourceBBF);
         fprintf(stderr, "[BBFCODEC] Invalid Footer.\n");
         return false;
     }
 
+    uint64_t fileSize = 0;
+    if (!getFileLength(sourceBBF, &fileSize))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to get file size.\n");
+        return false;
+    }
+
     // get first offset.
     uint64_t indexStart = footer.assetOffset;
-    // size of both header + footer combined
-    uint64_t newIndexStart = sizeof(BBFHeader) + sizeof(BBFFooter);
-
-    fseek(sourceBBF, 0, SEEK_END);
-    long endPos = ftell(sourceBBF);
-
-    if (endPos < 0)
+    if (indexStart < header.headerLen || indexStart > header.footerOffset || header.footerOffset + sizeof(BBFFooter) > fileSize)
     {
-        fclose(sourceBBF);
-        fprintf(stderr, "[BBFCODEC] ftell failed. Got: %ld\n", endPos);
+        fprintf(stderr, "[BBFCODEC] Invalid Footer.\n");
         return false;
     }
 
-    uint64_t fileSize = (uint64_t)endPos;
-
     uint64_t indexSize = header.footerOffset - indexStart; // don't copy footer
-    uint64_t dataSize = indexStart - header.headerLen;
-
-    FILE* tmpBBF = fopen(tmpPath, "wb+");
-    if (!tmpBBF)
+    if (indexSize > BBF::MAX_BALE_SIZE)
     {
-        fclose(sourceBBF);
-        fprintf(stderr, "[BBFCODEC] Failed to open petrified.bbf.tmp\n");
+        fprintf(stderr, "[BBFCODEC] Index region is too large to petrify.\n");
         return false;
     }
 
-    BBFHeader newHeader = header;
-    BBFFooter newFooter = footer; // make new footer
-    newHeader.flags |= BBF::BBF_PETRIFICATION_FLAG;
-
-    newHeader.footerOffset = sizeof(BBFHeader); // + indexSize - sizeof(BBFFooter);
-    // Write header
-    fwrite(&newHeader, 1, sizeof(BBFHeader), tmpBBF);
+    // Assets keep their alignment class, so the data moves by a multiple of the book's alignment.
+    // Ream assets in variable ream books are only 8 byte aligned.
+    if (header.alignment > BBF::MAX_GUARD_ALIGNMENT)
+    {
+        fprintf(stderr, "[BBFCODEC] Unsupported alignment (2^%u).\n", (unsigned)header.alignment);
+        return false;
+    }
+    uint64_t alignmentBytes = 1ULL << header.alignment;
+    if ((header.flags & BBF::BBF_VARIABLE_REAM_SIZE_FLAG) && alignmentBytes < 8)
+    {
+        alignmentBytes = 8;
+    }
 
-    // Read footer, calculate shifts
-    int64_t shiftIndex = (int64_t)newIndexStart - (int64_t)indexStart;
+    uint8_t* index = (uint8_t*)malloc((size_t)(indexSize ? indexSize : 1));
+    if (!index)
+    {
+        return false;
+    }
 
-    uint64_t newDataStart = newIndexStart + indexSize;
-    int64_t shiftData = (int64_t)newDataStart - (int64_t)header.headerLen;
+    if (!readAt(sourceBBF, indexStart, index, indexSize))
+    {
+        fprintf(stderr, "[BBFCODEC] Could not read index.\n");
+        free(index);
+        return false;
+    }
 
-    fseek(tmpBBF, (long)newHeader.footerOffset, SEEK_SET);
+    if (footer.assetCount > indexSize / sizeof(BBFAsset))
+    {
+        fprintf(stderr, "[BBFCODEC] Error patching assets.\n");
+        free(index);
+        return false;
+    }
+
+    // Everything before the first asset is padding. Skip whole alignment units of it,
+    // which usually leaves room for the index without moving the data at all.
+    uint64_t firstAsset = indexStart;
+    uint64_t assetIterator = 0;
+    for (; assetIterator < footer.assetCount; assetIterator++)
+    {
+        BBFAsset asset;
+        memcpy(&asset, index + assetIterator * sizeof(BBFAsset), sizeof(BBFAsset));
+        if (asset.fileOffset < header.headerLen || asset.fileOffset > indexStart || asset.fileSize > indexStart - asset.fileOffset)
+        {
+            fprintf(stderr, "[BBFCODEC] Asset %llu is outside the data region.\n", (unsigned long long)assetIterator);
+            free(index);
+            return false;
+        }
+        firstAsset = (asset.fileOffset < firstAsset) ? asset.fileOffset : firstAsset;
+    }
+
+    uint64_t dataStart = firstAsset - (firstAsset % alignmentBytes);
+    dataStart = (dataStart < header.headerLen) ? header.headerLen : dataStart;
+
+    // size of both header + footer combined
+    uint64_t newIndexStart = sizeof(BBFHeader) + sizeof(BBFFooter);
+    uint64_t indexEnd = newIndexStart + indexSize;
+    int64_t shiftIndex = (int64_t)newIndexStart - (int64_t)indexStart;
+
+    // First offset at or after the index with the same remainder as dataStart. Never below dataStart,
+    // so data only ever moves up.
+    uint64_t dataPhase = dataStart % alignmentBytes;
+    uint64_t newDataStart = ((indexEnd + alignmentBytes - 1 - dataPhase) / alignmentBytes) * alignmentBytes + dataPhase;
+    newDataStart = (newDataStart < dataStart) ? dataStart : newDataStart;
+
+    plan->dataStart = dataStart;
+    plan->dataSize = indexStart - dataStart;
+    plan->frontSize = newDataStart;
+    plan->shiftData = newDataStart - dataStart;
+
+    // Front region runs up to the data, padding zeroed
+    plan->front = (uint8_t*)calloc(1, (size_t)plan->frontSize);
+    if (!plan->front)
+    {
+        free(index);
+        return false;
+    }
+
+    BBFHeader newHeader = header;
+    newHeader.flags |= BBF::BBF_PETRIFICATION_FLAG;
+    newHeader.footerOffset = sizeof(BBFHeader);
 
     // Shift offsets
-    // TODO: Alignment, maybe?
+    BBFFooter newFooter = footer;
     newFooter.assetOffset += shiftIndex;
     newFooter.pageOffset += shiftIndex;
     newFooter.sectionOffset += shiftIndex;
@@ -698,348 +1068,3117 @@ bool BBFBuilder::petrifyFile(const char* iPath, const char* oPath)
     newFooter.expansionOffset = (newFooter.expansionOffset == 0) ? 0 : newFooter.expansionOffset + shiftIndex;
     newFooter.stringPoolOffset += shiftIndex;
 
-    // Write footer
-    fwrite(&newFooter, 1, sizeof(BBFFooter), tmpBBF);
+    memcpy(plan->front, &newHeader, sizeof(BBFHeader));
+    memcpy(plan->front + sizeof(BBFHeader), &newFooter, sizeof(BBFFooter));
+
+    uint8_t* newIndex = plan->front + newIndexStart;
+    memcpy(newIndex, index, (size_t)indexSize);
+    free(index);
 
-    // copy index
-    fseek(sourceBBF, (long)indexStart, SEEK_SET);
-    if (!copyRange(sourceBBF, tmpBBF, indexSize))
+    // Patch the asset table where it now sits
+    for (assetIterator = 0; assetIterator < footer.assetCount; assetIterator++)
     {
-        fclose(sourceBBF);
-        fclose(tmpBBF);
-        fprintf(stderr, "[BBFCODEC] Could not copy Index to TMPBBF\n");
+        BBFAsset asset;
+        memcpy(&asset, newIndex + assetIterator * sizeof(BBFAsset), sizeof(BBFAsset));
+        asset.fileOffset += plan->shiftData;
+        memcpy(newIndex + assetIterator * sizeof(BBFAsset), &asset, sizeof(BBFAsset));
+    }
+
+    return true;
+}
+
+bool BBFBuilder::petrifyFile(const char* iPath, const char* oPath, BBFCopyStats* copyStats)
+{
+    FILE* sourceBBF = fopen(iPath, "rb");
+    if (!sourceBBF)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to open %s.\n", iPath);
         return false;
     }
 
-    // copy data
-    fseek(sourceBBF, (long)header.headerLen, SEEK_SET);
-    if (!copyRange(sourceBBF, tmpBBF, dataSize))
+    PetrifyPlan plan;
+    if (!planPetrify(sourceBBF, &plan))
     {
         fclose(sourceBBF);
-        fclose(tmpBBF);
-        fprintf(stderr, "[BBFCODEC] Could not copy header bytes to tmpBBF.\n");
         return false;
     }
 
-    fseek(tmpBBF, (long)newFooter.assetOffset, SEEK_SET);
-    BBFAsset assetBuffer[64];
-
-    uint64_t remainingAssets = newFooter.assetCount;
-    while (remainingAssets > 0)
+    char* tmpPath = nullptr;
+    FILE* tmpBBF = openTempNear(oPath, &tmpPath);
+    if (!tmpBBF)
     {
-        uint64_t assetBatch = (remainingAssets > 64) ? 64 : remainingAssets;
-
-        long cursorPos = ftell(tmpBBF);
-        size_t readCount = fread(assetBuffer, sizeof(BBFAsset), assetBatch, tmpBBF);
+        fclose(sourceBBF);
+        free(plan.front);
+        fprintf(stderr, "[BBFCODEC] Failed to create a temporary file next to %s\n", oPath);
+        return false;
+    }
 
-        if (readCount != assetBatch)
+    #ifndef _WIN32
+        // mkstemp makes it 0600. Keep the source book's permissions instead.
+        struct stat sourceStat;
+        if (fstat(fileno(sourceBBF), &sourceStat) == 0)
         {
-            fprintf(stderr, "[BBFCODEC] Error patching assets.\n");
-            fclose(sourceBBF);
-            fclose(tmpBBF);
-            remove(tmpPath);
-            return false;
+            fchmod(fileno(tmpBBF), sourceStat.st_mode & 07777);
         }
+    #endif
 
-        uint64_t iterator = 0;
-        for(; iterator < assetBatch; iterator++)
+    // Header, footer and index, then the data. The data doesn't change, so the mover can
+    // share extents with the source, or at least keep it in the kernel.
+    bool copyOk = fwrite(plan.front, 1, (size_t)plan.frontSize, tmpBBF) == (size_t)plan.frontSize && fflush(tmpBBF) == 0;
+    if (copyOk)
+    {
+        #ifdef _WIN32
+            BBFDataMover dataMover(_fileno(sourceBBF), _fileno(tmpBBF));
+        #else
+            BBFDataMover dataMover(fileno(sourceBBF), fileno(tmpBBF));
+        #endif
+        copyOk = dataMover.copy(plan.dataStart, plan.frontSize, plan.dataSize);
+        if (copyStats)
         {
-            assetBuffer[iterator].fileOffset += shiftData;
+            *copyStats = dataMover.getStats();
         }
-
-        // Write assets
-        fseek(tmpBBF, cursorPos, SEEK_SET);
-        fwrite(assetBuffer, sizeof(BBFAsset), assetBatch, tmpBBF);
-
-        fseek(tmpBBF, cursorPos + (assetBatch * sizeof(BBFAsset)), SEEK_SET);
-        remainingAssets -= assetBatch;
     }
-
-    // Close, finally.
+    copyOk = (fclose(tmpBBF) == 0) && copyOk;
     fclose(sourceBBF);
-    fclose(tmpBBF);
+    free(plan.front);
+
+    if (!copyOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Could not copy book to %s\n", tmpPath);
+        remove(tmpPath);
+        free(tmpPath);
+        return false;
+    }
 
     #ifdef _WIN32
-        if (MoveFileEx("petrified.bbf.tmp", oPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED) == 0)
+        if (MoveFileExA(tmpPath, oPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED) == 0)
         {
             DWORD err = GetLastError();
             fprintf(stderr, "[BBFCODEC] MoveFileEx failed. Error: %lu\n", err);
+            remove(tmpPath);
+            free(tmpPath);
             return false;
         }
     #else
-        if (rename("petrified.bbf.tmp", oPath) != 0)
+        if (rename(tmpPath, oPath) != 0)
         {
-            fprintf(stderr, "[BBFCODEC] Could not rename temp file. Result is in 'petrified.bbf.tmp'\n");
+            fprintf(stderr, "[BBFCODEC] Could not rename temp file. Result is in '%s'\n", tmpPath);
+            free(tmpPath);
             return false;
         }
     #endif
 
+    free(tmpPath);
     return true;
 }
 
+// In-place petrify journal, <book>.bbfjournal. Holds the new front of the book and the block in flight.
+#pragma pack(push, 1)
+struct PetrifyJournal
+{
+    uint8_t magic[8]; // BBFJRNL1
+    uint64_t dataStart;
+    uint64_t dataSize;
+    uint64_t shiftData;
+    uint64_t frontSize;
+    uint64_t frontHash; // XXH3-64 of the front bytes
+
+    uint64_t movedFrom; // Data at and above this (relative to dataStart) is already in its new place
+    uint64_t blockOffset; // Block in flight, copied into the journal. 0xFFFFFFFFFFFFFFFF if none.
+    uint64_t blockLength;
+    uint64_t blockHash;
+
+    uint64_t journalHash; // XXH3-64 of everything above
+};
+#pragma pack(pop)
+
+static char* journalPathFor(const char* path)
+{
+    size_t journalLength = strlen(path) + sizeof(".bbfjournal");
+    char* journalPath = (char*)malloc(journalLength);
+    if (journalPath)
+    {
+        snprintf(journalPath, journalLength, "%s.bbfjournal", path);
+    }
+    return journalPath;
+}
 
-
-// READER FUNCTIONS
-
-BBFReader::BBFReader(const char* iFile)
+// The header is small enough to land in one sector write. Blocks go after the front bytes.
+static bool writeJournalHeader(FILE* journalFile, PetrifyJournal* journal)
 {
-    this->fileBuffer = nullptr;
-    this->fileSize = 0;
-    this->footerCache = nullptr;
+    journal->journalHash = XXH3_64bits(journal, offsetof(PetrifyJournal, journalHash));
+    return writeAt(journalFile, 0, journal, sizeof(PetrifyJournal)) && syncFile(journalFile);
+}
 
-    // Windows memory mapping
-    #ifdef _WIN32
-        this->hFile = CreateFileA(iFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+static bool runPetrifyJournal(FILE* bookFile, FILE* journalFile, PetrifyJournal* journal, const uint8_t* front)
+{
+    uint64_t blockSlot = sizeof(PetrifyJournal) + journal->frontSize;
+    uint64_t blockCap = (journal->dataSize < BBF::PETRIFY_BLOCK_SIZE) ? journal->dataSize : BBF::PETRIFY_BLOCK_SIZE;
+    uint8_t* blockBuffer = (uint8_t*)malloc((size_t)(blockCap ? blockCap : 1));
+    if (!blockBuffer)
+    {
+        return false;
+    }
 
-        if (this->hFile == INVALID_HANDLE_VALUE)
+    // Finish the block that was in flight. Its source may already be half overwritten, so use the journal copy.
+    if (journal->blockOffset != 0xFFFFFFFFFFFFFFFF)
+    {
+        bool blockOk = journal->blockLength <= blockCap && readAt(journalFile, blockSlot, blockBuffer, journal->blockLength) &&
+                       XXH3_64bits(blockBuffer, (size_t)journal->blockLength) == journal->blockHash;
+        if (!blockOk)
         {
-            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
-            return;
+            fprintf(stderr, "[BBFCODEC] Journaled block doesn't match its hash.\n");
+            free(blockBuffer);
+            return false;
         }
 
-        // Get Filesize
-        LARGE_INTEGER size;
-        GetFileSizeEx(this->hFile, &size);
-        this->fileSize = (size_t)size.QuadPart;
-
-        //Map to memory
-        this->hMap = CreateFileMappingA(this->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
-
-        if (this->hMap == NULL)
+        if (!writeAt(bookFile, journal->dataStart + journal->blockOffset + journal->shiftData, blockBuffer, journal->blockLength) || !syncFile(bookFile))
         {
-            fprintf(stderr, "[BBFCODEC] Failed to map file (CreateFileMapping)\n");
-            CloseHandle(this->hFile);
-            return;
+            free(blockBuffer);
+            return false;
         }
+        journal->movedFrom = journal->blockOffset;
 
-        this->fileBuffer = (uint8_t*)MapViewOfFile(this->hMap, FILE_MAP_READ, 0, 0, 0);
-        if (this->fileBuffer == NULL)
+        journal->blockOffset = 0xFFFFFFFFFFFFFFFF;
+        if (!writeJournalHeader(journalFile, journal))
         {
-            fprintf(stderr, "[BBFCODEC] Failed to map file (MapViewOfFile)\n");
-            CloseHandle(this->hMap);
-            CloseHandle(this->hFile);
-            return;
+            free(blockBuffer);
+            return false;
         }
-    #else
-        this->fileDescriptor = open(iFile, O_RDONLY);
-        if (this->fileDescriptor == -1)
+    }
+
+    // Back to front, so nothing is overwritten before it's moved.
+    // Each block goes to the journal first, since its destination overlaps its own source.
+    while (journal->movedFrom > 0)
+    {
+        uint64_t blockLength = (journal->movedFrom < blockCap) ? journal->movedFrom : blockCap;
+        uint64_t blockOffset = journal->movedFrom - blockLength;
+
+        if (!readAt(bookFile, journal->dataStart + blockOffset, blockBuffer, blockLength) ||
+            !writeAt(journalFile, blockSlot, blockBuffer, blockLength) || !syncFile(journalFile))
         {
-            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
-            return;
+            free(blockBuffer);
+            return false;
         }
 
-        struct stat fileStat;
-        if (fstat(this->fileDescriptor, &fileStat) == -1)
+        journal->blockOffset = blockOffset;
+        journal->blockLength = blockLength;
+        journal->blockHash = XXH3_64bits(blockBuffer, (size_t)blockLength);
+        if (!writeJournalHeader(journalFile, journal))
         {
-            fprintf(stderr, "[BBFCODEC] Unable to stat file\n");
-            close(this->fileDescriptor);
-            return;
+            free(blockBuffer);
+            return false;
         }
-        this->fileSize = fileStat.st_size;
 
-        void* fMap = mmap(NULL, this->fileSize, PROT_READ, MAP_PRIVATE, this->fileDescriptor, 0);
-        if (fMap == MAP_FAILED)
+        if (!writeAt(bookFile, journal->dataStart + blockOffset + journal->shiftData, blockBuffer, blockLength) || !syncFile(bookFile))
         {
-            fprintf(stderr, "[BBFCODEC] mmap failed\n");
-            close(this->fileDescriptor);
-            this->fileBuffer = nullptr;
-            return;
+            free(blockBuffer);
+            return false;
         }
-        this->fileBuffer = (uint8_t*)fMap;
-    #endif
 
+        journal->movedFrom = blockOffset;
+        journal->blockOffset = 0xFFFFFFFFFFFFFFFF;
+        if (!writeJournalHeader(journalFile, journal))
+        {
+            free(blockBuffer);
+            return false;
+        }
+    }
+    free(blockBuffer);
 
-    // if (!this->file)
-    // {
-    //     printf("[BBFCODEC] Unable to open file %s", iFile);
-    //     return;
-    // }
-
-    // fseek(file, 0, SEEK_END);
-    // fileSize = ftell(file);
-    // rewind(file);
+    // Data is all in place. The header goes last, in the same write as the index.
+    // Then the old index comes off the end.
+    return writeAt(bookFile, 0, front, journal->frontSize) && syncFile(bookFile) &&
+           truncateFile(bookFile, journal->frontSize + journal->dataSize) && syncFile(bookFile);
+}
 
-    // this->fileBuffer = new uint8_t[this->fileSize];
-    // fread(this->fileBuffer, 1, this->fileSize, this->file);
+static bool loadPetrifyJournal(FILE* journalFile, PetrifyJournal* journal, uint8_t** front)
+{
+    *front = nullptr;
+    if (!readAt(journalFile, 0, journal, sizeof(PetrifyJournal)) || memcmp(journal->magic, "BBFJRNL1", 8) != 0 ||
+        XXH3_64bits(journal, offsetof(PetrifyJournal, journalHash)) != journal->journalHash ||
+        journal->frontSize > BBF::MAX_BALE_SIZE + (1ULL << (BBF::MAX_GUARD_ALIGNMENT + 1)) || journal->movedFrom > journal->dataSize)
+    {
+        return false;
+    }
 
-    // fclose(this->file);
+    *front = (uint8_t*)malloc((size_t)journal->frontSize);
+    if (!*front || !readAt(journalFile, sizeof(PetrifyJournal), *front, journal->frontSize) || XXH3_64bits(*front, (size_t)journal->frontSize) != journal->frontHash)
+    {
+        free(*front);
+        *front = nullptr;
+        return false;
+    }
+    return true;
 }
 
-BBFReader::~BBFReader()
+bool BBFBuilder::petrifyInPlace(const char* path)
 {
-    if (this->fileBuffer)
+    char* journalPath = journalPathFor(path);
+    FILE* bookFile = journalPath ? fopen(path, "rb+") : nullptr;
+    if (!bookFile)
     {
+        fprintf(stderr, "[BBFCODEC] Unable to open %s.\n", path);
+        free(journalPath);
+        return false;
+    }
 
-        #ifdef _WIN32
-            UnmapViewOfFile(this->fileBuffer);
-            CloseHandle(this->hMap);
-            CloseHandle(this->hFile);
-        #else
-            munmap(this->fileBuffer, this->fileSize);
-            close(this->fileDescriptor);
-        #endif
+    PetrifyJournal journal = {};
+    uint8_t* front = nullptr;
+    FILE* journalFile = fopen(journalPath, "rb+");
+
+    if (journalFile)
+    {
+        // An earlier run was interrupted. Pick up where it stopped.
+        if (!loadPetrifyJournal(journalFile, &journal, &front))
+        {
+            fprintf(stderr, "[BBFCODEC] Journal %s is damaged. Not touching the book.\n", journalPath);
+            fclose(journalFile);
+            fclose(bookFile);
+            free(journalPath);
+            return false;
+        }
+    }
+    else
+    {
+        PetrifyPlan plan;
+        if (!planPetrify(bookFile, &plan))
+        {
+            fclose(bookFile);
+            free(journalPath);
+            return false;
+        }
 
-        this->fileBuffer = nullptr;
+        memcpy(journal.magic, "BBFJRNL1", 8);
+        journal.dataStart = plan.dataStart;
+        journal.dataSize = plan.dataSize;
+        journal.shiftData = plan.shiftData;
+        journal.frontSize = plan.frontSize;
+        journal.frontHash = XXH3_64bits(plan.front, (size_t)plan.frontSize);
+        journal.movedFrom = (plan.shiftData == 0) ? 0 : plan.dataSize; // Index fit in the padding, nothing to move
+        journal.blockOffset = 0xFFFFFFFFFFFFFFFF;
+        front = plan.front;
+
+        // The journal is complete and on disk before the book is touched
+        journalFile = fopen(journalPath, "wb+");
+        bool journalOk = journalFile && writeAt(journalFile, sizeof(PetrifyJournal), front, journal.frontSize) && writeJournalHeader(journalFile, &journal);
+        if (!journalOk)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to write journal %s.\n", journalPath);
+            if (journalFile)
+            {
+                fclose(journalFile);
+                remove(journalPath);
+            }
+            fclose(bookFile);
+            free(front);
+            free(journalPath);
+            return false;
+        }
     }
 
-    this->footerCache = nullptr;
-}
+    bool petrifyOk = runPetrifyJournal(bookFile, journalFile, &journal, front);
+    fclose(journalFile);
+    petrifyOk = (fclose(bookFile) == 0) && petrifyOk;
+    free(front);
 
-bool BBFReader::isSafe(uint64_t offset, uint64_t size) const
-{
-    if (!this->fileBuffer)
+    if (!petrifyOk)
     {
+        fprintf(stderr, "[BBFCODEC] In-place petrify stopped. Run it again to finish from %s.\n", journalPath);
+        free(journalPath);
         return false;
     }
 
-    // Size should be size of the struct, or the string pool size
+    remove(journalPath);
+    free(journalPath);
+    return true;
+}
 
-    // check if the given offset is out of bounds
-    // return true if it's safe
 
-    // Check overflow condition
-    if (offset + size < offset)
+
+// REPACK
+
+BBFCopyStats BBFBuilder::getCopyStats() const
+{
+    BBFCopyStats totalStats = this->copyStats;
+    if (this->dataMover)
     {
-        return false;
+        const BBFCopyStats& moverStats = this->dataMover->getStats();
+        totalStats.reflinkBytes += moverStats.reflinkBytes;
+        totalStats.kernelBytes += moverStats.kernelBytes;
+        totalStats.bufferedBytes += moverStats.bufferedBytes;
+        totalStats.copyCount += moverStats.copyCount;
     }
+    return totalStats;
+}
 
-    // Check if pointer is outta file range
-    if (offset + size > this->fileSize)
+bool BBFBuilder::copyFromFd(int sourceFd, uint64_t sourceOffset, uint64_t destOffset, uint64_t length)
+{
+    // The mover writes by offset, so get our buffered bytes out first and seek past its data after
+    if (sourceFd != this->moverSourceFd)
     {
-        return false;
+        if (this->dataMover)
+        {
+            this->copyStats = getCopyStats();
+            delete this->dataMover;
+        }
+
+        #ifdef _WIN32
+            this->dataMover = new BBFDataMover(sourceFd, _fileno(this->file));
+        #else
+            this->dataMover = new BBFDataMover(sourceFd, fileno(this->file));
+        #endif
+        this->moverSourceFd = sourceFd;
     }
 
-    // success.
-    return true;
+    return fflush(this->file) == 0 && this->dataMover->copy(sourceOffset, destOffset, length) &&
+           seekFile(this->file, destOffset + length);
 }
 
-bool BBFReader::isSafe(uint64_t offset) const
+bool BBFBuilder::reserveIndex(uint64_t indexBound)
 {
-    if (!this->fileBuffer)
+    // Only in front of the first page
+    if (!this->file || this->currentOffset != sizeof(BBFHeader) || indexBound == 0 || indexBound > BBF::MAX_BALE_SIZE)
     {
         return false;
     }
 
-    if (offset > this->fileSize)
+    static const uint8_t zeros[4096] = {0};
+    uint64_t bytesLeft = sizeof(BBFFooter) + indexBound;
+    while (bytesLeft > 0)
     {
-        return false;
+        uint64_t chunk = (bytesLeft > sizeof(zeros)) ? sizeof(zeros) : bytesLeft;
+        if (fwrite(zeros, 1, (size_t)chunk, this->file) != (size_t)chunk)
+        {
+            return false;
+        }
+        bytesLeft -= chunk;
     }
 
+    this->currentOffset += sizeof(BBFFooter) + indexBound;
+    this->indexReserve = indexBound;
     return true;
 }
 
-bool BBFReader::isSafe(uint64_t count, int index) const
+bool BBFBuilder::addPageFrom(BBFReader* source, uint64_t pageIndex)
 {
-    // Check if file exists
-    if (!this->fileBuffer)
+    if (!this->file || !source)
     {
         return false;
     }
-    // Size should be size of the struct.
 
-    if (index < 0)
+    BBFHeader* sourceHeader = source->getHeaderView();
+    BBFFooter* sourceFooter = sourceHeader ? source->getFooterView(sourceHeader->footerOffset) : nullptr;
+    if (!sourceFooter || pageIndex >= sourceFooter->pageCount)
     {
+        fprintf(stderr, "[BBFCODEC] Source page %llu doesn't exist.\n", (unsigned long long)pageIndex);
         return false;
     }
 
-    if ((uint64_t)index > count)
+    const BBFPage* sourcePage = source->getPageEntryView(source->getPageTableView(sourceFooter->pageOffset), (int)pageIndex);
+    const BBFAsset* sourceAsset = sourcePage ? source->getAssetEntryView(source->getAssetTableView(sourceFooter->assetOffset), (int)sourcePage->assetIndex) : nullptr;
+
+    int sourceFd = -1;
+    uint64_t sourceOffset = 0;
+    uint64_t assetSize = 0;
+    if (!sourceAsset || !source->getAssetFileRange(sourcePage->assetIndex, &sourceFd, &sourceOffset, &assetSize))
     {
+        fprintf(stderr, "[BBFCODEC] Source page %llu has no readable asset.\n", (unsigned long long)pageIndex);
         return false;
     }
 
-    return true;
+    if (this->pageCount >= this->pageCap)
+    {
+        growPages();
+    }
 
-}
+    XXH128_hash_t assetHash;
+    assetHash.low64 = sourceAsset->assetHash[0];
+    assetHash.high64 = sourceAsset->assetHash[1];
 
-BBFFooter* BBFReader::getFooterView(uint64_t fOffset)
-{
-    if (!this->fileBuffer)
+    // Already have it, from this book or an earlier one
+    uint64_t aIndex = this->assetLookupTable.findAsset(assetHash);
+    if (aIndex != 0xFFFFFFFFFFFFFFFF)
     {
-        return nullptr;
+        this->pages[this->pageCount].assetIndex = aIndex;
+        this->pages[this->pageCount].flags = sourcePage->flags;
+        this->pageCount++;
+        return true;
     }
 
-    if (!isSafe(fOffset, (uint64_t)sizeof(BBFFooter)))
+    writePadding(assetAlignment(assetSize));
+    uint64_t aStartOffset = this->currentOffset;
+
+    bool copyOk = false;
+    if (sourceFd >= 0)
     {
-        return nullptr;
+        copyOk = copyFromFd(sourceFd, sourceOffset, aStartOffset, assetSize);
+    }
+    else
+    {
+        // Book in memory, or behind a callback
+        uint8_t* assetData = (uint8_t*)malloc((size_t)(assetSize ? assetSize : 1));
+        copyOk = assetData && source->readAssetData(sourceAsset, assetData, assetSize) &&
+                 fwrite(assetData, 1, (size_t)assetSize, this->file) == (size_t)assetSize;
+        free(assetData);
     }
 
-    // Set the footerCache to the footer.
-    footerCache = (BBFFooter*)(this->fileBuffer + fOffset);
+    if (!copyOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to copy the asset for page %llu.\n", (unsigned long long)pageIndex);
+        return false;
+    }
+    this->currentOffset += assetSize;
 
-    return footerCache;
+    if (this->assetCount >= this->assetCap)
+    {
+        growAssets();
+    }
+
+    this->assets[this->assetCount] = *sourceAsset;
+    this->assets[this->assetCount].fileOffset = aStartOffset;
+
+    this->assetLookupTable.addAsset(assetHash, this->assetCount);
+
+    this->pages[this->pageCount].assetIndex = this->assetCount;
+    this->pages[this->pageCount].flags = sourcePage->flags;
+
+    this->assetCount++;
+    this->pageCount++;
+
+    return true;
 }
 
-const char* BBFReader::getStringView(uint64_t strOffset)
+bool BBFBuilder::appendBook(BBFReader* source, const char* volumeName)
 {
-    if (!this->footerCache)
+    BBFHeader* sourceHeader = source->getHeaderView();
+    BBFFooter* sourceFooter = sourceHeader ? source->getFooterView(sourceHeader->footerOffset) : nullptr;
+    if (!sourceFooter || !source->checkMagic(sourceHeader))
     {
-        printf("[BBFCODEC] Cannot Access String Pool. Ensure File is opened.");
-        return nullptr;
+        return false;
     }
 
-    if ((this->footerCache->stringPoolOffset) + strOffset < (this->footerCache->stringPoolOffset) || strOffset >= (this->footerCache->stringPoolOffset + this->footerCache->stringPoolSize))
+    // Where this book's pages start in ours
+    uint64_t pageBase = this->pageCount;
+    if (volumeName && !addSection(volumeName, pageBase))
     {
-        return nullptr;
+        return false;
     }
 
-    uint64_t bytesLeft = (this->footerCache->stringPoolOffset + this->footerCache->stringPoolSize) - strOffset;
-    uint64_t scanLimit = (BBF::MAX_FORME_SIZE < bytesLeft) ? BBF::MAX_FORME_SIZE : bytesLeft;
-
-    const char* pPtr = (const char*)(this->fileBuffer + strOffset + this->footerCache->stringPoolOffset);
+    // Pages in order. Assets no page uses never get copied.
+    uint64_t pageIterator = 0;
+    for (; pageIterator < sourceFooter->pageCount; pageIterator++)
+    {
+        if (!addPageFrom(source, pageIterator))
+        {
+            return false;
+        }
+    }
 
-    uint64_t iterator = 0;
-    for(; iterator < scanLimit; iterator++)
+    // Top level sections and metadata go under the volume
+    const uint8_t* sectionTable = source->getSectionTableView(sourceFooter->sectionOffset);
+    uint64_t sectionIterator = 0;
+    for (; sectionIterator < sourceFooter->sectionCount; sectionIterator++)
     {
-        if (pPtr[iterator] == '\0')
+        const BBFSection* section = source->getSectionEntryView(sectionTable, (int)sectionIterator);
+        const char* sectionName = section ? source->getStringView(section->sectionTitleOffset) : nullptr;
+        const char* parentName = (section && section->sectionParentOffset != 0xFFFFFFFFFFFFFFFF) ? source->getStringView(section->sectionParentOffset) : volumeName;
+        if (!sectionName || !addSection(sectionName, pageBase + section->sectionStartIndex, parentName))
         {
-            return pPtr;
+            return false;
         }
     }
 
-    return nullptr;
+    const uint8_t* metaTable = source->getMetadataView(sourceFooter->metaOffset);
+    uint64_t metaIterator = 0;
+    for (; metaIterator < sourceFooter->metaCount; metaIterator++)
+    {
+        const BBFMeta* meta = source->getMetaEntryView(metaTable, (int)metaIterator);
+        const char* keyName = meta ? source->getStringView(meta->keyOffset) : nullptr;
+        const char* valueText = meta ? source->getStringView(meta->valueOffset) : nullptr;
+        const char* parentName = (meta && meta->parentOffset != 0xFFFFFFFFFFFFFFFF) ? source->getStringView(meta->parentOffset) : volumeName;
+        if (!keyName || !valueText || !addMeta(keyName, valueText, parentName))
+        {
+            return false;
+        }
+    }
 
+    return true;
 }
 
-bool BBFReader::checkMagic(BBFHeader* pHeader)
+bool BBFBuilder::replaceWithTemp(char* tempPath, const char* destPath, const char* modeSource)
 {
-    // Check the magic number of the file
-    uint32_t fileMagic = (pHeader->magic[0] << 24) | (pHeader->magic[1] << 16) | (pHeader->magic[2] << 8)  | (pHeader->magic[3]);
-    if (!(fileMagic == 0x42424633))
+    #ifndef _WIN32
+        // Temp files are 0600
+        struct stat modeStat;
+        if ((modeSource && stat(modeSource, &modeStat) == 0) || stat(destPath, &modeStat) == 0)
+        {
+            chmod(tempPath, modeStat.st_mode & 07777);
+        }
+        else
+        {
+            chmod(tempPath, 0644);
+        }
+    #else
+        (void)modeSource;
+    #endif
+
+    #ifdef _WIN32
+        if (MoveFileExA(tempPath, destPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_COPY_ALLOWED) == 0)
+    #else
+        if (rename(tempPath, destPath) != 0)
+    #endif
     {
+        fprintf(stderr, "[BBFCODEC] Could not move the new file to %s\n", destPath);
+        remove(tempPath);
+        free(tempPath);
         return false;
     }
+
+    free(tempPath);
     return true;
 }
 
-XXH128_hash_t BBFReader::computeAssetHash(const BBFAsset* assetView)
+// Largest index a rewrite of source can need: its own tables and strings. Dropping and merging assets only shrinks it.
+// Past MAX_BALE_SIZE if the book can't be read, so nothing gets reserved for it.
+static uint64_t rewriteIndexBound(BBFReader* source)
 {
-    const uint8_t* dataView = this->getAssetDataView(assetView->fileOffset);
-
-    if (!dataView)
+    BBFHeader* header = source->getHeaderView();
+    BBFFooter* footer = header ? source->getFooterView(header->footerOffset) : nullptr;
+    if (!footer || footer->assetCount > BBF::MAX_BALE_SIZE || footer->pageCount > BBF::MAX_BALE_SIZE ||
+        footer->sectionCount > BBF::MAX_BALE_SIZE || footer->metaCount > BBF::MAX_BALE_SIZE || footer->stringPoolSize > BBF::MAX_BALE_SIZE)
     {
-        printf("[BBFCODEC] ERROR: Asset data out of bounds");
-        return {0,0};
+        return BBF::MAX_BALE_SIZE + 1;
     }
 
-    return XXH3_128bits(dataView, assetView->fileSize);
+    return footer->assetCount * sizeof(BBFAsset) + footer->pageCount * sizeof(BBFPage) + footer->sectionCount * sizeof(BBFSection) +
+           footer->metaCount * sizeof(BBFMeta) + footer->stringPoolSize;
 }
 
-XXH128_hash_t BBFReader::computeAssetHash(uint8_t* assetTableView, int assetIndex)
+// Move a finished temp book into place, or petrify it there. Takes tmpPath.
+static bool finishRewrite(char* tmpPath, const char* oPath, const char* modeSource, bool petrify, BBFCopyStats* copyStats)
 {
-    const BBFAsset* assetView = getAssetEntryView(assetTableView, assetIndex);
-    if (!assetView)
+    if (petrify)
     {
-        printf("[BBFCODEC] ERROR: Unable to get pointer for asset %i", assetIndex);
-        return {0,0};
-    }
+        #ifndef _WIN32
+            // Temp files are 0600. Keep the source book's permissions.
+            struct stat sourceStat;
+            if (modeSource && stat(modeSource, &sourceStat) == 0)
+            {
+                chmod(tmpPath, sourceStat.st_mode & 07777);
+            }
+        #endif
+
+        BBFCopyStats petrifyStats;
+        bool petrifyOk = BBFBuilder::petrifyFile(tmpPath, oPath, &petrifyStats);
+        remove(tmpPath);
+        free(tmpPath);
+        if (petrifyOk && copyStats)
+        {
+            copyStats->reflinkBytes += petrifyStats.reflinkBytes;
+            copyStats->kernelBytes += petrifyStats.kernelBytes;
+            copyStats->bufferedBytes += petrifyStats.bufferedBytes;
+            copyStats->copyCount += petrifyStats.copyCount;
+        }
+        return petrifyOk;
+    }
+
+    return BBFBuilder::replaceWithTemp(tmpPath, oPath, modeSource);
+}
+
+bool BBFBuilder::repackFile(const char* iPath, const char* oPath, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool petrify, BBFCopyStats* copyStats)
+{
+    if (alignment > BBF::MAX_GUARD_ALIGNMENT || reamSize > 63)
+    {
+        fprintf(stderr, "[BBFCODEC] Unsupported alignment or ream size.\n");
+        return false;
+    }
+
+    BBFReader source(iPath);
+    if (!source.getHeaderView())
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a readable book.\n", iPath);
+        return false;
+    }
+
+    // Build next to the output. oPath may be iPath.
+    char* tmpPath = nullptr;
+    FILE* tmpFile = openTempNear(oPath, &tmpPath);
+    if (!tmpFile)
+    {
+        fprintf(stderr, "[BBFCODEC] Failed to create a temporary file next to %s\n", oPath);
+        return false;
+    }
+    fclose(tmpFile);
+
+    // Petrify on the same pass: the index goes in front of the data, in room reserved before the first page
+    bool repackOk = false;
+    bool petrified = false;
+    {
+        BBFBuilder builder(tmpPath, alignment, reamSize, hFlags & ~BBF::BBF_PETRIFICATION_FLAG);
+        if (petrify)
+        {
+            builder.reserveIndex(rewriteIndexBound(&source));
+        }
+        repackOk = builder.appendBook(&source, nullptr);
+        if (repackOk && copyStats)
+        {
+            *copyStats = builder.getCopyStats();
+        }
+        repackOk = repackOk && builder.finalize();
+        petrified = (builder.headerFlags & BBF::BBF_PETRIFICATION_FLAG) != 0;
+    }
+
+    if (!repackOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Repacking %s failed.\n", iPath);
+        remove(tmpPath);
+        free(tmpPath);
+        return false;
+    }
+
+    return finishRewrite(tmpPath, oPath, iPath, petrify && !petrified, copyStats);
+}
+
+bool BBFBuilder::mergeFiles(const char* const* iPaths, uint32_t inputCount, const char* oPath, const char* const* volumeNames, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool petrify, BBFCopyStats* copyStats)
+{
+    if (!iPaths || inputCount == 0 || alignment > BBF::MAX_GUARD_ALIGNMENT || reamSize > 63)
+    {
+        return false;
+    }
+
+    char* tmpPath = nullptr;
+    FILE* tmpFile = openTempNear(oPath, &tmpPath);
+    if (!tmpFile)
+    {
+        fprintf(stderr, "[BBFCODEC] Failed to create a temporary file next to %s\n", oPath);
+        return false;
+    }
+    fclose(tmpFile);
+
+    bool mergeOk = true;
+    bool petrified = false;
+    {
+        BBFBuilder builder(tmpPath, alignment, reamSize, hFlags & ~BBF::BBF_PETRIFICATION_FLAG);
+
+        // Petrify on the same pass. Room for every input's index, plus a section and a name per volume.
+        uint32_t inputIterator = 0;
+        if (petrify)
+        {
+            uint64_t indexBound = 0;
+            for (; inputIterator < inputCount && indexBound <= BBF::MAX_BALE_SIZE; inputIterator++)
+            {
+                BBFReader source(iPaths[inputIterator]);
+                const char* volumeName = volumeNames ? volumeNames[inputIterator] : nullptr;
+                indexBound += rewriteIndexBound(&source) + (volumeName ? sizeof(BBFSection) + strlen(volumeName) + 1 : 0);
+            }
+            builder.reserveIndex(indexBound);
+        }
+
+        // One at a time, so only one input is mapped. The lookup table dedupes across all of them.
+        for (inputIterator = 0; mergeOk && inputIterator < inputCount; inputIterator++)
+        {
+            BBFReader source(iPaths[inputIterator]);
+            mergeOk = builder.appendBook(&source, volumeNames ? volumeNames[inputIterator] : nullptr);
+            if (!mergeOk)
+            {
+                fprintf(stderr, "[BBFCODEC] Unable to merge %s.\n", iPaths[inputIterator]);
+            }
+        }
+
+        if (mergeOk && copyStats)
+        {
+            *copyStats = builder.getCopyStats();
+        }
+        mergeOk = mergeOk && builder.finalize();
+        petrified = (builder.headerFlags & BBF::BBF_PETRIFICATION_FLAG) != 0;
+    }
+
+    if (!mergeOk)
+    {
+        remove(tmpPath);
+        free(tmpPath);
+        return false;
+    }
+
+    return finishRewrite(tmpPath, oPath, iPaths[0], petrify && !petrified, copyStats);
+}
+
+
+// Section depths, 1 for top level. Parents come before their children, so one pass finds them.
+static uint32_t* sectionDepths(BBFReader* source, BBFFooter* footer)
+{
+    uint32_t* depths = (uint32_t*)calloc((size_t)(footer->sectionCount ? footer->sectionCount : 1), sizeof(uint32_t));
+    const uint8_t* sectionTable = source->getSectionTableView(footer->sectionOffset);
+    if (!depths || !sectionTable)
+    {
+        free(depths);
+        return nullptr;
+    }
+
+    uint64_t sectionIterator = 0;
+    for (; sectionIterator < footer->sectionCount; sectionIterator++)
+    {
+        const BBFSection* section = source->getSectionEntryView(sectionTable, (int)sectionIterator);
+        depths[sectionIterator] = 1;
+        const char* parentName = (section && section->sectionParentOffset != 0xFFFFFFFFFFFFFFFF) ? source->getStringView(section->sectionParentOffset) : nullptr;
+        if (!parentName)
+        {
+            continue;
+        }
+
+        // Nearest earlier section with that title
+        uint64_t parentIterator = sectionIterator;
+        while (parentIterator > 0)
+        {
+            parentIterator--;
+            const BBFSection* parent = source->getSectionEntryView(sectionTable, (int)parentIterator);
+            const char* parentTitle = parent ? source->getStringView(parent->sectionTitleOffset) : nullptr;
+            if (parentTitle && strcmp(parentTitle, parentName) == 0)
+            {
+                depths[sectionIterator] = depths[parentIterator] + 1;
+                break;
+            }
+        }
+    }
+    return depths;
+}
+
+static bool titleInRange(BBFReader* source, const uint8_t* sectionTable, uint64_t first, uint64_t last, const char* title)
+{
+    uint64_t sectionIterator = first;
+    for (; sectionIterator < last; sectionIterator++)
+    {
+        const BBFSection* section = source->getSectionEntryView(sectionTable, (int)sectionIterator);
+        const char* sectionTitle = section ? source->getStringView(section->sectionTitleOffset) : nullptr;
+        if (sectionTitle && strcmp(sectionTitle, title) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// One section subtree into its own book. The section becomes top level, page numbers start at 0.
+static bool splitSection(BBFReader* source, const char* iPath, uint64_t sectionIndex, const char* oPath, BBFCopyStats* copyStats)
+{
+    BBFHeader* sourceHeader = source->getHeaderView();
+    BBFFooter* sourceFooter = sourceHeader ? source->getFooterView(sourceHeader->footerOffset) : nullptr;
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+    uint64_t subtreeEnd = 0;
+    if (!sourceFooter || !source->getSectionPageRangeAt(sectionIndex, &firstPage, &pageCount, &subtreeEnd) || pageCount == 0)
+    {
+        fprintf(stderr, "[BBFCODEC] Section %llu has no pages to split out.\n", (unsigned long long)sectionIndex);
+        return false;
+    }
+
+    char* tmpPath = nullptr;
+    FILE* tmpFile = BBFBuilder::openTempNear(oPath, &tmpPath);
+    if (!tmpFile)
+    {
+        fprintf(stderr, "[BBFCODEC] Failed to create a temporary file next to %s\n", oPath);
+        return false;
+    }
+    fclose(tmpFile);
+
+    // Same layout as the source. A builder that can't open its file fails this section, not the process.
+    BBFBuilder* builder = BBFBuilder::open(tmpPath, sourceHeader->alignment, sourceHeader->reamSize, sourceHeader->flags & ~BBF::BBF_PETRIFICATION_FLAG);
+    bool splitOk = builder != nullptr;
+    if (builder)
+    {
+        uint64_t pageIterator = 0;
+        for (; splitOk && pageIterator < pageCount; pageIterator++)
+        {
+            splitOk = builder->addPageFrom(source, firstPage + pageIterator);
+        }
+
+        const uint8_t* sectionTable = source->getSectionTableView(sourceFooter->sectionOffset);
+        uint64_t sectionIterator = sectionIndex;
+        for (; splitOk && sectionIterator < subtreeEnd; sectionIterator++)
+        {
+            const BBFSection* section = source->getSectionEntryView(sectionTable, (int)sectionIterator);
+            const char* sectionName = section ? source->getStringView(section->sectionTitleOffset) : nullptr;
+            const char* parentName = (section && sectionIterator != sectionIndex && section->sectionParentOffset != 0xFFFFFFFFFFFFFFFF) ? source->getStringView(section->sectionParentOffset) : nullptr;
+            splitOk = sectionName && section->sectionStartIndex >= firstPage && builder->addSection(sectionName, section->sectionStartIndex - firstPage, parentName);
+        }
+
+        // Book level metadata, plus whatever hangs off this subtree. The section's own entries become book level.
+        // Entries for other sections stay behind.
+        const BBFSection* rootSection = source->getSectionEntryView(sectionTable, (int)sectionIndex);
+        const char* rootName = rootSection ? source->getStringView(rootSection->sectionTitleOffset) : nullptr;
+        splitOk = splitOk && rootName != nullptr;
+        const uint8_t* metaTable = source->getMetadataView(sourceFooter->metaOffset);
+        uint64_t metaIterator = 0;
+        for (; splitOk && metaIterator < sourceFooter->metaCount; metaIterator++)
+        {
+            const BBFMeta* meta = source->getMetaEntryView(metaTable, (int)metaIterator);
+            const char* keyName = meta ? source->getStringView(meta->keyOffset) : nullptr;
+            const char* valueText = meta ? source->getStringView(meta->valueOffset) : nullptr;
+            const char* parentName = (meta && meta->parentOffset != 0xFFFFFFFFFFFFFFFF) ? source->getStringView(meta->parentOffset) : nullptr;
+            if (!keyName || !valueText)
+            {
+                splitOk = false;
+                break;
+            }
+
+            if (parentName && rootName && strcmp(parentName, rootName) == 0)
+            {
+                splitOk = builder->addMeta(keyName, valueText);
+            }
+            else if (!parentName || titleInRange(source, sectionTable, sectionIndex, subtreeEnd, parentName) ||
+                     !titleInRange(source, sectionTable, 0, sourceFooter->sectionCount, parentName))
+            {
+                splitOk = builder->addMeta(keyName, valueText, parentName);
+            }
+        }
+
+        if (splitOk)
+        {
+            *copyStats = builder->getCopyStats();
+        }
+        splitOk = splitOk && builder->finalize();
+        delete builder;
+    }
+
+    if (!splitOk)
+    {
+        remove(tmpPath);
+        free(tmpPath);
+        return false;
+    }
+
+    // Petrified books split into petrified books
+    return finishRewrite(tmpPath, oPath, iPath, (sourceHeader->flags & BBF::BBF_PETRIFICATION_FLAG) != 0, copyStats);
+}
+
+bool BBFBuilder::splitFile(const char* iPath, const char* outDir, uint32_t depth, uint32_t threadCount, BBFCopyStats* copyStats, uint64_t* bookCount)
+{
+    BBFReader source(iPath);
+    BBFHeader* sourceHeader = source.getHeaderView();
+    BBFFooter* sourceFooter = sourceHeader ? source.getFooterView(sourceHeader->footerOffset) : nullptr;
+    if (!sourceFooter || depth == 0)
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a readable book.\n", iPath);
+        return false;
+    }
+
+    uint32_t* depths = sectionDepths(&source, sourceFooter);
+    if (!depths)
+    {
+        return false;
+    }
+
+    // Sections at this depth, and a file name for each
+    uint64_t* splitSections = (uint64_t*)malloc(sizeof(uint64_t) * (size_t)(sourceFooter->sectionCount ? sourceFooter->sectionCount : 1));
+    char** outPaths = (char**)calloc((size_t)(sourceFooter->sectionCount ? sourceFooter->sectionCount : 1), sizeof(char*));
+    uint64_t splitCount = 0;
+    const uint8_t* sectionTable = source.getSectionTableView(sourceFooter->sectionOffset);
+
+    bool namesOk = splitSections && outPaths;
+    uint64_t sectionIterator = 0;
+    for (; namesOk && sectionIterator < sourceFooter->sectionCount; sectionIterator++)
+    {
+        const BBFSection* section = source.getSectionEntryView(sectionTable, (int)sectionIterator);
+        const char* sectionName = section ? source.getStringView(section->sectionTitleOffset) : nullptr;
+        if (depths[sectionIterator] != depth || !sectionName)
+        {
+            continue;
+        }
+
+        // Titles can hold anything. Keep file names portable.
+        size_t pathLength = strlen(outDir) + strlen(sectionName) + 32;
+        char* outPath = (char*)malloc(pathLength);
+        if (!outPath)
+        {
+            namesOk = false;
+            break;
+        }
+        int prefixLength = snprintf(outPath, pathLength, "%s/", outDir);
+        char* nameCursor = outPath + prefixLength;
+        const char* titleCursor = sectionName;
+        for (; *titleCursor; titleCursor++)
+        {
+            char nameChar = *titleCursor;
+            bool unsafe = nameChar == '/' || nameChar == '\\' || nameChar == ':' || nameChar == '*' || nameChar == '?' ||
+                          nameChar == '"' || nameChar == '<' || nameChar == '>' || nameChar == '|' || (uint8_t)nameChar < 0x20;
+            *nameCursor++ = unsafe ? '_' : nameChar;
+        }
+        *nameCursor = '\0';
+
+        // Repeated titles get a number
+        size_t baseLength = strlen(outPath);
+        uint64_t repeatCount = 1;
+        uint64_t earlierIterator = 0;
+        for (; earlierIterator < splitCount; earlierIterator++)
+        {
+            if (strncmp(outPaths[earlierIterator], outPath, baseLength) == 0 &&
+                (strcmp(outPaths[earlierIterator] + baseLength, ".bbf") == 0 || strncmp(outPaths[earlierIterator] + baseLength, " (", 2) == 0))
+            {
+                repeatCount++;
+            }
+        }
+        if (repeatCount > 1)
+        {
+            snprintf(outPath + baseLength, pathLength - baseLength, " (%llu).bbf", (unsigned long long)repeatCount);
+        }
+        else
+        {
+            snprintf(outPath + baseLength, pathLength - baseLength, ".bbf");
+        }
+
+        splitSections[splitCount] = sectionIterator;
+        outPaths[splitCount] = outPath;
+        splitCount++;
+    }
+    free(depths);
+
+    if (!namesOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Out of memory while naming the books split from %s.\n", iPath);
+    }
+    else if (splitCount == 0)
+    {
+        fprintf(stderr, "[BBFCODEC] %s has no sections at depth %u.\n", iPath, depth);
+    }
+
+    // One output per worker at a time. Each worker maps the book itself. Nothing is written unless every name was made.
+    std::atomic<uint64_t> nextSplit(namesOk ? 0 : splitCount);
+    std::atomic<bool> splitOk(namesOk && splitCount > 0);
+    BBFCopyStats* workerStats = (BBFCopyStats*)calloc(splitCount ? splitCount : 1, sizeof(BBFCopyStats));
+    if (!workerStats)
+    {
+        nextSplit = splitCount;
+        splitOk = false;
+    }
+
+    auto splitWorker = [&]()
+    {
+        BBFReader workerSource(iPath);
+        uint64_t splitIndex = 0;
+        while ((splitIndex = nextSplit.fetch_add(1)) < splitCount)
+        {
+            if (!splitSection(&workerSource, iPath, splitSections[splitIndex], outPaths[splitIndex], &workerStats[splitIndex]))
+            {
+                fprintf(stderr, "[BBFCODEC] Unable to write %s.\n", outPaths[splitIndex]);
+                splitOk = false;
+            }
+        }
+    };
+
+    if (threadCount == 0)
+    {
+        threadCount = 1;
+    }
+    uint32_t workerCount = (splitCount < threadCount) ? (uint32_t)splitCount : threadCount;
+    std::thread* workers = (workerCount > 1) ? new std::thread[workerCount - 1] : nullptr;
+
+    uint32_t workerIterator = 0;
+    for (; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator] = std::thread(splitWorker);
+    }
+    splitWorker();
+    for (workerIterator = 0; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator].join();
+    }
+    delete[] workers;
+
+    uint64_t splitIterator = 0;
+    for (; splitIterator < splitCount; splitIterator++)
+    {
+        if (copyStats && workerStats)
+        {
+            copyStats->reflinkBytes += workerStats[splitIterator].reflinkBytes;
+            copyStats->kernelBytes += workerStats[splitIterator].kernelBytes;
+            copyStats->bufferedBytes += workerStats[splitIterator].bufferedBytes;
+            copyStats->copyCount += workerStats[splitIterator].copyCount;
+        }
+        free(outPaths[splitIterator]);
+    }
+    free(workerStats);
+    free(outPaths);
+    free(splitSections);
+
+    if (bookCount)
+    {
+        *bookCount = namesOk ? splitCount : 0;
+    }
+    return splitOk;
+}
+
+
+// READER FUNCTIONS
+
+// Shared by every reader in the process
+std::atomic<uint64_t> BBFReader::processResidentBytes(0);
+std::atomic<uint64_t> BBFReader::processMemoryBudget(0);
+
+// Everything that isn't asset data: the tables, the string pool and the footer.
+static bool computeIndexRegion(const BBFFooter* footer, uint64_t footerOffset, uint64_t* indexStart, uint64_t* indexEnd)
+{
+    uint64_t regionStart = footerOffset;
+    uint64_t regionEnd = footerOffset + sizeof(BBFFooter);
+
+    uint64_t tableOffsets[5] = { footer->assetOffset, footer->pageOffset, footer->sectionOffset, footer->metaOffset, footer->stringPoolOffset };
+    int tableIterator = 0;
+    for (; tableIterator < 5; tableIterator++)
+    {
+        regionStart = (tableOffsets[tableIterator] < regionStart) ? tableOffsets[tableIterator] : regionStart;
+    }
+
+    uint64_t stringPoolEnd = footer->stringPoolOffset + footer->stringPoolSize;
+    if (stringPoolEnd < footer->stringPoolOffset)
+    {
+        return false;
+    }
+    regionEnd = (stringPoolEnd > regionEnd) ? stringPoolEnd : regionEnd;
+
+    if (regionStart > regionEnd)
+    {
+        return false;
+    }
+
+    *indexStart = regionStart;
+    *indexEnd = regionEnd;
+    return true;
+}
+
+BBFReader::BBFReader(const char* iFile)
+{
+    attachBackend(new BBFMmapBackend(iFile), true);
+}
+
+BBFReader::BBFReader(const uint8_t* bookData, size_t bookSize)
+{
+    attachBackend(new BBFMemoryBackend(bookData, bookSize), true);
+}
+
+#ifndef _WIN32
+BBFReader::BBFReader(int iFileDescriptor, uint64_t baseOffset, uint64_t length)
+{
+    attachBackend(new BBFMmapBackend(iFileDescriptor, baseOffset, length), true);
+}
+#endif
+
+BBFReader::BBFReader(BBFIOBackend* ioBackend, bool takeOwnership)
+{
+    attachBackend(ioBackend, takeOwnership);
+}
+
+BBFReader::~BBFReader()
+{
+    releaseBackend();
+}
+
+BBFReader::BBFReader(BBFReader&& other) noexcept
+{
+    takeFrom(other);
+}
+
+BBFReader& BBFReader::operator=(BBFReader&& other) noexcept
+{
+    if (this != &other)
+    {
+        releaseBackend();
+        takeFrom(other);
+    }
+    return *this;
+}
+
+void BBFReader::takeFrom(BBFReader& other)
+{
+    // The footer cache and index views point into buffers we take along, so they stay valid.
+    this->backend = other.backend;
+    this->ownsBackend = other.ownsBackend;
+    this->fileBuffer = other.fileBuffer;
+    this->footerCache = other.footerCache;
+    this->fileSize = other.fileSize;
+
+    this->headerBuffer = other.headerBuffer;
+    this->indexBuffer = other.indexBuffer;
+    this->indexBufferStart = other.indexBufferStart;
+    this->indexBufferEnd = other.indexBufferEnd;
+    this->assetSpans = other.assetSpans;
+    this->assetSpanCount = other.assetSpanCount;
+
+    this->memoryBudget = other.memoryBudget;
+    this->pageOutOnRelease = other.pageOutOnRelease;
+    this->residentBytes = other.residentBytes;
+    this->lruLinks = other.lruLinks;
+    this->lruHead = other.lruHead;
+    this->lruTail = other.lruTail;
+
+    // Leave the other reader empty. Every view on it fails from here on.
+    other.attachBackend(nullptr, false);
+}
+
+void BBFReader::releaseBackend()
+{
+    if (this->lruLinks)
+    {
+        free(this->lruLinks);
+        this->lruLinks = nullptr;
+    }
+
+    processResidentBytes -= this->residentBytes;
+    this->residentBytes = 0;
+
+    if (this->assetSpans)
+    {
+        free(this->assetSpans);
+        this->assetSpans = nullptr;
+    }
+
+    if (this->indexBuffer)
+    {
+        free(this->indexBuffer);
+        this->indexBuffer = nullptr;
+    }
+
+    if (this->headerBuffer)
+    {
+        free(this->headerBuffer);
+        this->headerBuffer = nullptr;
+    }
+
+    if (this->backend && this->ownsBackend)
+    {
+        delete this->backend;
+    }
+
+    this->backend = nullptr;
+    this->fileBuffer = nullptr;
+    this->footerCache = nullptr;
+    this->fileSize = 0;
+}
+
+bool BBFReader::attachBackend(BBFIOBackend* ioBackend, bool takeOwnership)
+{
+    this->backend = ioBackend;
+    this->ownsBackend = takeOwnership;
+
+    this->fileBuffer = nullptr;
+    this->fileSize = 0;
+    this->footerCache = nullptr;
+
+    this->headerBuffer = nullptr;
+    this->indexBuffer = nullptr;
+    this->indexBufferStart = 0;
+    this->indexBufferEnd = 0;
+    this->assetSpans = nullptr;
+    this->assetSpanCount = 0;
+
+    this->memoryBudget = 0;
+    this->pageOutOnRelease = false;
+    this->residentBytes = 0;
+    this->lruLinks = nullptr;
+    this->lruHead = 0xFFFFFFFFFFFFFFFF;
+    this->lruTail = 0xFFFFFFFFFFFFFFFF;
+
+    if (!this->backend || this->backend->getSize() == 0)
+    {
+        return false;
+    }
+
+    // Mapped backends are used in place, like they always were.
+    this->fileBuffer = this->backend->getMapping();
+    this->fileSize = (size_t)this->backend->getSize();
+
+    if (this->fileBuffer)
+    {
+        return true;
+    }
+
+    return loadIndexBuffer();
+}
+
+bool BBFReader::loadIndexBuffer()
+{
+    // Read the header, then the footer, then the whole index in one go.
+    // Everything the table/string views hand out comes from these two copies.
+    if (this->fileSize < sizeof(BBFHeader))
+    {
+        return false;
+    }
+
+    this->headerBuffer = (uint8_t*)malloc(sizeof(BBFHeader));
+    if (!this->headerBuffer)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate header buffer.\n");
+        return false;
+    }
+
+    if (!this->backend->read(0, this->headerBuffer, sizeof(BBFHeader)))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to read header.\n");
+        free(this->headerBuffer);
+        this->headerBuffer = nullptr;
+        return false;
+    }
+
+    // Not a BBF? Leave the header readable so checkMagic can say so.
+    BBFHeader* header = (BBFHeader*)this->headerBuffer;
+    if (!checkMagic(header) || !isSafe(header->footerOffset, (uint64_t)sizeof(BBFFooter)))
+    {
+        return true;
+    }
+
+    BBFFooter footer;
+    if (!this->backend->read(header->footerOffset, &footer, sizeof(BBFFooter)))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to read footer.\n");
+        return true;
+    }
+
+    uint64_t regionStart = 0;
+    uint64_t regionEnd = 0;
+    if (!computeIndexRegion(&footer, header->footerOffset, &regionStart, &regionEnd) || !isSafe(regionStart, regionEnd - regionStart))
+    {
+        return true;
+    }
+
+    this->indexBuffer = (uint8_t*)malloc((size_t)(regionEnd - regionStart));
+    if (!this->indexBuffer)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate %llu byte index buffer.\n", (unsigned long long)(regionEnd - regionStart));
+        return true;
+    }
+
+    if (!this->backend->read(regionStart, this->indexBuffer, regionEnd - regionStart))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to read index.\n");
+        free(this->indexBuffer);
+        this->indexBuffer = nullptr;
+        return true;
+    }
+
+    this->indexBufferStart = regionStart;
+    this->indexBufferEnd = regionEnd;
+    return true;
+}
+
+const uint8_t* BBFReader::resolve(uint64_t offset, uint64_t length)
+{
+    if (!isSafe(offset, length))
+    {
+        return nullptr;
+    }
+
+    if (this->fileBuffer)
+    {
+        return this->fileBuffer + offset;
+    }
+
+    if (this->headerBuffer && offset + length <= sizeof(BBFHeader))
+    {
+        return this->headerBuffer + offset;
+    }
+
+    if (this->indexBuffer && offset >= this->indexBufferStart && offset + length <= this->indexBufferEnd)
+    {
+        return this->indexBuffer + (offset - this->indexBufferStart);
+    }
+
+    return nullptr;
+}
+
+static int compareAssetSpans(const void* spanA, const void* spanB)
+{
+    uint64_t offsetA = ((const uint64_t*)spanA)[0];
+    uint64_t offsetB = ((const uint64_t*)spanB)[0];
+    return (offsetA > offsetB) - (offsetA < offsetB);
+}
+
+bool BBFReader::findAssetSize(uint64_t fileOffset, uint64_t* assetSize)
+{
+    // Only offsets are passed to getAssetDataView(offset), so look up how much to read.
+    if (!this->assetSpans)
+    {
+        BBFFooter* footer = loadFooter();
+        if (!footer || footer->assetCount == 0 || footer->assetCount > this->fileSize / sizeof(BBFAsset))
+        {
+            return false;
+        }
+
+        this->assetSpans = (uint64_t*)malloc(sizeof(uint64_t) * 2 * footer->assetCount);
+        if (!this->assetSpans)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to allocate asset spans.\n");
+            return false;
+        }
+
+        this->assetSpanCount = 0;
+        uint64_t assetIterator = 0;
+        for (; assetIterator < footer->assetCount; assetIterator++)
+        {
+            const BBFAsset* asset = getAssetEntry(assetIterator);
+            if (asset)
+            {
+                this->assetSpans[this->assetSpanCount * 2 + 0] = asset->fileOffset;
+                this->assetSpans[this->assetSpanCount * 2 + 1] = asset->fileSize;
+                this->assetSpanCount++;
+            }
+        }
+
+        qsort(this->assetSpans, (size_t)this->assetSpanCount, sizeof(uint64_t) * 2, compareAssetSpans);
+    }
+
+    uint64_t spanLow = 0;
+    uint64_t spanHigh = this->assetSpanCount;
+    while (spanLow < spanHigh)
+    {
+        uint64_t spanMid = spanLow + (spanHigh - spanLow) / 2;
+        if (this->assetSpans[spanMid * 2] < fileOffset)
+        {
+            spanLow = spanMid + 1;
+        }
+        else
+        {
+            spanHigh = spanMid;
+        }
+    }
+
+    if (spanLow >= this->assetSpanCount || this->assetSpans[spanLow * 2] != fileOffset)
+    {
+        return false;
+    }
+
+    *assetSize = this->assetSpans[spanLow * 2 + 1];
+    return true;
+}
+
+const uint8_t* BBFReader::getAssetDataView(uint64_t fileOffset)
+{
+    if (this->fileBuffer)
+    {
+        if (!isSafe(fileOffset))
+        {
+            return nullptr;
+        }
+        return this->fileBuffer + fileOffset;
+    }
+
+    uint64_t assetSize = 0;
+    if (!this->backend || !findAssetSize(fileOffset, &assetSize))
+    {
+        return nullptr;
+    }
+
+    return this->backend->getView(fileOffset, assetSize);
+}
+
+const uint8_t* BBFReader::getAssetDataView(const BBFAsset* assetView)
+{
+    if (!assetView || !isSafe(assetView->fileOffset, assetView->fileSize))
+    {
+        return nullptr;
+    }
+
+    if (this->fileBuffer)
+    {
+        return this->fileBuffer + assetView->fileOffset;
+    }
+
+    return this->backend->getView(assetView->fileOffset, assetView->fileSize);
+}
+
+bool BBFReader::readAssetData(const BBFAsset* assetView, void* dst, uint64_t dstSize)
+{
+    if (!assetView || !dst || dstSize < assetView->fileSize || !isSafe(assetView->fileOffset, assetView->fileSize))
+    {
+        return false;
+    }
+
+    return this->backend->read(assetView->fileOffset, dst, assetView->fileSize);
+}
+
+bool BBFReader::getAssetFileRange(uint64_t assetIndex, int* fileDescriptor, uint64_t* fileOffset, uint64_t* length)
+{
+    const BBFAsset* asset = getAssetEntry(assetIndex);
+    if (!asset || !fileDescriptor || !fileOffset || !length)
+    {
+        return false;
+    }
+
+    // Offsets in the book are relative to where it starts in the file
+    *fileDescriptor = this->backend->getFileDescriptor();
+    *fileOffset = this->backend->getBaseOffset() + asset->fileOffset;
+    *length = asset->fileSize;
+    return true;
+}
+
+uint64_t BBFReader::getAssetAlignment(uint64_t assetIndex)
+{
+    const BBFAsset* asset = getAssetEntry(assetIndex);
+    BBFHeader* header = getHeaderView();
+    if (!asset || !header || header->alignment > 63)
+    {
+        return 0;
+    }
+
+    // Same rule the builder pads by
+    bool variableAlign = header->flags & BBF::BBF_VARIABLE_REAM_SIZE_FLAG;
+    if (variableAlign && header->reamSize < 64 && asset->fileSize < (1ULL << header->reamSize))
+    {
+        return 8;
+    }
+    return 1ULL << header->alignment;
+}
+
+uint64_t BBFReader::findMisalignedAssets(uint64_t* assetIndices, uint64_t maxIndices)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer)
+    {
+        return 0;
+    }
+
+    uint64_t misalignedCount = 0;
+    uint64_t assetIterator = 0;
+    for (; assetIterator < footer->assetCount; assetIterator++)
+    {
+        const BBFAsset* asset = getAssetEntry(assetIterator);
+        uint64_t alignmentBytes = getAssetAlignment(assetIterator);
+        if (!asset || alignmentBytes == 0 || asset->fileOffset % alignmentBytes == 0)
+        {
+            continue;
+        }
+
+        if (assetIndices && misalignedCount < maxIndices)
+        {
+            assetIndices[misalignedCount] = assetIterator;
+        }
+        misalignedCount++;
+    }
+    return misalignedCount;
+}
+
+bool BBFReader::isSafe(uint64_t offset, uint64_t size) const
+{
+    if (!this->backend || this->fileSize == 0)
+    {
+        return false;
+    }
+
+    // Size should be size of the struct, or the string pool size
+
+    // check if the given offset is out of bounds
+    // return true if it's safe
+
+    // Check overflow condition
+    if (offset + size < offset)
+    {
+        return false;
+    }
+
+    // Check if pointer is outta file range
+    if (offset + size > this->fileSize)
+    {
+        return false;
+    }
+
+    // success.
+    return true;
+}
+
+bool BBFReader::isSafe(uint64_t offset) const
+{
+    if (!this->backend || this->fileSize == 0)
+    {
+        return false;
+    }
+
+    if (offset > this->fileSize)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+bool BBFReader::isSafe(uint64_t count, int index) const
+{
+    // Check if file exists
+    if (!this->backend || this->fileSize == 0)
+    {
+        return false;
+    }
+    // Size should be size of the struct.
+
+    if (index < 0)
+    {
+        return false;
+    }
+
+    if ((uint64_t)index > count)
+    {
+        return false;
+    }
+
+    return true;
+
+}
+
+BBFFooter* BBFReader::getFooterView(uint64_t fOffset)
+{
+    const uint8_t* footerView = resolve(fOffset, (uint64_t)sizeof(BBFFooter));
+    if (!footerView)
+    {
+        return nullptr;
+    }
+
+    // Set the footerCache to the footer.
+    footerCache = (BBFFooter*)footerView;
+
+    return footerCache;
+}
+
+const char* BBFReader::getStringView(uint64_t strOffset)
+{
+    if (!this->footerCache)
+    {
+        printf("[BBFCODEC] Cannot Access String Pool. Ensure File is opened.");
+        return nullptr;
+    }
+
+    // String offsets are relative to the pool. Keep the scan inside it, the pool may not be followed by anything we can read.
+    if ((this->footerCache->stringPoolOffset) + strOffset < (this->footerCache->stringPoolOffset) || strOffset >= this->footerCache->stringPoolSize)
+    {
+        return nullptr;
+    }
+
+    uint64_t bytesLeft = this->footerCache->stringPoolSize - strOffset;
+    uint64_t scanLimit = (BBF::MAX_FORME_SIZE < bytesLeft) ? BBF::MAX_FORME_SIZE : bytesLeft;
+
+    const char* pPtr = (const char*)resolve(strOffset + this->footerCache->stringPoolOffset, scanLimit);
+    if (!pPtr)
+    {
+        return nullptr;
+    }
+
+    uint64_t iterator = 0;
+    for(; iterator < scanLimit; iterator++)
+    {
+        if (pPtr[iterator] == '\0')
+        {
+            return pPtr;
+        }
+    }
+
+    return nullptr;
+
+}
+
+bool BBFReader::checkMagic(BBFHeader* pHeader)
+{
+    // Check the magic number of the file
+    uint32_t fileMagic = (pHeader->magic[0] << 24) | (pHeader->magic[1] << 16) | (pHeader->magic[2] << 8)  | (pHeader->magic[3]);
+    if (!(fileMagic == 0x42424633))
+    {
+        return false;
+    }
+    return true;
+}
+
+XXH128_hash_t BBFReader::computeAssetHash(const BBFAsset* assetView)
+{
+    const uint8_t* dataView = this->getAssetDataView(assetView);
+
+    if (!dataView)
+    {
+        printf("[BBFCODEC] ERROR: Asset data out of bounds");
+        return {0,0};
+    }
+
+    return XXH3_128bits(dataView, assetView->fileSize);
+}
+
+XXH128_hash_t BBFReader::computeAssetHash(uint8_t* assetTableView, int assetIndex)
+{
+    const BBFAsset* assetView = getAssetEntryView(assetTableView, assetIndex);
+    if (!assetView)
+    {
+        printf("[BBFCODEC] ERROR: Unable to get pointer for asset %i", assetIndex);
+        return {0,0};
+    }
+
+    const uint8_t* dataView = this->getAssetDataView(assetView);
+
+    if (!dataView)
+    {
+        printf("[BBFCODEC] ERROR: Unable to calculate hash for asset %i", assetIndex);
+        return {0,0};
+    }
+
+    return XXH3_128bits(dataView, assetView->fileSize);
+}
+BBFFooter* BBFReader::loadFooter()
+{
+    // Most callers fetch the footer themselves. Internal helpers shouldn't depend on that.
+    if (this->footerCache)
+    {
+        return this->footerCache;
+    }
+
+    if (!isSafe(0, (uint64_t)sizeof(BBFHeader)))
+    {
+        return nullptr;
+    }
+
+    BBFHeader* header = getHeaderView();
+    if (!header || !checkMagic(header))
+    {
+        return nullptr;
+    }
+
+    return getFooterView(header->footerOffset);
+}
+
+const BBFAsset* BBFReader::getAssetEntry(uint64_t assetIndex)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || assetIndex >= footer->assetCount)
+    {
+        return nullptr;
+    }
+
+    uint64_t assetEntryOffset = footer->assetOffset + assetIndex * sizeof(BBFAsset);
+    if (assetEntryOffset < footer->assetOffset || !isSafe(assetEntryOffset, (uint64_t)sizeof(BBFAsset)))
+    {
+        return nullptr;
+    }
+
+    const BBFAsset* asset = (const BBFAsset*)resolve(assetEntryOffset, (uint64_t)sizeof(BBFAsset));
+    if (!asset || !isSafe(asset->fileOffset, asset->fileSize))
+    {
+        return nullptr;
+    }
+
+    return asset;
+}
+
+const BBFAsset* BBFReader::getPageAsset(uint64_t pageIndex)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || pageIndex >= footer->pageCount)
+    {
+        return nullptr;
+    }
+
+    uint64_t pageEntryOffset = footer->pageOffset + pageIndex * sizeof(BBFPage);
+    if (pageEntryOffset < footer->pageOffset || !isSafe(pageEntryOffset, (uint64_t)sizeof(BBFPage)))
+    {
+        return nullptr;
+    }
+
+    const BBFPage* page = (const BBFPage*)resolve(pageEntryOffset, (uint64_t)sizeof(BBFPage));
+    if (!page)
+    {
+        return nullptr;
+    }
+
+    return getAssetEntry(page->assetIndex);
+}
+
+bool BBFReader::getIndexRegion(uint64_t* indexStart, uint64_t* indexEnd)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || !indexStart || !indexEnd)
+    {
+        return false;
+    }
+
+    uint64_t regionStart = 0;
+    uint64_t regionEnd = 0;
+
+    if (!computeIndexRegion(footer, getHeaderView()->footerOffset, &regionStart, &regionEnd) || !isSafe(regionStart, regionEnd - regionStart))
+    {
+        return false;
+    }
+
+    *indexStart = regionStart;
+    *indexEnd = regionEnd;
+    return true;
+}
+
+bool BBFReader::getSectionPageRange(const char* sectionName, uint64_t* firstPage, uint64_t* pageCount)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || !sectionName || !firstPage || !pageCount)
+    {
+        return false;
+    }
+
+    if (footer->sectionCount > this->fileSize / sizeof(BBFSection) || !isSafe(footer->sectionOffset, footer->sectionCount * sizeof(BBFSection)))
+    {
+        return false;
+    }
+
+    const BBFSection* sectionTable = (const BBFSection*)resolve(footer->sectionOffset, footer->sectionCount * sizeof(BBFSection));
+    if (!sectionTable)
+    {
+        return false;
+    }
+
+    uint64_t sectionIterator = 0;
+    for (; sectionIterator < footer->sectionCount; sectionIterator++)
+    {
+        const char* title = getStringView(sectionTable[sectionIterator].sectionTitleOffset);
+        if (title && strcmp(title, sectionName) == 0)
+        {
+            return getSectionPageRangeAt(sectionIterator, firstPage, pageCount);
+        }
+    }
+
+    return false;
+}
+
+bool BBFReader::getSectionPageRangeAt(uint64_t sectionIndex, uint64_t* firstPage, uint64_t* pageCount, uint64_t* subtreeEnd)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || sectionIndex >= footer->sectionCount)
+    {
+        return false;
+    }
+
+    if (footer->sectionCount > this->fileSize / sizeof(BBFSection) || !isSafe(footer->sectionOffset, footer->sectionCount * sizeof(BBFSection)))
+    {
+        return false;
+    }
+
+    const BBFSection* sectionTable = (const BBFSection*)resolve(footer->sectionOffset, footer->sectionCount * sizeof(BBFSection));
+    const char* title = sectionTable ? getStringView(sectionTable[sectionIndex].sectionTitleOffset) : nullptr;
+    if (!title)
+    {
+        return false;
+    }
+
+    // The section runs until the next section outside of its subtree.
+    // Children reference their parent by title, so keep the titles of the subtree around.
+    uint64_t endPage = footer->pageCount;
+    const char** subtree = (const char**)malloc(sizeof(const char*) * (size_t)(footer->sectionCount - sectionIndex));
+    if (!subtree)
+    {
+        return false;
+    }
+
+    size_t subtreeCount = 0;
+    subtree[subtreeCount++] = title;
+
+    uint64_t lookAheadIterator = sectionIndex + 1;
+    for (; lookAheadIterator < footer->sectionCount; lookAheadIterator++)
+    {
+        const BBFSection* checkSection = &sectionTable[lookAheadIterator];
+        bool isChild = false;
+
+        if (checkSection->sectionParentOffset != 0xFFFFFFFFFFFFFFFF)
+        {
+            const char* parentName = getStringView(checkSection->sectionParentOffset);
+            size_t subtreeIterator = 0;
+            for (; parentName && subtreeIterator < subtreeCount; subtreeIterator++)
+            {
+                if (strcmp(parentName, subtree[subtreeIterator]) == 0)
+                {
+                    isChild = true;
+                    break;
+                }
+            }
+        }
+
+        if (!isChild)
+        {
+            endPage = checkSection->sectionStartIndex;
+            break;
+        }
+
+        const char* childTitle = getStringView(checkSection->sectionTitleOffset);
+        if (childTitle)
+        {
+            subtree[subtreeCount++] = childTitle;
+        }
+    }
+
+    free(subtree);
+
+    uint64_t startPage = sectionTable[sectionIndex].sectionStartIndex;
+    if (startPage > endPage || endPage > footer->pageCount)
+    {
+        return false;
+    }
+
+    *firstPage = startPage;
+    *pageCount = endPage - startPage;
+    if (subtreeEnd)
+    {
+        *subtreeEnd = lookAheadIterator;
+    }
+    return true;
+}
+
+bool BBFReader::getDataRegion(uint64_t* dataStart, uint64_t* dataEnd)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || !dataStart || !dataEnd)
+    {
+        return false;
+    }
+
+    BBFHeader* header = getHeaderView();
+    uint64_t regionStart = header->headerLen;
+    uint64_t regionEnd = footer->assetOffset;
+
+    // Petrified files keep their data after the string pool (SPECNOTE 3.4)
+    if (header->flags & BBF::BBF_PETRIFICATION_FLAG)
+    {
+        regionStart = footer->stringPoolOffset + footer->stringPoolSize;
+        regionEnd = this->fileSize;
+    }
+
+    if (regionStart > regionEnd || !isSafe(regionStart, regionEnd - regionStart))
+    {
+        return false;
+    }
+
+    *dataStart = regionStart;
+    *dataEnd = regionEnd;
+    return true;
+}
+
+bool BBFReader::adviseRange(uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    if (!isSafe(offset, length))
+    {
+        return false;
+    }
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    // madvise for mapped backends, the page cache for file backends, nothing for the rest.
+    return this->backend->advise(offset, length, advice);
+}
+
+bool BBFReader::advisePages(uint64_t firstPage, uint64_t pageCount, uint64_t maxGap, BBFAdvice advice)
+{
+    BBFRangePlan plan;
+    if (!planRanges(firstPage, pageCount, maxGap, &plan))
+    {
+        return false;
+    }
+
+    bool adviseSuccess = true;
+    uint64_t extentIterator = 0;
+    for (; extentIterator < plan.extentCount; extentIterator++)
+    {
+        adviseSuccess &= adviseRange(plan.extents[extentIterator].fileOffset, plan.extents[extentIterator].length, advice);
+    }
+
+    freeRangePlan(&plan);
+    return adviseSuccess;
+}
+
+static int compareRangeEntries(const void* entryA, const void* entryB)
+{
+    // [fileOffset, end, page slot]
+    const uint64_t* rangeA = (const uint64_t*)entryA;
+    const uint64_t* rangeB = (const uint64_t*)entryB;
+
+    if (rangeA[0] != rangeB[0])
+    {
+        return (rangeA[0] > rangeB[0]) ? 1 : -1;
+    }
+    return (rangeA[1] > rangeB[1]) - (rangeA[1] < rangeB[1]);
+}
+
+bool BBFReader::planRanges(uint64_t firstPage, uint64_t pageCount, uint64_t maxGap, BBFRangePlan* plan)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || !plan)
+    {
+        return false;
+    }
+
+    *plan = BBFRangePlan();
+
+    if (firstPage + pageCount < firstPage || firstPage + pageCount > footer->pageCount)
+    {
+        return false;
+    }
+
+    plan->firstPage = firstPage;
+    if (pageCount == 0)
+    {
+        return true;
+    }
+
+    // Sort the page ranges by offset. Deduped assets and shared reams just overlap, and merge below.
+    uint64_t* rangeEntries = (uint64_t*)malloc(sizeof(uint64_t) * 3 * pageCount);
+    plan->pages = (BBFPageExtent*)malloc(sizeof(BBFPageExtent) * pageCount);
+    plan->extents = (BBFRangeExtent*)malloc(sizeof(BBFRangeExtent) * pageCount);
+    if (!rangeEntries || !plan->pages || !plan->extents)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate range plan for %llu pages.\n", (unsigned long long)pageCount);
+        free(rangeEntries);
+        freeRangePlan(plan);
+        return false;
+    }
+    plan->pageCount = pageCount;
+
+    uint64_t pageIterator = 0;
+    for (; pageIterator < pageCount; pageIterator++)
+    {
+        const BBFAsset* asset = getPageAsset(firstPage + pageIterator);
+        if (!asset)
+        {
+            free(rangeEntries);
+            freeRangePlan(plan);
+            return false;
+        }
+
+        rangeEntries[pageIterator * 3 + 0] = asset->fileOffset;
+        rangeEntries[pageIterator * 3 + 1] = asset->fileOffset + asset->fileSize;
+        rangeEntries[pageIterator * 3 + 2] = pageIterator;
+    }
+
+    qsort(rangeEntries, (size_t)pageCount, sizeof(uint64_t) * 3, compareRangeEntries);
+
+    uint64_t entryIterator = 0;
+    for (; entryIterator < pageCount; entryIterator++)
+    {
+        uint64_t rangeStart = rangeEntries[entryIterator * 3 + 0];
+        uint64_t rangeEnd = rangeEntries[entryIterator * 3 + 1];
+        BBFRangeExtent* extent = (plan->extentCount > 0) ? &plan->extents[plan->extentCount - 1] : nullptr;
+
+        if (!extent || rangeStart > extent->fileOffset + extent->length + maxGap)
+        {
+            extent = &plan->extents[plan->extentCount++];
+            extent->fileOffset = rangeStart;
+            extent->length = 0;
+        }
+
+        uint64_t extentEnd = extent->fileOffset + extent->length;
+        extent->length = (rangeEnd > extentEnd) ? rangeEnd - extent->fileOffset : extent->length;
+
+        BBFPageExtent* pageExtent = &plan->pages[rangeEntries[entryIterator * 3 + 2]];
+        pageExtent->extentIndex = plan->extentCount - 1;
+        pageExtent->extentOffset = rangeStart - extent->fileOffset;
+        pageExtent->length = rangeEnd - rangeStart;
+    }
+
+    uint64_t extentIterator = 0;
+    for (; extentIterator < plan->extentCount; extentIterator++)
+    {
+        plan->totalBytes += plan->extents[extentIterator].length;
+    }
+
+    free(rangeEntries);
+    return true;
+}
+
+bool BBFReader::planSectionRanges(const char* sectionName, uint64_t maxGap, BBFRangePlan* plan)
+{
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+
+    if (!getSectionPageRange(sectionName, &firstPage, &pageCount))
+    {
+        return false;
+    }
+
+    return planRanges(firstPage, pageCount, maxGap, plan);
+}
+
+void BBFReader::freeRangePlan(BBFRangePlan* plan)
+{
+    if (!plan)
+    {
+        return;
+    }
+
+    free(plan->extents);
+    free(plan->pages);
+    *plan = BBFRangePlan();
+}
+
+bool BBFReader::exportPages(uint64_t firstPage, uint64_t pageCount, BBFExportList* list)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || !list)
+    {
+        return false;
+    }
+
+    *list = BBFExportList();
+
+    if (firstPage + pageCount < firstPage || firstPage + pageCount > footer->pageCount)
+    {
+        return false;
+    }
+
+    if (pageCount == 0)
+    {
+        return true;
+    }
+
+    list->spans = (BBFFileSpan*)malloc(sizeof(BBFFileSpan) * pageCount);
+    if (!list->spans)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate export list for %llu pages.\n", (unsigned long long)pageCount);
+        return false;
+    }
+
+    int fileDescriptor = this->backend->getFileDescriptor();
+    uint64_t baseOffset = this->backend->getBaseOffset();
+
+    // Unlike planRanges, keep page order. Only merge a page into the span before it when its bytes follow on exactly.
+    uint64_t pageIterator = 0;
+    for (; pageIterator < pageCount; pageIterator++)
+    {
+        const BBFAsset* asset = getPageAsset(firstPage + pageIterator);
+        if (!asset)
+        {
+            freeExportList(list);
+            return false;
+        }
+
+        BBFFileSpan* span = (list->spanCount > 0) ? &list->spans[list->spanCount - 1] : nullptr;
+        if (span && span->bookOffset + span->length == asset->fileOffset)
+        {
+            span->length += asset->fileSize;
+        }
+        else
+        {
+            span = &list->spans[list->spanCount++];
+            span->fileDescriptor = fileDescriptor;
+            span->fileOffset = baseOffset + asset->fileOffset;
+            span->bookOffset = asset->fileOffset;
+            span->length = asset->fileSize;
+        }
+
+        list->totalBytes += asset->fileSize;
+    }
+
+    return true;
+}
+
+bool BBFReader::exportSection(const char* sectionName, BBFExportList* list)
+{
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+
+    if (!getSectionPageRange(sectionName, &firstPage, &pageCount))
+    {
+        return false;
+    }
+
+    return exportPages(firstPage, pageCount, list);
+}
+
+bool BBFReader::exportBook(BBFExportList* list)
+{
+    if (!list || !this->backend || this->fileSize == 0)
+    {
+        return false;
+    }
+
+    *list = BBFExportList();
+
+    list->spans = (BBFFileSpan*)malloc(sizeof(BBFFileSpan));
+    if (!list->spans)
+    {
+        return false;
+    }
+
+    list->spans[0].fileDescriptor = this->backend->getFileDescriptor();
+    list->spans[0].fileOffset = this->backend->getBaseOffset();
+    list->spans[0].bookOffset = 0;
+    list->spans[0].length = this->fileSize;
+    list->spanCount = 1;
+    list->totalBytes = this->fileSize;
+    return true;
+}
+
+void BBFReader::freeExportList(BBFExportList* list)
+{
+    if (!list)
+    {
+        return;
+    }
+
+    free(list->spans);
+    *list = BBFExportList();
+}
+
+#ifndef _WIN32
+// Non-blocking sockets run out of room. Wait for it instead of failing the send.
+static bool waitWritable(int outFd)
+{
+    struct pollfd writeWait;
+    writeWait.fd = outFd;
+    writeWait.events = POLLOUT;
+    writeWait.revents = 0;
+
+    int pollResult = 0;
+    do
+    {
+        pollResult = poll(&writeWait, 1, 30000);
+    } while (pollResult < 0 && errno == EINTR);
+
+    return pollResult > 0 && !(writeWait.revents & (POLLERR | POLLHUP | POLLNVAL));
+}
+
+bool BBFReader::exportIovecs(const BBFExportList* list, struct iovec** iovecList, uint64_t* iovecCount)
+{
+    if (!list || !iovecList || !iovecCount || !this->fileBuffer)
+    {
+        return false;
+    }
+
+    *iovecList = nullptr;
+    *iovecCount = 0;
+
+    if (list->spanCount == 0)
+    {
+        return true;
+    }
+
+    struct iovec* iovecs = (struct iovec*)malloc(sizeof(struct iovec) * list->spanCount);
+    if (!iovecs)
+    {
+        return false;
+    }
+
+    uint64_t spanIterator = 0;
+    for (; spanIterator < list->spanCount; spanIterator++)
+    {
+        const BBFFileSpan* span = &list->spans[spanIterator];
+        if (!isSafe(span->bookOffset, span->length))
+        {
+            free(iovecs);
+            return false;
+        }
+
+        iovecs[spanIterator].iov_base = (void*)(this->fileBuffer + span->bookOffset);
+        iovecs[spanIterator].iov_len = (size_t)span->length;
+    }
+
+    *iovecList = iovecs;
+    *iovecCount = list->spanCount;
+    return true;
+}
+
+bool BBFReader::sendExport(const BBFExportList* list, int outFd, uint64_t* bytesSent)
+{
+    if (!list || outFd < 0)
+    {
+        return false;
+    }
+
+    uint64_t sentTotal = 0;
+    bool sendSuccess = true;
+
+    uint64_t spanIterator = 0;
+    for (; spanIterator < list->spanCount && sendSuccess; spanIterator++)
+    {
+        const BBFFileSpan* span = &list->spans[spanIterator];
+        uint64_t spanDone = 0;
+
+        #ifdef __linux__
+            while (span->fileDescriptor != -1 && spanDone < span->length)
+            {
+                off_t sendOffset = (off_t)(span->fileOffset + spanDone);
+                uint64_t chunkSize = span->length - spanDone;
+                chunkSize = (chunkSize > 0x40000000) ? 0x40000000 : chunkSize;
+
+                ssize_t sentBytes = sendfile(outFd, span->fileDescriptor, &sendOffset, (size_t)chunkSize);
+                if (sentBytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (sentBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                {
+                    if (!waitWritable(outFd))
+                    {
+                        sendSuccess = false;
+                        break;
+                    }
+                    continue;
+                }
+
+                // EINVAL/ENOSYS: this pair of fds can't sendfile. Write the rest of the span below.
+                if (sentBytes < 0 && (errno == EINVAL || errno == ENOSYS) && spanDone == 0)
+                {
+                    break;
+                }
+
+                if (sentBytes <= 0)
+                {
+                    sendSuccess = false;
+                    break;
+                }
+                spanDone += (uint64_t)sentBytes;
+            }
+        #endif
+
+        // No file, or no sendfile. Copy out through the backend in blocks.
+        uint8_t copyBuffer[65536];
+        while (sendSuccess && spanDone < span->length)
+        {
+            uint64_t chunkSize = span->length - spanDone;
+            chunkSize = (chunkSize > sizeof(copyBuffer)) ? sizeof(copyBuffer) : chunkSize;
+
+            if (!this->backend->read(span->bookOffset + spanDone, copyBuffer, chunkSize))
+            {
+                sendSuccess = false;
+                break;
+            }
+
+            uint64_t writeDone = 0;
+            while (writeDone < chunkSize)
+            {
+                ssize_t writtenBytes = write(outFd, copyBuffer + writeDone, (size_t)(chunkSize - writeDone));
+                if (writtenBytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (writtenBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) && waitWritable(outFd))
+                {
+                    continue;
+                }
+                if (writtenBytes <= 0)
+                {
+                    sendSuccess = false;
+                    break;
+                }
+                writeDone += (uint64_t)writtenBytes;
+            }
+
+            spanDone += writeDone;
+        }
+
+        sentTotal += spanDone;
+    }
+
+    if (bytesSent)
+    {
+        *bytesSent = sentTotal;
+    }
+
+    return sendSuccess;
+}
+#endif
+
+bool BBFReader::prefetchPages(uint64_t firstPage, uint64_t pageCount)
+{
+    return advisePages(firstPage, pageCount, BBF::MAX_PREFETCH_GAP, BBFAdvice::WILLNEED);
+}
+
+bool BBFReader::releasePages(uint64_t firstPage, uint64_t pageCount, bool deactivateOnly)
+{
+    // Only merge touching assets. Anything in a gap may belong to a page we weren't asked to drop.
+    return advisePages(firstPage, pageCount, 0, deactivateOnly ? BBFAdvice::COLD : BBFAdvice::DONTNEED);
+}
+
+bool BBFReader::prefetchSection(const char* sectionName)
+{
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+
+    if (!getSectionPageRange(sectionName, &firstPage, &pageCount))
+    {
+        return false;
+    }
+
+    return prefetchPages(firstPage, pageCount);
+}
+
+bool BBFReader::setAccessPattern(BBF::BBFAccessPattern pattern)
+{
+    uint64_t dataStart = 0;
+    uint64_t dataEnd = 0;
+
+    if (!getDataRegion(&dataStart, &dataEnd))
+    {
+        return false;
+    }
+
+    BBFAdvice advice = BBFAdvice::NORMAL;
+    switch (pattern)
+    {
+        case BBF::BBFAccessPattern::NORMAL: advice = BBFAdvice::NORMAL; break;
+        case BBF::BBFAccessPattern::SEQUENTIAL: advice = BBFAdvice::SEQUENTIAL; break;
+        case BBF::BBFAccessPattern::RANDOM: advice = BBFAdvice::RANDOM; break;
+    }
+
+    return adviseRange(dataStart, dataEnd - dataStart, advice);
+}
+
+// RESIDENCY
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__)
+// Resident bytes of book range [offset, offset + length). Book offset 0 is headSkew bytes into the first system page.
+static uint64_t countResident(const unsigned char* residentPages, uint64_t headSkew, uint64_t systemPage, uint64_t offset, uint64_t length)
+{
+    uint64_t residentTotal = 0;
+    uint64_t rangeEnd = offset + length;
+    uint64_t rangeCursor = offset;
+
+    while (rangeCursor < rangeEnd)
+    {
+        uint64_t pageIndex = (rangeCursor + headSkew) / systemPage;
+        uint64_t pageEnd = (pageIndex + 1) * systemPage - headSkew;
+        uint64_t chunkEnd = (pageEnd < rangeEnd) ? pageEnd : rangeEnd;
+
+        if (residentPages[pageIndex] & 1)
+        {
+            residentTotal += chunkEnd - rangeCursor;
+        }
+        rangeCursor = chunkEnd;
+    }
+
+    return residentTotal;
+}
+#endif
+
+bool BBFReader::residency(BBFResidencyReport* report)
+{
+    if (!report)
+    {
+        return false;
+    }
+    *report = BBFResidencyReport();
+
+#if defined(_WIN32) || defined(__EMSCRIPTEN__)
+    fprintf(stderr, "[BBFCODEC] Page cache residency isn't available on this platform.\n");
+    return false;
+#else
+    BBFFooter* footer = loadFooter();
+    if (!footer || this->fileSize == 0)
+    {
+        return false;
+    }
+
+    // mincore wants a page aligned mapping. Use ours if there is one, otherwise map the file just for this.
+    uint64_t systemPage = (uint64_t)sysconf(_SC_PAGESIZE);
+    const uint8_t* bookStart = this->backend->getMapping();
+    uint8_t* alignedStart = nullptr;
+    uint64_t headSkew = 0;
+    void* tempMapping = nullptr;
+    uint64_t tempLength = 0;
+
+    if (bookStart)
+    {
+        headSkew = (uint64_t)((uintptr_t)bookStart % systemPage);
+        alignedStart = (uint8_t*)bookStart - headSkew;
+    }
+    else
+    {
+        int fileDescriptor = this->backend->getFileDescriptor();
+        if (fileDescriptor < 0)
+        {
+            fprintf(stderr, "[BBFCODEC] No mapping or file to check residency against.\n");
+            return false;
+        }
+
+        uint64_t baseOffset = this->backend->getBaseOffset();
+        headSkew = baseOffset % systemPage;
+        tempLength = headSkew + this->fileSize;
+        tempMapping = mmap(nullptr, (size_t)tempLength, PROT_READ, MAP_SHARED, fileDescriptor, (off_t)(baseOffset - headSkew));
+        if (tempMapping == MAP_FAILED)
+        {
+            return false;
+        }
+        alignedStart = (uint8_t*)tempMapping;
+    }
+
+    uint64_t vectorLength = (headSkew + this->fileSize + systemPage - 1) / systemPage;
+    unsigned char* residentPages = (unsigned char*)malloc((size_t)vectorLength);
+
+    #ifdef __APPLE__
+        bool residentOk = residentPages && mincore(alignedStart, (size_t)(headSkew + this->fileSize), (char*)residentPages) == 0;
+    #else
+        bool residentOk = residentPages && mincore(alignedStart, (size_t)(headSkew + this->fileSize), residentPages) == 0;
+    #endif
+
+    if (residentOk)
+    {
+        report->pageCount = footer->pageCount;
+        report->pageResident = (uint64_t*)calloc((size_t)(footer->pageCount ? footer->pageCount : 1), sizeof(uint64_t));
+        report->pageBytes = (uint64_t*)calloc((size_t)(footer->pageCount ? footer->pageCount : 1), sizeof(uint64_t));
+        report->sectionCount = footer->sectionCount;
+        report->sectionResident = (uint64_t*)calloc((size_t)(footer->sectionCount ? footer->sectionCount : 1), sizeof(uint64_t));
+        report->sectionBytes = (uint64_t*)calloc((size_t)(footer->sectionCount ? footer->sectionCount : 1), sizeof(uint64_t));
+        residentOk = report->pageResident && report->pageBytes && report->sectionResident && report->sectionBytes;
+    }
+
+    if (residentOk)
+    {
+        report->totalBytes = this->fileSize;
+        report->residentBytes = countResident(residentPages, headSkew, systemPage, 0, this->fileSize);
+
+        uint64_t pageIterator = 0;
+        for (; pageIterator < footer->pageCount; pageIterator++)
+        {
+            const BBFAsset* asset = getPageAsset(pageIterator);
+            if (asset && isSafe(asset->fileOffset, asset->fileSize))
+            {
+                report->pageBytes[pageIterator] = asset->fileSize;
+                report->pageResident[pageIterator] = countResident(residentPages, headSkew, systemPage, asset->fileOffset, asset->fileSize);
+            }
+        }
+
+        uint64_t sectionIterator = 0;
+        for (; sectionIterator < footer->sectionCount; sectionIterator++)
+        {
+            uint64_t sectionFirst = 0;
+            uint64_t sectionPages = 0;
+            if (!getSectionPageRangeAt(sectionIterator, &sectionFirst, &sectionPages))
+            {
+                continue;
+            }
+
+            for (pageIterator = sectionFirst; pageIterator < sectionFirst + sectionPages; pageIterator++)
+            {
+                report->sectionResident[sectionIterator] += report->pageResident[pageIterator];
+                report->sectionBytes[sectionIterator] += report->pageBytes[pageIterator];
+            }
+        }
+    }
+
+    free(residentPages);
+    if (tempMapping)
+    {
+        munmap(tempMapping, (size_t)tempLength);
+    }
+
+    if (!residentOk)
+    {
+        freeResidencyReport(report);
+    }
+    return residentOk;
+#endif
+}
+
+void BBFReader::freeResidencyReport(BBFResidencyReport* report)
+{
+    free(report->pageResident);
+    free(report->pageBytes);
+    free(report->sectionResident);
+    free(report->sectionBytes);
+    *report = BBFResidencyReport();
+}
+
+bool BBFReader::warm(uint64_t firstPage, uint64_t pageCount, uint32_t maxParallel)
+{
+    BBFRangePlan plan;
+    if (!planRanges(firstPage, pageCount, BBF::MAX_PREFETCH_GAP, &plan))
+    {
+        return false;
+    }
+
+    // Cut the extents into chunks, so one big extent still gets parallel reads. [offset, length] each.
+    uint64_t chunkCount = 0;
+    uint64_t extentIterator = 0;
+    for (; extentIterator < plan.extentCount; extentIterator++)
+    {
+        chunkCount += (plan.extents[extentIterator].length + BBF::WARM_CHUNK_SIZE - 1) / BBF::WARM_CHUNK_SIZE;
+    }
+
+    uint64_t* chunks = (uint64_t*)malloc(sizeof(uint64_t) * 2 * (chunkCount ? chunkCount : 1));
+    if (!chunks)
+    {
+        freeRangePlan(&plan);
+        return false;
+    }
+
+    uint64_t chunkIterator = 0;
+    for (extentIterator = 0; extentIterator < plan.extentCount; extentIterator++)
+    {
+        const BBFRangeExtent* extent = &plan.extents[extentIterator];
+        uint64_t extentDone = 0;
+        while (extentDone < extent->length)
+        {
+            uint64_t chunkLength = extent->length - extentDone;
+            chunkLength = (chunkLength > BBF::WARM_CHUNK_SIZE) ? BBF::WARM_CHUNK_SIZE : chunkLength;
+            chunks[chunkIterator * 2] = extent->fileOffset + extentDone;
+            chunks[chunkIterator * 2 + 1] = chunkLength;
+            chunkIterator++;
+            extentDone += chunkLength;
+        }
+    }
+    freeRangePlan(&plan);
+
+    // Workers share the fd (positioned reads) or the mapping (touch a byte per page).
+    // Anything else goes through the backend, which isn't thread safe, so one read at a time.
+    int fileDescriptor = this->backend->getFileDescriptor();
+    uint64_t baseOffset = this->backend->getBaseOffset();
+    const uint8_t* mapping = this->backend->getMapping();
+    (void)baseOffset; // fd reads only
+
+    // Mapping touches step one system page at a time, so every page faults in.
+    #ifdef _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        uint64_t systemPage = (uint64_t)systemInfo.dwPageSize;
+    #else
+        uint64_t systemPage = (uint64_t)sysconf(_SC_PAGESIZE);
+    #endif
 
-    const uint8_t* dataView = this->getAssetDataView(assetView->fileOffset);
+    uint64_t workerCount = (maxParallel == 0) ? 1 : maxParallel;
+    workerCount = (workerCount > chunkCount) ? chunkCount : workerCount;
+    #ifdef __EMSCRIPTEN__
+        workerCount = (workerCount > 1) ? 1 : workerCount;
+    #endif
+    if (fileDescriptor < 0 && !mapping && workerCount > 1)
+    {
+        workerCount = 1;
+    }
 
-    if (!dataView)
+    std::atomic<uint64_t> nextChunk(0);
+    std::atomic<bool> warmSuccess(true);
+    auto warmWorker = [&]()
     {
-        printf("[BBFCODEC] ERROR: Unable to calculate hash for asset %i", assetIndex);
-        return {0,0};
+        uint8_t* readBuffer = nullptr;
+        if (fileDescriptor >= 0 || !mapping)
+        {
+            readBuffer = (uint8_t*)malloc((size_t)BBF::WARM_CHUNK_SIZE);
+            if (!readBuffer)
+            {
+                warmSuccess = false;
+                return;
+            }
+        }
+
+        volatile uint8_t touchSink = 0;
+        uint64_t chunkIndex = nextChunk.fetch_add(1);
+        while (chunkIndex < chunkCount)
+        {
+            uint64_t chunkOffset = chunks[chunkIndex * 2];
+            uint64_t chunkLength = chunks[chunkIndex * 2 + 1];
+
+            if (fileDescriptor >= 0)
+            {
+            #ifdef _WIN32
+                // ReadFile at an offset, like pread. Chunks are WARM_CHUNK_SIZE, well under a DWORD.
+                HANDLE fileHandle = (HANDLE)_get_osfhandle(fileDescriptor);
+                uint64_t chunkDone = 0;
+                while (chunkDone < chunkLength)
+                {
+                    uint64_t readOffset = baseOffset + chunkOffset + chunkDone;
+                    OVERLAPPED overlapped = {};
+                    overlapped.Offset = (DWORD)(readOffset & 0xFFFFFFFF);
+                    overlapped.OffsetHigh = (DWORD)(readOffset >> 32);
+
+                    DWORD bytesRead = 0;
+                    if (fileHandle == INVALID_HANDLE_VALUE ||
+                        !ReadFile(fileHandle, readBuffer, (DWORD)(chunkLength - chunkDone), &bytesRead, &overlapped) || bytesRead == 0)
+                    {
+                        warmSuccess = false;
+                        break;
+                    }
+                    chunkDone += bytesRead;
+                }
+            #else
+                uint64_t chunkDone = 0;
+                while (chunkDone < chunkLength)
+                {
+                    ssize_t bytesRead = pread(fileDescriptor, readBuffer, (size_t)(chunkLength - chunkDone), (off_t)(baseOffset + chunkOffset + chunkDone));
+                    if (bytesRead < 0 && errno == EINTR)
+                    {
+                        continue;
+                    }
+                    if (bytesRead <= 0)
+                    {
+                        warmSuccess = false;
+                        break;
+                    }
+                    chunkDone += (uint64_t)bytesRead;
+                }
+            #endif
+            }
+            else if (mapping)
+            {
+                uint64_t touchOffset = 0;
+                for (; touchOffset < chunkLength; touchOffset += systemPage)
+                {
+                    touchSink = touchSink + mapping[chunkOffset + touchOffset];
+                }
+            }
+            else if (!this->backend->read(chunkOffset, readBuffer, chunkLength))
+            {
+                warmSuccess = false;
+            }
+
+            chunkIndex = nextChunk.fetch_add(1);
+        }
+
+        free(readBuffer);
+    };
+
+    std::thread* workers = new std::thread[workerCount > 1 ? workerCount - 1 : 0];
+    uint64_t workerIterator = 0;
+    for (; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator] = std::thread(warmWorker);
     }
 
-    return XXH3_128bits(dataView, assetView->fileSize);
-}
\ No newline at end of file
+    warmWorker(); // This thread reads too
+
+    for (workerIterator = 0; workerIterator + 1 < workerCount; workerIterator++)
+    {
+        workers[workerIterator].join();
+    }
+    delete[] workers;
+
+    free(chunks);
+    return warmSuccess.load();
+}
+
+bool BBFReader::warmSection(const char* sectionName, uint32_t maxParallel)
+{
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+
+    if (!getSectionPageRange(sectionName, &firstPage, &pageCount))
+    {
+        return false;
+    }
+
+    return warm(firstPage, pageCount, maxParallel);
+}
+
+// READ SESSION
+
+BBFReadSession::BBFReadSession(BBFReader* sReader, BBFSessionConfig sConfig)
+{
+    this->reader = sReader;
+    this->config = sConfig;
+    this->pageCount = 0;
+
+    if (this->config.minWindow == 0)
+    {
+        this->config.minWindow = 1;
+    }
+
+    if (this->config.maxWindow < this->config.minWindow)
+    {
+        this->config.maxWindow = this->config.minWindow;
+    }
+
+    this->direction = BBFReadDirection::NONE;
+    this->window = this->config.minWindow;
+    this->lastPage = 0;
+    this->hasLastPage = false;
+
+    this->residentLow = 0;
+    this->residentHigh = 0;
+    this->sectionLow = 0;
+    this->sectionHigh = 0;
+
+    this->prefetchedPages = 0;
+    this->releasedPages = 0;
+
+    BBFHeader* header = this->reader ? this->reader->getHeaderView() : nullptr;
+    BBFFooter* footer = header ? this->reader->getFooterView(header->footerOffset) : nullptr;
+
+    if (footer)
+    {
+        this->pageCount = footer->pageCount;
+    }
+}
+
+void BBFReadSession::updateSectionBounds(uint64_t pageIndex)
+{
+    // Closest section start at or before the page, and the next start after it.
+    this->sectionLow = 0;
+    this->sectionHigh = this->pageCount;
+
+    BBFHeader* header = this->reader->getHeaderView();
+    BBFFooter* footer = this->reader->getFooterView(header->footerOffset);
+    const uint8_t* sectionTable = footer ? this->reader->getSectionTableView(footer->sectionOffset) : nullptr;
+
+    if (!sectionTable)
+    {
+        return;
+    }
+
+    uint64_t sectionIterator = 0;
+    for (; sectionIterator < footer->sectionCount; sectionIterator++)
+    {
+        const BBFSection* section = this->reader->getSectionEntryView(sectionTable, (int)sectionIterator);
+        if (!section)
+        {
+            break;
+        }
+
+        uint64_t startIndex = section->sectionStartIndex;
+
+        if (startIndex <= pageIndex && startIndex > this->sectionLow)
+        {
+            this->sectionLow = startIndex;
+        }
+
+        if (startIndex > pageIndex && startIndex < this->sectionHigh)
+        {
+            this->sectionHigh = startIndex;
+        }
+    }
+}
+
+void BBFReadSession::adviseOutside(uint64_t low, uint64_t high, uint64_t keepLow, uint64_t keepHigh, bool prefetch)
+{
+    // Apply the hint to [low, high) minus [keepLow, keepHigh)
+    uint64_t spans[2][2] = { {low, high}, {high, high} };
+
+    if (keepLow < keepHigh)
+    {
+        spans[0][1] = (keepLow < high) ? keepLow : high;
+        spans[1][0] = (keepHigh > low) ? keepHigh : low;
+    }
+
+    int spanIterator = 0;
+    for (; spanIterator < 2; spanIterator++)
+    {
+        uint64_t spanLow = spans[spanIterator][0];
+        uint64_t spanHigh = spans[spanIterator][1];
+
+        if (spanLow >= spanHigh)
+        {
+            continue;
+        }
+
+        if (prefetch)
+        {
+            this->reader->prefetchPages(spanLow, spanHigh - spanLow);
+            this->prefetchedPages += spanHigh - spanLow;
+        }
+        else
+        {
+            this->reader->releasePages(spanLow, spanHigh - spanLow, this->config.deactivateOnly);
+            this->releasedPages += spanHigh - spanLow;
+        }
+    }
+}
+
+bool BBFReadSession::onPageAccess(uint64_t pageIndex)
+{
+    if (pageIndex >= this->pageCount)
+    {
+        return false;
+    }
+
+    // Classify the step. Small skips still count as sequential (two-page spreads).
+    if (!this->hasLastPage)
+    {
+        this->direction = BBFReadDirection::NONE;
+        this->window = this->config.minWindow;
+    }
+    else if (pageIndex == this->lastPage)
+    {
+        return true;
+    }
+    else if (pageIndex > this->lastPage && pageIndex - this->lastPage <= 2)
+    {
+        bool continuing = (this->direction == BBFReadDirection::FORWARD);
+        this->window = continuing ? this->window * 2 : this->config.minWindow;
+        this->direction = BBFReadDirection::FORWARD;
+    }
+    else if (pageIndex < this->lastPage && this->lastPage - pageIndex <= 2)
+    {
+        bool continuing = (this->direction == BBFReadDirection::BACKWARD);
+        this->window = continuing ? this->window * 2 : this->config.minWindow;
+        this->direction = BBFReadDirection::BACKWARD;
+    }
+    else
+    {
+        this->direction = BBFReadDirection::JUMP;
+        this->window = this->config.minWindow;
+    }
+
+    if (this->window > this->config.maxWindow)
+    {
+        this->window = this->config.maxWindow;
+    }
+
+    bool hadResident = this->hasLastPage;
+    this->lastPage = pageIndex;
+    this->hasLastPage = true;
+
+    if (pageIndex < this->sectionLow || pageIndex >= this->sectionHigh)
+    {
+        updateSectionBounds(pageIndex);
+    }
+
+    uint64_t aheadLow = 0;
+    uint64_t aheadHigh = 0;
+    uint64_t newLow = 0;
+    uint64_t newHigh = 0;
+
+    if (this->direction == BBFReadDirection::BACKWARD)
+    {
+        // Read ahead towards the start of the section, peeking into the previous one when close.
+        aheadHigh = pageIndex + 1;
+        aheadLow = (pageIndex - this->sectionLow > this->window) ? pageIndex - this->window : this->sectionLow;
+
+        if (pageIndex - this->sectionLow < this->config.minWindow)
+        {
+            aheadLow = (this->sectionLow > this->config.minWindow) ? this->sectionLow - this->config.minWindow : 0;
+        }
+
+        newLow = aheadLow;
+        newHigh = pageIndex + 1 + this->config.keepBehind;
+        newHigh = (newHigh > this->pageCount) ? this->pageCount : newHigh;
+    }
+    else
+    {
+        // Stop at the section boundary, unless the reader is about to cross it.
+        aheadLow = pageIndex;
+        aheadHigh = pageIndex + 1 + this->window;
+        aheadHigh = (aheadHigh > this->sectionHigh) ? this->sectionHigh : aheadHigh;
+
+        if (this->sectionHigh - pageIndex - 1 < this->config.minWindow)
+        {
+            aheadHigh = this->sectionHigh + this->config.minWindow;
+            aheadHigh = (aheadHigh > this->pageCount) ? this->pageCount : aheadHigh;
+        }
+
+        newLow = (pageIndex > this->config.keepBehind) ? pageIndex - this->config.keepBehind : 0;
+        newHigh = aheadHigh;
+    }
+
+    // Drop whatever fell out of the window, then fetch what's new.
+    if (hadResident)
+    {
+        adviseOutside(this->residentLow, this->residentHigh, newLow, newHigh, false);
+        adviseOutside(aheadLow, aheadHigh, this->residentLow, this->residentHigh, true);
+    }
+    else
+    {
+        adviseOutside(aheadLow, aheadHigh, 0, 0, true);
+    }
+
+    this->residentLow = newLow;
+    this->residentHigh = newHigh;
+
+    return true;
+}
+
+// MEMORY BUDGET
+
+void BBFReader::setMemoryBudget(uint64_t budgetBytes, bool pageOut)
+{
+    this->memoryBudget = budgetBytes;
+    this->pageOutOnRelease = pageOut;
+    enforceBudget(0xFFFFFFFFFFFFFFFF);
+}
+
+void BBFReader::setProcessMemoryBudget(uint64_t budgetBytes)
+{
+    processMemoryBudget = budgetBytes;
+}
+
+uint64_t BBFReader::getProcessResidentBytes()
+{
+    return processResidentBytes.load();
+}
+
+bool BBFReader::lruInit()
+{
+    if (this->lruLinks)
+    {
+        return true;
+    }
+
+    BBFFooter* footer = loadFooter();
+    if (!footer || footer->assetCount == 0 || footer->assetCount > this->fileSize / sizeof(BBFAsset))
+    {
+        return false;
+    }
+
+    // [prev, next, resident] per asset
+    this->lruLinks = (uint64_t*)malloc(sizeof(uint64_t) * 3 * footer->assetCount);
+    if (!this->lruLinks)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate LRU for %llu assets.\n", (unsigned long long)footer->assetCount);
+        return false;
+    }
+
+    uint64_t assetIterator = 0;
+    for (; assetIterator < footer->assetCount; assetIterator++)
+    {
+        this->lruLinks[assetIterator * 3 + 0] = 0xFFFFFFFFFFFFFFFF;
+        this->lruLinks[assetIterator * 3 + 1] = 0xFFFFFFFFFFFFFFFF;
+        this->lruLinks[assetIterator * 3 + 2] = 0;
+    }
+
+    return true;
+}
+
+void BBFReader::lruUnlink(uint64_t assetIndex)
+{
+    uint64_t prevIndex = this->lruLinks[assetIndex * 3 + 0];
+    uint64_t nextIndex = this->lruLinks[assetIndex * 3 + 1];
+
+    if (prevIndex != 0xFFFFFFFFFFFFFFFF) { this->lruLinks[prevIndex * 3 + 1] = nextIndex; } else { this->lruHead = nextIndex; }
+    if (nextIndex != 0xFFFFFFFFFFFFFFFF) { this->lruLinks[nextIndex * 3 + 0] = prevIndex; } else { this->lruTail = prevIndex; }
+
+    this->lruLinks[assetIndex * 3 + 0] = 0xFFFFFFFFFFFFFFFF;
+    this->lruLinks[assetIndex * 3 + 1] = 0xFFFFFFFFFFFFFFFF;
+}
+
+void BBFReader::lruPushFront(uint64_t assetIndex)
+{
+    this->lruLinks[assetIndex * 3 + 0] = 0xFFFFFFFFFFFFFFFF;
+    this->lruLinks[assetIndex * 3 + 1] = this->lruHead;
+
+    if (this->lruHead != 0xFFFFFFFFFFFFFFFF)
+    {
+        this->lruLinks[this->lruHead * 3 + 0] = assetIndex;
+    }
+
+    this->lruHead = assetIndex;
+
+    if (this->lruTail == 0xFFFFFFFFFFFFFFFF)
+    {
+        this->lruTail = assetIndex;
+    }
+}
+
+void BBFReader::enforceBudget(uint64_t keepIndex)
+{
+    if (!this->lruLinks)
+    {
+        return;
+    }
+
+    // Evict from the cold end until both budgets are met. Only this reader's
+    // assets are evicted here, other readers enforce the process budget themselves.
+    while (this->lruTail != 0xFFFFFFFFFFFFFFFF && this->lruTail != keepIndex)
+    {
+        uint64_t processBudget = processMemoryBudget.load();
+        bool overReader = (this->memoryBudget != 0 && this->residentBytes > this->memoryBudget);
+        bool overProcess = (processBudget != 0 && processResidentBytes.load() > processBudget);
+
+        if (!overReader && !overProcess)
+        {
+            break;
+        }
+
+        uint64_t coldIndex = this->lruTail;
+        const BBFAsset* asset = getAssetEntry(coldIndex);
+
+        if (asset)
+        {
+            adviseRange(asset->fileOffset, asset->fileSize, this->pageOutOnRelease ? BBFAdvice::PAGEOUT : BBFAdvice::DONTNEED);
+            this->residentBytes -= asset->fileSize;
+            processResidentBytes -= asset->fileSize;
+        }
+
+        lruUnlink(coldIndex);
+        this->lruLinks[coldIndex * 3 + 2] = 0;
+    }
+}
+
+const uint8_t* BBFReader::acquireAsset(uint64_t assetIndex)
+{
+    const BBFAsset* asset = getAssetEntry(assetIndex);
+    if (!asset || !lruInit())
+    {
+        return nullptr;
+    }
+
+    if (this->lruLinks[assetIndex * 3 + 2])
+    {
+        lruUnlink(assetIndex);
+    }
+    else
+    {
+        this->lruLinks[assetIndex * 3 + 2] = 1;
+        this->residentBytes += asset->fileSize;
+        processResidentBytes += asset->fileSize;
+    }
+
+    lruPushFront(assetIndex);
+    enforceBudget(assetIndex);
+
+    return getAssetDataView(asset);
+}
+
+const uint8_t* BBFReader::acquirePage(uint64_t pageIndex, uint64_t* assetSize)
+{
+    BBFFooter* footer = loadFooter();
+    if (!footer || pageIndex >= footer->pageCount)
+    {
+        return nullptr;
+    }
+
+    uint64_t pageEntryOffset = footer->pageOffset + pageIndex * sizeof(BBFPage);
+    if (pageEntryOffset < footer->pageOffset || !isSafe(pageEntryOffset, (uint64_t)sizeof(BBFPage)))
+    {
+        return nullptr;
+    }
+
+    const BBFPage* page = (const BBFPage*)resolve(pageEntryOffset, (uint64_t)sizeof(BBFPage));
+    const BBFAsset* asset = page ? getAssetEntry(page->assetIndex) : nullptr;
+
+    if (!asset)
+    {
+        return nullptr;
+    }
+
+    if (assetSize)
+    {
+        *assetSize = asset->fileSize;
+    }
+
+    return acquireAsset(page->assetIndex);
+}
+
+bool BBFReader::pinIndex(bool lockMemory)
+{
+    uint64_t indexStart = 0;
+    uint64_t indexEnd = 0;
+
+    if (!getIndexRegion(&indexStart, &indexEnd))
+    {
+        return false;
+    }
+
+    // The header is tiny and read on every lookup, keep it with the index.
+    if (!adviseRange(0, sizeof(BBFHeader), BBFAdvice::WILLNEED) || !adviseRange(indexStart, indexEnd - indexStart, BBFAdvice::WILLNEED))
+    {
+        return false;
+    }
+
+    if (!lockMemory)
+    {
+        return true;
+    }
+
+    // Can fail under RLIMIT_MEMLOCK, the WILLNEED above still applies.
+    bool lockSuccess = false;
+    if (this->fileBuffer)
+    {
+        lockSuccess = this->backend->lock(0, sizeof(BBFHeader)) && this->backend->lock(indexStart, indexEnd - indexStart);
+    }
+    else if (this->indexBuffer)
+    {
+        #if defined(_WIN32) || defined(__EMSCRIPTEN__)
+            lockSuccess = false;
+        #else
+            lockSuccess = mlock(this->headerBuffer, sizeof(BBFHeader)) == 0 && mlock(this->indexBuffer, (size_t)(this->indexBufferEnd - this->indexBufferStart)) == 0;
+        #endif
+    }
+
+    if (!lockSuccess)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to lock index region (errno %d).\n", errno);
+        return false;
+    }
+
+    return true;
+}
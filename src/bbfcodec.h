@@ -7,21 +7,18 @@
 #include "libbbf.h"
 #include "dedupemap.h"
 #include "stringpool.h"
-
-// Handle Memory Mapping
-#ifdef _WIN32
-    #define WIN32_LEAN_AND_MEAN
-    #include <windows.h>
-#else
-    #include <sys/mman.h>
-    #include <sys/stat.h>
-    #include <fcntl.h>
-    #include <unistd.h>
-#endif
+#include "bbfio.h"
+#include "bbfmove.h"
 
 #include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <atomic>
+
+class BBFReader;
+
+// Sees each chunk of a page as the builder hashes it, e.g. to check an archive's CRC on the same pass
+typedef void (*BBFChunkHook)(const uint8_t* chunk, size_t chunkSize, void* hookData);
 
 class BBFBuilder
 {
@@ -30,13 +27,50 @@ class BBFBuilder
         ~BBFBuilder(); // Deconstructor.
         // TODO: Copy constructor.
 
+        // Same, but returns nullptr when oFile can't be written instead of exiting. For worker threads. delete when done.
+        static BBFBuilder* open(const char* oFile, uint32_t alignment = BBF::DEFAULT_GUARD_ALIGNMENT, uint32_t reamSize = BBF::DEFAULT_SMALL_REAM_THRESHOLD, uint32_t hFlags = BBF::BBF_VARIABLE_REAM_SIZE_FLAG);
+
         // Default flag is variable alignment.
         bool addPage(const char* fPath, uint32_t pFlags = 0, uint32_t aFlags = 0);
         bool addMeta(const char* key, const char* value, const char* parent = nullptr);
         bool addSection(const char* sectionName, uint64_t startIndex, const char* parentName = nullptr);
 
+        // Pages that aren't files of their own. nameHint is only used for its extension (the media type).
+        // knownHash is the data's XXH3-128 when the caller already hashed it on the way in.
+        bool addPageData(const void* data, uint64_t dataSize, const char* nameHint, uint32_t pFlags = 0, uint32_t aFlags = 0, const XXH128_hash_t* knownHash = nullptr);
+        // A byte range of an open file, like a stored archive entry. Hashed with positioned reads, then copied
+        // through BBFDataMover. The fd's file position isn't touched.
+        bool addPageRange(int sourceFd, uint64_t sourceOffset, uint64_t length, const char* nameHint, uint32_t pFlags = 0, uint32_t aFlags = 0, BBFChunkHook chunkHook = nullptr, void* hookData = nullptr);
+
         bool finalize();
-        static bool petrifyFile(const char* iPath, const char* oPath); // Petrify!
+        static bool petrifyFile(const char* iPath, const char* oPath, BBFCopyStats* copyStats = nullptr); // Petrify! copyStats says how the data moved.
+        // Petrify without a second copy: data shifts up in blocks, back to front, then the index goes in after the header.
+        // Journaled in <path>.bbfjournal. If it's interrupted, call it again to finish.
+        static bool petrifyInPlace(const char* path);
+
+        // Copy a page out of another book. Uses the stored hash, so the data is never rehashed, and a page
+        // whose hash is already here shares that asset. The bytes move through BBFDataMover.
+        bool addPageFrom(BBFReader* source, uint64_t pageIndex);
+        BBFCopyStats getCopyStats() const;
+
+        // Rewrite a book with a new layout. Drops unreferenced assets, merges duplicates, keeps sections and metadata.
+        static bool repackFile(const char* iPath, const char* oPath, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool petrify = false, BBFCopyStats* copyStats = nullptr);
+
+        // Merge books into one, in order, with a top level section per input (volumeNames, one each) holding its
+        // pages, sections and metadata. Assets shared between inputs are stored once. Nothing is rehashed.
+        static bool mergeFiles(const char* const* iPaths, uint32_t inputCount, const char* oPath, const char* const* volumeNames, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool petrify = false, BBFCopyStats* copyStats = nullptr);
+
+        // The other way: one book per section at depth (1 = top level), written to outDir as <title>.bbf. Each gets
+        // the section's pages, its subsections and the metadata that applies to it. threadCount books at a time.
+        static bool splitFile(const char* iPath, const char* outDir, uint32_t depth = 1, uint32_t threadCount = 4, BBFCopyStats* copyStats = nullptr, uint64_t* bookCount = nullptr);
+
+        static uint8_t detectType(const char* iPath); // BBFMediaType from the extension
+
+        // Replacing a file: write a unique temp file next to destPath (mkstemp, *tempPath is malloc'd), then rename it over.
+        // replaceWithTemp frees tempPath, and removes it on failure. The result gets modeSource's permissions, else
+        // destPath's if it exists, else 0644.
+        static FILE* openTempNear(const char* destPath, char** tempPath);
+        static bool replaceWithTemp(char* tempPath, const char* destPath, const char* modeSource = nullptr);
 
         // Getters
         size_t getAssetCount() { if(!assetCount) {return 0;} return assetCount; }
@@ -46,6 +80,8 @@ class BBFBuilder
 
     
     private:
+        BBFBuilder(const char* oFile, uint32_t alignment, uint32_t reamSize, uint32_t hFlags, bool exitOnError);
+
         FILE* file;
         uint64_t currentOffset;
 
@@ -74,6 +110,20 @@ class BBFBuilder
         size_t keyCount;
         size_t keyCap;
 
+        // Copying from other books
+        BBFDataMover* dataMover;
+        int moverSourceFd;
+        BBFCopyStats copyStats; // from movers we're done with
+        uint64_t indexReserve; // Index bytes held in front of the data, 0 if none
+
+        uint64_t assetAlignment(uint64_t fileSize); // Boundary for a new asset of this size
+        bool addDuplicatePage(XXH128_hash_t assetHash, uint32_t pFlags); // false if the asset isn't here yet
+        void addNewPage(XXH128_hash_t assetHash, uint64_t fileOffset, uint64_t fileSize, uint8_t mediaType, uint32_t pFlags, uint32_t aFlags);
+        bool copyFromFd(int sourceFd, uint64_t sourceOffset, uint64_t destOffset, uint64_t length); // Through dataMover
+        bool appendBook(BBFReader* source, const char* volumeName); // Pages, sections and metadata. Rebased, under volumeName if set.
+        // Before the first page: room for the footer and up to indexBound index bytes after the header.
+        // finalize writes a petrified book there if the index fits, and the usual layout if it doesn't.
+        bool reserveIndex(uint64_t indexBound);
         void growAssets(); // realloc(this->assets)
         void growPages();
         void growSections();
@@ -81,25 +131,87 @@ class BBFBuilder
 
         // Other Helpers
         void writePadding(uint64_t alignmentBoundary);
-        uint8_t detectType(const char* iPath);
+};
+
+// A byte range to fetch, and where each planned page sits inside one
+struct BBFRangeExtent
+{
+    uint64_t fileOffset;
+    uint64_t length;
+};
+
+struct BBFPageExtent
+{
+    uint64_t extentIndex;
+    uint64_t extentOffset; // page data starts this far into the extent
+    uint64_t length;
+};
+
+struct BBFRangePlan
+{
+    BBFRangeExtent* extents = nullptr; // sorted by offset, never overlapping
+    uint64_t extentCount = 0;
+    BBFPageExtent* pages = nullptr; // one per planned page, in page order
+    uint64_t pageCount = 0;
+    uint64_t firstPage = 0;
+    uint64_t totalBytes = 0; // sum of extent lengths, gaps included
+};
+
+// Where a run of book bytes lives in a file. Pass straight to sendfile/splice/copy_file_range.
+struct BBFFileSpan
+{
+    int fileDescriptor; // -1 when the book isn't backed by a file
+    uint64_t fileOffset; // absolute, base offset already applied
+    uint64_t bookOffset; // same bytes, relative to the start of the book
+    uint64_t length;
+};
+
+struct BBFExportList
+{
+    BBFFileSpan* spans = nullptr; // in page order, so sending them in order reproduces the pages
+    uint64_t spanCount = 0;
+    uint64_t totalBytes = 0;
+};
+
+// Page cache residency (mincore). Counted per system page, so a partly cached asset shows up as such.
+struct BBFResidencyReport
+{
+    uint64_t* pageResident = nullptr; // resident bytes of each page's asset
+    uint64_t* pageBytes = nullptr; // each page's asset size
+    uint64_t pageCount = 0;
+    uint64_t* sectionResident = nullptr; // over the section's pages, subsections included
+    uint64_t* sectionBytes = nullptr;
+    uint64_t sectionCount = 0;
+    uint64_t residentBytes = 0; // the whole book, index included
+    uint64_t totalBytes = 0;
 };
 
 class BBFReader
 {
     public:
-        BBFReader(const char* iFile);
+        BBFReader(const char* iFile); // mmap the whole file
+        BBFReader(const uint8_t* bookData, size_t bookSize); // Book already in memory. Not copied, keep it alive.
+        #ifndef _WIN32
+            BBFReader(int iFileDescriptor, uint64_t baseOffset, uint64_t length); // Book inside a larger file. Offsets are relative to baseOffset.
+        #endif
+        BBFReader(BBFIOBackend* ioBackend, bool takeOwnership = false);
         ~BBFReader();
-        // TODO: Copy constructor.
 
-        BBFHeader* getHeaderView() {if(!this->fileBuffer){ return nullptr; } return (BBFHeader*)this->fileBuffer; }
+        // Move only. A copy would unmap (or free) the book twice. The moved-from reader is left empty.
+        BBFReader(const BBFReader&) = delete;
+        BBFReader& operator=(const BBFReader&) = delete;
+        BBFReader(BBFReader&& other) noexcept;
+        BBFReader& operator=(BBFReader&& other) noexcept;
+
+        BBFHeader* getHeaderView() { return (BBFHeader*)resolve(0, sizeof(BBFHeader)); }
         BBFFooter* getFooterView(uint64_t fOffset);
 
         // Unsure what type these pointers should be
-        const uint8_t* getPageTableView(uint64_t pgOffset) { if (!isSafe(pgOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + pgOffset); }
-        const uint8_t* getAssetTableView(uint64_t aOffset) { if (!isSafe(aOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + aOffset); }
-        const uint8_t* getSectionTableView(uint64_t sOffset) { if (!isSafe(sOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + sOffset); }
-        const uint8_t* getMetadataView(uint64_t mOffset) { if (!isSafe(mOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + mOffset); }
-        const uint8_t* getExpansionTableView(uint64_t eOffset) { if (!isSafe(eOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + eOffset); }
+        const uint8_t* getPageTableView(uint64_t pgOffset) { return resolve(pgOffset, 0); }
+        const uint8_t* getAssetTableView(uint64_t aOffset) { return resolve(aOffset, 0); }
+        const uint8_t* getSectionTableView(uint64_t sOffset) { return resolve(sOffset, 0); }
+        const uint8_t* getMetadataView(uint64_t mOffset) { return resolve(mOffset, 0); }
+        const uint8_t* getExpansionTableView(uint64_t eOffset) { return resolve(eOffset, 0); }
 
         // This, however, is
         const BBFAsset* getAssetEntryView(uint8_t* assetTable, int assetIndex) { if (!this->footerCache) {return nullptr;} if (!isSafe(this->footerCache->assetCount, assetIndex)) {return nullptr;} return (const BBFAsset*)(assetTable + sizeof(BBFAsset) * assetIndex); }
@@ -116,8 +228,15 @@ class BBFReader
         const BBFExpansion* getExpansionEntryView(const uint8_t* expansionTable, int expansionIndex) { if (!this->footerCache) {return nullptr;} if (!isSafe(this->footerCache->expansionCount, expansionIndex)) {return nullptr;} return ((const BBFExpansion*)(expansionTable + sizeof(BBFExpansion) * expansionIndex)); }
 
 
-        // Get asset data
-        const uint8_t* getAssetDataView(uint64_t fileOffset) { if (!isSafe(fileOffset)){return nullptr;} return ((const uint8_t*)this->fileBuffer + fileOffset); }
+        // Get asset data. Backends without a mapping hand out a buffer that's only valid until the next data view.
+        const uint8_t* getAssetDataView(uint64_t fileOffset);
+        const uint8_t* getAssetDataView(const BBFAsset* assetView);
+        bool readAssetData(const BBFAsset* assetView, void* dst, uint64_t dstSize); // Copy an asset out, any backend
+        bool getAssetFileRange(uint64_t assetIndex, int* fileDescriptor, uint64_t* fileOffset, uint64_t* length); // Where an asset lives on disk. fd is -1 without a file.
+        // Boundary an asset should start on: 2^alignment, or 8 for ream sized assets in variable ream books. 0 if there's no such asset.
+        uint64_t getAssetAlignment(uint64_t assetIndex);
+        // Assets off their boundary. Writes up to maxIndices of them, returns how many there are.
+        uint64_t findMisalignedAssets(uint64_t* assetIndices, uint64_t maxIndices);
         // Get strings
         const char* getStringView(uint64_t strOffset);
 
@@ -134,14 +253,74 @@ class BBFReader
         
         //FILE* file;
 
+        // Section/Region lookups
+        bool getSectionPageRange(const char* sectionName, uint64_t* firstPage, uint64_t* pageCount);
+        // Same, by index, so repeated titles work. subtreeEnd is one past the section's last subsection.
+        bool getSectionPageRangeAt(uint64_t sectionIndex, uint64_t* firstPage, uint64_t* pageCount, uint64_t* subtreeEnd = nullptr);
+        bool getDataRegion(uint64_t* dataStart, uint64_t* dataEnd);
+        bool getIndexRegion(uint64_t* indexStart, uint64_t* indexEnd);
+
+        // Prefetching. Hints only, so the pages may or may not be resident afterwards.
+        bool prefetchPages(uint64_t firstPage, uint64_t pageCount);
+        bool prefetchSection(const char* sectionName);
+        bool setAccessPattern(BBF::BBFAccessPattern pattern);
+
+        // What's in the page cache right now. Not on Windows. Free the report with freeResidencyReport.
+        bool residency(BBFResidencyReport* report);
+        static void freeResidencyReport(BBFResidencyReport* report);
+
+        // Read pages into the page cache with up to maxParallel reads in flight. Unlike prefetchPages,
+        // this returns once they're loaded.
+        bool warm(uint64_t firstPage, uint64_t pageCount, uint32_t maxParallel = 4);
+        bool warmSection(const char* sectionName, uint32_t maxParallel = 4);
+
+        // Minimal set of byte ranges covering a page span. Ranges closer than maxGap are merged.
+        // Free the plan with freeRangePlan.
+        bool planRanges(uint64_t firstPage, uint64_t pageCount, uint64_t maxGap, BBFRangePlan* plan);
+        bool planSectionRanges(const char* sectionName, uint64_t maxGap, BBFRangePlan* plan);
+        static void freeRangePlan(BBFRangePlan* plan);
+
+        // Zero-copy export. Spans for pages (back to back assets are merged), a section, or the whole book.
+        // Free the list with freeExportList.
+        bool exportPages(uint64_t firstPage, uint64_t pageCount, BBFExportList* list);
+        bool exportSection(const char* sectionName, BBFExportList* list);
+        bool exportBook(BBFExportList* list);
+        static void freeExportList(BBFExportList* list);
+        #ifndef _WIN32
+            // iovecs into the mapping, for writev. Only for backends with a mapping. Free with free().
+            bool exportIovecs(const BBFExportList* list, struct iovec** iovecList, uint64_t* iovecCount);
+            // Write every span to outFd, in order. sendfile where we can, so the bytes never reach user space.
+            // Non-blocking sockets are fine, it waits for them to drain.
+            bool sendExport(const BBFExportList* list, int outFd, uint64_t* bytesSent = nullptr);
+        #endif
+
+        // Drop pages from this mapping (MADV_DONTNEED), or just mark them cold (MADV_COLD)
+        bool releasePages(uint64_t firstPage, uint64_t pageCount, bool deactivateOnly = false);
+
+        // Memory budget. Assets handed out by acquireAsset/acquirePage are kept in an LRU,
+        // and the coldest are released (MADV_DONTNEED, or MADV_PAGEOUT) when over budget. 0 = unlimited.
+        void setMemoryBudget(uint64_t budgetBytes, bool pageOut = false);
+        static void setProcessMemoryBudget(uint64_t budgetBytes);
+        const uint8_t* acquireAsset(uint64_t assetIndex);
+        const uint8_t* acquirePage(uint64_t pageIndex, uint64_t* assetSize);
+        bool pinIndex(bool lockMemory = false); // Keep the index resident, optionally mlock'd
+
+        uint64_t getResidentBytes() const { return residentBytes; }
+        static uint64_t getProcessResidentBytes();
+
+        BBFIOBackend* getBackend() { return backend; }
+
     private:
 
-        #ifdef _WIN32
-            HANDLE hFile;
-            HANDLE hMap;
-        #else
-            int fileDescriptor;
-        #endif
+        BBFIOBackend* backend;
+        bool ownsBackend;
+
+        bool attachBackend(BBFIOBackend* ioBackend, bool takeOwnership);
+        void releaseBackend();
+        void takeFrom(BBFReader& other);
+        bool loadIndexBuffer();
+        const uint8_t* resolve(uint64_t offset, uint64_t length); // header/index bytes, wherever they live
+        bool findAssetSize(uint64_t fileOffset, uint64_t* assetSize);
 
         bool isSafe(uint64_t offset, uint64_t size) const;
         bool isSafe(uint64_t count, int index) const;
@@ -149,10 +328,96 @@ class BBFReader
 
         char* getString(uint64_t stringOffset) { if(!isSafe(stringOffset)) {return nullptr;} return (char*)stringOffset; };
 
-        uint8_t* fileBuffer;
+        // Footer + range helpers
+        BBFFooter* loadFooter();
+        const BBFAsset* getAssetEntry(uint64_t assetIndex);
+        const BBFAsset* getPageAsset(uint64_t pageIndex);
+        bool adviseRange(uint64_t offset, uint64_t length, BBFAdvice advice);
+        bool advisePages(uint64_t firstPage, uint64_t pageCount, uint64_t maxGap, BBFAdvice advice);
+
+        // Budget tracking
+        bool lruInit();
+        void lruUnlink(uint64_t assetIndex);
+        void lruPushFront(uint64_t assetIndex);
+        void enforceBudget(uint64_t keepIndex);
+
+        const uint8_t* fileBuffer; // backend mapping, nullptr if it doesn't have one
         BBFFooter* footerCache;
         size_t fileSize;
 
+        // Copies of the header and index for backends without a mapping
+        uint8_t* headerBuffer;
+        uint8_t* indexBuffer;
+        uint64_t indexBufferStart;
+        uint64_t indexBufferEnd;
+        uint64_t* assetSpans; // [fileOffset, fileSize] sorted by offset, for getAssetDataView(offset)
+        uint64_t assetSpanCount;
+
+        uint64_t memoryBudget;
+        bool pageOutOnRelease;
+        uint64_t residentBytes; // bytes of acquired assets we haven't released
+        uint64_t* lruLinks; // [prev, next, resident] per asset
+        uint64_t lruHead;
+        uint64_t lruTail;
+
+        static std::atomic<uint64_t> processResidentBytes;
+        static std::atomic<uint64_t> processMemoryBudget;
+
+};
+
+// Reading direction detected by BBFReadSession
+enum class BBFReadDirection: uint8_t
+{
+    NONE = 0,
+    FORWARD,
+    BACKWARD,
+    JUMP
+};
+
+struct BBFSessionConfig
+{
+    uint64_t minWindow = 2; // Readahead (pages) after opening or jumping
+    uint64_t maxWindow = 32; // Readahead cap for long sequential runs
+    uint64_t keepBehind = 4; // Pages kept resident behind the reader
+    bool deactivateOnly = false; // Use MADV_COLD instead of MADV_DONTNEED for passed pages
+};
+
+class BBFReadSession
+{
+    public:
+        BBFReadSession(BBFReader* sReader, BBFSessionConfig sConfig = BBFSessionConfig());
+
+        // Call whenever a page is shown. Adjusts the readahead window and drops passed pages.
+        bool onPageAccess(uint64_t pageIndex);
+
+        BBFReadDirection getDirection() const { return direction; }
+        uint64_t getWindow() const { return window; }
+        uint64_t getPrefetchedPages() const { return prefetchedPages; }
+        uint64_t getReleasedPages() const { return releasedPages; }
+
+    private:
+        BBFReader* reader;
+        BBFSessionConfig config;
+        uint64_t pageCount;
+
+        BBFReadDirection direction;
+        uint64_t window;
+        uint64_t lastPage;
+        bool hasLastPage;
+
+        // Pages we've asked to be resident [residentLow, residentHigh)
+        uint64_t residentLow;
+        uint64_t residentHigh;
+
+        // Innermost section around the current page [sectionLow, sectionHigh)
+        uint64_t sectionLow;
+        uint64_t sectionHigh;
+
+        uint64_t prefetchedPages;
+        uint64_t releasedPages;
+
+        void updateSectionBounds(uint64_t pageIndex);
+        void adviseOutside(uint64_t low, uint64_t high, uint64_t keepLow, uint64_t keepHigh, bool prefetch);
 };
 
 #endif // BBFCODEC_H
\ No newline at end of file
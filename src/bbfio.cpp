@@ -0,0 +1,1096 @@
+#include "bbfio.h"
+
+#include <string.h>
+#include <errno.h>
+
+// Shared helpers
+
+#if !defined(_WIN32)
+static bool preadFull(int fileDescriptor, uint64_t offset, void* dst, uint64_t length)
+{
+    uint8_t* dstBytes = (uint8_t*)dst;
+    uint64_t bytesDone = 0;
+
+    while (bytesDone < length)
+    {
+        ssize_t bytesRead = pread(fileDescriptor, dstBytes + bytesDone, (size_t)(length - bytesDone), (off_t)(offset + bytesDone));
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        // Unexpected EOF. The file shrank under us.
+        if (bytesRead == 0)
+        {
+            return false;
+        }
+
+        bytesDone += (uint64_t)bytesRead;
+    }
+
+    return true;
+}
+
+// Page cache hints for backends that don't map the file.
+static bool fileAdvise(int fileDescriptor, uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    #if defined(__EMSCRIPTEN__) || defined(__APPLE__)
+        (void)fileDescriptor; (void)offset; (void)length; (void)advice;
+        return true;
+    #else
+        int adviceFlag = POSIX_FADV_NORMAL;
+        switch (advice)
+        {
+            case BBFAdvice::NORMAL: adviceFlag = POSIX_FADV_NORMAL; break;
+            case BBFAdvice::SEQUENTIAL: adviceFlag = POSIX_FADV_SEQUENTIAL; break;
+            case BBFAdvice::RANDOM: adviceFlag = POSIX_FADV_RANDOM; break;
+            case BBFAdvice::WILLNEED: adviceFlag = POSIX_FADV_WILLNEED; break;
+            // No "cold" for the page cache. Dropping is the closest thing.
+            case BBFAdvice::DONTNEED:
+            case BBFAdvice::COLD:
+            case BBFAdvice::PAGEOUT: adviceFlag = POSIX_FADV_DONTNEED; break;
+        }
+
+        return posix_fadvise(fileDescriptor, (off_t)offset, (off_t)length, adviceFlag) == 0;
+    #endif
+}
+#else
+static bool readFileFull(HANDLE hFile, uint64_t offset, void* dst, uint64_t length)
+{
+    uint8_t* dstBytes = (uint8_t*)dst;
+    uint64_t bytesDone = 0;
+
+    while (bytesDone < length)
+    {
+        uint64_t chunkSize = length - bytesDone;
+        DWORD requestSize = (chunkSize > 0x40000000) ? 0x40000000 : (DWORD)chunkSize;
+        DWORD bytesRead = 0;
+
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)((offset + bytesDone) & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)((offset + bytesDone) >> 32);
+
+        if (!ReadFile(hFile, dstBytes + bytesDone, requestSize, &bytesRead, &overlapped) || bytesRead == 0)
+        {
+            return false;
+        }
+
+        bytesDone += bytesRead;
+    }
+
+    return true;
+}
+#endif
+
+// BASE BACKEND
+
+BBFIOBackend::BBFIOBackend()
+{
+    this->scratchBuffer = nullptr;
+    this->scratchCap = 0;
+}
+
+BBFIOBackend::~BBFIOBackend()
+{
+    if (this->scratchBuffer)
+    {
+        free(this->scratchBuffer);
+        this->scratchBuffer = nullptr;
+    }
+    this->scratchCap = 0;
+}
+
+const uint8_t* BBFIOBackend::getView(uint64_t offset, uint64_t length)
+{
+    uint64_t backendSize = getSize();
+    if (offset + length < offset || offset + length > backendSize)
+    {
+        return nullptr;
+    }
+
+    // Backends without a mapping read into a scratch buffer that only grows.
+    if (length > this->scratchCap || !this->scratchBuffer)
+    {
+        uint64_t newCap = (length > 4096) ? length : 4096;
+        uint8_t* tempBuffer = (uint8_t*)realloc(this->scratchBuffer, (size_t)newCap);
+        if (!tempBuffer)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to allocate %llu byte read buffer.\n", (unsigned long long)newCap);
+            return nullptr;
+        }
+        this->scratchBuffer = tempBuffer;
+        this->scratchCap = newCap;
+    }
+
+    if (!read(offset, this->scratchBuffer, length))
+    {
+        return nullptr;
+    }
+
+    return this->scratchBuffer;
+}
+
+// MMAP BACKEND
+
+BBFMmapBackend::BBFMmapBackend(const char* iFile)
+{
+    this->fileBase = 0;
+    this->mapBuffer = nullptr;
+    this->mapSize = 0;
+    this->mapBase = nullptr;
+    this->mapLength = 0;
+
+    // Windows memory mapping
+    #ifdef _WIN32
+        this->hFile = CreateFileA(iFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (this->hFile == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        // Get Filesize
+        LARGE_INTEGER size;
+        GetFileSizeEx(this->hFile, &size);
+
+        //Map to memory
+        this->hMap = CreateFileMappingA(this->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+        if (this->hMap == NULL)
+        {
+            fprintf(stderr, "[BBFCODEC] Failed to map file (CreateFileMapping)\n");
+            CloseHandle(this->hFile);
+            return;
+        }
+
+        this->mapBuffer = (uint8_t*)MapViewOfFile(this->hMap, FILE_MAP_READ, 0, 0, 0);
+        if (this->mapBuffer == NULL)
+        {
+            fprintf(stderr, "[BBFCODEC] Failed to map file (MapViewOfFile)\n");
+            CloseHandle(this->hMap);
+            CloseHandle(this->hFile);
+            this->mapBuffer = nullptr;
+            return;
+        }
+        this->mapSize = (uint64_t)size.QuadPart;
+        this->mapBase = this->mapBuffer;
+        this->mapLength = this->mapSize;
+    #else
+        this->fileDescriptor = open(iFile, O_RDONLY);
+        if (this->fileDescriptor == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(this->fileDescriptor, &fileStat) == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to stat file\n");
+            close(this->fileDescriptor);
+            return;
+        }
+
+        void* fMap = mmap(NULL, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, this->fileDescriptor, 0);
+        if (fMap == MAP_FAILED)
+        {
+            fprintf(stderr, "[BBFCODEC] mmap failed\n");
+            close(this->fileDescriptor);
+            return;
+        }
+        this->mapBuffer = (uint8_t*)fMap;
+        this->mapSize = (uint64_t)fileStat.st_size;
+        this->mapBase = this->mapBuffer;
+        this->mapLength = this->mapSize;
+    #endif
+}
+
+#ifndef _WIN32
+BBFMmapBackend::BBFMmapBackend(int iFileDescriptor, uint64_t baseOffset, uint64_t length)
+{
+    this->fileBase = 0;
+    this->mapBuffer = nullptr;
+    this->mapSize = 0;
+    this->mapBase = nullptr;
+    this->mapLength = 0;
+
+    this->fileDescriptor = dup(iFileDescriptor);
+    if (this->fileDescriptor == -1)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to duplicate file descriptor %d\n", iFileDescriptor);
+        return;
+    }
+
+    struct stat fileStat;
+    if (fstat(this->fileDescriptor, &fileStat) == -1 || baseOffset > (uint64_t)fileStat.st_size)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to stat file, or base offset is past the end\n");
+        close(this->fileDescriptor);
+        return;
+    }
+
+    uint64_t bytesLeft = (uint64_t)fileStat.st_size - baseOffset;
+    if (length == 0)
+    {
+        length = bytesLeft;
+    }
+
+    if (length == 0 || length > bytesLeft)
+    {
+        fprintf(stderr, "[BBFCODEC] Book at %llu runs past the end of the file\n", (unsigned long long)baseOffset);
+        close(this->fileDescriptor);
+        return;
+    }
+
+    // mmap offsets have to be page aligned. Map from the page before the book, and start the view at the book.
+    static const uint64_t systemPageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+    uint64_t alignedOffset = baseOffset & ~(systemPageSize - 1);
+    uint64_t alignedLength = length + (baseOffset - alignedOffset);
+
+    void* fMap = mmap(NULL, (size_t)alignedLength, PROT_READ, MAP_PRIVATE, this->fileDescriptor, (off_t)alignedOffset);
+    if (fMap == MAP_FAILED)
+    {
+        fprintf(stderr, "[BBFCODEC] mmap failed\n");
+        close(this->fileDescriptor);
+        return;
+    }
+
+    this->mapBase = (uint8_t*)fMap;
+    this->mapLength = alignedLength;
+    this->mapBuffer = this->mapBase + (baseOffset - alignedOffset);
+    this->mapSize = length;
+    this->fileBase = baseOffset;
+}
+#endif
+
+BBFMmapBackend::~BBFMmapBackend()
+{
+    if (this->mapBuffer)
+    {
+        #ifdef _WIN32
+            UnmapViewOfFile(this->mapBuffer);
+            CloseHandle(this->hMap);
+            CloseHandle(this->hFile);
+        #else
+            munmap(this->mapBase, (size_t)this->mapLength);
+            close(this->fileDescriptor);
+        #endif
+
+        this->mapBuffer = nullptr;
+    }
+    this->mapSize = 0;
+}
+
+bool BBFMmapBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    const uint8_t* srcView = getView(offset, length);
+    if (!srcView)
+    {
+        return false;
+    }
+
+    memcpy(dst, srcView, (size_t)length);
+    return true;
+}
+
+const uint8_t* BBFMmapBackend::getView(uint64_t offset, uint64_t length)
+{
+    if (!this->mapBuffer || offset + length < offset || offset + length > this->mapSize)
+    {
+        return nullptr;
+    }
+
+    return this->mapBuffer + offset;
+}
+
+bool BBFMmapBackend::advise(uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    if (!getView(offset, length))
+    {
+        return false;
+    }
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    #if defined(_WIN32) || defined(__EMSCRIPTEN__)
+        // No madvise here. Hints are optional, so this isn't a failure.
+        (void)advice;
+        return true;
+    #else
+        static const uint64_t systemPageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+
+        // madvise wants a page aligned address. Hints that bring data in round outwards.
+        // Hints that drop data round inwards, so a neighbouring asset sharing a system page is left alone.
+        uintptr_t rangeAddress = (uintptr_t)(this->mapBuffer + offset);
+        uintptr_t alignedStart = rangeAddress & ~(uintptr_t)(systemPageSize - 1);
+        uintptr_t alignedEnd = rangeAddress + length;
+
+        int adviceFlag = MADV_NORMAL;
+        switch (advice)
+        {
+            case BBFAdvice::NORMAL: adviceFlag = MADV_NORMAL; break;
+            case BBFAdvice::SEQUENTIAL: adviceFlag = MADV_SEQUENTIAL; break;
+            case BBFAdvice::RANDOM: adviceFlag = MADV_RANDOM; break;
+            case BBFAdvice::WILLNEED: adviceFlag = MADV_WILLNEED; break;
+            case BBFAdvice::DONTNEED: adviceFlag = MADV_DONTNEED; break;
+            case BBFAdvice::COLD:
+                #ifdef MADV_COLD
+                    adviceFlag = MADV_COLD;
+                #else
+                    adviceFlag = MADV_DONTNEED;
+                #endif
+                break;
+            case BBFAdvice::PAGEOUT:
+                #ifdef MADV_PAGEOUT
+                    adviceFlag = MADV_PAGEOUT;
+                #else
+                    adviceFlag = MADV_DONTNEED;
+                #endif
+                break;
+        }
+
+        if (advice == BBFAdvice::DONTNEED || advice == BBFAdvice::COLD || advice == BBFAdvice::PAGEOUT)
+        {
+            alignedStart = (rangeAddress + systemPageSize - 1) & ~(uintptr_t)(systemPageSize - 1);
+            alignedEnd = (rangeAddress + length) & ~(uintptr_t)(systemPageSize - 1);
+
+            if (alignedEnd <= alignedStart)
+            {
+                return true;
+            }
+        }
+
+        if (madvise((void*)alignedStart, (size_t)(alignedEnd - alignedStart), adviceFlag) == 0)
+        {
+            return true;
+        }
+
+        #ifdef MADV_COLD
+            // Older kernels don't know MADV_COLD/MADV_PAGEOUT. Fall back to dropping the range.
+            if ((advice == BBFAdvice::COLD || advice == BBFAdvice::PAGEOUT) && errno == EINVAL)
+            {
+                return madvise((void*)alignedStart, (size_t)(alignedEnd - alignedStart), MADV_DONTNEED) == 0;
+            }
+        #endif
+
+        return false;
+    #endif
+}
+
+bool BBFMmapBackend::lock(uint64_t offset, uint64_t length)
+{
+    if (!getView(offset, length))
+    {
+        return false;
+    }
+
+    #if defined(_WIN32) || defined(__EMSCRIPTEN__)
+        return false;
+    #else
+        static const uint64_t systemPageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+        uintptr_t rangeAddress = (uintptr_t)(this->mapBuffer + offset);
+        uintptr_t alignedStart = rangeAddress & ~(uintptr_t)(systemPageSize - 1);
+
+        return mlock((void*)alignedStart, (size_t)(rangeAddress + length - alignedStart)) == 0;
+    #endif
+}
+
+// WINDOWED MMAP BACKEND
+
+BBFWindowedMmapBackend::BBFWindowedMmapBackend(const char* iFile, uint64_t wSize, uint32_t wCount)
+{
+    this->fileSize = 0;
+    this->useClock = 0;
+    this->windowCount = (wCount == 0) ? 1 : wCount;
+    this->windows = nullptr;
+
+    // Windows have to start on a mapping boundary
+    #ifdef _WIN32
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+        uint64_t mapGranularity = systemInfo.dwAllocationGranularity;
+    #else
+        uint64_t mapGranularity = (uint64_t)sysconf(_SC_PAGESIZE);
+    #endif
+    if (wSize < mapGranularity)
+    {
+        wSize = mapGranularity;
+    }
+    this->windowSize = (wSize + mapGranularity - 1) & ~(mapGranularity - 1);
+
+    #ifdef _WIN32
+        this->hMap = NULL;
+        this->hFile = CreateFileA(iFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+        if (this->hFile == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(this->hFile, &size);
+
+        this->hMap = CreateFileMappingA(this->hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (this->hMap == NULL)
+        {
+            fprintf(stderr, "[BBFCODEC] Failed to map file (CreateFileMapping)\n");
+            CloseHandle(this->hFile);
+            this->hFile = INVALID_HANDLE_VALUE;
+            return;
+        }
+        uint64_t openedSize = (uint64_t)size.QuadPart;
+    #else
+        this->fileDescriptor = open(iFile, O_RDONLY);
+        if (this->fileDescriptor == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(this->fileDescriptor, &fileStat) == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to stat file\n");
+            close(this->fileDescriptor);
+            this->fileDescriptor = -1;
+            return;
+        }
+        uint64_t openedSize = (uint64_t)fileStat.st_size;
+    #endif
+
+    this->windows = (MapWindow*)calloc(this->windowCount, sizeof(MapWindow));
+    if (!this->windows)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate map windows.\n");
+        return;
+    }
+
+    this->fileSize = openedSize;
+}
+
+BBFWindowedMmapBackend::~BBFWindowedMmapBackend()
+{
+    if (this->windows)
+    {
+        uint32_t windowIterator = 0;
+        for (; windowIterator < this->windowCount; windowIterator++)
+        {
+            unmapWindow(&this->windows[windowIterator]);
+        }
+
+        free(this->windows);
+        this->windows = nullptr;
+    }
+
+    #ifdef _WIN32
+        if (this->hMap != NULL) { CloseHandle(this->hMap); }
+        if (this->hFile != INVALID_HANDLE_VALUE) { CloseHandle(this->hFile); }
+    #else
+        if (this->fileDescriptor != -1) { close(this->fileDescriptor); }
+    #endif
+}
+
+void BBFWindowedMmapBackend::unmapWindow(MapWindow* window)
+{
+    if (!window->base)
+    {
+        return;
+    }
+
+    #ifdef _WIN32
+        UnmapViewOfFile(window->base);
+    #else
+        munmap(window->base, (size_t)window->length);
+    #endif
+
+    window->base = nullptr;
+    window->start = 0;
+    window->length = 0;
+    window->lastUse = 0;
+}
+
+const uint8_t* BBFWindowedMmapBackend::getView(uint64_t offset, uint64_t length)
+{
+    if (!this->windows || offset + length < offset || offset + length > this->fileSize)
+    {
+        return nullptr;
+    }
+
+    this->useClock++;
+
+    // Already mapped?
+    MapWindow* victim = &this->windows[0];
+    uint32_t windowIterator = 0;
+    for (; windowIterator < this->windowCount; windowIterator++)
+    {
+        MapWindow* window = &this->windows[windowIterator];
+        if (window->base && offset >= window->start && offset + length <= window->start + window->length)
+        {
+            window->lastUse = this->useClock;
+            return window->base + (offset - window->start);
+        }
+
+        if (!window->base || (victim->base && window->lastUse < victim->lastUse))
+        {
+            victim = window;
+        }
+    }
+
+    // Map a new window over the least recently used one. Assets larger than a window get a window of their own size.
+    unmapWindow(victim);
+
+    uint64_t windowStart = offset - (offset % this->windowSize);
+    uint64_t windowLength = offset + length - windowStart;
+    windowLength = (windowLength < this->windowSize) ? this->windowSize : windowLength;
+    windowLength = (windowStart + windowLength > this->fileSize) ? this->fileSize - windowStart : windowLength;
+
+    if (windowLength == 0)
+    {
+        return nullptr;
+    }
+
+    #ifdef _WIN32
+        void* wMap = MapViewOfFile(this->hMap, FILE_MAP_READ, (DWORD)(windowStart >> 32), (DWORD)(windowStart & 0xFFFFFFFF), (SIZE_T)windowLength);
+        if (wMap == NULL)
+        {
+            fprintf(stderr, "[BBFCODEC] Failed to map window (MapViewOfFile)\n");
+            return nullptr;
+        }
+    #else
+        void* wMap = mmap(NULL, (size_t)windowLength, PROT_READ, MAP_PRIVATE, this->fileDescriptor, (off_t)windowStart);
+        if (wMap == MAP_FAILED)
+        {
+            fprintf(stderr, "[BBFCODEC] mmap failed for window at %llu\n", (unsigned long long)windowStart);
+            return nullptr;
+        }
+    #endif
+
+    victim->base = (uint8_t*)wMap;
+    victim->start = windowStart;
+    victim->length = windowLength;
+    victim->lastUse = this->useClock;
+
+    return victim->base + (offset - windowStart);
+}
+
+bool BBFWindowedMmapBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    const uint8_t* srcView = getView(offset, length);
+    if (!srcView)
+    {
+        return false;
+    }
+
+    memcpy(dst, srcView, (size_t)length);
+    return true;
+}
+
+bool BBFWindowedMmapBackend::advise(uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    if (offset + length < offset || offset + length > this->fileSize)
+    {
+        return false;
+    }
+
+    // Most of the file isn't mapped, so hint the page cache instead.
+    #if defined(_WIN32)
+        (void)advice;
+        return true;
+    #else
+        return fileAdvise(this->fileDescriptor, offset, length, advice);
+    #endif
+}
+
+// CACHED BACKEND
+
+BBFCachedBackend::BBFCachedBackend(uint32_t bSize, uint32_t bCount)
+{
+    this->cacheSize = 0;
+    this->blockSize = (bSize < 4096) ? 4096 : bSize;
+    this->blockCount = (bCount < 2) ? 2 : bCount;
+    this->useClock = 0;
+    this->blocks = nullptr;
+    this->blockData = nullptr;
+    this->fetchBuffer = nullptr;
+    this->cacheHits = 0;
+    this->cacheMisses = 0;
+}
+
+BBFCachedBackend::~BBFCachedBackend()
+{
+    if (this->blocks) { free(this->blocks); this->blocks = nullptr; }
+    if (this->blockData) { free(this->blockData); this->blockData = nullptr; }
+    if (this->fetchBuffer) { free(this->fetchBuffer); this->fetchBuffer = nullptr; }
+}
+
+bool BBFCachedBackend::initCache(uint64_t bookSize)
+{
+    this->blocks = (CacheBlock*)calloc(this->blockCount, sizeof(CacheBlock));
+    this->blockData = (uint8_t*)malloc((size_t)this->blockSize * this->blockCount);
+    this->fetchBuffer = (uint8_t*)malloc((size_t)this->blockSize * 2);
+    if (!this->blocks || !this->blockData || !this->fetchBuffer)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to allocate %u block cache.\n", this->blockCount);
+        return false;
+    }
+
+    uint32_t blockIterator = 0;
+    for (; blockIterator < this->blockCount; blockIterator++)
+    {
+        this->blocks[blockIterator].blockIndex = 0xFFFFFFFFFFFFFFFF;
+        this->blocks[blockIterator].data = this->blockData + (size_t)this->blockSize * blockIterator;
+    }
+
+    this->cacheSize = bookSize;
+    return true;
+}
+
+BBFCachedBackend::CacheBlock* BBFCachedBackend::findBlock(uint64_t blockIndex)
+{
+    uint32_t blockIterator = 0;
+    for (; blockIterator < this->blockCount; blockIterator++)
+    {
+        if (this->blocks[blockIterator].blockIndex == blockIndex)
+        {
+            this->blocks[blockIterator].lastUse = ++this->useClock;
+            return &this->blocks[blockIterator];
+        }
+    }
+    return nullptr;
+}
+
+BBFCachedBackend::CacheBlock* BBFCachedBackend::claimBlock(uint64_t blockIndex, const uint8_t* src, uint64_t validBytes)
+{
+    CacheBlock* victim = &this->blocks[0];
+    uint32_t blockIterator = 1;
+    for (; blockIterator < this->blockCount; blockIterator++)
+    {
+        if (this->blocks[blockIterator].lastUse < victim->lastUse)
+        {
+            victim = &this->blocks[blockIterator];
+        }
+    }
+
+    memcpy(victim->data, src, (size_t)validBytes);
+    victim->blockIndex = blockIndex;
+    victim->validBytes = validBytes;
+    victim->lastUse = ++this->useClock;
+    return victim;
+}
+
+bool BBFCachedBackend::loadBlocks(uint64_t firstBlock, uint64_t lastBlock)
+{
+    // Skip what's cached, and fetch the rest (one or two blocks) in a single request.
+    while (firstBlock <= lastBlock && findBlock(firstBlock))
+    {
+        this->cacheHits++;
+        firstBlock++;
+    }
+    while (lastBlock >= firstBlock && lastBlock > 0 && findBlock(lastBlock))
+    {
+        this->cacheHits++;
+        lastBlock--;
+    }
+    if (firstBlock > lastBlock)
+    {
+        return true;
+    }
+
+    this->cacheMisses += lastBlock - firstBlock + 1;
+
+    uint64_t fetchStart = firstBlock * this->blockSize;
+    uint64_t fetchEnd = (lastBlock + 1) * this->blockSize;
+    fetchEnd = (fetchEnd > this->cacheSize) ? this->cacheSize : fetchEnd;
+
+    if (!fetch(fetchStart, this->fetchBuffer, fetchEnd - fetchStart))
+    {
+        fprintf(stderr, "[BBFCODEC] Read failed at %llu\n", (unsigned long long)fetchStart);
+        return false;
+    }
+
+    uint64_t blockIterator = firstBlock;
+    for (; blockIterator <= lastBlock; blockIterator++)
+    {
+        uint64_t blockStart = blockIterator * this->blockSize;
+        uint64_t blockBytes = (fetchEnd - blockStart > this->blockSize) ? this->blockSize : fetchEnd - blockStart;
+        claimBlock(blockIterator, this->fetchBuffer + (blockStart - fetchStart), blockBytes);
+    }
+
+    return true;
+}
+
+bool BBFCachedBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    if (!this->blocks || !inRange(offset, length))
+    {
+        return false;
+    }
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    // Big reads (whole images, usually) would just flush the cache. Go straight to the source.
+    if (length >= this->blockSize)
+    {
+        return fetch(offset, dst, length);
+    }
+
+    // Smaller than a block, so it touches two blocks at most
+    uint64_t firstBlock = offset / this->blockSize;
+    uint64_t lastBlock = (offset + length - 1) / this->blockSize;
+    if (!loadBlocks(firstBlock, lastBlock))
+    {
+        return false;
+    }
+
+    uint8_t* dstBytes = (uint8_t*)dst;
+    uint64_t bytesDone = 0;
+    while (bytesDone < length)
+    {
+        uint64_t readOffset = offset + bytesDone;
+        CacheBlock* block = findBlock(readOffset / this->blockSize);
+        if (!block)
+        {
+            return false;
+        }
+
+        uint64_t blockOffset = readOffset - block->blockIndex * this->blockSize;
+        uint64_t copyBytes = block->validBytes - blockOffset;
+        copyBytes = (copyBytes > length - bytesDone) ? length - bytesDone : copyBytes;
+
+        memcpy(dstBytes + bytesDone, block->data + blockOffset, (size_t)copyBytes);
+        bytesDone += copyBytes;
+    }
+
+    return true;
+}
+
+const uint8_t* BBFCachedBackend::getView(uint64_t offset, uint64_t length)
+{
+    if (!this->blocks || !inRange(offset, length))
+    {
+        return nullptr;
+    }
+
+    // Inside a single block? Point straight into the cache.
+    uint64_t blockIndex = offset / this->blockSize;
+    if (length > 0 && length < this->blockSize && (offset + length - 1) / this->blockSize == blockIndex)
+    {
+        if (!loadBlocks(blockIndex, blockIndex))
+        {
+            return nullptr;
+        }
+
+        CacheBlock* block = findBlock(blockIndex);
+        return block ? block->data + (offset - blockIndex * this->blockSize) : nullptr;
+    }
+
+    return BBFIOBackend::getView(offset, length);
+}
+
+// PREAD BACKEND
+
+BBFPreadBackend::BBFPreadBackend(const char* iFile, uint32_t bSize, uint32_t bCount) : BBFCachedBackend(bSize, bCount)
+{
+    #ifdef _WIN32
+        this->hFile = CreateFileA(iFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (this->hFile == INVALID_HANDLE_VALUE)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        LARGE_INTEGER size;
+        GetFileSizeEx(this->hFile, &size);
+        uint64_t openedSize = (uint64_t)size.QuadPart;
+    #else
+        this->fileDescriptor = open(iFile, O_RDONLY);
+        if (this->fileDescriptor == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to open file %s\n", iFile);
+            return;
+        }
+
+        struct stat fileStat;
+        if (fstat(this->fileDescriptor, &fileStat) == -1)
+        {
+            fprintf(stderr, "[BBFCODEC] Unable to stat file\n");
+            close(this->fileDescriptor);
+            this->fileDescriptor = -1;
+            return;
+        }
+        uint64_t openedSize = (uint64_t)fileStat.st_size;
+    #endif
+
+    initCache(openedSize);
+}
+
+BBFPreadBackend::~BBFPreadBackend()
+{
+    #ifdef _WIN32
+        if (this->hFile != INVALID_HANDLE_VALUE) { CloseHandle(this->hFile); }
+    #else
+        if (this->fileDescriptor != -1) { close(this->fileDescriptor); }
+    #endif
+}
+
+bool BBFPreadBackend::fetch(uint64_t offset, void* dst, uint64_t length)
+{
+    #ifdef _WIN32
+        return readFileFull(this->hFile, offset, dst, length);
+    #else
+        return preadFull(this->fileDescriptor, offset, dst, length);
+    #endif
+}
+
+bool BBFPreadBackend::advise(uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    if (!inRange(offset, length))
+    {
+        return false;
+    }
+
+    #if defined(_WIN32)
+        (void)advice;
+        return true;
+    #else
+        return fileAdvise(this->fileDescriptor, offset, length, advice);
+    #endif
+}
+
+// RANGE BACKEND
+
+BBFRangeBackend::BBFRangeBackend(BBFReadCallback rFetchFn, void* rUserData, uint64_t rSize, uint32_t bSize, uint32_t bCount, uint64_t sLimit) : BBFCachedBackend(bSize, bCount)
+{
+    this->fetchFn = rFetchFn;
+    this->userData = rUserData;
+    this->stageLimit = sLimit;
+    this->stagedBytes = 0;
+    this->stageClock = 0;
+    this->fetchCount = 0;
+    this->fetchedBytes = 0;
+    memset(this->staged, 0, sizeof(this->staged));
+
+    if (this->fetchFn)
+    {
+        initCache(rSize);
+    }
+}
+
+BBFRangeBackend::~BBFRangeBackend()
+{
+    uint32_t slotIterator = 0;
+    for (; slotIterator < STAGE_SLOTS; slotIterator++)
+    {
+        dropStaged(&this->staged[slotIterator]);
+    }
+}
+
+bool BBFRangeBackend::fetch(uint64_t offset, void* dst, uint64_t length)
+{
+    this->fetchCount++;
+    this->fetchedBytes += length;
+    return this->fetchFn(this->userData, offset, dst, length);
+}
+
+void BBFRangeBackend::dropStaged(StagedRange* range)
+{
+    if (range->data)
+    {
+        free(range->data);
+        this->stagedBytes -= range->length;
+    }
+    memset(range, 0, sizeof(StagedRange));
+}
+
+const BBFRangeBackend::StagedRange* BBFRangeBackend::findStaged(uint64_t offset, uint64_t length)
+{
+    uint32_t slotIterator = 0;
+    for (; slotIterator < STAGE_SLOTS; slotIterator++)
+    {
+        StagedRange* range = &this->staged[slotIterator];
+        if (range->data && offset >= range->start && offset + length <= range->start + range->length)
+        {
+            range->lastUse = ++this->stageClock;
+            return range;
+        }
+    }
+    return nullptr;
+}
+
+bool BBFRangeBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    if (!inRange(offset, length))
+    {
+        return false;
+    }
+
+    const StagedRange* range = findStaged(offset, length);
+    if (range)
+    {
+        memcpy(dst, range->data + (offset - range->start), (size_t)length);
+        return true;
+    }
+
+    return BBFCachedBackend::read(offset, dst, length);
+}
+
+const uint8_t* BBFRangeBackend::getView(uint64_t offset, uint64_t length)
+{
+    if (!inRange(offset, length))
+    {
+        return nullptr;
+    }
+
+    const StagedRange* range = findStaged(offset, length);
+    if (range)
+    {
+        return range->data + (offset - range->start);
+    }
+
+    // Asset sized views bypass the block cache. Stage them, so looking at a page twice doesn't fetch it twice.
+    if (length < getBlockSize() || length > this->stageLimit / STAGE_SLOTS || !advise(offset, length, BBFAdvice::WILLNEED))
+    {
+        return BBFCachedBackend::getView(offset, length);
+    }
+
+    range = findStaged(offset, length);
+    return range ? range->data + (offset - range->start) : BBFCachedBackend::getView(offset, length);
+}
+
+bool BBFRangeBackend::advise(uint64_t offset, uint64_t length, BBFAdvice advice)
+{
+    if (!inRange(offset, length))
+    {
+        return false;
+    }
+
+    // Dropping staged data is all the other hints can do here
+    if (advice == BBFAdvice::DONTNEED || advice == BBFAdvice::COLD || advice == BBFAdvice::PAGEOUT)
+    {
+        uint32_t slotIterator = 0;
+        for (; slotIterator < STAGE_SLOTS; slotIterator++)
+        {
+            StagedRange* range = &this->staged[slotIterator];
+            if (range->data && range->start >= offset && range->start + range->length <= offset + length)
+            {
+                dropStaged(range);
+            }
+        }
+        return true;
+    }
+
+    if (advice != BBFAdvice::WILLNEED || length == 0 || length > this->stageLimit || findStaged(offset, length))
+    {
+        return true;
+    }
+
+    // Callers already merged neighbouring pages (BBFReader::advisePages), so this is one request per run.
+    StagedRange* victim = &this->staged[0];
+    uint32_t slotIterator = 0;
+    for (; slotIterator < STAGE_SLOTS; slotIterator++)
+    {
+        if (!this->staged[slotIterator].data)
+        {
+            victim = &this->staged[slotIterator];
+            break;
+        }
+
+        if (this->staged[slotIterator].lastUse < victim->lastUse)
+        {
+            victim = &this->staged[slotIterator];
+        }
+    }
+    dropStaged(victim);
+
+    // Make room under the limit, oldest first
+    while (this->stagedBytes + length > this->stageLimit)
+    {
+        StagedRange* oldest = nullptr;
+        for (slotIterator = 0; slotIterator < STAGE_SLOTS; slotIterator++)
+        {
+            StagedRange* range = &this->staged[slotIterator];
+            if (range->data && (!oldest || range->lastUse < oldest->lastUse))
+            {
+                oldest = range;
+            }
+        }
+
+        if (!oldest)
+        {
+            break;
+        }
+        dropStaged(oldest);
+    }
+
+    uint8_t* stageData = (uint8_t*)malloc((size_t)length);
+    if (!stageData)
+    {
+        return false;
+    }
+
+    if (!fetch(offset, stageData, length))
+    {
+        free(stageData);
+        return false;
+    }
+
+    victim->start = offset;
+    victim->length = length;
+    victim->lastUse = ++this->stageClock;
+    victim->data = stageData;
+    this->stagedBytes += length;
+    return true;
+}
+
+// MEMORY BACKEND
+
+bool BBFMemoryBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    const uint8_t* srcView = getView(offset, length);
+    if (!srcView)
+    {
+        return false;
+    }
+
+    memcpy(dst, srcView, (size_t)length);
+    return true;
+}
+
+const uint8_t* BBFMemoryBackend::getView(uint64_t offset, uint64_t length)
+{
+    if (!this->memoryData || offset + length < offset || offset + length > this->memorySize)
+    {
+        return nullptr;
+    }
+
+    return this->memoryData + offset;
+}
+
+// CALLBACK BACKEND
+
+bool BBFCallbackBackend::read(uint64_t offset, void* dst, uint64_t length)
+{
+    if (!this->readFn || offset + length < offset || offset + length > this->callbackSize)
+    {
+        return false;
+    }
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    return this->readFn(this->userData, offset, dst, length);
+}
@@ -0,0 +1,297 @@
+// BBF I/O Backends
+// Where BBFReader gets its bytes from.
+#ifndef BBFIO_H
+#define BBFIO_H
+
+#ifdef _WIN32
+    #define WIN32_LEAN_AND_MEAN
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <sys/uio.h>
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+// Kernel paging hints (see BBFIOBackend::advise)
+enum class BBFAdvice: uint8_t
+{
+    NORMAL = 0,
+    SEQUENTIAL,
+    RANDOM,
+    WILLNEED,
+    DONTNEED,
+    COLD,
+    PAGEOUT
+};
+
+// User read callback. Copy (length) bytes at (offset) into dst, return false on failure.
+typedef bool (*BBFReadCallback)(void* userData, uint64_t offset, void* dst, uint64_t length);
+
+class BBFIOBackend
+{
+    public:
+        BBFIOBackend();
+        virtual ~BBFIOBackend();
+
+        // Size of the book in bytes. 0 if the backend failed to open.
+        virtual uint64_t getSize() const = 0;
+
+        // Copy [offset, offset + length) into dst.
+        virtual bool read(uint64_t offset, void* dst, uint64_t length) = 0;
+
+        // The whole book in memory, if this backend has it that way (mmap, memory buffer).
+        virtual const uint8_t* getMapping() { return nullptr; }
+
+        // Pointer to [offset, offset + length). Only valid until the next getView call.
+        virtual const uint8_t* getView(uint64_t offset, uint64_t length);
+
+        // Paging hints. Backends that can't act on them just ignore them.
+        virtual bool advise(uint64_t offset, uint64_t length, BBFAdvice advice) { (void)offset; (void)length; (void)advice; return true; }
+
+        // mlock a range of the mapping. False if there's nothing to lock.
+        virtual bool lock(uint64_t offset, uint64_t length) { (void)offset; (void)length; return false; }
+
+        // The file behind this backend, for pread/io_uring/sendfile. -1 if there isn't one (or on Windows).
+        // Book offset 0 is file offset getBaseOffset().
+        virtual int getFileDescriptor() const { return -1; }
+        virtual uint64_t getBaseOffset() const { return 0; }
+
+    protected:
+        uint8_t* scratchBuffer;
+        uint64_t scratchCap;
+};
+
+// Full file mapping. The default, and what BBFReader has always done.
+class BBFMmapBackend : public BBFIOBackend
+{
+    public:
+        BBFMmapBackend(const char* iFile);
+        #ifndef _WIN32
+            // A book stored inside a larger file. Offset 0 is baseOffset, length 0 means "to the end".
+            // The fd is dup'd, the caller keeps theirs.
+            BBFMmapBackend(int iFileDescriptor, uint64_t baseOffset, uint64_t length);
+        #endif
+        ~BBFMmapBackend();
+
+        uint64_t getSize() const override { return mapSize; }
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+        const uint8_t* getMapping() override { return mapBuffer; }
+        const uint8_t* getView(uint64_t offset, uint64_t length) override;
+        bool advise(uint64_t offset, uint64_t length, BBFAdvice advice) override;
+        bool lock(uint64_t offset, uint64_t length) override;
+
+        #ifndef _WIN32
+            int getFileDescriptor() const override { return mapBuffer ? fileDescriptor : -1; }
+            uint64_t getBaseOffset() const override { return fileBase; }
+        #endif
+
+    private:
+        #ifdef _WIN32
+            HANDLE hFile;
+            HANDLE hMap;
+        #else
+            int fileDescriptor;
+        #endif
+
+        uint64_t fileBase;
+        uint8_t* mapBuffer; // start of the book
+        uint64_t mapSize;
+        uint8_t* mapBase; // start of the mapping, page aligned
+        uint64_t mapLength;
+};
+
+// Maps a handful of fixed size windows on demand. For 32-bit targets and huge books.
+class BBFWindowedMmapBackend : public BBFIOBackend
+{
+    public:
+        BBFWindowedMmapBackend(const char* iFile, uint64_t wSize = 64 * 1024 * 1024, uint32_t wCount = 4);
+        ~BBFWindowedMmapBackend();
+
+        uint64_t getSize() const override { return fileSize; }
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+        const uint8_t* getView(uint64_t offset, uint64_t length) override;
+        bool advise(uint64_t offset, uint64_t length, BBFAdvice advice) override;
+
+        #ifndef _WIN32
+            int getFileDescriptor() const override { return windows ? fileDescriptor : -1; }
+        #endif
+
+    private:
+        struct MapWindow
+        {
+            uint8_t* base;
+            uint64_t start;
+            uint64_t length;
+            uint64_t lastUse;
+        };
+
+        #ifdef _WIN32
+            HANDLE hFile;
+            HANDLE hMap;
+        #else
+            int fileDescriptor;
+        #endif
+
+        uint64_t fileSize;
+        uint64_t windowSize;
+        uint32_t windowCount;
+        uint64_t useClock;
+        MapWindow* windows;
+
+        void unmapWindow(MapWindow* window);
+};
+
+// Small reads go through an LRU block cache, big ones straight to fetch().
+// Base for backends where every read is a syscall or a request.
+class BBFCachedBackend : public BBFIOBackend
+{
+    public:
+        BBFCachedBackend(uint32_t bSize, uint32_t bCount);
+        ~BBFCachedBackend();
+
+        uint64_t getSize() const override { return cacheSize; }
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+        const uint8_t* getView(uint64_t offset, uint64_t length) override;
+
+        uint64_t getCacheHits() const { return cacheHits; }
+        uint64_t getCacheMisses() const { return cacheMisses; }
+
+    protected:
+        // Read [offset, offset + length) from wherever the book lives.
+        virtual bool fetch(uint64_t offset, void* dst, uint64_t length) = 0;
+
+        bool initCache(uint64_t bookSize); // call once the size is known
+        bool inRange(uint64_t offset, uint64_t length) const { return offset + length >= offset && offset + length <= cacheSize; }
+        uint32_t getBlockSize() const { return blockSize; }
+
+    private:
+        struct CacheBlock
+        {
+            uint64_t blockIndex;
+            uint64_t validBytes;
+            uint64_t lastUse;
+            uint8_t* data;
+        };
+
+        uint64_t cacheSize;
+        uint32_t blockSize;
+        uint32_t blockCount;
+        uint64_t useClock;
+        CacheBlock* blocks;
+        uint8_t* blockData;
+        uint8_t* fetchBuffer; // two blocks, so a read across a boundary is one fetch
+
+        uint64_t cacheHits;
+        uint64_t cacheMisses;
+
+        CacheBlock* findBlock(uint64_t blockIndex);
+        CacheBlock* claimBlock(uint64_t blockIndex, const uint8_t* src, uint64_t validBytes);
+        bool loadBlocks(uint64_t firstBlock, uint64_t lastBlock);
+};
+
+// pread() through the block cache. For filesystems where mmap is slow or unsafe.
+class BBFPreadBackend : public BBFCachedBackend
+{
+    public:
+        BBFPreadBackend(const char* iFile, uint32_t bSize = 65536, uint32_t bCount = 64);
+        ~BBFPreadBackend();
+
+        bool advise(uint64_t offset, uint64_t length, BBFAdvice advice) override;
+
+        #ifndef _WIN32
+            int getFileDescriptor() const override { return (getSize() != 0) ? fileDescriptor : -1; }
+        #endif
+
+    protected:
+        bool fetch(uint64_t offset, void* dst, uint64_t length) override;
+
+    private:
+        #ifdef _WIN32
+            HANDLE hFile;
+        #else
+            int fileDescriptor;
+        #endif
+};
+
+// Books on object storage. Every byte comes from a user fetchRange callback (an HTTP range request, usually).
+// Opening costs the header, footer and index. Prefetch hints fetch whole page runs in one request and keep them staged.
+class BBFRangeBackend : public BBFCachedBackend
+{
+    public:
+        BBFRangeBackend(BBFReadCallback rFetchFn, void* rUserData, uint64_t rSize, uint32_t bSize = 16384, uint32_t bCount = 64, uint64_t sLimit = 16 * 1024 * 1024);
+        ~BBFRangeBackend();
+
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+        const uint8_t* getView(uint64_t offset, uint64_t length) override;
+        bool advise(uint64_t offset, uint64_t length, BBFAdvice advice) override;
+
+        uint64_t getFetchCount() const { return fetchCount; }
+        uint64_t getFetchedBytes() const { return fetchedBytes; }
+
+    protected:
+        bool fetch(uint64_t offset, void* dst, uint64_t length) override;
+
+    private:
+        struct StagedRange
+        {
+            uint64_t start;
+            uint64_t length;
+            uint64_t lastUse;
+            uint8_t* data;
+        };
+
+        constexpr static uint32_t STAGE_SLOTS = 8;
+
+        BBFReadCallback fetchFn;
+        void* userData;
+
+        StagedRange staged[STAGE_SLOTS];
+        uint64_t stageLimit; // bytes held across all staged ranges
+        uint64_t stagedBytes;
+        uint64_t stageClock;
+
+        uint64_t fetchCount;
+        uint64_t fetchedBytes;
+
+        const StagedRange* findStaged(uint64_t offset, uint64_t length);
+        void dropStaged(StagedRange* range);
+};
+
+// A book that's already in memory. Not copied, the caller keeps it alive.
+class BBFMemoryBackend : public BBFIOBackend
+{
+    public:
+        BBFMemoryBackend(const uint8_t* mData, uint64_t mSize) : memoryData(mData), memorySize(mData ? mSize : 0) {}
+
+        uint64_t getSize() const override { return memorySize; }
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+        const uint8_t* getMapping() override { return memoryData; }
+        const uint8_t* getView(uint64_t offset, uint64_t length) override;
+
+    private:
+        const uint8_t* memoryData;
+        uint64_t memorySize;
+};
+
+// Every read goes through a user callback.
+class BBFCallbackBackend : public BBFIOBackend
+{
+    public:
+        BBFCallbackBackend(BBFReadCallback cReadFn, void* cUserData, uint64_t cSize) : readFn(cReadFn), userData(cUserData), callbackSize(cReadFn ? cSize : 0) {}
+
+        uint64_t getSize() const override { return callbackSize; }
+        bool read(uint64_t offset, void* dst, uint64_t length) override;
+
+    private:
+        BBFReadCallback readFn;
+        void* userData;
+        uint64_t callbackSize;
+};
+
+#endif // BBFIO_H
@@ -0,0 +1,258 @@
+#include "bbfmove.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+    #include <sys/stat.h>
+#endif
+
+#ifdef __linux__
+    #include <sys/ioctl.h>
+    #include <linux/fs.h>
+#endif
+
+BBFDataMover::BBFDataMover(int mSourceFd, int mDestFd)
+{
+    this->sourceFd = mSourceFd;
+    this->destFd = mDestFd;
+    this->blockSize = 4096;
+    this->buffer = nullptr;
+    this->lastMethod = BBFCopyMethod::NONE;
+
+    #ifdef __linux__
+        this->reflinkAllowed = true;
+        this->kernelAllowed = true;
+
+        struct stat destStat;
+        if (fstat(this->destFd, &destStat) == 0 && destStat.st_blksize > 0)
+        {
+            this->blockSize = (uint64_t)destStat.st_blksize;
+        }
+    #else
+        this->reflinkAllowed = false;
+        this->kernelAllowed = false;
+    #endif
+}
+
+BBFDataMover::~BBFDataMover()
+{
+    free(this->buffer);
+}
+
+void BBFDataMover::disable(BBFCopyMethod method)
+{
+    if (method == BBFCopyMethod::REFLINK)
+    {
+        this->reflinkAllowed = false;
+    }
+    else if (method == BBFCopyMethod::KERNEL)
+    {
+        this->kernelAllowed = false;
+    }
+}
+
+const char* BBFDataMover::methodName(BBFCopyMethod method)
+{
+    switch (method)
+    {
+        case BBFCopyMethod::REFLINK: return "reflink";
+        case BBFCopyMethod::KERNEL: return "copy_file_range";
+        case BBFCopyMethod::BUFFERED: return "buffered";
+        default: return "none";
+    }
+}
+
+void BBFDataMover::noteMethod(BBFCopyMethod method)
+{
+    if ((uint8_t)method > (uint8_t)this->lastMethod)
+    {
+        this->lastMethod = method;
+    }
+}
+
+bool BBFDataMover::reflinkRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length)
+{
+    #ifdef __linux__
+        struct file_clone_range cloneRange;
+        cloneRange.src_fd = this->sourceFd;
+        cloneRange.src_offset = sourceOffset;
+        cloneRange.src_length = length;
+        cloneRange.dest_offset = destOffset;
+
+        if (ioctl(this->destFd, FICLONERANGE, &cloneRange) == 0)
+        {
+            this->stats.reflinkBytes += length;
+            noteMethod(BBFCopyMethod::REFLINK);
+            return true;
+        }
+
+        // Not supported here (ext4, tmpfs), different filesystems, or a layout it won't share. Don't ask again.
+        this->reflinkAllowed = false;
+    #else
+        (void)sourceOffset;
+        (void)destOffset;
+        (void)length;
+    #endif
+    return false;
+}
+
+bool BBFDataMover::kernelRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length, uint64_t* copiedBytes)
+{
+    *copiedBytes = 0;
+
+    #ifdef __linux__
+        while (*copiedBytes < length)
+        {
+            loff_t sourcePos = (loff_t)(sourceOffset + *copiedBytes);
+            loff_t destPos = (loff_t)(destOffset + *copiedBytes);
+            uint64_t remaining = length - *copiedBytes;
+            size_t chunk = (remaining > 0x40000000) ? 0x40000000 : (size_t)remaining;
+
+            ssize_t copied = copy_file_range(this->sourceFd, &sourcePos, this->destFd, &destPos, chunk, 0);
+            if (copied < 0 && errno == EINTR)
+            {
+                continue;
+            }
+
+            if (copied <= 0)
+            {
+                // ENOSYS/EXDEV/EOPNOTSUPP/EINVAL: this pair of files can't do it. Short source is a real error,
+                // but the buffered copy reports that just the same.
+                this->kernelAllowed = false;
+                break;
+            }
+
+            *copiedBytes += (uint64_t)copied;
+        }
+
+        this->stats.kernelBytes += *copiedBytes;
+        if (*copiedBytes)
+        {
+            noteMethod(BBFCopyMethod::KERNEL);
+        }
+        return *copiedBytes == length;
+    #else
+        (void)sourceOffset;
+        (void)destOffset;
+        (void)length;
+        return false;
+    #endif
+}
+
+bool BBFDataMover::bufferedRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length)
+{
+    if (!this->buffer)
+    {
+        this->buffer = (uint8_t*)malloc(BBF::MOVE_BUFFER_SIZE);
+        if (!this->buffer)
+        {
+            return false;
+        }
+    }
+
+    uint64_t copiedBytes = 0;
+    while (copiedBytes < length)
+    {
+        uint64_t remaining = length - copiedBytes;
+        uint64_t chunk = (remaining > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : remaining;
+
+        #ifdef _WIN32
+            if (_lseeki64(this->sourceFd, (__int64)(sourceOffset + copiedBytes), SEEK_SET) < 0 ||
+                _read(this->sourceFd, this->buffer, (unsigned int)chunk) != (int)chunk ||
+                _lseeki64(this->destFd, (__int64)(destOffset + copiedBytes), SEEK_SET) < 0 ||
+                _write(this->destFd, this->buffer, (unsigned int)chunk) != (int)chunk)
+            {
+                fprintf(stderr, "[BBFCODEC] Copy failed at %llu.\n", (unsigned long long)(sourceOffset + copiedBytes));
+                return false;
+            }
+        #else
+            uint64_t chunkDone = 0;
+            while (chunkDone < chunk)
+            {
+                ssize_t readBytes = pread(this->sourceFd, this->buffer + chunkDone, (size_t)(chunk - chunkDone), (off_t)(sourceOffset + copiedBytes + chunkDone));
+                if (readBytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (readBytes <= 0)
+                {
+                    fprintf(stderr, "[BBFCODEC] Copy failed reading at %llu.\n", (unsigned long long)(sourceOffset + copiedBytes + chunkDone));
+                    return false;
+                }
+                chunkDone += (uint64_t)readBytes;
+            }
+
+            chunkDone = 0;
+            while (chunkDone < chunk)
+            {
+                ssize_t wroteBytes = pwrite(this->destFd, this->buffer + chunkDone, (size_t)(chunk - chunkDone), (off_t)(destOffset + copiedBytes + chunkDone));
+                if (wroteBytes < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (wroteBytes <= 0)
+                {
+                    fprintf(stderr, "[BBFCODEC] Copy failed writing at %llu.\n", (unsigned long long)(destOffset + copiedBytes + chunkDone));
+                    return false;
+                }
+                chunkDone += (uint64_t)wroteBytes;
+            }
+        #endif
+
+        copiedBytes += chunk;
+    }
+
+    this->stats.bufferedBytes += length;
+    if (length)
+    {
+        noteMethod(BBFCopyMethod::BUFFERED);
+    }
+    return true;
+}
+
+bool BBFDataMover::copyUnaligned(uint64_t sourceOffset, uint64_t destOffset, uint64_t length)
+{
+    uint64_t copiedBytes = 0;
+    if (this->kernelAllowed && kernelRange(sourceOffset, destOffset, length, &copiedBytes))
+    {
+        return true;
+    }
+
+    // Whatever copy_file_range didn't get to
+    return bufferedRange(sourceOffset + copiedBytes, destOffset + copiedBytes, length - copiedBytes);
+}
+
+bool BBFDataMover::copy(uint64_t sourceOffset, uint64_t destOffset, uint64_t length)
+{
+    this->lastMethod = BBFCopyMethod::NONE;
+    this->stats.copyCount++;
+
+    if (length == 0)
+    {
+        return true;
+    }
+
+    // Reflinks share whole blocks, so both offsets need the same position within a block.
+    // Clone the aligned middle, copy the ragged ends.
+    if (this->reflinkAllowed && (sourceOffset % this->blockSize) == (destOffset % this->blockSize))
+    {
+        uint64_t headBytes = (this->blockSize - (sourceOffset % this->blockSize)) % this->blockSize;
+        if (headBytes < length)
+        {
+            uint64_t middleBytes = ((length - headBytes) / this->blockSize) * this->blockSize;
+            if (middleBytes > 0 && reflinkRange(sourceOffset + headBytes, destOffset + headBytes, middleBytes))
+            {
+                uint64_t tailStart = headBytes + middleBytes;
+                return copyUnaligned(sourceOffset, destOffset, headBytes) &&
+                       copyUnaligned(sourceOffset + tailStart, destOffset + tailStart, length - tailStart);
+            }
+        }
+    }
+
+    return copyUnaligned(sourceOffset, destOffset, length);
+}
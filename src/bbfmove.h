@@ -0,0 +1,73 @@
+// BBF Data Mover
+// Copies byte ranges between two files for the rewrite paths (petrify, repack, merge).
+// Tries a reflink first (FICLONERANGE, metadata only on XFS/btrfs), then copy_file_range,
+// then a plain read/write loop. Falls back per call, and stops trying a path once the filesystem refuses it.
+#ifndef BBFMOVE_H
+#define BBFMOVE_H
+
+#include "libbbf.h"
+
+#include <stdint.h>
+
+enum class BBFCopyMethod: uint8_t
+{
+    NONE = 0,
+    REFLINK, // FICLONERANGE, shares extents
+    KERNEL, // copy_file_range, stays in the kernel
+    BUFFERED // read + write through a user buffer
+};
+
+// Bytes moved by each path
+struct BBFCopyStats
+{
+    uint64_t reflinkBytes = 0;
+    uint64_t kernelBytes = 0;
+    uint64_t bufferedBytes = 0;
+    uint64_t copyCount = 0;
+};
+
+namespace BBF
+{
+    constexpr static uint64_t MOVE_BUFFER_SIZE = 1048576; // Buffered copy chunk [1MB]
+}
+
+class BBFDataMover
+{
+    public:
+        // File descriptors (CRT descriptors on Windows), kept open by the caller. Offsets are absolute.
+        BBFDataMover(int mSourceFd, int mDestFd);
+        ~BBFDataMover();
+        // Not copyable, it owns the copy buffer.
+        BBFDataMover(const BBFDataMover&) = delete;
+        BBFDataMover& operator=(const BBFDataMover&) = delete;
+
+        // Copy [sourceOffset, sourceOffset + length) to destOffset. Ranges in one file must not overlap.
+        bool copy(uint64_t sourceOffset, uint64_t destOffset, uint64_t length);
+
+        // Stop using a path, e.g. to test the fallbacks. BUFFERED can't be turned off.
+        void disable(BBFCopyMethod method);
+
+        const BBFCopyStats& getStats() const { return stats; }
+        BBFCopyMethod getLastMethod() const { return lastMethod; } // Slowest path the last copy needed
+        static const char* methodName(BBFCopyMethod method);
+
+    private:
+        int sourceFd;
+        int destFd;
+        uint64_t blockSize; // Reflink granularity, the destination's block size
+
+        bool reflinkAllowed;
+        bool kernelAllowed;
+
+        uint8_t* buffer;
+        BBFCopyStats stats;
+        BBFCopyMethod lastMethod;
+
+        bool reflinkRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length);
+        bool kernelRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length, uint64_t* copiedBytes);
+        bool bufferedRange(uint64_t sourceOffset, uint64_t destOffset, uint64_t length);
+        bool copyUnaligned(uint64_t sourceOffset, uint64_t destOffset, uint64_t length);
+        void noteMethod(BBFCopyMethod method);
+};
+
+#endif // BBFMOVE_H
@@ -0,0 +1,563 @@
+#include "bbfpatch.h"
+#include "bbfcodec.h"
+#include "dedupemap.h"
+#include "xxhash.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+// HELPERS
+
+static bool seekPatchFile(FILE* file, uint64_t offset)
+{
+    #ifdef _WIN32
+        return _fseeki64(file, (__int64)offset, SEEK_SET) == 0;
+    #else
+        return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+    #endif
+}
+
+static bool patchFileLength(FILE* file, uint64_t* fileLength)
+{
+    #ifdef _WIN32
+        if (_fseeki64(file, 0, SEEK_END) != 0) { return false; }
+        __int64 endPos = _ftelli64(file);
+    #else
+        if (fseeko(file, 0, SEEK_END) != 0) { return false; }
+        off_t endPos = ftello(file);
+    #endif
+
+    if (endPos < 0)
+    {
+        return false;
+    }
+    *fileLength = (uint64_t)endPos;
+    return true;
+}
+
+static uint64_t footerHashOf(const char* bookPath)
+{
+    BBFReader book(bookPath);
+    BBFHeader* header = book.getHeaderView();
+    BBFFooter* footer = header ? book.getFooterView(header->footerOffset) : nullptr;
+    return footer ? footer->footerHash : 0;
+}
+
+// DIFF
+
+// An asset of the new book that the old book already has
+struct ReuseSpan
+{
+    uint64_t newOffset;
+    uint64_t length;
+    uint64_t oldOffset;
+};
+
+struct PatchDraft
+{
+    FILE* patchFile;
+    XXH3_state_t* patchHashState;
+    XXH3_state_t* newHashState;
+
+    BBFPatchExtent* extents;
+    uint64_t extentCount;
+    uint64_t extentCapacity;
+    uint64_t literalSize;
+
+    BBFPatchStats* stats;
+};
+
+static bool pushExtent(PatchDraft* draft, BBFPatchSource source, uint64_t newOffset, uint64_t length, uint64_t sourceOffset)
+{
+    if (length == 0)
+    {
+        return true;
+    }
+
+    // Back to back ranges from the same place are one extent
+    if (draft->extentCount > 0)
+    {
+        BBFPatchExtent* lastExtent = &draft->extents[draft->extentCount - 1];
+        if (lastExtent->source == (uint32_t)source && lastExtent->newOffset + lastExtent->length == newOffset &&
+            (source == BBFPatchSource::ZERO || lastExtent->sourceOffset + lastExtent->length == sourceOffset))
+        {
+            lastExtent->length += length;
+            return true;
+        }
+    }
+
+    if (draft->extentCount == draft->extentCapacity)
+    {
+        uint64_t newCapacity = draft->extentCapacity ? draft->extentCapacity * 2 : 256;
+        BBFPatchExtent* newExtents = (BBFPatchExtent*)realloc(draft->extents, (size_t)(newCapacity * sizeof(BBFPatchExtent)));
+        if (!newExtents)
+        {
+            return false;
+        }
+        draft->extents = newExtents;
+        draft->extentCapacity = newCapacity;
+    }
+
+    BBFPatchExtent* extent = &draft->extents[draft->extentCount++];
+    extent->newOffset = newOffset;
+    extent->length = length;
+    extent->sourceOffset = (source == BBFPatchSource::ZERO) ? 0 : sourceOffset;
+    extent->source = (uint32_t)source;
+    extent->reserved = 0;
+    return true;
+}
+
+// New bytes. Long zero runs (padding) are only recorded, the rest goes into the patch.
+static bool addLiteral(PatchDraft* draft, const uint8_t* data, uint64_t length, uint64_t newOffset)
+{
+    uint64_t cursor = 0;
+    while (cursor < length)
+    {
+        uint64_t runEnd = cursor;
+        if (data[cursor] == 0)
+        {
+            while (runEnd < length && data[runEnd] == 0)
+            {
+                runEnd++;
+            }
+
+            if (runEnd - cursor >= BBF::PATCH_ZERO_RUN)
+            {
+                if (!pushExtent(draft, BBFPatchSource::ZERO, newOffset + cursor, runEnd - cursor, 0))
+                {
+                    return false;
+                }
+                draft->stats->zeroBytes += runEnd - cursor;
+                cursor = runEnd;
+                continue;
+            }
+        }
+        else
+        {
+            const uint8_t* nextZero = (const uint8_t*)memchr(data + cursor, 0, (size_t)(length - cursor));
+            runEnd = nextZero ? (uint64_t)(nextZero - data) : length;
+        }
+
+        uint64_t runLength = runEnd - cursor;
+        if (fwrite(data + cursor, 1, (size_t)runLength, draft->patchFile) != (size_t)runLength ||
+            !pushExtent(draft, BBFPatchSource::LITERAL, newOffset + cursor, runLength, draft->literalSize))
+        {
+            return false;
+        }
+        XXH3_64bits_update(draft->patchHashState, data + cursor, (size_t)runLength);
+        draft->literalSize += runLength;
+        draft->stats->literalBytes += runLength;
+        cursor = runEnd;
+    }
+    return true;
+}
+
+// Read [offset, offset + length) of the new book in order. Everything is hashed, literal ranges are also shipped.
+static bool streamRange(PatchDraft* draft, FILE* newFile, uint8_t* buffer, uint64_t offset, uint64_t length, bool literal)
+{
+    uint64_t doneBytes = 0;
+    while (doneBytes < length)
+    {
+        uint64_t remaining = length - doneBytes;
+        size_t chunk = (size_t)((remaining > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : remaining);
+        if (fread(buffer, 1, chunk, newFile) != chunk)
+        {
+            fprintf(stderr, "[BBFCODEC] Short read at %llu in the new book.\n", (unsigned long long)(offset + doneBytes));
+            return false;
+        }
+
+        XXH3_128bits_update(draft->newHashState, buffer, chunk);
+        if (literal && !addLiteral(draft, buffer, chunk, offset + doneBytes))
+        {
+            return false;
+        }
+        doneBytes += chunk;
+    }
+    return true;
+}
+
+bool BBFPatch::diff(const char* oldPath, const char* newPath, const char* patchPath, BBFPatchStats* stats)
+{
+    BBFPatchStats localStats;
+    if (!stats)
+    {
+        stats = &localStats;
+    }
+    *stats = BBFPatchStats();
+
+    BBFReader oldBook(oldPath);
+    BBFReader newBook(newPath);
+    BBFHeader* oldHeader = oldBook.getHeaderView();
+    BBFHeader* newHeader = newBook.getHeaderView();
+    BBFFooter* oldFooter = oldHeader ? oldBook.getFooterView(oldHeader->footerOffset) : nullptr;
+    BBFFooter* newFooter = newHeader ? newBook.getFooterView(newHeader->footerOffset) : nullptr;
+    if (!oldFooter || !newFooter)
+    {
+        fprintf(stderr, "[BBFCODEC] Both %s and %s need to be readable books.\n", oldPath, newPath);
+        return false;
+    }
+
+    // Old assets by stored hash. Nothing is rehashed.
+    BBFAssetTable oldAssets(4096);
+    const uint8_t* oldAssetTable = oldBook.getAssetTableView(oldFooter->assetOffset);
+    uint64_t assetIterator = 0;
+    for (; assetIterator < oldFooter->assetCount; assetIterator++)
+    {
+        const BBFAsset* asset = oldBook.getAssetEntryView(oldAssetTable, (int)assetIterator);
+        if (!asset)
+        {
+            fprintf(stderr, "[BBFCODEC] %s has a damaged asset table.\n", oldPath);
+            return false;
+        }
+        XXH128_hash_t assetHash = { asset->assetHash[0], asset->assetHash[1] };
+        if (oldAssets.findAsset(assetHash) == 0xFFFFFFFFFFFFFFFF)
+        {
+            oldAssets.addAsset(assetHash, assetIterator);
+        }
+    }
+
+    ReuseSpan* reuseSpans = (ReuseSpan*)malloc(sizeof(ReuseSpan) * (size_t)(newFooter->assetCount ? newFooter->assetCount : 1));
+    if (!reuseSpans)
+    {
+        return false;
+    }
+
+    uint64_t spanCount = 0;
+    const uint8_t* newAssetTable = newBook.getAssetTableView(newFooter->assetOffset);
+    for (assetIterator = 0; assetIterator < newFooter->assetCount; assetIterator++)
+    {
+        const BBFAsset* asset = newBook.getAssetEntryView(newAssetTable, (int)assetIterator);
+        if (!asset)
+        {
+            fprintf(stderr, "[BBFCODEC] %s has a damaged asset table.\n", newPath);
+            free(reuseSpans);
+            return false;
+        }
+        XXH128_hash_t assetHash = { asset->assetHash[0], asset->assetHash[1] };
+        uint64_t oldIndex = oldAssets.findAsset(assetHash);
+        const BBFAsset* oldAsset = (oldIndex != 0xFFFFFFFFFFFFFFFF) ? oldBook.getAssetEntryView(oldAssetTable, (int)oldIndex) : nullptr;
+        if (!oldAsset || oldAsset->fileSize != asset->fileSize || asset->fileSize == 0)
+        {
+            stats->assetsShipped++;
+            continue;
+        }
+
+        reuseSpans[spanCount].newOffset = asset->fileOffset;
+        reuseSpans[spanCount].length = asset->fileSize;
+        reuseSpans[spanCount].oldOffset = oldAsset->fileOffset;
+        spanCount++;
+        stats->assetsReused++;
+        stats->reusedBytes += asset->fileSize;
+    }
+    std::sort(reuseSpans, reuseSpans + spanCount, [](const ReuseSpan& left, const ReuseSpan& right)
+    {
+        return left.newOffset < right.newOffset;
+    });
+
+    FILE* oldFile = fopen(oldPath, "rb");
+    FILE* newFile = fopen(newPath, "rb");
+    uint64_t oldSize = 0;
+    uint64_t newSize = 0;
+    bool diffOk = oldFile && newFile && patchFileLength(oldFile, &oldSize) && patchFileLength(newFile, &newSize) && seekPatchFile(newFile, 0);
+    if (oldFile)
+    {
+        fclose(oldFile);
+    }
+
+    // Header goes in last, once the sizes are known
+    char* tempPath = nullptr;
+    PatchDraft draft = {};
+    draft.stats = stats;
+    draft.patchFile = diffOk ? BBFBuilder::openTempNear(patchPath, &tempPath) : nullptr;
+    draft.patchHashState = XXH3_createState();
+    draft.newHashState = XXH3_createState();
+    XXH3_64bits_reset(draft.patchHashState);
+    XXH3_128bits_reset(draft.newHashState);
+    uint8_t* buffer = (uint8_t*)malloc(BBF::MOVE_BUFFER_SIZE);
+
+    BBFPatchHeader header = {};
+    diffOk = draft.patchFile && buffer && fwrite(&header, sizeof(BBFPatchHeader), 1, draft.patchFile) == 1;
+
+    // Walk the new book front to back. Reused assets become OLD extents, the gaps between them are shipped.
+    uint64_t cursor = 0;
+    uint64_t spanIterator = 0;
+    for (; diffOk && spanIterator < spanCount; spanIterator++)
+    {
+        const ReuseSpan* span = &reuseSpans[spanIterator];
+        if (span->newOffset < cursor || span->newOffset + span->length > newSize)
+        {
+            continue;
+        }
+
+        diffOk = streamRange(&draft, newFile, buffer, cursor, span->newOffset - cursor, true) &&
+                 streamRange(&draft, newFile, buffer, span->newOffset, span->length, false) &&
+                 pushExtent(&draft, BBFPatchSource::OLD, span->newOffset, span->length, span->oldOffset);
+        cursor = span->newOffset + span->length;
+    }
+    diffOk = diffOk && streamRange(&draft, newFile, buffer, cursor, newSize - cursor, true);
+
+    if (diffOk)
+    {
+        XXH3_64bits_update(draft.patchHashState, draft.extents, (size_t)(draft.extentCount * sizeof(BBFPatchExtent)));
+        XXH128_hash_t newHash = XXH3_128bits_digest(draft.newHashState);
+
+        header.magic[0] = 'B';
+        header.magic[1] = 'B';
+        header.magic[2] = 'F';
+        header.magic[3] = 'P';
+        header.version = BBF::PATCH_VERSION;
+        header.headerLen = (uint16_t)sizeof(BBFPatchHeader);
+        header.oldSize = oldSize;
+        header.oldFooterHash = oldFooter->footerHash;
+        header.newSize = newSize;
+        header.newHash[0] = newHash.low64;
+        header.newHash[1] = newHash.high64;
+        header.literalOffset = sizeof(BBFPatchHeader);
+        header.literalSize = draft.literalSize;
+        header.extentCount = draft.extentCount;
+        header.extentOffset = header.literalOffset + draft.literalSize;
+        header.patchHash = XXH3_64bits_digest(draft.patchHashState);
+
+        diffOk = (draft.extentCount == 0 || fwrite(draft.extents, sizeof(BBFPatchExtent), (size_t)draft.extentCount, draft.patchFile) == (size_t)draft.extentCount) &&
+                 seekPatchFile(draft.patchFile, 0) && fwrite(&header, sizeof(BBFPatchHeader), 1, draft.patchFile) == 1;
+        stats->patchSize = header.extentOffset + draft.extentCount * sizeof(BBFPatchExtent);
+    }
+
+    if (draft.patchFile)
+    {
+        diffOk = (fclose(draft.patchFile) == 0) && diffOk;
+    }
+    if (newFile)
+    {
+        fclose(newFile);
+    }
+    if (!diffOk && tempPath)
+    {
+        remove(tempPath);
+        free(tempPath);
+    }
+    diffOk = diffOk && BBFBuilder::replaceWithTemp(tempPath, patchPath);
+
+    if (!diffOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to write patch %s.\n", patchPath);
+    }
+
+    XXH3_freeState(draft.patchHashState);
+    XXH3_freeState(draft.newHashState);
+    free(draft.extents);
+    free(buffer);
+    free(reuseSpans);
+    return diffOk;
+}
+
+// APPLY
+
+// Header, bounds, hash, and extents that tile the new book exactly
+static BBFPatchExtent* loadPatch(FILE* patchFile, BBFPatchHeader* header, uint8_t* buffer)
+{
+    uint64_t patchSize = 0;
+    if (!patchFileLength(patchFile, &patchSize) || patchSize < sizeof(BBFPatchHeader) || !seekPatchFile(patchFile, 0) ||
+        fread(header, sizeof(BBFPatchHeader), 1, patchFile) != 1)
+    {
+        return nullptr;
+    }
+
+    if (memcmp(header->magic, "BBFP", 4) != 0 || header->version != BBF::PATCH_VERSION || header->headerLen < sizeof(BBFPatchHeader) ||
+        header->literalOffset < header->headerLen || header->literalOffset > patchSize || header->literalSize > patchSize - header->literalOffset ||
+        header->extentOffset > patchSize || header->extentCount > (patchSize - header->extentOffset) / sizeof(BBFPatchExtent))
+    {
+        return nullptr;
+    }
+
+    BBFPatchExtent* extents = (BBFPatchExtent*)malloc(sizeof(BBFPatchExtent) * (size_t)(header->extentCount ? header->extentCount : 1));
+    if (!extents || !seekPatchFile(patchFile, header->extentOffset) ||
+        fread(extents, sizeof(BBFPatchExtent), (size_t)header->extentCount, patchFile) != (size_t)header->extentCount)
+    {
+        free(extents);
+        return nullptr;
+    }
+
+    XXH3_state_t* hashState = XXH3_createState();
+    XXH3_64bits_reset(hashState);
+    bool patchOk = seekPatchFile(patchFile, header->literalOffset);
+    uint64_t doneBytes = 0;
+    while (patchOk && doneBytes < header->literalSize)
+    {
+        uint64_t remaining = header->literalSize - doneBytes;
+        size_t chunk = (size_t)((remaining > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : remaining);
+        patchOk = fread(buffer, 1, chunk, patchFile) == chunk;
+        XXH3_64bits_update(hashState, buffer, chunk);
+        doneBytes += chunk;
+    }
+    XXH3_64bits_update(hashState, extents, (size_t)(header->extentCount * sizeof(BBFPatchExtent)));
+    patchOk = patchOk && XXH3_64bits_digest(hashState) == header->patchHash;
+    XXH3_freeState(hashState);
+
+    uint64_t cursor = 0;
+    uint64_t extentIterator = 0;
+    for (; patchOk && extentIterator < header->extentCount; extentIterator++)
+    {
+        const BBFPatchExtent* extent = &extents[extentIterator];
+        patchOk = extent->newOffset == cursor && extent->length <= header->newSize - cursor;
+        if (extent->source == (uint32_t)BBFPatchSource::OLD)
+        {
+            patchOk = patchOk && extent->sourceOffset <= header->oldSize && extent->length <= header->oldSize - extent->sourceOffset;
+        }
+        else if (extent->source == (uint32_t)BBFPatchSource::LITERAL)
+        {
+            patchOk = patchOk && extent->sourceOffset <= header->literalSize && extent->length <= header->literalSize - extent->sourceOffset;
+        }
+        else if (extent->source != (uint32_t)BBFPatchSource::ZERO)
+        {
+            patchOk = false;
+        }
+        cursor += extent->length;
+    }
+
+    if (!patchOk || cursor != header->newSize)
+    {
+        free(extents);
+        return nullptr;
+    }
+    return extents;
+}
+
+bool BBFPatch::apply(const char* oldPath, const char* patchPath, const char* newPath, BBFCopyStats* copyStats)
+{
+    FILE* patchFile = fopen(patchPath, "rb");
+    uint8_t* buffer = (uint8_t*)malloc(BBF::MOVE_BUFFER_SIZE);
+    BBFPatchHeader header = {};
+    BBFPatchExtent* extents = (patchFile && buffer) ? loadPatch(patchFile, &header, buffer) : nullptr;
+    if (!extents)
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not a valid patch.\n", patchPath);
+        if (patchFile)
+        {
+            fclose(patchFile);
+        }
+        free(buffer);
+        return false;
+    }
+
+    // Only the book it was made from
+    FILE* oldFile = fopen(oldPath, "rb");
+    uint64_t oldSize = 0;
+    if (!oldFile || !patchFileLength(oldFile, &oldSize) || oldSize != header.oldSize || footerHashOf(oldPath) != header.oldFooterHash)
+    {
+        fprintf(stderr, "[BBFCODEC] %s is not the book this patch applies to.\n", oldPath);
+        if (oldFile)
+        {
+            fclose(oldFile);
+        }
+        fclose(patchFile);
+        free(extents);
+        free(buffer);
+        return false;
+    }
+
+    // Sized up front, so ZERO extents are already there
+    char* tempPath = nullptr;
+    FILE* newFile = BBFBuilder::openTempNear(newPath, &tempPath);
+    #ifdef _WIN32
+        bool applyOk = newFile && _chsize_s(_fileno(newFile), (__int64)header.newSize) == 0;
+    #else
+        bool applyOk = newFile && ftruncate(fileno(newFile), (off_t)header.newSize) == 0;
+    #endif
+
+    BBFCopyStats applyStats;
+    if (applyOk)
+    {
+        #ifdef _WIN32
+            BBFDataMover oldMover(_fileno(oldFile), _fileno(newFile));
+            BBFDataMover patchMover(_fileno(patchFile), _fileno(newFile));
+        #else
+            BBFDataMover oldMover(fileno(oldFile), fileno(newFile));
+            BBFDataMover patchMover(fileno(patchFile), fileno(newFile));
+        #endif
+
+        uint64_t extentIterator = 0;
+        for (; applyOk && extentIterator < header.extentCount; extentIterator++)
+        {
+            const BBFPatchExtent* extent = &extents[extentIterator];
+            if (extent->source == (uint32_t)BBFPatchSource::OLD)
+            {
+                applyOk = oldMover.copy(extent->sourceOffset, extent->newOffset, extent->length);
+            }
+            else if (extent->source == (uint32_t)BBFPatchSource::LITERAL)
+            {
+                applyOk = patchMover.copy(header.literalOffset + extent->sourceOffset, extent->newOffset, extent->length);
+            }
+        }
+
+        const BBFCopyStats* moverStats[2] = { &oldMover.getStats(), &patchMover.getStats() };
+        int moverIterator = 0;
+        for (; moverIterator < 2; moverIterator++)
+        {
+            applyStats.reflinkBytes += moverStats[moverIterator]->reflinkBytes;
+            applyStats.kernelBytes += moverStats[moverIterator]->kernelBytes;
+            applyStats.bufferedBytes += moverStats[moverIterator]->bufferedBytes;
+            applyStats.copyCount += moverStats[moverIterator]->copyCount;
+        }
+    }
+
+    // Byte for byte, or it doesn't replace anything
+    if (applyOk)
+    {
+        XXH3_state_t* hashState = XXH3_createState();
+        XXH3_128bits_reset(hashState);
+        applyOk = seekPatchFile(newFile, 0);
+        uint64_t doneBytes = 0;
+        while (applyOk && doneBytes < header.newSize)
+        {
+            uint64_t remaining = header.newSize - doneBytes;
+            size_t chunk = (size_t)((remaining > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : remaining);
+            applyOk = fread(buffer, 1, chunk, newFile) == chunk;
+            XXH3_128bits_update(hashState, buffer, chunk);
+            doneBytes += chunk;
+        }
+        XXH128_hash_t newHash = XXH3_128bits_digest(hashState);
+        XXH3_freeState(hashState);
+
+        if (applyOk && (newHash.low64 != header.newHash[0] || newHash.high64 != header.newHash[1]))
+        {
+            fprintf(stderr, "[BBFCODEC] Patched book doesn't match the expected hash.\n");
+            applyOk = false;
+        }
+    }
+
+    if (newFile)
+    {
+        applyOk = (fclose(newFile) == 0) && applyOk;
+    }
+    fclose(oldFile);
+    fclose(patchFile);
+    if (!applyOk && tempPath)
+    {
+        remove(tempPath);
+        free(tempPath);
+    }
+    // Keeps the old book's permissions
+    applyOk = applyOk && BBFBuilder::replaceWithTemp(tempPath, newPath, oldPath);
+
+    if (!applyOk)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to write %s.\n", newPath);
+    }
+    else if (copyStats)
+    {
+        *copyStats = applyStats;
+    }
+
+    free(extents);
+    free(buffer);
+    return applyOk;
+}
@@ -0,0 +1,85 @@
+// BBF Patch
+// Binary diff between two revisions of a book. Assets the old book already has (same XXH3-128) are
+// referenced by offset, everything else (changed pages, the new index) is shipped. Applying the patch
+// to the old book gives back the new one, byte for byte.
+#ifndef BBFPATCH_H
+#define BBFPATCH_H
+
+#include "libbbf.h"
+#include "bbfmove.h"
+
+#include <stdint.h>
+
+// Layout: header, literals, extents.
+// The extents cover the new book in order, with no gaps. Each one says where its bytes come from.
+#pragma pack(push, 1)
+
+struct BBFPatchHeader
+{
+    uint8_t magic[4]; // BBFP
+    uint16_t version;
+    uint16_t headerLen;
+    uint32_t flags;
+    uint32_t reservedExtra;
+
+    uint64_t oldSize;
+    uint64_t oldFooterHash; // footerHash of the book this applies to
+    uint64_t newSize;
+    uint64_t newHash[2]; // XXH3-128 of the whole new book
+
+    uint64_t extentCount;
+    uint64_t extentOffset;
+    uint64_t literalOffset;
+    uint64_t literalSize;
+
+    uint64_t patchHash; // XXH3-64 of the literals, then the extents
+
+    uint8_t reserved[32];
+};
+
+struct BBFPatchExtent
+{
+    uint64_t newOffset;
+    uint64_t length;
+    uint64_t sourceOffset; // Into the old book, or into the literals
+    uint32_t source; // BBFPatchSource
+    uint32_t reserved;
+};
+
+#pragma pack(pop)
+
+enum class BBFPatchSource: uint32_t
+{
+    OLD = 0, // Copy from the old book
+    LITERAL, // Copy from the patch
+    ZERO // Padding, nothing stored
+};
+
+struct BBFPatchStats
+{
+    uint64_t assetsReused = 0;
+    uint64_t assetsShipped = 0;
+    uint64_t reusedBytes = 0;
+    uint64_t literalBytes = 0; // Changed assets, index, footer
+    uint64_t zeroBytes = 0;
+    uint64_t patchSize = 0;
+};
+
+namespace BBF
+{
+    constexpr static uint16_t PATCH_VERSION = 1;
+    constexpr static uint64_t PATCH_ZERO_RUN = 64; // Shorter runs of zeros stay literal
+}
+
+class BBFPatch
+{
+    public:
+        // Write the patch that turns oldPath into newPath.
+        static bool diff(const char* oldPath, const char* newPath, const char* patchPath, BBFPatchStats* stats = nullptr);
+
+        // Rebuild the new book from oldPath and the patch. Refuses the wrong old book, and checks the result
+        // against the new book's hash before it replaces newPath. newPath may be oldPath.
+        static bool apply(const char* oldPath, const char* patchPath, const char* newPath, BBFCopyStats* copyStats = nullptr);
+};
+
+#endif // BBFPATCH_H
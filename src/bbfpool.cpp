@@ -0,0 +1,480 @@
+#include "bbfpool.h"
+#include "xxhash.h"
+
+#include <string.h>
+#include <sys/stat.h>
+
+// What we compare to notice a book was replaced or rewritten
+struct BookStamp
+{
+    uint64_t fileDevice;
+    uint64_t fileInode;
+    uint64_t fileSize;
+    int64_t fileModified;
+};
+
+static void stampFromStat(const struct stat* fileStat, BookStamp* stamp)
+{
+    stamp->fileDevice = (uint64_t)fileStat->st_dev;
+    stamp->fileInode = (uint64_t)fileStat->st_ino;
+    stamp->fileSize = (uint64_t)fileStat->st_size;
+
+    #if defined(_WIN32)
+        stamp->fileModified = (int64_t)fileStat->st_mtime * 1000000000LL;
+    #elif defined(__APPLE__)
+        stamp->fileModified = (int64_t)fileStat->st_mtimespec.tv_sec * 1000000000LL + fileStat->st_mtimespec.tv_nsec;
+    #else
+        stamp->fileModified = (int64_t)fileStat->st_mtim.tv_sec * 1000000000LL + fileStat->st_mtim.tv_nsec;
+    #endif
+}
+
+static bool stampPath(const char* path, BookStamp* stamp)
+{
+    struct stat fileStat;
+    if (stat(path, &fileStat) != 0 || (fileStat.st_mode & S_IFMT) != S_IFREG)
+    {
+        return false;
+    }
+
+    stampFromStat(&fileStat, stamp);
+    return true;
+}
+
+// HANDLE
+
+BBFReaderHandle::BBFReaderHandle(BBFReaderHandle&& other) noexcept
+{
+    this->pool = other.pool;
+    this->entry = other.entry;
+    other.pool = nullptr;
+    other.entry = nullptr;
+}
+
+BBFReaderHandle& BBFReaderHandle::operator=(BBFReaderHandle&& other) noexcept
+{
+    if (this != &other)
+    {
+        reset();
+        this->pool = other.pool;
+        this->entry = other.entry;
+        other.pool = nullptr;
+        other.entry = nullptr;
+    }
+    return *this;
+}
+
+BBFReader* BBFReaderHandle::get() const
+{
+    return this->entry ? ((BBFReaderPool::PoolEntry*)this->entry)->reader : nullptr;
+}
+
+const BBFFooter* BBFReaderHandle::getFooter() const
+{
+    return this->entry ? ((BBFReaderPool::PoolEntry*)this->entry)->footer : nullptr;
+}
+
+const char* BBFReaderHandle::getPath() const
+{
+    return this->entry ? ((BBFReaderPool::PoolEntry*)this->entry)->path : nullptr;
+}
+
+void BBFReaderHandle::reset()
+{
+    if (this->pool && this->entry)
+    {
+        this->pool->release((BBFReaderPool::PoolEntry*)this->entry);
+    }
+    this->pool = nullptr;
+    this->entry = nullptr;
+}
+
+// POOL
+
+BBFReaderPool::BBFReaderPool(uint32_t pMaxOpen, uint64_t pMaxMappedBytes)
+{
+    this->maxOpen = (pMaxOpen == 0) ? 1 : pMaxOpen;
+    this->maxMappedBytes = pMaxMappedBytes;
+
+    this->bucketCount = 64;
+    this->tableCount = 0;
+    this->buckets = (PoolEntry**)calloc(this->bucketCount, sizeof(PoolEntry*));
+    this->useHead = nullptr;
+    this->useTail = nullptr;
+
+    this->openCount = 0;
+    this->mappedBytes = 0;
+    this->hits = 0;
+    this->misses = 0;
+    this->evictions = 0;
+}
+
+BBFReaderPool::~BBFReaderPool()
+{
+    while (this->useHead)
+    {
+        PoolEntry* entry = this->useHead;
+        unlinkEntry(entry);
+        freeEntry(entry);
+    }
+
+    free(this->buckets);
+    this->buckets = nullptr;
+}
+
+BBFReaderPool& BBFReaderPool::getProcessPool()
+{
+    static BBFReaderPool processPool;
+    return processPool;
+}
+
+BBFReaderPool::PoolEntry* BBFReaderPool::findEntry(const char* path, uint64_t pathHash)
+{
+    PoolEntry* entry = this->buckets[pathHash & (this->bucketCount - 1)];
+    for (; entry; entry = entry->nextInBucket)
+    {
+        if (entry->pathHash == pathHash && strcmp(entry->path, path) == 0)
+        {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+void BBFReaderPool::growBuckets()
+{
+    uint64_t newCount = this->bucketCount * 2;
+    PoolEntry** newBuckets = (PoolEntry**)calloc(newCount, sizeof(PoolEntry*));
+    if (!newBuckets)
+    {
+        return; // Longer chains, still correct
+    }
+
+    uint64_t bucketIterator = 0;
+    for (; bucketIterator < this->bucketCount; bucketIterator++)
+    {
+        PoolEntry* entry = this->buckets[bucketIterator];
+        while (entry)
+        {
+            PoolEntry* nextEntry = entry->nextInBucket;
+            uint64_t slot = entry->pathHash & (newCount - 1);
+            entry->nextInBucket = newBuckets[slot];
+            newBuckets[slot] = entry;
+            entry = nextEntry;
+        }
+    }
+
+    free(this->buckets);
+    this->buckets = newBuckets;
+    this->bucketCount = newCount;
+}
+
+BBFReaderHandle BBFReaderPool::acquire(const char* path)
+{
+    BBFReaderHandle handle;
+
+    BookStamp stamp;
+    if (!path || !this->buckets || !stampPath(path, &stamp))
+    {
+        return handle;
+    }
+
+    uint64_t pathHash = XXH3_64bits(path, strlen(path));
+
+    {
+        std::lock_guard<std::mutex> guard(this->poolLock);
+
+        PoolEntry* entry = findEntry(path, pathHash);
+        if (entry)
+        {
+            bool unchanged = entry->fileDevice == stamp.fileDevice && entry->fileInode == stamp.fileInode &&
+                             entry->fileSize == stamp.fileSize && entry->fileModified == stamp.fileModified;
+            if (unchanged)
+            {
+                this->hits++;
+                entry->refCount++;
+
+                // Move to the front of the LRU
+                if (entry != this->useHead)
+                {
+                    entry->prevUse->nextUse = entry->nextUse;
+                    if (entry->nextUse)
+                    {
+                        entry->nextUse->prevUse = entry->prevUse;
+                    }
+                    else
+                    {
+                        this->useTail = entry->prevUse;
+                    }
+                    entry->prevUse = nullptr;
+                    entry->nextUse = this->useHead;
+                    this->useHead->prevUse = entry;
+                    this->useHead = entry;
+                }
+
+                handle.pool = this;
+                handle.entry = entry;
+                return handle;
+            }
+
+            // The file changed. Anyone still holding the old reader keeps it, everyone else gets a new one.
+            unlinkEntry(entry);
+            if (entry->refCount == 0)
+            {
+                freeEntry(entry);
+            }
+            else
+            {
+                entry->detached = true;
+            }
+        }
+
+        this->misses++;
+    }
+
+    // Open outside the lock, opens of other books shouldn't wait on this one
+    BBFReader* reader = new BBFReader(path);
+    BBFHeader* header = reader->getHeaderView();
+    const BBFFooter* footer = (header && reader->checkMagic(header)) ? reader->getFooterView(header->footerOffset) : nullptr;
+    if (!footer)
+    {
+        delete reader;
+        return handle;
+    }
+
+    // Stamp the file we actually mapped, in case it changed since the stat
+    #ifndef _WIN32
+        struct stat openStat;
+        int fileDescriptor = reader->getBackend()->getFileDescriptor();
+        if (fileDescriptor != -1 && fstat(fileDescriptor, &openStat) == 0)
+        {
+            stampFromStat(&openStat, &stamp);
+        }
+    #endif
+
+    uint64_t entryBytes = reader->getBackend()->getMapping() ? reader->getBackend()->getSize() : 0;
+
+    std::lock_guard<std::mutex> guard(this->poolLock);
+
+    // Someone else opened it while we were
+    PoolEntry* raced = findEntry(path, pathHash);
+    if (raced && raced->fileDevice == stamp.fileDevice && raced->fileInode == stamp.fileInode &&
+        raced->fileSize == stamp.fileSize && raced->fileModified == stamp.fileModified)
+    {
+        delete reader;
+        raced->refCount++;
+        handle.pool = this;
+        handle.entry = raced;
+        return handle;
+    }
+
+    if (raced)
+    {
+        unlinkEntry(raced);
+        if (raced->refCount == 0)
+        {
+            freeEntry(raced);
+        }
+        else
+        {
+            raced->detached = true;
+        }
+    }
+
+    evictIdle(1, entryBytes);
+
+    PoolEntry* entry = (PoolEntry*)calloc(1, sizeof(PoolEntry));
+    char* pathCopy = (char*)malloc(strlen(path) + 1);
+    if (!entry || !pathCopy)
+    {
+        free(entry);
+        free(pathCopy);
+        delete reader;
+        return handle;
+    }
+    strcpy(pathCopy, path);
+
+    entry->path = pathCopy;
+    entry->pathHash = pathHash;
+    entry->reader = reader;
+    entry->footer = footer;
+    entry->mappedBytes = entryBytes;
+    entry->fileDevice = stamp.fileDevice;
+    entry->fileInode = stamp.fileInode;
+    entry->fileSize = stamp.fileSize;
+    entry->fileModified = stamp.fileModified;
+    entry->refCount = 1;
+    entry->detached = false;
+
+    if (this->tableCount >= this->bucketCount)
+    {
+        growBuckets();
+    }
+
+    uint64_t slot = pathHash & (this->bucketCount - 1);
+    entry->nextInBucket = this->buckets[slot];
+    this->buckets[slot] = entry;
+    this->tableCount++;
+
+    entry->prevUse = nullptr;
+    entry->nextUse = this->useHead;
+    if (this->useHead)
+    {
+        this->useHead->prevUse = entry;
+    }
+    this->useHead = entry;
+    if (!this->useTail)
+    {
+        this->useTail = entry;
+    }
+
+    this->openCount++;
+    this->mappedBytes += entryBytes;
+
+    handle.pool = this;
+    handle.entry = entry;
+    return handle;
+}
+
+void BBFReaderPool::release(PoolEntry* entry)
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+
+    entry->refCount--;
+    if (entry->refCount > 0)
+    {
+        return;
+    }
+
+    if (entry->detached)
+    {
+        freeEntry(entry);
+        return;
+    }
+
+    // We may have gone over while everything was busy
+    evictIdle(0, 0);
+}
+
+void BBFReaderPool::unlinkEntry(PoolEntry* entry)
+{
+    PoolEntry** link = &this->buckets[entry->pathHash & (this->bucketCount - 1)];
+    while (*link && *link != entry)
+    {
+        link = &(*link)->nextInBucket;
+    }
+    if (*link)
+    {
+        *link = entry->nextInBucket;
+        this->tableCount--;
+    }
+    entry->nextInBucket = nullptr;
+
+    if (entry->prevUse)
+    {
+        entry->prevUse->nextUse = entry->nextUse;
+    }
+    else if (this->useHead == entry)
+    {
+        this->useHead = entry->nextUse;
+    }
+
+    if (entry->nextUse)
+    {
+        entry->nextUse->prevUse = entry->prevUse;
+    }
+    else if (this->useTail == entry)
+    {
+        this->useTail = entry->prevUse;
+    }
+
+    entry->prevUse = nullptr;
+    entry->nextUse = nullptr;
+}
+
+void BBFReaderPool::freeEntry(PoolEntry* entry)
+{
+    this->openCount--;
+    this->mappedBytes -= entry->mappedBytes;
+
+    delete entry->reader;
+    free(entry->path);
+    free(entry);
+}
+
+void BBFReaderPool::evictIdle(uint32_t extraOpen, uint64_t extraBytes)
+{
+    PoolEntry* entry = this->useTail;
+    while (entry)
+    {
+        bool overOpen = this->openCount + extraOpen > this->maxOpen;
+        bool overBytes = this->maxMappedBytes != 0 && this->mappedBytes + extraBytes > this->maxMappedBytes;
+        if (!overOpen && !overBytes)
+        {
+            return;
+        }
+
+        PoolEntry* prevEntry = entry->prevUse;
+        if (entry->refCount == 0)
+        {
+            unlinkEntry(entry);
+            freeEntry(entry);
+            this->evictions++;
+        }
+        entry = prevEntry;
+    }
+}
+
+void BBFReaderPool::setLimits(uint32_t pMaxOpen, uint64_t pMaxMappedBytes)
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    this->maxOpen = (pMaxOpen == 0) ? 1 : pMaxOpen;
+    this->maxMappedBytes = pMaxMappedBytes;
+    evictIdle(0, 0);
+}
+
+void BBFReaderPool::purge()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+
+    PoolEntry* entry = this->useTail;
+    while (entry)
+    {
+        PoolEntry* prevEntry = entry->prevUse;
+        if (entry->refCount == 0)
+        {
+            unlinkEntry(entry);
+            freeEntry(entry);
+        }
+        entry = prevEntry;
+    }
+}
+
+uint32_t BBFReaderPool::getOpenCount()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    return this->openCount;
+}
+
+uint64_t BBFReaderPool::getMappedBytes()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    return this->mappedBytes;
+}
+
+uint64_t BBFReaderPool::getHits()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    return this->hits;
+}
+
+uint64_t BBFReaderPool::getMisses()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    return this->misses;
+}
+
+uint64_t BBFReaderPool::getEvictions()
+{
+    std::lock_guard<std::mutex> guard(this->poolLock);
+    return this->evictions;
+}
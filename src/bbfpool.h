@@ -0,0 +1,118 @@
+// BBF Reader Pool
+// Shares open readers between requests, so a server touching thousands of books
+// doesn't pay open + fstat + mmap + munmap on every one.
+#ifndef BBFPOOL_H
+#define BBFPOOL_H
+
+#include "bbfcodec.h"
+
+#include <stdint.h>
+#include <mutex>
+
+class BBFReaderPool;
+
+// Refcounted, move-only reference to a pooled reader. The reader stays open while any handle holds it.
+// Readers are shared, so stick to the table/data views and exports when using one from several threads.
+class BBFReaderHandle
+{
+    public:
+        BBFReaderHandle() : pool(nullptr), entry(nullptr) {}
+        ~BBFReaderHandle() { reset(); }
+
+        BBFReaderHandle(const BBFReaderHandle&) = delete;
+        BBFReaderHandle& operator=(const BBFReaderHandle&) = delete;
+        BBFReaderHandle(BBFReaderHandle&& other) noexcept;
+        BBFReaderHandle& operator=(BBFReaderHandle&& other) noexcept;
+
+        BBFReader* get() const;
+        BBFReader* operator->() const { return get(); }
+        explicit operator bool() const { return entry != nullptr; }
+
+        const BBFFooter* getFooter() const; // Loaded when the book was opened
+        const char* getPath() const;
+
+        void reset(); // Drop the reference early
+
+    private:
+        friend class BBFReaderPool;
+        BBFReaderPool* pool;
+        void* entry;
+};
+
+class BBFReaderPool
+{
+    public:
+        // Limits on idle readers. Readers in use are never evicted, so both are soft while everything is busy.
+        // 0 = unlimited mapped bytes.
+        BBFReaderPool(uint32_t pMaxOpen = 1024, uint64_t pMaxMappedBytes = 0);
+        ~BBFReaderPool(); // Outstanding handles must be gone by now
+        BBFReaderPool(const BBFReaderPool&) = delete;
+        BBFReaderPool& operator=(const BBFReaderPool&) = delete;
+
+        static BBFReaderPool& getProcessPool();
+
+        // Open (or share) the book at path. Empty handle if it's missing or not a BBF.
+        // The file is stat'ed every time, and a changed file gets a fresh reader.
+        // Handles to the old one keep working until they're dropped.
+        BBFReaderHandle acquire(const char* path);
+
+        void setLimits(uint32_t pMaxOpen, uint64_t pMaxMappedBytes);
+        void purge(); // Close every idle reader
+
+        uint32_t getOpenCount();
+        uint64_t getMappedBytes();
+        uint64_t getHits();
+        uint64_t getMisses();
+        uint64_t getEvictions();
+
+    private:
+        friend class BBFReaderHandle;
+
+        struct PoolEntry
+        {
+            char* path;
+            uint64_t pathHash;
+            BBFReader* reader;
+            const BBFFooter* footer;
+            uint64_t mappedBytes;
+
+            // Identity of the file we opened
+            uint64_t fileDevice;
+            uint64_t fileInode;
+            uint64_t fileSize;
+            int64_t fileModified; // ns
+
+            uint32_t refCount;
+            bool detached; // Replaced by a newer open. Freed when the last handle goes.
+
+            PoolEntry* nextInBucket;
+            PoolEntry* prevUse; // LRU, most recent at the head
+            PoolEntry* nextUse;
+        };
+
+        std::mutex poolLock;
+        uint32_t maxOpen;
+        uint64_t maxMappedBytes;
+
+        PoolEntry** buckets;
+        uint64_t bucketCount; // Power of 2
+        uint64_t tableCount;
+        PoolEntry* useHead;
+        PoolEntry* useTail;
+
+        uint32_t openCount; // Includes detached entries still in use
+        uint64_t mappedBytes;
+
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+
+        PoolEntry* findEntry(const char* path, uint64_t pathHash);
+        void growBuckets();
+        void release(PoolEntry* entry);
+        void unlinkEntry(PoolEntry* entry); // From the table and LRU, not freed
+        void freeEntry(PoolEntry* entry);
+        void evictIdle(uint32_t extraOpen, uint64_t extraBytes);
+};
+
+#endif // BBFPOOL_H
@@ -0,0 +1,641 @@
+#include "bbfprobe.h"
+#include "bbfio.h" // Platform file headers
+
+#include <string.h>
+#include <errno.h>
+#include <thread>
+#include <atomic>
+
+#ifndef _WIN32
+    #include <dirent.h>
+#endif
+
+// FILE ACCESS
+
+struct ProbeFile
+{
+#ifdef _WIN32
+    HANDLE hFile;
+#else
+    int fileDescriptor;
+#endif
+    uint64_t fileSize;
+};
+
+static bool openProbeFile(const char* path, ProbeFile* file)
+{
+#ifdef _WIN32
+    file->hFile = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file->hFile == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER sizeValue;
+    if (!GetFileSizeEx(file->hFile, &sizeValue))
+    {
+        CloseHandle(file->hFile);
+        return false;
+    }
+    file->fileSize = (uint64_t)sizeValue.QuadPart;
+#else
+    file->fileDescriptor = open(path, O_RDONLY | O_CLOEXEC);
+    if (file->fileDescriptor < 0)
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file->fileDescriptor, &fileStat) != 0 || (fileStat.st_mode & S_IFMT) != S_IFREG)
+    {
+        close(file->fileDescriptor);
+        return false;
+    }
+    file->fileSize = (uint64_t)fileStat.st_size;
+#endif
+    return true;
+}
+
+static void closeProbeFile(ProbeFile* file)
+{
+#ifdef _WIN32
+    CloseHandle(file->hFile);
+#else
+    close(file->fileDescriptor);
+#endif
+}
+
+static bool readProbeFile(ProbeFile* file, uint64_t offset, void* dst, uint64_t length)
+{
+    uint8_t* dstBytes = (uint8_t*)dst;
+    uint64_t bytesDone = 0;
+
+    while (bytesDone < length)
+    {
+#ifdef _WIN32
+        uint64_t chunkSize = length - bytesDone;
+        DWORD requestSize = (chunkSize > 0x40000000) ? 0x40000000 : (DWORD)chunkSize;
+        DWORD bytesRead = 0;
+
+        OVERLAPPED overlapped = {};
+        overlapped.Offset = (DWORD)((offset + bytesDone) & 0xFFFFFFFF);
+        overlapped.OffsetHigh = (DWORD)((offset + bytesDone) >> 32);
+
+        if (!ReadFile(file->hFile, dstBytes + bytesDone, requestSize, &bytesRead, &overlapped) || bytesRead == 0)
+        {
+            return false;
+        }
+#else
+        ssize_t bytesRead = pread(file->fileDescriptor, dstBytes + bytesDone, (size_t)(length - bytesDone), (off_t)(offset + bytesDone));
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+
+        if (bytesRead == 0)
+        {
+            return false;
+        }
+#endif
+        bytesDone += (uint64_t)bytesRead;
+    }
+
+    return true;
+}
+
+// PROBE
+
+// The start of the file, the bytes before the footer, and the meta table + strings if neither covered them.
+struct ProbeRead
+{
+    uint8_t* data;
+    uint64_t offset;
+    uint64_t length;
+};
+
+static bool addProbeRead(ProbeFile* file, ProbeRead* reads, uint32_t* readCount, uint64_t offset, uint64_t length)
+{
+    ProbeRead* probeRead = &reads[*readCount];
+    probeRead->data = (uint8_t*)malloc(length ? length : 1);
+    probeRead->offset = offset;
+    probeRead->length = length;
+    (*readCount)++;
+
+    return probeRead->data && readProbeFile(file, offset, probeRead->data, length);
+}
+
+static const uint8_t* findInReads(const ProbeRead* reads, uint32_t readCount, uint64_t offset, uint64_t length)
+{
+    uint32_t readIterator = 0;
+    for (; readIterator < readCount; readIterator++)
+    {
+        const ProbeRead* probeRead = &reads[readIterator];
+        if (offset >= probeRead->offset && offset - probeRead->offset <= probeRead->length && length <= probeRead->length - (offset - probeRead->offset))
+        {
+            return probeRead->data + (offset - probeRead->offset);
+        }
+    }
+    return nullptr;
+}
+
+static bool tableFits(uint64_t tableOffset, uint64_t entryCount, uint64_t entrySize, uint64_t fileSize)
+{
+    if (entryCount > fileSize / entrySize)
+    {
+        return false;
+    }
+
+    uint64_t tableBytes = entryCount * entrySize;
+    return tableOffset <= fileSize && tableBytes <= fileSize - tableOffset;
+}
+
+// Length of the string at poolOffset, or -1 if it runs off the pool or past MAX_FORME_SIZE
+static int64_t poolStringLength(const uint8_t* stringPool, uint64_t poolSize, uint64_t poolOffset)
+{
+    if (poolOffset >= poolSize)
+    {
+        return -1;
+    }
+
+    uint64_t maxLength = poolSize - poolOffset;
+    maxLength = (maxLength > BBF::MAX_FORME_SIZE) ? BBF::MAX_FORME_SIZE : maxLength;
+
+    const void* terminator = memchr(stringPool + poolOffset, 0, (size_t)maxLength);
+    if (!terminator)
+    {
+        return -1;
+    }
+    return (int64_t)((const uint8_t*)terminator - (stringPool + poolOffset));
+}
+
+static bool findMetaValues(const uint8_t* metaTable, uint64_t metaCount, const uint8_t* stringPool, uint64_t poolSize,
+                           const char* const* metaKeys, uint32_t keyCount, BBFProbeResult* result)
+{
+    uint64_t* valueOffsets = (uint64_t*)malloc(sizeof(uint64_t) * keyCount);
+    int64_t* valueLengths = (int64_t*)malloc(sizeof(int64_t) * keyCount);
+    if (!valueOffsets || !valueLengths)
+    {
+        free(valueOffsets);
+        free(valueLengths);
+        return false;
+    }
+
+    uint32_t keyIterator = 0;
+    for (; keyIterator < keyCount; keyIterator++)
+    {
+        valueLengths[keyIterator] = -1;
+    }
+
+    uint64_t metaIterator = 0;
+    for (; metaIterator < metaCount; metaIterator++)
+    {
+        BBFMeta metaEntry;
+        memcpy(&metaEntry, metaTable + metaIterator * sizeof(BBFMeta), sizeof(BBFMeta));
+
+        int64_t keyLength = poolStringLength(stringPool, poolSize, metaEntry.keyOffset);
+        int64_t valueLength = poolStringLength(stringPool, poolSize, metaEntry.valueOffset);
+        if (keyLength < 0 || valueLength < 0)
+        {
+            continue;
+        }
+
+        const char* entryKey = (const char*)(stringPool + metaEntry.keyOffset);
+        for (keyIterator = 0; keyIterator < keyCount; keyIterator++)
+        {
+            if (valueLengths[keyIterator] < 0 && strlen(metaKeys[keyIterator]) == (size_t)keyLength && memcmp(metaKeys[keyIterator], entryKey, (size_t)keyLength) == 0)
+            {
+                valueOffsets[keyIterator] = metaEntry.valueOffset;
+                valueLengths[keyIterator] = valueLength;
+            }
+        }
+    }
+
+    // Pointers first, then the strings they point at. One free.
+    uint64_t blockSize = sizeof(const char*) * keyCount;
+    for (keyIterator = 0; keyIterator < keyCount; keyIterator++)
+    {
+        blockSize += (valueLengths[keyIterator] >= 0) ? (uint64_t)valueLengths[keyIterator] + 1 : 0;
+    }
+
+    uint8_t* valueBlock = (uint8_t*)malloc((size_t)blockSize);
+    if (!valueBlock)
+    {
+        free(valueOffsets);
+        free(valueLengths);
+        return false;
+    }
+
+    const char** metaValues = (const char**)valueBlock;
+    char* valueCursor = (char*)(valueBlock + sizeof(const char*) * keyCount);
+    for (keyIterator = 0; keyIterator < keyCount; keyIterator++)
+    {
+        if (valueLengths[keyIterator] < 0)
+        {
+            metaValues[keyIterator] = nullptr;
+            continue;
+        }
+
+        memcpy(valueCursor, stringPool + valueOffsets[keyIterator], (size_t)valueLengths[keyIterator]);
+        valueCursor[valueLengths[keyIterator]] = '\0';
+        metaValues[keyIterator] = valueCursor;
+        valueCursor += valueLengths[keyIterator] + 1;
+    }
+
+    result->metaValues = metaValues;
+    free(valueOffsets);
+    free(valueLengths);
+    return true;
+}
+
+static bool copyAllMeta(const uint8_t* metaTable, uint64_t metaCount, const uint8_t* stringPool, uint64_t poolSize, BBFProbeResult* result)
+{
+    // Same layout as findMetaValues: the pointers, then the strings
+    uint64_t blockSize = sizeof(const char*) * 2 * metaCount;
+    uint64_t metaIterator = 0;
+    for (; metaIterator < metaCount; metaIterator++)
+    {
+        BBFMeta metaEntry;
+        memcpy(&metaEntry, metaTable + metaIterator * sizeof(BBFMeta), sizeof(BBFMeta));
+
+        int64_t keyLength = poolStringLength(stringPool, poolSize, metaEntry.keyOffset);
+        int64_t valueLength = poolStringLength(stringPool, poolSize, metaEntry.valueOffset);
+        if (keyLength >= 0 && valueLength >= 0)
+        {
+            blockSize += (uint64_t)keyLength + (uint64_t)valueLength + 2;
+        }
+    }
+
+    uint8_t* pairBlock = (uint8_t*)malloc((size_t)(blockSize ? blockSize : 1));
+    if (!pairBlock)
+    {
+        return false;
+    }
+
+    const char** metaPairs = (const char**)pairBlock;
+    char* pairCursor = (char*)(pairBlock + sizeof(const char*) * 2 * metaCount);
+    uint64_t pairCount = 0;
+    for (metaIterator = 0; metaIterator < metaCount; metaIterator++)
+    {
+        BBFMeta metaEntry;
+        memcpy(&metaEntry, metaTable + metaIterator * sizeof(BBFMeta), sizeof(BBFMeta));
+
+        int64_t keyLength = poolStringLength(stringPool, poolSize, metaEntry.keyOffset);
+        int64_t valueLength = poolStringLength(stringPool, poolSize, metaEntry.valueOffset);
+        if (keyLength < 0 || valueLength < 0)
+        {
+            continue;
+        }
+
+        memcpy(pairCursor, stringPool + metaEntry.keyOffset, (size_t)keyLength + 1);
+        metaPairs[pairCount * 2] = pairCursor;
+        pairCursor += keyLength + 1;
+
+        memcpy(pairCursor, stringPool + metaEntry.valueOffset, (size_t)valueLength + 1);
+        metaPairs[pairCount * 2 + 1] = pairCursor;
+        pairCursor += valueLength + 1;
+        pairCount++;
+    }
+
+    result->metaPairs = metaPairs;
+    result->metaPairCount = pairCount;
+    return true;
+}
+
+static bool probeOpenFile(ProbeFile* file, BBFProbeResult* result, ProbeRead* reads, uint32_t* readCount, const char* const* metaKeys, uint32_t keyCount, bool allMeta)
+{
+    uint64_t fileSize = file->fileSize;
+    if (fileSize < sizeof(BBFHeader))
+    {
+        return false;
+    }
+
+    // Header, plus the footer and the whole index if the book is petrified and not huge
+    uint64_t firstLength = (fileSize < BBF::PROBE_READ_SIZE) ? fileSize : BBF::PROBE_READ_SIZE;
+    if (!addProbeRead(file, reads, readCount, 0, firstLength))
+    {
+        return false;
+    }
+
+    BBFHeader header;
+    memcpy(&header, reads[0].data, sizeof(BBFHeader));
+    if (header.magic[0] != 'B' || header.magic[1] != 'B' || header.magic[2] != 'F' || header.magic[3] != '3')
+    {
+        return false;
+    }
+
+    if (header.footerOffset > fileSize || fileSize - header.footerOffset < sizeof(BBFFooter))
+    {
+        return false;
+    }
+
+    const uint8_t* footerBytes = findInReads(reads, *readCount, header.footerOffset, sizeof(BBFFooter));
+    if (!footerBytes)
+    {
+        // Not petrified. The tables and strings sit right before the footer, so read back from its end.
+        uint64_t tailEnd = header.footerOffset + sizeof(BBFFooter);
+        uint64_t tailStart = (tailEnd > BBF::PROBE_READ_SIZE) ? tailEnd - BBF::PROBE_READ_SIZE : 0;
+        if (!addProbeRead(file, reads, readCount, tailStart, tailEnd - tailStart))
+        {
+            return false;
+        }
+        footerBytes = findInReads(reads, *readCount, header.footerOffset, sizeof(BBFFooter));
+    }
+
+    BBFFooter footer;
+    memcpy(&footer, footerBytes, sizeof(BBFFooter));
+
+    if (!tableFits(footer.assetOffset, footer.assetCount, sizeof(BBFAsset), fileSize) ||
+        !tableFits(footer.pageOffset, footer.pageCount, sizeof(BBFPage), fileSize) ||
+        !tableFits(footer.sectionOffset, footer.sectionCount, sizeof(BBFSection), fileSize) ||
+        !tableFits(footer.metaOffset, footer.metaCount, sizeof(BBFMeta), fileSize) ||
+        !tableFits(footer.stringPoolOffset, footer.stringPoolSize, 1, fileSize))
+    {
+        return false;
+    }
+
+    if ((metaKeys && keyCount > 0) || allMeta)
+    {
+        uint64_t metaBytes = footer.metaCount * sizeof(BBFMeta);
+        const uint8_t* metaTable = findInReads(reads, *readCount, footer.metaOffset, metaBytes);
+        const uint8_t* stringPool = findInReads(reads, *readCount, footer.stringPoolOffset, footer.stringPoolSize);
+
+        if (!metaTable || !stringPool)
+        {
+            uint64_t spanStart = (footer.metaOffset < footer.stringPoolOffset) ? footer.metaOffset : footer.stringPoolOffset;
+            uint64_t metaEnd = footer.metaOffset + metaBytes;
+            uint64_t poolEnd = footer.stringPoolOffset + footer.stringPoolSize;
+            uint64_t spanEnd = (metaEnd > poolEnd) ? metaEnd : poolEnd;
+
+            if (spanEnd - spanStart > BBF::MAX_BALE_SIZE)
+            {
+                fprintf(stderr, "[BBFCODEC] Index region is too large to probe.\n");
+                return false;
+            }
+
+            if (!addProbeRead(file, reads, readCount, spanStart, spanEnd - spanStart))
+            {
+                return false;
+            }
+            metaTable = findInReads(reads, *readCount, footer.metaOffset, metaBytes);
+            stringPool = findInReads(reads, *readCount, footer.stringPoolOffset, footer.stringPoolSize);
+        }
+
+        if (metaKeys && keyCount > 0 && !findMetaValues(metaTable, footer.metaCount, stringPool, footer.stringPoolSize, metaKeys, keyCount, result))
+        {
+            return false;
+        }
+
+        if (allMeta && !copyAllMeta(metaTable, footer.metaCount, stringPool, footer.stringPoolSize, result))
+        {
+            return false;
+        }
+    }
+
+    result->version = header.version;
+    result->headerFlags = header.flags;
+    result->alignment = header.alignment;
+    result->reamSize = header.reamSize;
+    result->fileSize = fileSize;
+    result->assetCount = footer.assetCount;
+    result->pageCount = footer.pageCount;
+    result->sectionCount = footer.sectionCount;
+    result->metaCount = footer.metaCount;
+    result->footerFlags = footer.flags;
+    result->footerHash = footer.footerHash;
+    result->valid = true;
+    return true;
+}
+
+static bool probePath(const char* path, BBFProbeResult* result, const char* const* metaKeys, uint32_t keyCount, bool allMeta)
+{
+    *result = BBFProbeResult();
+
+    ProbeFile file;
+    if (!path || !openProbeFile(path, &file))
+    {
+        return false;
+    }
+
+    ProbeRead reads[3] = {};
+    uint32_t readCount = 0;
+    bool probeOk = probeOpenFile(&file, result, reads, &readCount, metaKeys, keyCount, allMeta);
+    result->readCount = readCount;
+
+    uint32_t readIterator = 0;
+    for (; readIterator < readCount; readIterator++)
+    {
+        free(reads[readIterator].data);
+    }
+    closeProbeFile(&file);
+
+    if (!probeOk)
+    {
+        BBFProbe::freeProbeResult(result);
+        result->valid = false;
+    }
+    return probeOk;
+}
+
+bool BBFProbe::probeBook(const char* path, BBFProbeResult* result, const char* const* metaKeys, uint32_t keyCount)
+{
+    return probePath(path, result, metaKeys, keyCount, false);
+}
+
+bool BBFProbe::probeBookMetadata(const char* path, BBFProbeResult* result)
+{
+    return probePath(path, result, nullptr, 0, true);
+}
+
+void BBFProbe::freeProbeResult(BBFProbeResult* result)
+{
+    free((void*)result->metaValues);
+    free((void*)result->metaPairs);
+    result->metaValues = nullptr;
+    result->metaPairs = nullptr;
+    result->metaPairCount = 0;
+}
+
+// BATCH
+
+static bool hasBookExtension(const char* fileName)
+{
+    size_t nameLength = strlen(fileName);
+    return nameLength > 4 && fileName[0] != '.' && strcmp(fileName + nameLength - 4, ".bbf") == 0;
+}
+
+static int comparePaths(const void* left, const void* right)
+{
+    return strcmp(*(char* const*)left, *(char* const*)right);
+}
+
+static bool addBookPath(BBFProbeBatch* batch, uint64_t* capacity, const char* dirPath, const char* fileName)
+{
+    if (batch->count == *capacity)
+    {
+        uint64_t newCapacity = *capacity ? *capacity * 2 : 64;
+        char** newPaths = (char**)realloc(batch->paths, sizeof(char*) * newCapacity);
+        if (!newPaths)
+        {
+            return false;
+        }
+        batch->paths = newPaths;
+        *capacity = newCapacity;
+    }
+
+    size_t dirLength = strlen(dirPath);
+    bool needsSep = dirLength > 0 && dirPath[dirLength - 1] != '/' && dirPath[dirLength - 1] != '\\';
+    size_t pathLength = dirLength + (needsSep ? 1 : 0) + strlen(fileName) + 1;
+
+    char* joined = (char*)malloc(pathLength);
+    if (!joined)
+    {
+        return false;
+    }
+    snprintf(joined, pathLength, needsSep ? "%s/%s" : "%s%s", dirPath, fileName);
+
+    batch->paths[batch->count++] = joined;
+    return true;
+}
+
+static bool listBooks(const char* dirPath, BBFProbeBatch* batch)
+{
+    uint64_t capacity = 0;
+
+#ifdef _WIN32
+    char searchPath[1024];
+    snprintf(searchPath, sizeof(searchPath), "%s\\*.bbf", dirPath);
+
+    WIN32_FIND_DATAA findData;
+    HANDLE hFind = FindFirstFileA(searchPath, &findData);
+    if (hFind == INVALID_HANDLE_VALUE)
+    {
+        return GetLastError() == ERROR_FILE_NOT_FOUND;
+    }
+
+    do
+    {
+        if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) && hasBookExtension(findData.cFileName))
+        {
+            if (!addBookPath(batch, &capacity, dirPath, findData.cFileName))
+            {
+                FindClose(hFind);
+                return false;
+            }
+        }
+    } while (FindNextFileA(hFind, &findData));
+    FindClose(hFind);
+#else
+    DIR* bookDir = opendir(dirPath);
+    if (!bookDir)
+    {
+        return false;
+    }
+
+    struct dirent* dirEntry = nullptr;
+    while ((dirEntry = readdir(bookDir)) != nullptr)
+    {
+        if (hasBookExtension(dirEntry->d_name) && !addBookPath(batch, &capacity, dirPath, dirEntry->d_name))
+        {
+            closedir(bookDir);
+            return false;
+        }
+    }
+    closedir(bookDir);
+#endif
+
+    return true;
+}
+
+bool BBFProbe::listBookFiles(const char* dirPath, BBFProbeBatch* batch)
+{
+    *batch = BBFProbeBatch();
+
+    if (!dirPath || !listBooks(dirPath, batch))
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to list books in %s.\n", dirPath ? dirPath : "(null)");
+        freeProbeBatch(batch);
+        return false;
+    }
+
+    if (batch->count > 0)
+    {
+        qsort(batch->paths, (size_t)batch->count, sizeof(char*), comparePaths);
+    }
+    return true;
+}
+
+void BBFProbe::probeBatch(BBFProbeBatch* batch, const char* const* metaKeys, uint32_t keyCount, uint32_t threadCount, bool allMeta)
+{
+    if (batch->count == 0)
+    {
+        return;
+    }
+
+    if (!batch->results)
+    {
+        batch->results = new BBFProbeResult[batch->count];
+    }
+
+    // Each probe is a couple of small blocking reads, so keep several going at once
+    uint64_t workerCount = (threadCount == 0) ? 1 : threadCount;
+    workerCount = (workerCount > batch->count) ? batch->count : workerCount;
+
+    std::atomic<uint64_t> nextBook(0);
+    auto probeWorker = [&]()
+    {
+        uint64_t bookIndex = nextBook.fetch_add(1);
+        while (bookIndex < batch->count)
+        {
+            freeProbeResult(&batch->results[bookIndex]);
+            probePath(batch->paths[bookIndex], &batch->results[bookIndex], metaKeys, keyCount, allMeta);
+            bookIndex = nextBook.fetch_add(1);
+        }
+    };
+
+    std::thread* workers = new std::thread[workerCount - 1];
+    uint64_t workerIterator = 0;
+    for (; workerIterator < workerCount - 1; workerIterator++)
+    {
+        workers[workerIterator] = std::thread(probeWorker);
+    }
+
+    probeWorker(); // This thread works too
+
+    for (workerIterator = 0; workerIterator < workerCount - 1; workerIterator++)
+    {
+        workers[workerIterator].join();
+    }
+    delete[] workers;
+}
+
+bool BBFProbe::probeDirectory(const char* dirPath, BBFProbeBatch* batch, const char* const* metaKeys, uint32_t keyCount, uint32_t threadCount)
+{
+    if (!listBookFiles(dirPath, batch))
+    {
+        return false;
+    }
+
+    probeBatch(batch, metaKeys, keyCount, threadCount);
+    return true;
+}
+
+void BBFProbe::freeProbeBatch(BBFProbeBatch* batch)
+{
+    uint64_t bookIterator = 0;
+    for (; bookIterator < batch->count; bookIterator++)
+    {
+        if (batch->results)
+        {
+            freeProbeResult(&batch->results[bookIterator]);
+        }
+        free(batch->paths[bookIterator]);
+    }
+
+    delete[] batch->results;
+    free(batch->paths);
+    *batch = BBFProbeBatch();
+}
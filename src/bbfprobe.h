@@ -0,0 +1,68 @@
+// BBF Probe
+// Counts, flags and a few metadata values straight from the header, footer and index.
+// One or two preads per book and no mapping, for scanning big libraries.
+#ifndef BBFPROBE_H
+#define BBFPROBE_H
+
+#include "libbbf.h"
+
+#include <stdint.h>
+
+struct BBFProbeResult
+{
+    bool valid = false; // The header and footer fields are zero unless this is set
+    uint16_t version = 0;
+    uint32_t headerFlags = 0;
+    uint8_t alignment = 0;
+    uint8_t reamSize = 0;
+    uint64_t fileSize = 0;
+
+    uint64_t assetCount = 0;
+    uint64_t pageCount = 0;
+    uint64_t sectionCount = 0;
+    uint64_t metaCount = 0;
+    uint32_t footerFlags = 0;
+    uint64_t footerHash = 0; // As stored. Not checked.
+
+    // One per requested key, nullptr if the book doesn't have it. First match wins.
+    const char** metaValues = nullptr;
+
+    // Every entry, from probeBookMetadata. metaPairs[2 * i] is a key, metaPairs[2 * i + 1] its value.
+    const char** metaPairs = nullptr;
+    uint64_t metaPairCount = 0;
+
+    uint32_t readCount = 0; // preads it took
+};
+
+struct BBFProbeBatch
+{
+    char** paths = nullptr; // Sorted
+    BBFProbeResult* results = nullptr;
+    uint64_t count = 0;
+};
+
+namespace BBF
+{
+    constexpr static uint64_t PROBE_READ_SIZE = 16384; // First read. Covers the whole index of most petrified books.
+}
+
+class BBFProbe
+{
+    public:
+        // False if the file can't be read or isn't a BBF. The result still needs freeProbeResult either way.
+        static bool probeBook(const char* path, BBFProbeResult* result, const char* const* metaKeys = nullptr, uint32_t keyCount = 0);
+        static bool probeBookMetadata(const char* path, BBFProbeResult* result); // Counts plus every metadata entry
+        static void freeProbeResult(BBFProbeResult* result);
+
+        // Probe every *.bbf in a directory (not recursive) on threadCount threads.
+        // False if the directory can't be opened. Books that fail show up with valid = false.
+        static bool probeDirectory(const char* dirPath, BBFProbeBatch* batch, const char* const* metaKeys = nullptr, uint32_t keyCount = 0, uint32_t threadCount = 8);
+
+        // The two halves of probeDirectory. listBookFiles fills paths (sorted) and count only,
+        // probeBatch fills results for whatever paths the batch holds.
+        static bool listBookFiles(const char* dirPath, BBFProbeBatch* batch);
+        static void probeBatch(BBFProbeBatch* batch, const char* const* metaKeys, uint32_t keyCount, uint32_t threadCount = 8, bool allMeta = false);
+        static void freeProbeBatch(BBFProbeBatch* batch);
+};
+
+#endif // BBFPROBE_H
@@ -0,0 +1,1172 @@
+#include "bbfserve.h"
+
+#ifdef __linux__
+
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+
+// Growable text buffer for JSON bodies
+struct TextBuffer
+{
+    char* data = nullptr;
+    size_t size = 0;
+    size_t cap = 0;
+};
+
+static bool textAppend(TextBuffer* text, const char* str, size_t length)
+{
+    if (text->size + length + 1 > text->cap)
+    {
+        size_t newCap = (text->cap == 0) ? 1024 : text->cap;
+        while (newCap < text->size + length + 1)
+        {
+            newCap *= 2;
+        }
+
+        char* newData = (char*)realloc(text->data, newCap);
+        if (!newData)
+        {
+            return false;
+        }
+        text->data = newData;
+        text->cap = newCap;
+    }
+
+    memcpy(text->data + text->size, str, length);
+    text->size += length;
+    text->data[text->size] = 0;
+    return true;
+}
+
+static bool textAppend(TextBuffer* text, const char* str)
+{
+    return textAppend(text, str, strlen(str));
+}
+
+static bool textAppendNumber(TextBuffer* text, uint64_t number)
+{
+    char numberText[24];
+    int numberLength = snprintf(numberText, sizeof(numberText), "%llu", (unsigned long long)number);
+    return textAppend(text, numberText, (size_t)numberLength);
+}
+
+// Quoted JSON string, or null
+static bool textAppendJson(TextBuffer* text, const char* str)
+{
+    if (!str)
+    {
+        return textAppend(text, "null");
+    }
+
+    bool appendSuccess = textAppend(text, "\"");
+    for (; *str && appendSuccess; str++)
+    {
+        unsigned char strChar = (unsigned char)*str;
+        if (strChar == '"' || strChar == '\\')
+        {
+            char escaped[2] = { '\\', (char)strChar };
+            appendSuccess = textAppend(text, escaped, 2);
+        }
+        else if (strChar < 0x20)
+        {
+            char escaped[8];
+            snprintf(escaped, sizeof(escaped), "\\u%04x", strChar);
+            appendSuccess = textAppend(text, escaped, 6);
+        }
+        else
+        {
+            appendSuccess = textAppend(text, (const char*)&strChar, 1);
+        }
+    }
+
+    return appendSuccess && textAppend(text, "\"");
+}
+
+static const char* statusText(int statusCode)
+{
+    switch (statusCode)
+    {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 416: return "Range Not Satisfiable";
+        case 431: return "Request Header Fields Too Large";
+        default: return "Internal Server Error";
+    }
+}
+
+static const char* contentType(uint8_t mediaType)
+{
+    // See SPECNOTE 4.3.1
+    switch ((BBF::BBFMediaType)mediaType)
+    {
+        case BBF::BBFMediaType::AVIF: return "image/avif";
+        case BBF::BBFMediaType::PNG: return "image/png";
+        case BBF::BBFMediaType::WEBP: return "image/webp";
+        case BBF::BBFMediaType::JXL: return "image/jxl";
+        case BBF::BBFMediaType::BMP: return "image/bmp";
+        case BBF::BBFMediaType::GIF: return "image/gif";
+        case BBF::BBFMediaType::TIFF: return "image/tiff";
+        case BBF::BBFMediaType::JPG: return "image/jpeg";
+        default: return "application/octet-stream";
+    }
+}
+
+// %XX in place. False on a bad escape, or anything that decodes to a path separator.
+static bool percentDecode(char* str)
+{
+    char* out = str;
+    for (; *str; str++)
+    {
+        if (*str == '%')
+        {
+            if (!isxdigit((unsigned char)str[1]) || !isxdigit((unsigned char)str[2]))
+            {
+                return false;
+            }
+
+            char hexText[3] = { str[1], str[2], 0 };
+            long decoded = strtol(hexText, nullptr, 16);
+            if (decoded == 0 || decoded == '/' || decoded == '\\')
+            {
+                return false;
+            }
+            *out++ = (char)decoded;
+            str += 2;
+        }
+        else
+        {
+            *out++ = *str;
+        }
+    }
+
+    *out = 0;
+    return true;
+}
+
+static bool validBookName(const char* bookName)
+{
+    size_t nameLength = strlen(bookName);
+    if (nameLength < 5 || bookName[0] == '.' || strchr(bookName, '/') || strchr(bookName, '\\'))
+    {
+        return false;
+    }
+    return strcmp(bookName + nameLength - 4, ".bbf") == 0;
+}
+
+// Single "bytes=" range. 1 = use it, 0 = ignore it and send everything, -1 = not satisfiable.
+static int parseRange(const char* rangeHeader, uint64_t assetSize, uint64_t* rangeStart, uint64_t* rangeEnd)
+{
+    if (!rangeHeader || strncmp(rangeHeader, "bytes=", 6) != 0 || strchr(rangeHeader, ','))
+    {
+        return 0;
+    }
+
+    const char* rangeText = rangeHeader + 6;
+    char* numberEnd = nullptr;
+
+    if (*rangeText == '-')
+    {
+        // Suffix, the last N bytes
+        uint64_t suffixLength = strtoull(rangeText + 1, &numberEnd, 10);
+        if (numberEnd == rangeText + 1)
+        {
+            return 0;
+        }
+        if (suffixLength == 0 || assetSize == 0)
+        {
+            return -1;
+        }
+        suffixLength = (suffixLength > assetSize) ? assetSize : suffixLength;
+        *rangeStart = assetSize - suffixLength;
+        *rangeEnd = assetSize - 1;
+        return 1;
+    }
+
+    *rangeStart = strtoull(rangeText, &numberEnd, 10);
+    if (numberEnd == rangeText || *numberEnd != '-')
+    {
+        return 0;
+    }
+
+    rangeText = numberEnd + 1;
+    bool openEnded = !(*rangeText >= '0' && *rangeText <= '9');
+    *rangeEnd = openEnded ? 0 : strtoull(rangeText, &numberEnd, 10);
+    if (!openEnded && *rangeEnd < *rangeStart)
+    {
+        return 0;
+    }
+    if (*rangeStart >= assetSize)
+    {
+        return -1;
+    }
+    *rangeEnd = openEnded ? assetSize - 1 : *rangeEnd;
+
+    *rangeEnd = (*rangeEnd >= assetSize) ? assetSize - 1 : *rangeEnd;
+    return 1;
+}
+
+// Copy out a header value, trimmed. Names are case-insensitive.
+static bool findHeader(const char* headerBlock, const char* headerName, char* value, size_t valueSize)
+{
+    size_t nameLength = strlen(headerName);
+    const char* line = headerBlock;
+
+    while (line && *line)
+    {
+        const char* lineEnd = strstr(line, "\r\n");
+        if (!lineEnd)
+        {
+            lineEnd = line + strlen(line);
+        }
+
+        if (strncasecmp(line, headerName, nameLength) == 0 && line[nameLength] == ':')
+        {
+            const char* valueStart = line + nameLength + 1;
+            while (valueStart < lineEnd && (*valueStart == ' ' || *valueStart == '\t'))
+            {
+                valueStart++;
+            }
+
+            const char* valueEnd = lineEnd;
+            while (valueEnd > valueStart && (valueEnd[-1] == ' ' || valueEnd[-1] == '\t'))
+            {
+                valueEnd--;
+            }
+
+            size_t valueLength = (size_t)(valueEnd - valueStart);
+            if (valueLength >= valueSize)
+            {
+                return false;
+            }
+            memcpy(value, valueStart, valueLength);
+            value[valueLength] = 0;
+            return true;
+        }
+
+        line = (*lineEnd) ? lineEnd + 2 : nullptr;
+    }
+
+    return false;
+}
+
+static int compareNames(const void* nameA, const void* nameB)
+{
+    return strcmp(*(const char* const*)nameA, *(const char* const*)nameB);
+}
+
+BBFServer::BBFServer(const BBFServerConfig& sConfig) : bookPool(sConfig.maxOpenBooks)
+{
+    this->config = sConfig;
+    this->bookDir = sConfig.bookDir ? strdup(sConfig.bookDir) : nullptr;
+    this->config.bookDir = this->bookDir;
+    this->config.workerCount = (sConfig.workerCount == 0) ? 1 : sConfig.workerCount;
+    this->config.maxOpenBooks = (sConfig.maxOpenBooks == 0) ? 1 : sConfig.maxOpenBooks;
+
+    this->boundPort = 0;
+    this->requestCount = 0;
+    this->listenFd = -1;
+    this->epollFd = -1;
+    this->wakeFd = -1;
+    this->workers = nullptr;
+    this->workerCount = 0;
+    this->workHead = nullptr;
+    this->workTail = nullptr;
+    this->stopping = false;
+    this->openHead = nullptr;
+}
+
+BBFServer::~BBFServer()
+{
+    stop();
+    wait();
+
+    free(this->bookDir);
+    this->bookDir = nullptr;
+}
+
+bool BBFServer::start()
+{
+    if (!this->bookDir || this->listenFd != -1)
+    {
+        return false;
+    }
+
+    // A client hanging up mid-sendfile shouldn't take the process down
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_in bindAddr;
+    memset(&bindAddr, 0, sizeof(bindAddr));
+    bindAddr.sin_family = AF_INET;
+    bindAddr.sin_port = htons(this->config.port);
+    if (inet_pton(AF_INET, this->config.bindAddress, &bindAddr.sin_addr) != 1)
+    {
+        fprintf(stderr, "[BBFCODEC] Invalid bind address %s\n", this->config.bindAddress);
+        return false;
+    }
+
+    this->listenFd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (this->listenFd == -1)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to create socket\n");
+        return false;
+    }
+
+    int reuseAddr = 1;
+    setsockopt(this->listenFd, SOL_SOCKET, SO_REUSEADDR, &reuseAddr, sizeof(reuseAddr));
+
+    if (bind(this->listenFd, (struct sockaddr*)&bindAddr, sizeof(bindAddr)) == -1 || listen(this->listenFd, 512) == -1)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to listen on %s:%u (errno %d)\n", this->config.bindAddress, (unsigned)this->config.port, errno);
+        close(this->listenFd);
+        this->listenFd = -1;
+        return false;
+    }
+
+    socklen_t addrLength = sizeof(bindAddr);
+    getsockname(this->listenFd, (struct sockaddr*)&bindAddr, &addrLength);
+    this->boundPort = ntohs(bindAddr.sin_port);
+
+    this->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    this->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->epollFd == -1 || this->wakeFd == -1)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to set up epoll\n");
+        return false;
+    }
+
+    struct epoll_event listenEvent;
+    listenEvent.events = EPOLLIN;
+    listenEvent.data.ptr = &this->listenFd;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->listenFd, &listenEvent);
+
+    struct epoll_event wakeEvent;
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.ptr = &this->wakeFd;
+    epoll_ctl(this->epollFd, EPOLL_CTL_ADD, this->wakeFd, &wakeEvent);
+
+    this->stopping = false;
+    this->workerCount = this->config.workerCount;
+    this->workers = new std::thread[this->workerCount];
+
+    uint32_t workerIterator = 0;
+    for (; workerIterator < this->workerCount; workerIterator++)
+    {
+        this->workers[workerIterator] = std::thread(&BBFServer::workerLoop, this);
+    }
+
+    this->eventThread = std::thread(&BBFServer::eventLoop, this);
+    return true;
+}
+
+void BBFServer::stop()
+{
+    // Just an eventfd write, so signal handlers can call this
+    if (this->wakeFd != -1)
+    {
+        uint64_t wakeValue = 1;
+        ssize_t wakeResult = write(this->wakeFd, &wakeValue, sizeof(wakeValue));
+        (void)wakeResult;
+    }
+}
+
+void BBFServer::wait()
+{
+    if (this->eventThread.joinable())
+    {
+        this->eventThread.join();
+    }
+}
+
+void BBFServer::eventLoop()
+{
+    struct epoll_event events[64];
+    bool running = true;
+
+    while (running)
+    {
+        int eventCount = epoll_wait(this->epollFd, events, 64, -1);
+        if (eventCount < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+
+        int eventIterator = 0;
+        for (; eventIterator < eventCount; eventIterator++)
+        {
+            void* eventTarget = events[eventIterator].data.ptr;
+
+            if (eventTarget == &this->wakeFd)
+            {
+                running = false;
+            }
+            else if (eventTarget == &this->listenFd)
+            {
+                acceptConnections();
+            }
+            else
+            {
+                // One-shot, so only one worker ever owns a connection
+                Connection* connection = (Connection*)eventTarget;
+                connection->nextWork = nullptr;
+                {
+                    std::lock_guard<std::mutex> guard(this->workLock);
+                    if (this->workTail)
+                    {
+                        this->workTail->nextWork = connection;
+                    }
+                    else
+                    {
+                        this->workHead = connection;
+                    }
+                    this->workTail = connection;
+                }
+                this->workReady.notify_one();
+            }
+        }
+    }
+
+    // Shut down. Workers finish what they're serving, then everything left open is closed.
+    {
+        std::lock_guard<std::mutex> guard(this->workLock);
+        this->stopping = true;
+    }
+    this->workReady.notify_all();
+
+    uint32_t workerIterator = 0;
+    for (; workerIterator < this->workerCount; workerIterator++)
+    {
+        this->workers[workerIterator].join();
+    }
+    delete[] this->workers;
+    this->workers = nullptr;
+    this->workerCount = 0;
+
+    while (this->openHead)
+    {
+        closeConnection(this->openHead);
+    }
+    this->workHead = nullptr;
+    this->workTail = nullptr;
+
+    close(this->listenFd);
+    close(this->epollFd);
+    close(this->wakeFd);
+    this->listenFd = -1;
+    this->epollFd = -1;
+    this->wakeFd = -1;
+}
+
+void BBFServer::acceptConnections()
+{
+    while (true)
+    {
+        int socketFd = accept4(this->listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (socketFd == -1)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return;
+        }
+
+        int noDelay = 1;
+        setsockopt(socketFd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        Connection* connection = (Connection*)malloc(sizeof(Connection));
+        if (!connection)
+        {
+            close(socketFd);
+            continue;
+        }
+
+        connection->socketFd = socketFd;
+        connection->bufferUsed = 0;
+        connection->outData = nullptr;
+        connection->outSize = 0;
+        connection->outCap = 0;
+        connection->outSent = 0;
+        connection->bodyFd = -1;
+        connection->bodyOffset = 0;
+        connection->bodyLeft = 0;
+        connection->closeAfter = false;
+        connection->nextWork = nullptr;
+        connection->prevOpen = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(this->openLock);
+            connection->nextOpen = this->openHead;
+            if (this->openHead)
+            {
+                this->openHead->prevOpen = connection;
+            }
+            this->openHead = connection;
+        }
+
+        struct epoll_event connectionEvent;
+        connectionEvent.events = EPOLLIN | EPOLLRDHUP | EPOLLONESHOT;
+        connectionEvent.data.ptr = connection;
+        if (epoll_ctl(this->epollFd, EPOLL_CTL_ADD, socketFd, &connectionEvent) == -1)
+        {
+            closeConnection(connection);
+        }
+    }
+}
+
+void BBFServer::closeConnection(Connection* connection)
+{
+    {
+        std::lock_guard<std::mutex> guard(this->openLock);
+        if (connection->prevOpen)
+        {
+            connection->prevOpen->nextOpen = connection->nextOpen;
+        }
+        else
+        {
+            this->openHead = connection->nextOpen;
+        }
+        if (connection->nextOpen)
+        {
+            connection->nextOpen->prevOpen = connection->prevOpen;
+        }
+    }
+
+    if (connection->bodyFd != -1)
+    {
+        close(connection->bodyFd);
+    }
+    close(connection->socketFd);
+    free(connection->outData);
+    free(connection);
+}
+
+bool BBFServer::rearmConnection(Connection* connection)
+{
+    bool outputPending = connection->outSent < connection->outSize || connection->bodyLeft > 0;
+
+    struct epoll_event connectionEvent;
+    connectionEvent.events = (outputPending ? EPOLLOUT : (EPOLLIN | EPOLLRDHUP)) | EPOLLONESHOT;
+    connectionEvent.data.ptr = connection;
+    return epoll_ctl(this->epollFd, EPOLL_CTL_MOD, connection->socketFd, &connectionEvent) == 0;
+}
+
+bool BBFServer::queueOutput(Connection* connection, const void* data, size_t length)
+{
+    if (connection->outSize + length > connection->outCap)
+    {
+        size_t newCap = (connection->outCap == 0) ? 1024 : connection->outCap;
+        while (newCap < connection->outSize + length)
+        {
+            newCap *= 2;
+        }
+
+        char* newData = (char*)realloc(connection->outData, newCap);
+        if (!newData)
+        {
+            return false;
+        }
+        connection->outData = newData;
+        connection->outCap = newCap;
+    }
+
+    memcpy(connection->outData + connection->outSize, data, length);
+    connection->outSize += length;
+    return true;
+}
+
+bool BBFServer::flushOutput(Connection* connection)
+{
+    while (connection->outSent < connection->outSize)
+    {
+        ssize_t sentBytes = send(connection->socketFd, connection->outData + connection->outSent, connection->outSize - connection->outSent, MSG_NOSIGNAL);
+        if (sentBytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sentBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+        if (sentBytes <= 0)
+        {
+            return false;
+        }
+        connection->outSent += (size_t)sentBytes;
+    }
+
+    while (connection->bodyLeft > 0)
+    {
+        off_t sendOffset = (off_t)connection->bodyOffset;
+        size_t chunkSize = (connection->bodyLeft > 0x40000000) ? 0x40000000 : (size_t)connection->bodyLeft;
+        ssize_t sentBytes = sendfile(connection->socketFd, connection->bodyFd, &sendOffset, chunkSize);
+        if (sentBytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (sentBytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            return true;
+        }
+        if (sentBytes <= 0)
+        {
+            return false;
+        }
+        connection->bodyOffset += (uint64_t)sentBytes;
+        connection->bodyLeft -= (uint64_t)sentBytes;
+    }
+
+    // All out. The buffer is kept for the next response.
+    connection->outSize = 0;
+    connection->outSent = 0;
+    if (connection->bodyFd != -1)
+    {
+        close(connection->bodyFd);
+        connection->bodyFd = -1;
+    }
+    return true;
+}
+
+void BBFServer::workerLoop()
+{
+    while (true)
+    {
+        Connection* connection = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(this->workLock);
+            this->workReady.wait(lock, [this] { return this->stopping || this->workHead != nullptr; });
+            if (this->stopping)
+            {
+                return;
+            }
+
+            connection = this->workHead;
+            this->workHead = connection->nextWork;
+            if (!this->workHead)
+            {
+                this->workTail = nullptr;
+            }
+        }
+
+        serveConnection(connection);
+    }
+}
+
+void BBFServer::serveConnection(Connection* connection)
+{
+    // The last response comes first. If it still doesn't fit, wait for the socket again.
+    if (!flushOutput(connection))
+    {
+        closeConnection(connection);
+        return;
+    }
+    if (connection->outSize > 0 || connection->closeAfter)
+    {
+        if (connection->outSize == 0 || !rearmConnection(connection))
+        {
+            closeConnection(connection);
+        }
+        return;
+    }
+
+    bool peerClosed = false;
+
+    // Drain the socket. It's non-blocking, so this stops when there's nothing more yet.
+    while (connection->bufferUsed < sizeof(connection->requestBuffer) - 1)
+    {
+        ssize_t readBytes = recv(connection->socketFd, connection->requestBuffer + connection->bufferUsed, sizeof(connection->requestBuffer) - 1 - connection->bufferUsed, 0);
+        if (readBytes < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (readBytes == 0 || (readBytes < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+        {
+            peerClosed = true;
+            break;
+        }
+        if (readBytes < 0)
+        {
+            break;
+        }
+        connection->bufferUsed += (uint32_t)readBytes;
+    }
+    connection->requestBuffer[connection->bufferUsed] = 0;
+
+    // Answer every complete request in the buffer, pipelined or not. One response is queued at a time.
+    while (true)
+    {
+        char* headerEnd = strstr(connection->requestBuffer, "\r\n\r\n");
+        if (!headerEnd)
+        {
+            if (connection->bufferUsed >= sizeof(connection->requestBuffer) - 1)
+            {
+                Request tooLarge = {};
+                if (!sendStatus(connection, &tooLarge, 431))
+                {
+                    closeConnection(connection);
+                    return;
+                }
+                connection->closeAfter = true;
+            }
+            break;
+        }
+
+        headerEnd[2] = 0;
+        uint32_t requestLength = (uint32_t)(headerEnd + 4 - connection->requestBuffer);
+
+        Request request = {};
+        bool queueSuccess = false;
+
+        // Request line: METHOD SP target SP version
+        char* lineEnd = strstr(connection->requestBuffer, "\r\n");
+        *lineEnd = 0;
+        char* method = connection->requestBuffer;
+        char* target = strchr(method, ' ');
+        char* version = target ? strchr(target + 1, ' ') : nullptr;
+        if (!target || !version)
+        {
+            queueSuccess = sendStatus(connection, &request, 400);
+        }
+        else
+        {
+            *target++ = 0;
+            *version++ = 0;
+            char* headerBlock = lineEnd + 2;
+
+            char connectionValue[64];
+            bool hasConnection = findHeader(headerBlock, "Connection", connectionValue, sizeof(connectionValue));
+            bool wantsClose = hasConnection && strcasecmp(connectionValue, "close") == 0;
+            bool wantsKeepAlive = hasConnection && strcasecmp(connectionValue, "keep-alive") == 0;
+            request.keepAlive = (strcmp(version, "HTTP/1.1") == 0) ? !wantsClose : wantsKeepAlive;
+
+            request.rangeHeader = findHeader(headerBlock, "Range", request.rangeValue, sizeof(request.rangeValue)) ? request.rangeValue : nullptr;
+            request.ifNoneMatch = findHeader(headerBlock, "If-None-Match", request.matchValue, sizeof(request.matchValue)) ? request.matchValue : nullptr;
+            request.target = target;
+            request.headOnly = strcmp(method, "HEAD") == 0;
+
+            if (!request.headOnly && strcmp(method, "GET") != 0)
+            {
+                request.keepAlive = false;
+                queueSuccess = sendStatus(connection, &request, 405, "Allow: GET, HEAD\r\n");
+            }
+            else
+            {
+                queueSuccess = handleRequest(connection, &request);
+            }
+            this->requestCount++;
+        }
+
+        // Out of memory for the response. Nothing sensible can go out.
+        if (!queueSuccess)
+        {
+            closeConnection(connection);
+            return;
+        }
+
+        memmove(connection->requestBuffer, connection->requestBuffer + requestLength, connection->bufferUsed - requestLength);
+        connection->bufferUsed -= requestLength;
+        connection->requestBuffer[connection->bufferUsed] = 0;
+
+        if (!request.keepAlive)
+        {
+            connection->closeAfter = true;
+            break;
+        }
+
+        // The rest of the pipeline waits until this one is out
+        if (!flushOutput(connection))
+        {
+            closeConnection(connection);
+            return;
+        }
+        if (connection->outSize > 0)
+        {
+            break;
+        }
+    }
+
+    connection->closeAfter = connection->closeAfter || peerClosed;
+    if (!flushOutput(connection))
+    {
+        closeConnection(connection);
+        return;
+    }
+
+    bool outputPending = connection->outSize > 0;
+    if ((!outputPending && connection->closeAfter) || !rearmConnection(connection))
+    {
+        closeConnection(connection);
+    }
+}
+
+bool BBFServer::sendStatus(Connection* connection, Request* request, int statusCode, const char* extraHeaders)
+{
+    char response[512];
+    char body[64];
+    int bodyLength = snprintf(body, sizeof(body), "%d %s\n", statusCode, statusText(statusCode));
+
+    // 304 has no body
+    if (statusCode == 304)
+    {
+        bodyLength = 0;
+    }
+
+    int responseLength = snprintf(response, sizeof(response),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: text/plain\r\n"
+        "Content-Length: %d\r\n"
+        "%s"
+        "%s"
+        "\r\n",
+        statusCode, statusText(statusCode), bodyLength, extraHeaders,
+        request->keepAlive ? "" : "Connection: close\r\n");
+
+    if (!queueOutput(connection, response, (size_t)responseLength))
+    {
+        return false;
+    }
+
+    return request->headOnly || bodyLength == 0 || queueOutput(connection, body, (size_t)bodyLength);
+}
+
+bool BBFServer::handleRequest(Connection* connection, Request* request)
+{
+    // Queries aren't used
+    char* query = strchr(request->target, '?');
+    if (query)
+    {
+        *query = 0;
+    }
+
+    if (strcmp(request->target, "/") == 0 || strcmp(request->target, "/books") == 0)
+    {
+        return sendBookList(connection, request);
+    }
+
+    // /<book>/toc, /<book>/page/<N>
+    if (request->target[0] != '/')
+    {
+        return sendStatus(connection, request, 400);
+    }
+
+    char* bookName = request->target + 1;
+    char* route = strchr(bookName, '/');
+    if (!route)
+    {
+        return sendStatus(connection, request, 404);
+    }
+    *route++ = 0;
+
+    if (!percentDecode(bookName) || !validBookName(bookName))
+    {
+        return sendStatus(connection, request, 404);
+    }
+
+    uint64_t pageIndex = 0xFFFFFFFFFFFFFFFF;
+    bool tocRoute = strcmp(route, "toc") == 0;
+    if (!tocRoute)
+    {
+        if (strncmp(route, "page/", 5) != 0 || route[5] < '0' || route[5] > '9')
+        {
+            return sendStatus(connection, request, 404);
+        }
+
+        char* numberEnd = nullptr;
+        pageIndex = strtoull(route + 5, &numberEnd, 10);
+        if (*numberEnd != 0)
+        {
+            return sendStatus(connection, request, 404);
+        }
+    }
+
+    BBFReaderHandle book = acquireBook(bookName);
+    if (!book)
+    {
+        return sendStatus(connection, request, 404);
+    }
+
+    return tocRoute ? sendToc(connection, request, book, bookName) : sendPage(connection, request, book, pageIndex);
+}
+
+bool BBFServer::sendBookList(Connection* connection, Request* request)
+{
+    DIR* dir = opendir(this->bookDir);
+    if (!dir)
+    {
+        return sendStatus(connection, request, 500);
+    }
+
+    uint64_t nameCount = 0;
+    uint64_t nameCap = 64;
+    char** names = (char**)malloc(sizeof(char*) * nameCap);
+
+    struct dirent* entry = nullptr;
+    while (names && (entry = readdir(dir)) != nullptr)
+    {
+        if (!validBookName(entry->d_name))
+        {
+            continue;
+        }
+
+        if (nameCount == nameCap)
+        {
+            nameCap *= 2;
+            char** newNames = (char**)realloc(names, sizeof(char*) * nameCap);
+            if (!newNames)
+            {
+                break;
+            }
+            names = newNames;
+        }
+        names[nameCount++] = strdup(entry->d_name);
+    }
+    closedir(dir);
+
+    if (!names)
+    {
+        return sendStatus(connection, request, 500);
+    }
+
+    qsort(names, (size_t)nameCount, sizeof(char*), compareNames);
+
+    TextBuffer body;
+    bool buildSuccess = textAppend(&body, "{\"books\":[");
+
+    uint64_t nameIterator = 0;
+    for (; nameIterator < nameCount; nameIterator++)
+    {
+        if (nameIterator > 0)
+        {
+            buildSuccess = buildSuccess && textAppend(&body, ",");
+        }
+        buildSuccess = buildSuccess && textAppendJson(&body, names[nameIterator]);
+        free(names[nameIterator]);
+    }
+    free(names);
+
+    buildSuccess = buildSuccess && textAppend(&body, "]}\n");
+    if (!buildSuccess)
+    {
+        free(body.data);
+        return sendStatus(connection, request, 500);
+    }
+
+    char headers[256];
+    int headerLength = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %llu\r\n"
+        "Cache-Control: no-cache\r\n"
+        "%s"
+        "\r\n",
+        (unsigned long long)body.size, request->keepAlive ? "" : "Connection: close\r\n");
+
+    bool sendSuccess = queueOutput(connection, headers, (size_t)headerLength) && (request->headOnly || queueOutput(connection, body.data, body.size));
+    free(body.data);
+    return sendSuccess;
+}
+
+bool BBFServer::sendToc(Connection* connection, Request* request, const BBFReaderHandle& book, const char* bookName)
+{
+    // The pool loaded the footer, so nothing here writes to the shared reader
+    BBFReader* reader = book.get();
+    const BBFFooter* footer = book.getFooter();
+
+    TextBuffer body;
+    bool buildSuccess = textAppend(&body, "{\"book\":") && textAppendJson(&body, bookName);
+    buildSuccess = buildSuccess && textAppend(&body, ",\"pages\":") && textAppendNumber(&body, footer->pageCount);
+    buildSuccess = buildSuccess && textAppend(&body, ",\"sections\":[");
+
+    const uint8_t* sectionTable = reader->getSectionTableView(footer->sectionOffset);
+    uint64_t sectionIterator = 0;
+    for (; buildSuccess && sectionTable && sectionIterator < footer->sectionCount; sectionIterator++)
+    {
+        const BBFSection* section = reader->getSectionEntryView(sectionTable, (int)sectionIterator);
+        if (!section)
+        {
+            break;
+        }
+
+        buildSuccess = textAppend(&body, (sectionIterator > 0) ? ",{\"title\":" : "{\"title\":");
+        buildSuccess = buildSuccess && textAppendJson(&body, reader->getStringView(section->sectionTitleOffset));
+        buildSuccess = buildSuccess && textAppend(&body, ",\"page\":") && textAppendNumber(&body, section->sectionStartIndex);
+        buildSuccess = buildSuccess && textAppend(&body, ",\"parent\":") && textAppendJson(&body, reader->getStringView(section->sectionParentOffset));
+        buildSuccess = buildSuccess && textAppend(&body, "}");
+    }
+
+    buildSuccess = buildSuccess && textAppend(&body, "],\"meta\":[");
+
+    const uint8_t* metaTable = reader->getMetadataView(footer->metaOffset);
+    uint64_t metaIterator = 0;
+    for (; buildSuccess && metaTable && metaIterator < footer->metaCount; metaIterator++)
+    {
+        const BBFMeta* meta = reader->getMetaEntryView(metaTable, (int)metaIterator);
+        if (!meta)
+        {
+            break;
+        }
+
+        buildSuccess = textAppend(&body, (metaIterator > 0) ? ",{\"key\":" : "{\"key\":");
+        buildSuccess = buildSuccess && textAppendJson(&body, reader->getStringView(meta->keyOffset));
+        buildSuccess = buildSuccess && textAppend(&body, ",\"value\":") && textAppendJson(&body, reader->getStringView(meta->valueOffset));
+        buildSuccess = buildSuccess && textAppend(&body, ",\"parent\":") && textAppendJson(&body, reader->getStringView(meta->parentOffset));
+        buildSuccess = buildSuccess && textAppend(&body, "}");
+    }
+
+    buildSuccess = buildSuccess && textAppend(&body, "]}\n");
+    if (!buildSuccess)
+    {
+        free(body.data);
+        return sendStatus(connection, request, 500);
+    }
+
+    char headers[256];
+    int headerLength = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %llu\r\n"
+        "Cache-Control: no-cache\r\n"
+        "%s"
+        "\r\n",
+        (unsigned long long)body.size, request->keepAlive ? "" : "Connection: close\r\n");
+
+    bool sendSuccess = queueOutput(connection, headers, (size_t)headerLength) && (request->headOnly || queueOutput(connection, body.data, body.size));
+    free(body.data);
+    return sendSuccess;
+}
+
+bool BBFServer::sendPage(Connection* connection, Request* request, const BBFReaderHandle& book, uint64_t pageIndex)
+{
+    BBFReader* reader = book.get();
+    const BBFFooter* footer = book.getFooter();
+
+    if (pageIndex >= footer->pageCount)
+    {
+        return sendStatus(connection, request, 404);
+    }
+
+    const BBFPage* page = reader->getPageEntryView(reader->getPageTableView(footer->pageOffset), (int)pageIndex);
+    const BBFAsset* asset = page ? reader->getAssetEntryView(reader->getAssetTableView(footer->assetOffset), (int)page->assetIndex) : nullptr;
+
+    BBFExportList list;
+    if (!asset || !reader->exportPages(pageIndex, 1, &list))
+    {
+        return sendStatus(connection, request, 500);
+    }
+
+    // Assets never change under a hash, so the hash is the ETag
+    char entityTag[40];
+    snprintf(entityTag, sizeof(entityTag), "\"%016llx%016llx\"", (unsigned long long)asset->assetHash[1], (unsigned long long)asset->assetHash[0]);
+
+    char extraHeaders[256];
+    snprintf(extraHeaders, sizeof(extraHeaders), "ETag: %s\r\nCache-Control: public, max-age=31536000, immutable\r\n", entityTag);
+
+    if (request->ifNoneMatch && (strstr(request->ifNoneMatch, entityTag) || strcmp(request->ifNoneMatch, "*") == 0))
+    {
+        BBFReader::freeExportList(&list);
+        return sendStatus(connection, request, 304, extraHeaders);
+    }
+
+    uint64_t rangeStart = 0;
+    uint64_t rangeEnd = 0;
+    int rangeResult = parseRange(request->rangeHeader, asset->fileSize, &rangeStart, &rangeEnd);
+    if (rangeResult < 0)
+    {
+        BBFReader::freeExportList(&list);
+        char rangeHeaders[320];
+        snprintf(rangeHeaders, sizeof(rangeHeaders), "%sContent-Range: bytes */%llu\r\n", extraHeaders, (unsigned long long)asset->fileSize);
+        return sendStatus(connection, request, 416, rangeHeaders);
+    }
+
+    // Trim the span to the range. It's a single asset, so a single span.
+    if (rangeResult > 0)
+    {
+        list.spans[0].fileOffset += rangeStart;
+        list.spans[0].bookOffset += rangeStart;
+        list.spans[0].length = rangeEnd - rangeStart + 1;
+        list.totalBytes = list.spans[0].length;
+    }
+
+    char contentRange[96] = "";
+    if (rangeResult > 0)
+    {
+        snprintf(contentRange, sizeof(contentRange), "Content-Range: bytes %llu-%llu/%llu\r\n", (unsigned long long)rangeStart, (unsigned long long)rangeEnd, (unsigned long long)asset->fileSize);
+    }
+
+    char headers[768];
+    int headerLength = snprintf(headers, sizeof(headers),
+        "HTTP/1.1 %s\r\n"
+        "Content-Type: %s\r\n"
+        "Content-Length: %llu\r\n"
+        "Accept-Ranges: bytes\r\n"
+        "%s"
+        "%s"
+        "%s"
+        "\r\n",
+        (rangeResult > 0) ? "206 Partial Content" : "200 OK",
+        contentType(asset->type),
+        (unsigned long long)list.totalBytes,
+        extraHeaders, contentRange,
+        request->keepAlive ? "" : "Connection: close\r\n");
+
+    bool sendSuccess = queueOutput(connection, headers, (size_t)headerLength);
+    if (sendSuccess && !request->headOnly && list.totalBytes > 0)
+    {
+        const BBFFileSpan* span = &list.spans[0];
+        if (span->fileDescriptor != -1)
+        {
+            // Our own fd, so the pool can close the book while the page is still going out
+            connection->bodyFd = fcntl(span->fileDescriptor, F_DUPFD_CLOEXEC, 0);
+            connection->bodyOffset = span->fileOffset;
+            connection->bodyLeft = span->length;
+            sendSuccess = connection->bodyFd != -1;
+            connection->bodyLeft = sendSuccess ? connection->bodyLeft : 0;
+        }
+        else
+        {
+            // Not backed by a file. The mapped bytes are copied into the queue.
+            const uint8_t* assetData = reader->getAssetDataView(asset);
+            sendSuccess = assetData && queueOutput(connection, assetData + (span->bookOffset - asset->fileOffset), (size_t)span->length);
+        }
+    }
+
+    BBFReader::freeExportList(&list);
+    return sendSuccess;
+}
+
+BBFReaderHandle BBFServer::acquireBook(const char* bookName)
+{
+    size_t dirLength = strlen(this->bookDir);
+    size_t pathLength = dirLength + 1 + strlen(bookName) + 1;
+    char* bookPath = (char*)malloc(pathLength);
+    if (!bookPath)
+    {
+        return BBFReaderHandle();
+    }
+    snprintf(bookPath, pathLength, "%s%s%s", this->bookDir, (dirLength > 0 && this->bookDir[dirLength - 1] == '/') ? "" : "/", bookName);
+
+    BBFReaderHandle book = this->bookPool.acquire(bookPath);
+    free(bookPath);
+    return book;
+}
+
+#endif // __linux__
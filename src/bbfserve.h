@@ -0,0 +1,128 @@
+// BBF Page Server
+// Small HTTP/1.1 server for pages out of a directory of books. One epoll thread hands
+// ready connections to a worker pool, and page bytes go out with sendfile. Linux only (epoll).
+// Sockets never block: a response that doesn't fit waits on epoll for the client, not on a worker.
+//
+// GET /books                  JSON list of books in the directory
+// GET /<book>/toc             JSON sections and metadata
+// GET /<book>/page/<N>        Page N. Immutable ETag from the asset's XXH3-128, Range supported.
+#ifndef BBFSERVE_H
+#define BBFSERVE_H
+
+#include "bbfcodec.h"
+#include "bbfpool.h"
+
+#ifdef __linux__
+
+#include <stdint.h>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+struct BBFServerConfig
+{
+    const char* bookDir = nullptr;
+    const char* bindAddress = "127.0.0.1";
+    uint16_t port = 8080; // 0 picks a free port, see getPort()
+    uint32_t workerCount = 4;
+    uint32_t maxOpenBooks = 64; // Readers kept open between requests (BBFReaderPool limit)
+};
+
+class BBFServer
+{
+    public:
+        BBFServer(const BBFServerConfig& sConfig);
+        ~BBFServer(); // Stops the server and waits for it
+        // Not copyable, it owns the listening socket and its threads.
+        BBFServer(const BBFServer&) = delete;
+        BBFServer& operator=(const BBFServer&) = delete;
+
+        bool start(); // Bind, listen, start the threads. Returns once it's accepting. Ignores SIGPIPE.
+        void wait(); // Block until the server has stopped
+        void stop(); // Safe from a signal handler
+
+        uint16_t getPort() const { return boundPort; }
+        uint64_t getRequestCount() const { return requestCount.load(); }
+
+    private:
+        struct Connection
+        {
+            int socketFd;
+            char requestBuffer[8192];
+            uint32_t bufferUsed;
+
+            // Response still going out: headers and small bodies, then a page from the book
+            char* outData;
+            size_t outSize;
+            size_t outCap;
+            size_t outSent;
+            int bodyFd; // Our own dup of the book's fd, -1 if none
+            uint64_t bodyOffset;
+            uint64_t bodyLeft;
+            bool closeAfter; // Close once the response is out
+
+            Connection* nextWork;
+            Connection* prevOpen;
+            Connection* nextOpen;
+        };
+
+        struct Request
+        {
+            bool headOnly;
+            bool keepAlive;
+            char* target;
+            const char* rangeHeader; // nullptr if missing, otherwise points at rangeValue
+            const char* ifNoneMatch;
+            char rangeValue[128];
+            char matchValue[256];
+        };
+
+        BBFServerConfig config;
+        char* bookDir;
+        uint16_t boundPort;
+        std::atomic<uint64_t> requestCount;
+
+        int listenFd;
+        int epollFd;
+        int wakeFd;
+        std::thread eventThread;
+        std::thread* workers;
+        uint32_t workerCount;
+
+        // Connections ready to be read. Pushed by the event thread, popped by workers.
+        std::mutex workLock;
+        std::condition_variable workReady;
+        Connection* workHead;
+        Connection* workTail;
+        bool stopping;
+
+        // Every open connection, so they can be closed on shutdown
+        std::mutex openLock;
+        Connection* openHead;
+
+        BBFReaderPool bookPool;
+
+        void eventLoop();
+        void workerLoop();
+        void acceptConnections();
+        void serveConnection(Connection* connection);
+        void closeConnection(Connection* connection);
+        bool rearmConnection(Connection* connection); // For reading, or for writing while a response is going out
+
+        // Responses are queued on the connection, then flushed until the socket is full
+        bool queueOutput(Connection* connection, const void* data, size_t length);
+        bool flushOutput(Connection* connection); // False on a real error. Anything left waits for EPOLLOUT.
+
+        bool handleRequest(Connection* connection, Request* request);
+        bool sendBookList(Connection* connection, Request* request);
+        bool sendToc(Connection* connection, Request* request, const BBFReaderHandle& book, const char* bookName);
+        bool sendPage(Connection* connection, Request* request, const BBFReaderHandle& book, uint64_t pageIndex);
+        bool sendStatus(Connection* connection, Request* request, int statusCode, const char* extraHeaders = "");
+
+        BBFReaderHandle acquireBook(const char* bookName);
+};
+
+#endif // __linux__
+
+#endif // BBFSERVE_H
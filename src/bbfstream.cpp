@@ -0,0 +1,419 @@
+#include "bbfstream.h"
+
+#include <string.h>
+
+static int compareStreamPages(const void* pageA, const void* pageB)
+{
+    const uint64_t* entryA = (const uint64_t*)pageA;
+    const uint64_t* entryB = (const uint64_t*)pageB;
+
+    // By asset end, then page order, so pages sharing an asset come out in reading order.
+    if (entryA[0] != entryB[0])
+    {
+        return (entryA[0] > entryB[0]) ? 1 : -1;
+    }
+    return (entryA[1] > entryB[1]) - (entryA[1] < entryB[1]);
+}
+
+// Does [offset, offset + count * entrySize) fit below limit?
+static bool tableFits(uint64_t offset, uint64_t count, uint64_t entrySize, uint64_t limit)
+{
+    if (count > limit / entrySize)
+    {
+        return false;
+    }
+
+    uint64_t tableBytes = count * entrySize;
+    return offset + tableBytes >= offset && offset + tableBytes <= limit;
+}
+
+BBFStreamParser::BBFStreamParser(bool sVerifyAssets)
+{
+    this->state = STREAM_HEADER;
+    this->verifyAssets = sVerifyAssets;
+    this->errorMessage = nullptr;
+    this->errorPage = 0;
+
+    this->streamBuffer = nullptr;
+    this->bufferCap = 0;
+    this->receivedBytes = 0;
+
+    memset(&this->footerData, 0, sizeof(BBFFooter));
+    this->hasFooter = false;
+    this->indexEnd = 0;
+    this->bookSize = 0;
+
+    this->pageOrder = nullptr;
+    this->pageCursor = 0;
+}
+
+BBFStreamParser::~BBFStreamParser()
+{
+    if (this->streamBuffer)
+    {
+        free(this->streamBuffer);
+        this->streamBuffer = nullptr;
+    }
+
+    if (this->pageOrder)
+    {
+        free(this->pageOrder);
+        this->pageOrder = nullptr;
+    }
+}
+
+void BBFStreamParser::fail(const char* message)
+{
+    this->state = STREAM_ERROR;
+    this->errorMessage = message;
+}
+
+bool BBFStreamParser::growBuffer(uint64_t minCap)
+{
+    if (minCap <= this->bufferCap)
+    {
+        return true;
+    }
+
+    // realloc takes a size_t. A 64-bit size cut down to 32 bits would hand back a small block.
+    if (minCap > BBF::MAX_STREAM_BOOK_SIZE || minCap > (uint64_t)SIZE_MAX)
+    {
+        fprintf(stderr, "[BBFCODEC] Stream buffer of %llu bytes is too large.\n", (unsigned long long)minCap);
+        return false;
+    }
+
+    // Double until the index arrives. After that the buffer is exactly the book.
+    uint64_t newCap = (this->bookSize != 0) ? minCap : ((this->bufferCap * 2 > minCap) ? this->bufferCap * 2 : minCap);
+    newCap = (newCap < 4096) ? 4096 : newCap;
+    newCap = (newCap > BBF::MAX_STREAM_BOOK_SIZE) ? BBF::MAX_STREAM_BOOK_SIZE : newCap;
+
+    uint8_t* tempBuffer = (uint8_t*)realloc(this->streamBuffer, (size_t)newCap);
+    if (!tempBuffer)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to grow stream buffer to %llu bytes.\n", (unsigned long long)newCap);
+        return false;
+    }
+
+    this->streamBuffer = tempBuffer;
+    this->bufferCap = newCap;
+    return true;
+}
+
+bool BBFStreamParser::feed(const void* chunk, size_t chunkSize)
+{
+    if (this->state == STREAM_ERROR || this->state == STREAM_FAILED)
+    {
+        return false;
+    }
+
+    if (!chunk || chunkSize == 0)
+    {
+        return true;
+    }
+
+    uint64_t copyBytes = chunkSize;
+
+    // Once we know how big the book is, anything after it is ignored.
+    if (this->bookSize != 0)
+    {
+        uint64_t bytesLeft = (this->receivedBytes < this->bookSize) ? this->bookSize - this->receivedBytes : 0;
+        copyBytes = (copyBytes > bytesLeft) ? bytesLeft : copyBytes;
+        if (copyBytes == 0)
+        {
+            return true;
+        }
+    }
+
+    if (!growBuffer(this->receivedBytes + copyBytes))
+    {
+        fail("Out of memory");
+        return false;
+    }
+
+    memcpy(this->streamBuffer + this->receivedBytes, chunk, (size_t)copyBytes);
+    this->receivedBytes += copyBytes;
+    return true;
+}
+
+bool BBFStreamParser::parseIndex()
+{
+    const BBFFooter* pFooter = &this->footerData;
+
+    if (!tableFits(pFooter->assetOffset, pFooter->assetCount, sizeof(BBFAsset), this->indexEnd) ||
+        !tableFits(pFooter->pageOffset, pFooter->pageCount, sizeof(BBFPage), this->indexEnd) ||
+        !tableFits(pFooter->sectionOffset, pFooter->sectionCount, sizeof(BBFSection), this->indexEnd) ||
+        !tableFits(pFooter->metaOffset, pFooter->metaCount, sizeof(BBFMeta), this->indexEnd))
+    {
+        fail("Index tables out of bounds");
+        return false;
+    }
+
+    if (pFooter->assetCount == 0 || pFooter->pageCount == 0)
+    {
+        fail("Book has no pages");
+        return false;
+    }
+
+    // Where the book ends, and when each page is complete
+    uint64_t dataEnd = this->indexEnd;
+    const BBFAsset* assetTable = (const BBFAsset*)(this->streamBuffer + pFooter->assetOffset);
+
+    uint64_t assetIterator = 0;
+    for (; assetIterator < pFooter->assetCount; assetIterator++)
+    {
+        uint64_t assetEnd = assetTable[assetIterator].fileOffset + assetTable[assetIterator].fileSize;
+        if (assetEnd < assetTable[assetIterator].fileOffset || assetTable[assetIterator].fileOffset < this->indexEnd)
+        {
+            fail("Asset out of bounds");
+            return false;
+        }
+        dataEnd = (assetEnd > dataEnd) ? assetEnd : dataEnd;
+    }
+
+    if (dataEnd > BBF::MAX_STREAM_BOOK_SIZE)
+    {
+        fail("Book too large to stream");
+        return false;
+    }
+
+    this->pageOrder = (uint64_t*)malloc(sizeof(uint64_t) * 2 * pFooter->pageCount);
+    if (!this->pageOrder)
+    {
+        fail("Out of memory");
+        return false;
+    }
+
+    const BBFPage* pageTable = (const BBFPage*)(this->streamBuffer + pFooter->pageOffset);
+    uint64_t pageIterator = 0;
+    for (; pageIterator < pFooter->pageCount; pageIterator++)
+    {
+        uint64_t assetIndex = pageTable[pageIterator].assetIndex;
+        if (assetIndex >= pFooter->assetCount)
+        {
+            fail("Page references a missing asset");
+            return false;
+        }
+
+        this->pageOrder[pageIterator * 2 + 0] = assetTable[assetIndex].fileOffset + assetTable[assetIndex].fileSize;
+        this->pageOrder[pageIterator * 2 + 1] = pageIterator;
+    }
+
+    qsort(this->pageOrder, (size_t)pFooter->pageCount, sizeof(uint64_t) * 2, compareStreamPages);
+
+    // Size the buffer for the whole book now, so page pointers never move.
+    this->bookSize = dataEnd;
+    if (!growBuffer(this->bookSize))
+    {
+        fail("Out of memory");
+        return false;
+    }
+
+    // Bytes past the end of the book that were already fed don't count.
+    this->receivedBytes = (this->receivedBytes > this->bookSize) ? this->bookSize : this->receivedBytes;
+    return true;
+}
+
+bool BBFStreamParser::poll(BBFStreamEvent* event)
+{
+    if (!event)
+    {
+        return false;
+    }
+
+    *event = BBFStreamEvent();
+
+    switch (this->state)
+    {
+        case STREAM_HEADER:
+        {
+            if (this->receivedBytes < sizeof(BBFHeader))
+            {
+                return false;
+            }
+
+            const BBFHeader* header = (const BBFHeader*)this->streamBuffer;
+            if (header->magic[0] != 'B' || header->magic[1] != 'B' || header->magic[2] != 'F' || header->magic[3] != '3')
+            {
+                fail("Invalid magic");
+            }
+            else if (!(header->flags & BBF::BBF_PETRIFICATION_FLAG))
+            {
+                // The footer is at the end of a regular file, nothing can be shown early.
+                fail("Book is not petrified");
+            }
+            else if (header->footerOffset < header->headerLen || header->footerOffset > BBF::MAX_STREAM_BOOK_SIZE - sizeof(BBFFooter))
+            {
+                fail("Invalid footer offset");
+            }
+            else
+            {
+                this->state = STREAM_FOOTER;
+                event->type = BBFStreamEventType::HEADER;
+                return true;
+            }
+
+            return poll(event);
+        }
+
+        case STREAM_FOOTER:
+        {
+            const BBFHeader* header = (const BBFHeader*)this->streamBuffer;
+            if (this->receivedBytes < header->footerOffset + sizeof(BBFFooter))
+            {
+                return false;
+            }
+
+            memcpy(&this->footerData, this->streamBuffer + header->footerOffset, sizeof(BBFFooter));
+            this->hasFooter = true;
+
+            // Index is everything up to the end of the string pool (or the footer, if that's further)
+            uint64_t stringPoolEnd = this->footerData.stringPoolOffset + this->footerData.stringPoolSize;
+            uint64_t footerEnd = header->footerOffset + sizeof(BBFFooter);
+            if (stringPoolEnd < this->footerData.stringPoolOffset || stringPoolEnd > BBF::MAX_STREAM_BOOK_SIZE)
+            {
+                fail("Invalid string pool");
+                return poll(event);
+            }
+
+            this->indexEnd = (stringPoolEnd > footerEnd) ? stringPoolEnd : footerEnd;
+            this->state = STREAM_INDEX;
+            event->type = BBFStreamEventType::FOOTER;
+            return true;
+        }
+
+        case STREAM_INDEX:
+        {
+            if (this->receivedBytes < this->indexEnd)
+            {
+                return false;
+            }
+
+            if (!parseIndex())
+            {
+                return poll(event);
+            }
+
+            this->state = STREAM_PAGES;
+            event->type = BBFStreamEventType::INDEX;
+            return true;
+        }
+
+        case STREAM_PAGES:
+        {
+            if (this->pageCursor >= this->footerData.pageCount)
+            {
+                if (this->receivedBytes < this->bookSize)
+                {
+                    return false;
+                }
+
+                this->state = STREAM_DONE;
+                event->type = BBFStreamEventType::COMPLETE;
+                return true;
+            }
+
+            if (this->pageOrder[this->pageCursor * 2] > this->receivedBytes)
+            {
+                return false;
+            }
+
+            uint64_t pageIndex = this->pageOrder[this->pageCursor * 2 + 1];
+            const BBFAsset* asset = getAsset(getPage(pageIndex)->assetIndex);
+            const uint8_t* assetData = this->streamBuffer + asset->fileOffset;
+
+            if (this->verifyAssets)
+            {
+                XXH128_hash_t assetHash = XXH3_128bits(assetData, (size_t)asset->fileSize);
+                if (assetHash.low64 != asset->assetHash[0] || assetHash.high64 != asset->assetHash[1])
+                {
+                    fail("Asset hash mismatch");
+                    this->errorPage = pageIndex;
+                    return poll(event);
+                }
+            }
+
+            this->pageCursor++;
+
+            event->type = BBFStreamEventType::PAGE;
+            event->pageIndex = pageIndex;
+            event->asset = asset;
+            event->data = assetData;
+            event->dataSize = asset->fileSize;
+            return true;
+        }
+
+        case STREAM_ERROR:
+        {
+            event->type = BBFStreamEventType::INVALID;
+            event->pageIndex = this->errorPage;
+            event->message = this->errorMessage;
+            this->state = STREAM_FAILED;
+            return true;
+        }
+
+        case STREAM_DONE:
+        case STREAM_FAILED:
+            return false;
+    }
+
+    return false;
+}
+
+const BBFAsset* BBFStreamParser::getAsset(uint64_t assetIndex) const
+{
+    if (this->bookSize == 0 || assetIndex >= this->footerData.assetCount)
+    {
+        return nullptr;
+    }
+    return (const BBFAsset*)(this->streamBuffer + this->footerData.assetOffset) + assetIndex;
+}
+
+const BBFPage* BBFStreamParser::getPage(uint64_t pageIndex) const
+{
+    if (this->bookSize == 0 || pageIndex >= this->footerData.pageCount)
+    {
+        return nullptr;
+    }
+    return (const BBFPage*)(this->streamBuffer + this->footerData.pageOffset) + pageIndex;
+}
+
+const BBFSection* BBFStreamParser::getSection(uint64_t sectionIndex) const
+{
+    if (this->bookSize == 0 || sectionIndex >= this->footerData.sectionCount)
+    {
+        return nullptr;
+    }
+    return (const BBFSection*)(this->streamBuffer + this->footerData.sectionOffset) + sectionIndex;
+}
+
+const BBFMeta* BBFStreamParser::getMeta(uint64_t metaIndex) const
+{
+    if (this->bookSize == 0 || metaIndex >= this->footerData.metaCount)
+    {
+        return nullptr;
+    }
+    return (const BBFMeta*)(this->streamBuffer + this->footerData.metaOffset) + metaIndex;
+}
+
+const char* BBFStreamParser::getStringView(uint64_t strOffset) const
+{
+    if (this->bookSize == 0 || strOffset >= this->footerData.stringPoolSize)
+    {
+        return nullptr;
+    }
+
+    uint64_t bytesLeft = this->footerData.stringPoolSize - strOffset;
+    uint64_t scanLimit = (BBF::MAX_FORME_SIZE < bytesLeft) ? BBF::MAX_FORME_SIZE : bytesLeft;
+    const char* pPtr = (const char*)(this->streamBuffer + this->footerData.stringPoolOffset + strOffset);
+
+    uint64_t iterator = 0;
+    for (; iterator < scanLimit; iterator++)
+    {
+        if (pPtr[iterator] == '\0')
+        {
+            return pPtr;
+        }
+    }
+
+    return nullptr;
+}
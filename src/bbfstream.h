@@ -0,0 +1,104 @@
+// BBF Stream Parser
+// Push-style parser for petrified books arriving over a stream (SPECNOTE 3.4)
+#ifndef BBFSTREAM_H
+#define BBFSTREAM_H
+
+#include "xxhash.h"
+#include "libbbf.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+enum class BBFStreamEventType: uint8_t
+{
+    NONE = 0,
+    HEADER, // Header arrived and checks out
+    FOOTER, // Footer arrived, index size is known
+    INDEX, // Tables and string pool arrived, table getters work from here on
+    PAGE, // All bytes of a page's asset arrived
+    COMPLETE, // Every page has been reported
+    INVALID // Not a petrified BBF, or it's damaged. Nothing follows.
+};
+
+struct BBFStreamEvent
+{
+    BBFStreamEventType type = BBFStreamEventType::NONE;
+    uint64_t pageIndex = 0; // PAGE, or INVALID on a hash mismatch
+    const BBFAsset* asset = nullptr; // PAGE only
+    const uint8_t* data = nullptr; // PAGE only. Stays valid for the life of the parser.
+    uint64_t dataSize = 0;
+    const char* message = nullptr; // INVALID only
+};
+
+namespace BBF
+{
+    // The whole book is buffered, so a header or index that claims more than this is damaged (or hostile).
+    // Always fits a size_t. [1TB, half the address space on 32-bit and wasm]
+    constexpr static uint64_t MAX_STREAM_BOOK_SIZE = ((uint64_t)SIZE_MAX < (1ull << 40)) ? (uint64_t)(SIZE_MAX / 2) : (1ull << 40);
+}
+
+class BBFStreamParser
+{
+    public:
+        BBFStreamParser(bool sVerifyAssets = false); // Optionally check each page against its XXH3-128 before reporting it
+        ~BBFStreamParser();
+        // Not copyable, it owns the stream buffer and the page order.
+        BBFStreamParser(const BBFStreamParser&) = delete;
+        BBFStreamParser& operator=(const BBFStreamParser&) = delete;
+
+        // Push the next chunk of the book. Returns false once the parser has failed.
+        bool feed(const void* chunk, size_t chunkSize);
+
+        // Pop the next event. Returns false when nothing is ready yet.
+        bool poll(BBFStreamEvent* event);
+
+        // Valid from the INDEX event on
+        const BBFHeader* getHeader() const { return (receivedBytes >= sizeof(BBFHeader)) ? (const BBFHeader*)streamBuffer : nullptr; }
+        const BBFFooter* getFooter() const { return hasFooter ? &footerData : nullptr; }
+        const BBFAsset* getAsset(uint64_t assetIndex) const;
+        const BBFPage* getPage(uint64_t pageIndex) const;
+        const BBFSection* getSection(uint64_t sectionIndex) const;
+        const BBFMeta* getMeta(uint64_t metaIndex) const;
+        const char* getStringView(uint64_t strOffset) const;
+
+        // The whole book once COMPLETE has been polled. Can be handed to BBFReader(const uint8_t*, size_t).
+        const uint8_t* getBookData() const { return (state == STREAM_DONE) ? streamBuffer : nullptr; }
+        uint64_t getBookSize() const { return bookSize; }
+        uint64_t getReceivedBytes() const { return receivedBytes; }
+
+    private:
+        enum StreamState
+        {
+            STREAM_HEADER,
+            STREAM_FOOTER,
+            STREAM_INDEX,
+            STREAM_PAGES,
+            STREAM_DONE,
+            STREAM_ERROR,
+            STREAM_FAILED // INVALID has been reported
+        };
+
+        StreamState state;
+        bool verifyAssets;
+        const char* errorMessage;
+        uint64_t errorPage;
+
+        uint8_t* streamBuffer;
+        uint64_t bufferCap;
+        uint64_t receivedBytes;
+
+        BBFFooter footerData; // copied, the buffer moves until the index arrives
+        bool hasFooter;
+        uint64_t indexEnd;
+        uint64_t bookSize; // 0 until the index arrives
+
+        uint64_t* pageOrder; // [assetEnd, pageIndex], sorted so pages come out as their bytes arrive
+        uint64_t pageCursor;
+
+        bool growBuffer(uint64_t minCap);
+        bool parseIndex();
+        void fail(const char* message);
+};
+
+#endif // BBFSTREAM_H
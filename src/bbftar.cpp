@@ -0,0 +1,562 @@
+#include "bbftar.h"
+#include "bbfcodec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+    #include <io.h>
+    #include <fcntl.h>
+#endif
+
+// HELPERS
+
+// fread until length bytes or end of stream. Pipes hand data over in pieces.
+static bool readFully(FILE* tarStream, void* buffer, uint64_t length, BBFTarStats* stats)
+{
+    uint8_t* cursor = (uint8_t*)buffer;
+    while (length > 0)
+    {
+        size_t chunkSize = (length > BBF::MOVE_BUFFER_SIZE) ? (size_t)BBF::MOVE_BUFFER_SIZE : (size_t)length;
+        size_t got = fread(cursor, 1, chunkSize, tarStream);
+        stats->bytesRead += got;
+        if (got == 0)
+        {
+            return false;
+        }
+        cursor += got;
+        length -= got;
+    }
+    return true;
+}
+
+static bool skipBytes(FILE* tarStream, uint64_t length, uint8_t* scratch, BBFTarStats* stats)
+{
+    while (length > 0)
+    {
+        uint64_t chunkSize = (length > BBF::MOVE_BUFFER_SIZE) ? BBF::MOVE_BUFFER_SIZE : length;
+        if (!readFully(tarStream, scratch, chunkSize, stats))
+        {
+            return false;
+        }
+        length -= chunkSize;
+    }
+    return true;
+}
+
+static uint64_t paddedSize(uint64_t memberSize)
+{
+    return (memberSize + BBF::TAR_BLOCK_SIZE - 1) & ~(BBF::TAR_BLOCK_SIZE - 1);
+}
+
+// Octal, space or NUL terminated. GNU base-256 when the top bit of the first byte is set (sizes >= 8GB).
+static bool parseNumber(const uint8_t* field, size_t fieldLength, uint64_t* value)
+{
+    *value = 0;
+    if (field[0] & 0x80)
+    {
+        size_t byteIterator = 1;
+        uint64_t high = field[0] & 0x7F;
+        for (; byteIterator < fieldLength; byteIterator++)
+        {
+            if (high >> 56)
+            {
+                return false;
+            }
+            high = (high << 8) | field[byteIterator];
+        }
+        *value = high;
+        return true;
+    }
+
+    size_t byteIterator = 0;
+    while (byteIterator < fieldLength && field[byteIterator] == ' ')
+    {
+        byteIterator++;
+    }
+    for (; byteIterator < fieldLength && field[byteIterator] >= '0' && field[byteIterator] <= '7'; byteIterator++)
+    {
+        if (*value >> 61)
+        {
+            return false;
+        }
+        *value = (*value << 3) | (uint64_t)(field[byteIterator] - '0');
+    }
+    return byteIterator == fieldLength || field[byteIterator] == ' ' || field[byteIterator] == '\0';
+}
+
+// Sum of the header with the checksum field read as spaces. Old tars summed signed bytes.
+static bool checksumOk(const uint8_t* header)
+{
+    uint64_t storedSum = 0;
+    if (!parseNumber(header + 148, 8, &storedSum))
+    {
+        return false;
+    }
+
+    uint64_t unsignedSum = 0;
+    int64_t signedSum = 0;
+    size_t byteIterator = 0;
+    for (; byteIterator < BBF::TAR_BLOCK_SIZE; byteIterator++)
+    {
+        uint8_t headerByte = (byteIterator >= 148 && byteIterator < 156) ? (uint8_t)' ' : header[byteIterator];
+        unsignedSum += headerByte;
+        signedSum += (int8_t)headerByte;
+    }
+    return storedSum == unsignedSum || (int64_t)storedSum == signedSum;
+}
+
+static bool isZeroBlock(const uint8_t* header)
+{
+    size_t byteIterator = 0;
+    for (; byteIterator < BBF::TAR_BLOCK_SIZE; byteIterator++)
+    {
+        if (header[byteIterator] != 0)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fixed-width header field to a C string
+static char* fieldString(const uint8_t* field, size_t fieldLength)
+{
+    size_t stringLength = 0;
+    while (stringLength < fieldLength && field[stringLength] != '\0')
+    {
+        stringLength++;
+    }
+    char* fieldCopy = (char*)malloc(stringLength + 1);
+    if (fieldCopy)
+    {
+        memcpy(fieldCopy, field, stringLength);
+        fieldCopy[stringLength] = '\0';
+    }
+    return fieldCopy;
+}
+
+// ustar splits long names into prefix + "/" + name. GNU tars use the prefix bytes for other things.
+static char* headerName(const uint8_t* header)
+{
+    char* memberName = fieldString(header, 100);
+    if (!memberName || memcmp(header + 257, "ustar\0" "00", 8) != 0 || header[345] == '\0')
+    {
+        return memberName;
+    }
+
+    char* prefix = fieldString(header + 345, 155);
+    char* fullName = prefix ? (char*)malloc(strlen(prefix) + 1 + strlen(memberName) + 1) : nullptr;
+    if (fullName)
+    {
+        sprintf(fullName, "%s/%s", prefix, memberName);
+    }
+    free(prefix);
+    free(memberName);
+    return fullName;
+}
+
+// pax records: "<length> <key>=<value>\n". Only path and size matter here.
+static bool parsePax(const char* records, uint64_t recordsLength, char** paxPath, uint64_t* paxSize, bool* hasPaxSize)
+{
+    uint64_t recordOffset = 0;
+    while (recordOffset < recordsLength)
+    {
+        const char* record = records + recordOffset;
+        uint64_t recordLength = 0;
+        uint64_t digitIterator = 0;
+        for (; recordOffset + digitIterator < recordsLength && record[digitIterator] >= '0' && record[digitIterator] <= '9'; digitIterator++)
+        {
+            recordLength = recordLength * 10 + (uint64_t)(record[digitIterator] - '0');
+        }
+
+        if (recordLength == 0 && digitIterator == 0 && record[0] == '\0')
+        {
+            break; // Some writers pad with NULs
+        }
+        if (digitIterator == 0 || recordLength <= digitIterator + 1 || recordLength > recordsLength - recordOffset ||
+            record[digitIterator] != ' ' || record[recordLength - 1] != '\n')
+        {
+            return false;
+        }
+
+        const char* key = record + digitIterator + 1;
+        const char* recordEnd = record + recordLength - 1;
+        const char* equals = (const char*)memchr(key, '=', (size_t)(recordEnd - key));
+        if (!equals)
+        {
+            return false;
+        }
+
+        size_t keyLength = (size_t)(equals - key);
+        const char* value = equals + 1;
+        size_t valueLength = (size_t)(recordEnd - value);
+        if (paxPath && keyLength == 4 && memcmp(key, "path", 4) == 0)
+        {
+            free(*paxPath);
+            *paxPath = (char*)malloc(valueLength + 1);
+            if (!*paxPath)
+            {
+                return false;
+            }
+            memcpy(*paxPath, value, valueLength);
+            (*paxPath)[valueLength] = '\0';
+        }
+        else if (paxSize && keyLength == 4 && memcmp(key, "size", 4) == 0)
+        {
+            uint64_t sizeValue = 0;
+            size_t valueIterator = 0;
+            for (; valueIterator < valueLength && value[valueIterator] >= '0' && value[valueIterator] <= '9'; valueIterator++)
+            {
+                sizeValue = sizeValue * 10 + (uint64_t)(value[valueIterator] - '0');
+            }
+            if (valueIterator != valueLength || valueLength == 0)
+            {
+                return false;
+            }
+            *paxSize = sizeValue;
+            *hasPaxSize = true;
+        }
+
+        recordOffset += recordLength;
+    }
+    return true;
+}
+
+// Length of the directory part, 0 for members at the top of the archive
+static size_t memberDirLength(const char* memberName)
+{
+    const char* lastSep = strrchr(memberName, '/');
+    return lastSep ? (size_t)(lastSep - memberName) : 0;
+}
+
+// macOS resource forks (._name) and other dotfiles ride along in tars made on a Mac
+static bool isJunkMember(const char* memberName)
+{
+    if (strncmp(memberName, "__MACOSX/", 9) == 0 || strstr(memberName, "/__MACOSX/"))
+    {
+        return true;
+    }
+    const char* baseName = memberName + memberDirLength(memberName);
+    if (*baseName == '/')
+    {
+        baseName++;
+    }
+    return baseName[0] == '.';
+}
+
+struct TarFolder
+{
+    char* folderName;
+    uint64_t startIndex;
+};
+
+// IMPORT
+
+// Members to pages, up to the end of the archive
+static bool muxMembers(FILE* tarStream, const char* streamName, BBFBuilder* builder, BBFTarStats* stats)
+{
+    uint8_t header[BBF::TAR_BLOCK_SIZE];
+    uint8_t* scratch = (uint8_t*)malloc((size_t)BBF::MOVE_BUFFER_SIZE);
+    XXH3_state_t* hashState = XXH3_createState();
+    if (!scratch || !hashState)
+    {
+        free(scratch);
+        XXH3_freeState(hashState);
+        return false;
+    }
+
+    uint8_t* pageBuffer = nullptr;
+    uint64_t pageCapacity = 0;
+    char* longName = nullptr; // GNU 'L', for the next member
+    char* paxPath = nullptr; // pax 'x', for the next member
+    uint64_t paxSize = 0;
+    bool hasPaxSize = false;
+
+    TarFolder* folders = nullptr;
+    uint64_t folderCount = 0;
+    bool folderSections = false;
+
+    bool importOk = true;
+    while (importOk)
+    {
+        uint64_t headerStart = stats->bytesRead;
+        if (!readFully(tarStream, header, BBF::TAR_BLOCK_SIZE, stats))
+        {
+            // Some writers stop without the two zero blocks. Fine, as long as it stops between members.
+            if (stats->bytesRead != headerStart)
+            {
+                fprintf(stderr, "[BBFCODEC] %s: stream ends inside a tar header.\n", streamName);
+                importOk = false;
+            }
+            break;
+        }
+
+        if (isZeroBlock(header))
+        {
+            break;
+        }
+
+        if (!checksumOk(header))
+        {
+            if (stats->membersRead == 0 && header[0] == 0x1F && header[1] == 0x8B)
+            {
+                fprintf(stderr, "[BBFCODEC] %s is gzip compressed. Pipe it through gzip -dc first.\n", streamName);
+            }
+            else
+            {
+                fprintf(stderr, "[BBFCODEC] %s: bad tar header after %llu bytes.\n", streamName, (unsigned long long)headerStart);
+            }
+            importOk = false;
+            break;
+        }
+
+        uint64_t memberSize = 0;
+        if (!parseNumber(header + 124, 12, &memberSize))
+        {
+            fprintf(stderr, "[BBFCODEC] %s: bad member size.\n", streamName);
+            importOk = false;
+            break;
+        }
+
+        char typeFlag = (char)header[156];
+        stats->membersRead++;
+
+        // Headers that describe the next member
+        if (typeFlag == 'x' || typeFlag == 'g' || typeFlag == 'L')
+        {
+            if (memberSize > BBF::TAR_MAX_HEADER_DATA)
+            {
+                fprintf(stderr, "[BBFCODEC] %s: oversized extended header.\n", streamName);
+                importOk = false;
+                break;
+            }
+
+            char* headerData = (char*)malloc((size_t)paddedSize(memberSize) + 1);
+            importOk = headerData && readFully(tarStream, headerData, paddedSize(memberSize), stats);
+            if (importOk)
+            {
+                headerData[memberSize] = '\0';
+                if (typeFlag == 'L')
+                {
+                    free(longName);
+                    longName = headerData;
+                    headerData = nullptr;
+                }
+                else
+                {
+                    // Global records apply to every member after them, but a global path makes no sense for pages
+                    importOk = (typeFlag == 'x') ? parsePax(headerData, memberSize, &paxPath, &paxSize, &hasPaxSize)
+                                                 : parsePax(headerData, memberSize, nullptr, nullptr, nullptr);
+                    if (!importOk)
+                    {
+                        fprintf(stderr, "[BBFCODEC] %s: bad pax header.\n", streamName);
+                    }
+                }
+            }
+            free(headerData);
+            stats->membersSkipped++;
+            continue;
+        }
+
+        char* memberName = paxPath ? paxPath : (longName ? longName : headerName(header));
+        if (memberName == paxPath)
+        {
+            free(longName);
+        }
+        else if (memberName == longName)
+        {
+            free(paxPath);
+        }
+        else
+        {
+            free(longName);
+            free(paxPath);
+        }
+        longName = nullptr;
+        paxPath = nullptr;
+        if (hasPaxSize)
+        {
+            memberSize = paxSize;
+            hasPaxSize = false;
+        }
+
+        if (!memberName)
+        {
+            importOk = false;
+            break;
+        }
+
+        // Names from tar -C dir . start with ./
+        const char* pageName = memberName;
+        while (pageName[0] == '.' && pageName[1] == '/')
+        {
+            pageName += 2;
+        }
+
+        bool regularFile = typeFlag == '0' || typeFlag == '\0' || typeFlag == '7';
+        if (!regularFile || isJunkMember(pageName) || BBFBuilder::detectType(pageName) == (uint8_t)BBF::BBFMediaType::UNKNOWN)
+        {
+            // Hard links, symlinks and directories carry no data (size 0), so this just skips to the next header
+            importOk = skipBytes(tarStream, paddedSize(memberSize), scratch, stats);
+            stats->membersSkipped++;
+            free(memberName);
+            continue;
+        }
+
+        if (memberSize > (uint64_t)(size_t)-1)
+        {
+            fprintf(stderr, "[BBFCODEC] %s: %s is too large to buffer.\n", streamName, pageName);
+            free(memberName);
+            importOk = false;
+            break;
+        }
+
+        if (memberSize > pageCapacity)
+        {
+            uint8_t* newBuffer = (uint8_t*)realloc(pageBuffer, (size_t)memberSize);
+            if (!newBuffer)
+            {
+                free(memberName);
+                importOk = false;
+                break;
+            }
+            pageBuffer = newBuffer;
+            pageCapacity = memberSize;
+        }
+
+        // Hash while it comes off the pipe, one chunk at a time
+        XXH3_128bits_reset(hashState);
+        uint64_t memberOffset = 0;
+        while (importOk && memberOffset < memberSize)
+        {
+            uint64_t chunkSize = memberSize - memberOffset;
+            if (chunkSize > BBF::MOVE_BUFFER_SIZE)
+            {
+                chunkSize = BBF::MOVE_BUFFER_SIZE;
+            }
+            importOk = readFully(tarStream, pageBuffer + memberOffset, chunkSize, stats);
+            if (importOk)
+            {
+                XXH3_128bits_update(hashState, pageBuffer + memberOffset, (size_t)chunkSize);
+                memberOffset += chunkSize;
+            }
+        }
+        importOk = importOk && skipBytes(tarStream, paddedSize(memberSize) - memberSize, scratch, stats);
+        if (!importOk)
+        {
+            fprintf(stderr, "[BBFCODEC] %s: stream ends inside %s.\n", streamName, pageName);
+            free(memberName);
+            break;
+        }
+
+        // Remember where each folder starts. Sections are added at the end, once it's known there's more than one.
+        size_t dirLength = memberDirLength(pageName);
+        TarFolder* lastFolder = folderCount ? &folders[folderCount - 1] : nullptr;
+        if (!lastFolder || strlen(lastFolder->folderName) != dirLength || strncmp(lastFolder->folderName, pageName, dirLength) != 0)
+        {
+            TarFolder* newFolders = (TarFolder*)realloc(folders, (size_t)(folderCount + 1) * sizeof(TarFolder));
+            char* folderName = (char*)malloc(dirLength + 1);
+            if (newFolders)
+            {
+                folders = newFolders;
+            }
+            if (!newFolders || !folderName)
+            {
+                free(folderName);
+                free(memberName);
+                importOk = false;
+                break;
+            }
+            memcpy(folderName, pageName, dirLength);
+            folderName[dirLength] = '\0';
+            folders[folderCount].folderName = folderName;
+            folders[folderCount].startIndex = (uint64_t)builder->getPageCount();
+            folderSections = folderSections || folderCount > 0;
+            folderCount++;
+        }
+
+        XXH128_hash_t pageHash = XXH3_128bits_digest(hashState);
+        importOk = builder->addPageData(pageBuffer, memberSize, pageName, 0, 0, &pageHash);
+        stats->pagesAdded += importOk ? 1 : 0;
+        free(memberName);
+    }
+
+    free(longName);
+    free(paxPath);
+    free(pageBuffer);
+    free(scratch);
+    XXH3_freeState(hashState);
+
+    if (importOk && stats->pagesAdded == 0)
+    {
+        fprintf(stderr, "[BBFCODEC] %s has no pages.\n", streamName);
+        importOk = false;
+    }
+
+    uint64_t folderIterator = 0;
+    for (; folderIterator < folderCount; folderIterator++)
+    {
+        if (importOk && folderSections && folders[folderIterator].folderName[0] != '\0')
+        {
+            importOk = builder->addSection(folders[folderIterator].folderName, folders[folderIterator].startIndex);
+        }
+        free(folders[folderIterator].folderName);
+    }
+    free(folders);
+
+    return importOk;
+}
+
+bool BBFTar::importStream(FILE* tarStream, const char* streamName, const char* bbfPath, const BBFTarOptions* options, BBFTarStats* stats)
+{
+    BBFTarOptions defaultOptions;
+    BBFTarStats localStats;
+    if (!options)
+    {
+        options = &defaultOptions;
+    }
+    if (!stats)
+    {
+        stats = &localStats;
+    }
+
+    // Not the exiting constructor, this is a library call
+    BBFBuilder* builder = BBFBuilder::open(bbfPath, options->alignment, options->reamSize, options->hFlags);
+    if (!builder)
+    {
+        return false;
+    }
+
+    bool importOk = muxMembers(tarStream, streamName, builder, stats) && builder->finalize();
+    delete builder;
+
+    // No half books
+    if (!importOk)
+    {
+        remove(bbfPath);
+    }
+    return importOk;
+}
+
+bool BBFTar::importFile(const char* tarPath, const char* bbfPath, const BBFTarOptions* options, BBFTarStats* stats)
+{
+    if (strcmp(tarPath, "-") == 0)
+    {
+        #ifdef _WIN32
+            _setmode(_fileno(stdin), _O_BINARY);
+        #endif
+        return importStream(stdin, "stdin", bbfPath, options, stats);
+    }
+
+    FILE* tarFile = fopen(tarPath, "rb");
+    if (!tarFile)
+    {
+        fprintf(stderr, "[BBFCODEC] Unable to open %s.\n", tarPath);
+        return false;
+    }
+    bool importOk = importStream(tarFile, tarPath, bbfPath, options, stats);
+    fclose(tarFile);
+    return importOk;
+}
@@ -0,0 +1,44 @@
+// BBF Tar Import
+// Reads a tar stream (ustar, pax, GNU long names) front to back and muxes it into a book as it arrives.
+// Works on pipes: nothing is seeked and nothing is written to disk but the book. Each page is read
+// into one reused buffer and hashed on the way in, so the builder never hashes it again.
+#ifndef BBFTAR_H
+#define BBFTAR_H
+
+#include "libbbf.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct BBFTarStats
+{
+    uint64_t membersRead = 0;
+    uint64_t pagesAdded = 0;
+    uint64_t membersSkipped = 0; // Directories, links, pax headers and anything else that isn't an image
+    uint64_t bytesRead = 0; // Whole stream, headers and padding included
+};
+
+struct BBFTarOptions
+{
+    uint32_t alignment = BBF::DEFAULT_GUARD_ALIGNMENT;
+    uint32_t reamSize = BBF::DEFAULT_SMALL_REAM_THRESHOLD;
+    uint32_t hFlags = BBF::BBF_VARIABLE_REAM_SIZE_FLAG;
+};
+
+namespace BBF
+{
+    constexpr static uint64_t TAR_BLOCK_SIZE = 512;
+    constexpr static uint64_t TAR_MAX_HEADER_DATA = 1048576; // pax records and GNU long names [1MB]
+}
+
+class BBFTar
+{
+    public:
+        // Pages go in stream order (a pipe can't be sorted). Folders become sections, unless everything sits in one folder.
+        static bool importStream(FILE* tarStream, const char* streamName, const char* bbfPath, const BBFTarOptions* options = nullptr, BBFTarStats* stats = nullptr);
+
+        // tarPath "-" reads stdin
+        static bool importFile(const char* tarPath, const char* bbfPath, const BBFTarOptions* options = nullptr, BBFTarStats* stats = nullptr);
+};
+
+#endif // BBFTAR_H
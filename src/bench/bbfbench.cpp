@@ -1,5 +1,15 @@
 #include "libbbf.h"
 #include "bbfcodec.h"
+#include "bbfstream.h"
+#include "bbfasync.h"
+#include "bbfserve.h"
+#include "bbfpool.h"
+#include "bbfprobe.h"
+#include "bbfcatalog.h"
+#include "bbfpatch.h"
+#include "bbfcbz.h"
+#include "bbftar.h"
+#include "bbfmove.h"
 #include "xxhash.h"
 #include "miniz.h"
 
@@ -9,8 +19,22 @@
 #include <fstream>
 #include <random>
 #include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#ifndef _WIN32
+    #include <sys/socket.h>
+    #include <netinet/in.h>
+    #include <arpa/inet.h>
+    #include <dirent.h>
+    #include <fcntl.h>
+#else
+    #include <io.h>
+    #include <fcntl.h>
+#endif
 
 #include <catch2/catch_test_macros.hpp>
+#include <catch2/generators/catch_generators.hpp>
 #include <catch2/benchmark/catch_benchmark.hpp>
 
 const char* OUTPUT = "testBBF.bbf";
@@ -97,6 +121,33 @@ void deleteFile(const std::string& filename)
     std::remove(filename.c_str());
 }
 
+// Build a small book: two sections, (pageCount) random pages, one duplicate.
+void createTestBook(const char* bookName, int pageCount, size_t pageSize)
+{
+    BBFBuilder bbfBuilder(bookName);
+
+    int pageIterator = 0;
+    for (; pageIterator < pageCount; ++pageIterator)
+    {
+        std::string name = "book_page_" + std::to_string(pageIterator) + ".png";
+        createRandomFile(name, pageSize);
+        bbfBuilder.addPage(name.c_str());
+        deleteFile(name);
+    }
+
+    createTestFile("book_dupe.png", pageSize, 'D');
+    bbfBuilder.addPage("book_dupe.png");
+    bbfBuilder.addPage("book_dupe.png");
+    deleteFile("book_dupe.png");
+
+    bbfBuilder.addSection("Volume 1", 0);
+    bbfBuilder.addSection("Chapter 1", 0, "Volume 1");
+    bbfBuilder.addSection("Chapter 2", pageCount / 2, "Volume 1");
+    bbfBuilder.addSection("Extras", pageCount);
+    bbfBuilder.addMeta("Title", "Test Book");
+    bbfBuilder.finalize();
+}
+
 // Test BBF Test Cases
 TEST_CASE("BBFBuilder - Constructor")
 {
@@ -244,140 +295,2314 @@ TEST_CASE("BBFReader - Constructor")
 
 TEST_CASE("BBFReader - Header and Footer Navigation")
 {
-    BBFBuilder bbfBuilder(OUTPUT);
-    createTestFile("test.png", 1024);
-    bbfBuilder.addPage("test.png");
-    deleteFile("test.png");
-    REQUIRE(bbfBuilder.finalize());
+    BBFBuilder bbfBuilder(OUTPUT);
+    createTestFile("test.png", 1024);
+    bbfBuilder.addPage("test.png");
+    deleteFile("test.png");
+    REQUIRE(bbfBuilder.finalize());
+
+    BBFReader reader(OUTPUT);
+
+    BBFHeader* header = reader.getHeaderView();
+    REQUIRE(header != nullptr);
+    CHECK(reader.checkMagic(header) == true);
+    CHECK(header->version == BBF::VERSION);
+
+    BBFFooter* footer = reader.getFooterView(header->footerOffset);
+    REQUIRE(footer != nullptr);
+
+    CHECK(footer->assetCount == 1);
+    CHECK(footer->pageCount == 1);
+}
+
+TEST_CASE("BBFReader - Reading Asset Data")
+{
+    const std::string content = "THIS_IS_IMAGE_DATA";
+    createTestFileContent("img.png", 100, content);
+    
+    BBFBuilder bbfBuilder(OUTPUT);
+    bbfBuilder.addPage("img.png");
+    bbfBuilder.finalize();
+    deleteFile("img.png");
+
+    BBFReader reader(OUTPUT);
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+
+    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+    REQUIRE(assetTable != nullptr);
+
+    const BBFAsset* asset = reader.getAssetEntryView((uint8_t*)assetTable, 0);
+    REQUIRE(asset != nullptr);
+    CHECK(asset->fileSize == 100);
+
+    const uint8_t* data = reader.getAssetDataView(asset->fileOffset);
+    REQUIRE(data != nullptr);
+
+    CHECK(memcmp(data, content.c_str(), content.length()) == 0);
+}
+
+TEST_CASE("BBFReader - Metadata and Strings")
+{
+    BBFBuilder bbfBuilder(OUTPUT);
+
+    createTestFile("test.png", 1024);
+    bbfBuilder.addPage("test.png");
+    deleteFile("test.png");
+
+    bbfBuilder.addMeta("TestKey", "TestVal", "TestParent");
+    bbfBuilder.finalize();
+
+    BBFReader reader(OUTPUT);
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+
+    REQUIRE(f->metaCount == 1);
+
+    const uint8_t* metaTable = reader.getMetadataView(f->metaOffset);
+    REQUIRE(metaTable != nullptr);
+
+    const BBFMeta* metaEntry = reader.getMetaEntryView((uint8_t*)metaTable, 0);
+    REQUIRE(metaEntry != nullptr);
+
+    const char* key = reader.getStringView(metaEntry->keyOffset);
+    const char* val = reader.getStringView(metaEntry->valueOffset);
+    const char* parent = reader.getStringView(metaEntry->parentOffset);
+
+    REQUIRE(std::string(key) == "TestKey");
+    REQUIRE(std::string(val) == "TestVal");
+    REQUIRE(std::string(parent) == "TestParent");
+}
+
+TEST_CASE("BBFReader - Verify Hashes")
+{
+    createTestFile("hash_test.png", 512, 'X'); // Fill with 'X'
+    BBFBuilder builder(OUTPUT);
+    builder.addPage("hash_test.png");
+    builder.finalize();
+    deleteFile("hash_test.png");
+
+    BBFReader reader(OUTPUT);
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+    const BBFAsset* asset = reader.getAssetEntryView((uint8_t*)aTable, 0);
+
+    XXH128_hash_t calcHash = reader.computeAssetHash(asset);
+
+    REQUIRE(calcHash.low64 == asset->assetHash[0]);
+    REQUIRE(calcHash.high64 == asset->assetHash[1]);
+}
+
+TEST_CASE("BBFReader - Check Bounds")
+{
+    BBFBuilder builder(OUTPUT);
+    createTestFile("test.png", 10);
+    builder.addPage("test.png"); 
+    builder.finalize();
+    deleteFile("test.png");
+
+    BBFReader reader(OUTPUT);
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    
+    SECTION("Invalid Footer Offset")
+    {
+        CHECK(reader.getFooterView(99999999) == nullptr);
+    }
+
+    SECTION("Asset Index Out of Bounds") 
+    {
+        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+        CHECK_FALSE(reader.getAssetEntryView((uint8_t*)aTable, 1) == nullptr);
+        CHECK(reader.getAssetEntryView((uint8_t*)aTable, -1) == nullptr);
+    }
+
+    SECTION("Invalid String Offset") 
+    {
+        CHECK(reader.getStringView(99999999) == nullptr);
+    }
+
+    SECTION("Invalid Data View") 
+    {
+        CHECK(reader.getAssetDataView(99999999) == nullptr);
+    }
+}
+
+
+TEST_CASE("BBFReader - Section Page Range")
+{
+    createTestBook(OUTPUT, 8, 1024);
+    BBFReader reader(OUTPUT);
+
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+
+    REQUIRE(reader.getSectionPageRange("Volume 1", &firstPage, &pageCount));
+    CHECK(firstPage == 0);
+    CHECK(pageCount == 8);
+
+    REQUIRE(reader.getSectionPageRange("Chapter 2", &firstPage, &pageCount));
+    CHECK(firstPage == 4);
+    CHECK(pageCount == 4);
+
+    REQUIRE(reader.getSectionPageRange("Extras", &firstPage, &pageCount));
+    CHECK(firstPage == 8);
+    CHECK(pageCount == 2);
+
+    CHECK_FALSE(reader.getSectionPageRange("Missing", &firstPage, &pageCount));
+}
+
+TEST_CASE("BBFReader - Prefetch")
+{
+    createTestBook(OUTPUT, 8, 8192);
+    BBFReader reader(OUTPUT);
+
+    CHECK(reader.prefetchPages(0, 10));
+    CHECK(reader.prefetchPages(9, 1));
+    CHECK(reader.prefetchPages(3, 0));
+    CHECK_FALSE(reader.prefetchPages(9, 2));
+    CHECK_FALSE(reader.prefetchPages(0xFFFFFFFFFFFFFFFF, 2));
+
+    CHECK(reader.prefetchSection("Chapter 1"));
+    CHECK_FALSE(reader.prefetchSection("Missing"));
+
+    CHECK(reader.setAccessPattern(BBF::BBFAccessPattern::SEQUENTIAL));
+    CHECK(reader.setAccessPattern(BBF::BBFAccessPattern::RANDOM));
+    CHECK(reader.setAccessPattern(BBF::BBFAccessPattern::NORMAL));
+
+    // Petrified layout keeps its data behind the index
+    REQUIRE(BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT));
+    BBFReader petrified(PETRIFIEDOUTPUT);
+
+    uint64_t dataStart = 0;
+    uint64_t dataEnd = 0;
+    REQUIRE(petrified.getDataRegion(&dataStart, &dataEnd));
+    CHECK(dataStart > sizeof(BBFHeader) + sizeof(BBFFooter));
+    CHECK(petrified.prefetchPages(0, 10));
+    CHECK(petrified.setAccessPattern(BBF::BBFAccessPattern::SEQUENTIAL));
+}
+
+
+TEST_CASE("BBFReadSession - Adaptive Window")
+{
+    createTestBook(OUTPUT, 40, 4096);
+    BBFReader reader(OUTPUT);
+    BBFReadSession session(&reader);
+
+    uint64_t pageIterator = 0;
+    for (; pageIterator < 6; ++pageIterator)
+    {
+        REQUIRE(session.onPageAccess(pageIterator));
+    }
+
+    CHECK(session.getDirection() == BBFReadDirection::FORWARD);
+    CHECK(session.getWindow() == 32);
+    CHECK(session.getPrefetchedPages() > 0);
+
+    for (; pageIterator < 10; ++pageIterator)
+    {
+        REQUIRE(session.onPageAccess(pageIterator));
+    }
+    CHECK(session.getReleasedPages() > 0);
+
+    REQUIRE(session.onPageAccess(30));
+    CHECK(session.getDirection() == BBFReadDirection::JUMP);
+    CHECK(session.getWindow() == 2);
+
+    REQUIRE(session.onPageAccess(29));
+    CHECK(session.getDirection() == BBFReadDirection::BACKWARD);
+
+    CHECK_FALSE(session.onPageAccess(42));
+}
+
+TEST_CASE("BBFReader - Range Planning")
+{
+    // 100KB pages are guard aligned, so there are gaps between them
+    createTestBook(OUTPUT, 10, 100000);
+    BBFReader reader(OUTPUT);
+    BBFFooter* f = reader.getFooterView(reader.getHeaderView()->footerOffset);
+    REQUIRE(f != nullptr);
+
+    BBFRangePlan plan;
+    REQUIRE(reader.planRanges(0, f->pageCount, 0, &plan));
+    CHECK(plan.pageCount == f->pageCount);
+    CHECK(plan.extentCount == 11); // 12 pages, the last two share an asset
+
+    uint64_t extentIterator = 1;
+    for (; extentIterator < plan.extentCount; ++extentIterator)
+    {
+        CHECK(plan.extents[extentIterator].fileOffset > plan.extents[extentIterator - 1].fileOffset + plan.extents[extentIterator - 1].length);
+    }
+
+    uint64_t pageIterator = 0;
+    for (; pageIterator < plan.pageCount; ++pageIterator)
+    {
+        const BBFPage* page = reader.getPageEntryView(reader.getPageTableView(f->pageOffset), (int)pageIterator);
+        const BBFAsset* asset = reader.getAssetEntryView(reader.getAssetTableView(f->assetOffset), (int)page->assetIndex);
+        const BBFPageExtent& pageExtent = plan.pages[pageIterator];
+
+        REQUIRE(pageExtent.extentIndex < plan.extentCount);
+        CHECK(plan.extents[pageExtent.extentIndex].fileOffset + pageExtent.extentOffset == asset->fileOffset);
+        CHECK(pageExtent.length == asset->fileSize);
+        CHECK(pageExtent.extentOffset + pageExtent.length <= plan.extents[pageExtent.extentIndex].length);
+    }
+    CHECK(plan.pages[10].extentIndex == plan.pages[11].extentIndex);
+    BBFReader::freeRangePlan(&plan);
+    CHECK(plan.extents == nullptr);
+
+    // Bridging the alignment padding gives one read for the book
+    REQUIRE(reader.planRanges(0, f->pageCount, 4096, &plan));
+    CHECK(plan.extentCount == 1);
+    BBFReader::freeRangePlan(&plan);
+
+    REQUIRE(reader.planSectionRanges("Chapter 2", 4096, &plan));
+    CHECK(plan.firstPage == 5);
+    CHECK(plan.pageCount == 5);
+    CHECK(plan.extentCount == 1);
+    CHECK(plan.totalBytes >= 5 * 100000);
+    BBFReader::freeRangePlan(&plan);
+
+    CHECK_FALSE(reader.planRanges(f->pageCount, 1, 0, &plan));
+    CHECK_FALSE(reader.planSectionRanges("Nope", 0, &plan));
+}
+
+TEST_CASE("BBFReader - Memory Budget")
+{
+    createTestBook(OUTPUT, 10, 16384);
+    BBFReader reader(OUTPUT);
+
+    uint64_t processBefore = BBFReader::getProcessResidentBytes();
+    reader.setMemoryBudget(3 * 16384);
+    CHECK(reader.pinIndex());
+
+    uint64_t pageIterator = 0;
+    for (; pageIterator < 10; ++pageIterator)
+    {
+        uint64_t assetSize = 0;
+        const uint8_t* data = reader.acquirePage(pageIterator, &assetSize);
+        REQUIRE(data != nullptr);
+        CHECK(assetSize == 16384);
+        CHECK(reader.getResidentBytes() <= 3 * 16384);
+    }
+
+    CHECK(reader.getResidentBytes() == 3 * 16384);
+    CHECK(BBFReader::getProcessResidentBytes() - processBefore == reader.getResidentBytes());
+
+    // Shrinking the budget evicts straight away
+    reader.setMemoryBudget(16384);
+    CHECK(reader.getResidentBytes() == 16384);
+    CHECK(reader.acquirePage(12, nullptr) == nullptr);
+
+    // A process-wide budget applies to every reader
+    BBFReader other(OUTPUT);
+    BBFReader::setProcessMemoryBudget(BBFReader::getProcessResidentBytes() + 16384);
+    other.acquireAsset(0);
+    other.acquireAsset(1);
+    CHECK(other.getResidentBytes() == 16384);
+    BBFReader::setProcessMemoryBudget(0);
+}
+
+static bool readFromFile(void* userData, uint64_t offset, void* dst, uint64_t length)
+{
+    FILE* file = (FILE*)userData;
+    return fseek(file, (long)offset, SEEK_SET) == 0 && fread(dst, 1, (size_t)length, file) == length;
+}
+
+// Walks a whole book and checks it against the default (mmap) reader
+static void checkBackendMatches(BBFReader& reader, BBFReader& reference)
+{
+    BBFHeader* h = reader.getHeaderView();
+    REQUIRE(h != nullptr);
+    REQUIRE(reader.checkMagic(h));
+
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    BBFFooter* refFooter = reference.getFooterView(reference.getHeaderView()->footerOffset);
+    REQUIRE(f != nullptr);
+    REQUIRE(f->pageCount == refFooter->pageCount);
+
+    const uint8_t* pageTable = reader.getPageTableView(f->pageOffset);
+    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+    const uint8_t* refAssetTable = reference.getAssetTableView(refFooter->assetOffset);
+    REQUIRE(pageTable != nullptr);
+    REQUIRE(assetTable != nullptr);
+
+    uint64_t pageIterator = 0;
+    for (; pageIterator < f->pageCount; ++pageIterator)
+    {
+        const BBFPage* page = reader.getPageEntryView(pageTable, (int)pageIterator);
+        const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)page->assetIndex);
+        const BBFAsset* refAsset = reference.getAssetEntryView(refAssetTable, (int)page->assetIndex);
+
+        XXH128_hash_t hash = reader.computeAssetHash(asset);
+        CHECK(hash.low64 == asset->assetHash[0]);
+        CHECK(hash.high64 == asset->assetHash[1]);
+
+        const uint8_t* data = reader.getAssetDataView(asset->fileOffset);
+        REQUIRE(data != nullptr);
+        CHECK(memcmp(data, reference.getAssetDataView(refAsset), (size_t)asset->fileSize) == 0);
+
+        std::vector<uint8_t> copy(asset->fileSize);
+        CHECK(reader.readAssetData(asset, copy.data(), copy.size()));
+        CHECK(memcmp(copy.data(), reference.getAssetDataView(refAsset), copy.size()) == 0);
+    }
+
+    const BBFMeta* meta = reader.getMetaEntryView(reader.getMetadataView(f->metaOffset), 0);
+    REQUIRE(meta != nullptr);
+    CHECK(std::string(reader.getStringView(meta->valueOffset)) == "Test Book");
+
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+    uint64_t refFirstPage = 0;
+    uint64_t refPageCount = 0;
+    CHECK(reader.getSectionPageRange("Chapter 2", &firstPage, &pageCount));
+    CHECK(reference.getSectionPageRange("Chapter 2", &refFirstPage, &refPageCount));
+    CHECK(firstPage == refFirstPage);
+    CHECK(pageCount == refPageCount);
+    CHECK(reader.prefetchPages(0, f->pageCount));
+}
+
+TEST_CASE("BBFReader - I/O Backends")
+{
+    const char* petrifiedName = "backends_petrified.bbf";
+    createTestBook(OUTPUT, 10, 100000);
+
+    for (const char* bookName : { OUTPUT, petrifiedName })
+    {
+        if (bookName == petrifiedName)
+        {
+            REQUIRE(BBFBuilder::petrifyFile(OUTPUT, petrifiedName));
+        }
+
+        BBFReader reference(bookName);
+
+        SECTION("Windowed mmap")
+        {
+            // Tiny windows, so assets straddle them
+            BBFReader reader(new BBFWindowedMmapBackend(bookName, 65536, 2), true);
+            checkBackendMatches(reader, reference);
+        }
+
+        SECTION("pread")
+        {
+            BBFPreadBackend* backend = new BBFPreadBackend(bookName, 16384, 8);
+            BBFReader reader(backend, true);
+            checkBackendMatches(reader, reference);
+            CHECK(backend->getCacheHits() > 0);
+        }
+
+        SECTION("Memory buffer")
+        {
+            std::ifstream in(bookName, std::ios::binary);
+            std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+            BBFMemoryBackend backend(book.data(), book.size());
+            BBFReader reader(&backend);
+            checkBackendMatches(reader, reference);
+            CHECK(reader.getHeaderView() == (BBFHeader*)book.data());
+        }
+
+        SECTION("Callback")
+        {
+            FILE* file = fopen(bookName, "rb");
+            REQUIRE(file != nullptr);
+            fseek(file, 0, SEEK_END);
+            uint64_t bookSize = (uint64_t)ftell(file);
+
+            BBFCallbackBackend backend(readFromFile, file, bookSize);
+            BBFReader reader(&backend);
+            checkBackendMatches(reader, reference);
+            CHECK(reader.getAssetDataView(bookSize + 1) == nullptr);
+            fclose(file);
+        }
+    }
+
+    deleteFile(petrifiedName);
+}
+
+TEST_CASE("BBFReader - Range Fetching")
+{
+    // 40 x 100KB pages, 4MB book
+    createTestBook(OUTPUT, 40, 100000);
+    BBFReader reference(OUTPUT);
+
+    FILE* file = fopen(OUTPUT, "rb");
+    REQUIRE(file != nullptr);
+    fseek(file, 0, SEEK_END);
+    uint64_t bookSize = (uint64_t)ftell(file);
+
+    BBFRangeBackend* backend = new BBFRangeBackend(readFromFile, file, bookSize);
+    BBFReader reader(backend, true);
+
+    // Opening is the header, footer and index. A handful of requests, nowhere near the whole book.
+    BBFHeader* h = reader.getHeaderView();
+    REQUIRE(h != nullptr);
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    REQUIRE(f != nullptr);
+    CHECK(backend->getFetchCount() <= 3);
+    CHECK(backend->getFetchedBytes() < 64 * 1024);
+
+    // One request per asset, and none on a second look
+    uint64_t fetchesBefore = backend->getFetchCount();
+    uint64_t assetSize = 0;
+    REQUIRE(reader.acquirePage(0, &assetSize) != nullptr);
+    CHECK(backend->getFetchCount() == fetchesBefore + 1);
+    REQUIRE(reader.acquirePage(0, &assetSize) != nullptr);
+    CHECK(backend->getFetchCount() == fetchesBefore + 1);
+
+    // A run of pages is one request, then reading them is free
+    fetchesBefore = backend->getFetchCount();
+    CHECK(reader.prefetchPages(10, 10));
+    CHECK(backend->getFetchCount() == fetchesBefore + 1);
+
+    uint64_t pageIterator = 10;
+    for (; pageIterator < 20; ++pageIterator)
+    {
+        const BBFAsset* asset = reader.getAssetEntryView(reader.getAssetTableView(f->assetOffset), (int)reader.getPageEntryView(reader.getPageTableView(f->pageOffset), (int)pageIterator)->assetIndex);
+        XXH128_hash_t hash = reader.computeAssetHash(asset);
+        CHECK(hash.low64 == asset->assetHash[0]);
+        CHECK(hash.high64 == asset->assetHash[1]);
+    }
+    CHECK(backend->getFetchCount() == fetchesBefore + 1);
+
+    // And the whole book still matches
+    checkBackendMatches(reader, reference);
+    CHECK(backend->getFetchedBytes() < bookSize * 3);
+
+    fclose(file);
+}
+
+TEST_CASE("BBFReader - Embedded Books")
+{
+    createTestBook(OUTPUT, 10, 100000);
+    BBFReader reference(OUTPUT);
+
+    std::ifstream in(OUTPUT, std::ios::binary);
+    std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    SECTION("Memory buffer")
+    {
+        BBFReader reader(book.data(), book.size());
+        checkBackendMatches(reader, reference);
+        CHECK(reader.getHeaderView() == (BBFHeader*)book.data());
+    }
+
+#ifndef _WIN32
+    SECTION("Inside a larger file")
+    {
+        // Junk either side, and a base offset that isn't page aligned
+        const char* packName = "embedded_pack.bin";
+        std::vector<uint8_t> junk(5000, 'J');
+        {
+            std::ofstream out(packName, std::ios::binary);
+            out.write((const char*)junk.data(), 1234);
+            out.write((const char*)book.data(), book.size());
+            out.write((const char*)junk.data(), junk.size());
+        }
+
+        int packFile = open(packName, O_RDONLY);
+        REQUIRE(packFile != -1);
+
+        {
+            BBFReader reader(packFile, 1234, book.size());
+            checkBackendMatches(reader, reference);
+            CHECK(memcmp(reader.getHeaderView(), book.data(), sizeof(BBFHeader)) == 0);
+        }
+
+        // Out of range, or not a book
+        BBFReader pastEnd(packFile, 1234, book.size() + junk.size() + 1);
+        CHECK(pastEnd.getHeaderView() == nullptr);
+        BBFReader notBook(packFile, 0, book.size());
+        CHECK_FALSE(notBook.checkMagic(notBook.getHeaderView()));
+
+        close(packFile);
+        deleteFile(packName);
+    }
+#endif
+}
+
+TEST_CASE("BBFStreamParser - Random Chunks")
+{
+    const char* petrifiedName = "stream_petrified.bbf";
+    createTestBook(OUTPUT, 20, 50000);
+    REQUIRE(BBFBuilder::petrifyFile(OUTPUT, petrifiedName));
+
+    std::ifstream in(petrifiedName, std::ios::binary);
+    std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    BBFReader reference(petrifiedName);
+    BBFFooter* refFooter = reference.getFooterView(reference.getHeaderView()->footerOffset);
+
+    SECTION("Pages arrive as their bytes do")
+    {
+        std::mt19937 rng(1234);
+        std::uniform_int_distribution<size_t> chunkDist(1, 8192);
+
+        BBFStreamParser parser(true);
+        std::vector<BBFStreamEventType> order;
+        std::vector<int> seenPages(refFooter->pageCount, 0);
+        uint64_t firstPageAt = 0;
+
+        size_t fedBytes = 0;
+        while (fedBytes < book.size())
+        {
+            size_t chunkSize = std::min(chunkDist(rng), book.size() - fedBytes);
+            REQUIRE(parser.feed(book.data() + fedBytes, chunkSize));
+            fedBytes += chunkSize;
+
+            BBFStreamEvent event;
+            while (parser.poll(&event))
+            {
+                REQUIRE(event.type != BBFStreamEventType::INVALID);
+                if (order.empty() || order.back() != event.type)
+                {
+                    order.push_back(event.type);
+                }
+
+                if (event.type == BBFStreamEventType::PAGE)
+                {
+                    REQUIRE(event.pageIndex < refFooter->pageCount);
+                    seenPages[event.pageIndex]++;
+                    firstPageAt = firstPageAt ? firstPageAt : fedBytes;
+
+                    CHECK(event.asset->fileOffset + event.dataSize <= fedBytes);
+                    CHECK(memcmp(event.data, book.data() + event.asset->fileOffset, (size_t)event.dataSize) == 0);
+                }
+            }
+        }
+
+        std::vector<BBFStreamEventType> expected = { BBFStreamEventType::HEADER, BBFStreamEventType::FOOTER, BBFStreamEventType::INDEX, BBFStreamEventType::PAGE, BBFStreamEventType::COMPLETE };
+        CHECK(order == expected);
+        CHECK(std::count(seenPages.begin(), seenPages.end(), 1) == (long)seenPages.size());
+        CHECK(firstPageAt < book.size() / 4);
+
+        CHECK(std::string(parser.getStringView(parser.getMeta(0)->valueOffset)) == "Test Book");
+
+        // The finished buffer is a regular book
+        REQUIRE(parser.getBookData() != nullptr);
+        BBFReader reader(parser.getBookData(), (size_t)parser.getBookSize());
+        checkBackendMatches(reader, reference);
+    }
+
+    SECTION("Damaged or unpetrified input")
+    {
+        BBFStreamEvent event;
+
+        std::ifstream rawIn(OUTPUT, std::ios::binary);
+        std::vector<uint8_t> raw((std::istreambuf_iterator<char>(rawIn)), std::istreambuf_iterator<char>());
+        BBFStreamParser rawParser;
+        rawParser.feed(raw.data(), raw.size());
+        REQUIRE(rawParser.poll(&event));
+        CHECK(event.type == BBFStreamEventType::INVALID);
+        CHECK_FALSE(rawParser.poll(&event));
+        CHECK_FALSE(rawParser.feed(raw.data(), 1));
+
+        // Flip a byte in the last asset
+        std::vector<uint8_t> damaged = book;
+        damaged[damaged.size() - 1] ^= 0xFF;
+        BBFStreamParser damagedParser(true);
+        damagedParser.feed(damaged.data(), damaged.size());
+
+        BBFStreamEventType lastType = BBFStreamEventType::NONE;
+        while (damagedParser.poll(&event))
+        {
+            lastType = event.type;
+        }
+        CHECK(lastType == BBFStreamEventType::INVALID);
+        CHECK(damagedParser.getBookData() == nullptr);
+    }
+
+    SECTION("Sizes past what can be buffered")
+    {
+        BBFStreamEvent event;
+
+        // Footer claimed near the top of the 64-bit range
+        std::vector<uint8_t> farFooter(book.begin(), book.begin() + sizeof(BBFHeader));
+        ((BBFHeader*)farFooter.data())->footerOffset = 0xFFFFFFFFFFFFFF00;
+        BBFStreamParser footerParser;
+        footerParser.feed(farFooter.data(), farFooter.size());
+        REQUIRE(footerParser.poll(&event));
+        CHECK(event.type == BBFStreamEventType::INVALID);
+
+        // An asset whose end would make the book larger than a size_t
+        std::vector<uint8_t> hugeAsset = book;
+        ((BBFAsset*)(hugeAsset.data() + refFooter->assetOffset))->fileSize = 1ull << 62;
+        BBFStreamParser assetParser;
+        assetParser.feed(hugeAsset.data(), hugeAsset.size());
+        const char* lastMessage = nullptr;
+        while (assetParser.poll(&event))
+        {
+            lastMessage = (event.type == BBFStreamEventType::INVALID) ? event.message : lastMessage;
+        }
+        REQUIRE(lastMessage != nullptr);
+        CHECK(std::string(lastMessage) == "Book too large to stream");
+        CHECK(assetParser.getBookData() == nullptr);
+        CHECK_FALSE(assetParser.feed(book.data(), 1));
+    }
+
+    deleteFile(petrifiedName);
+}
+
+#ifndef _WIN32
+// Send an export to a scratch file and read it back
+static std::vector<uint8_t> sendToFile(BBFReader& reader, const BBFExportList* list)
+{
+    const char* sinkName = "export_sink.bin";
+    int sinkFile = open(sinkName, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    REQUIRE(sinkFile != -1);
+
+    uint64_t bytesSent = 0;
+    CHECK(reader.sendExport(list, sinkFile, &bytesSent));
+    CHECK(bytesSent == list->totalBytes);
+    close(sinkFile);
+
+    std::ifstream in(sinkName, std::ios::binary);
+    std::vector<uint8_t> sent((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    deleteFile(sinkName);
+    return sent;
+}
+
+static std::vector<uint8_t> concatPages(BBFReader& reader, uint64_t firstPage, uint64_t pageCount)
+{
+    BBFFooter* f = reader.getFooterView(reader.getHeaderView()->footerOffset);
+    const uint8_t* pageTable = reader.getPageTableView(f->pageOffset);
+    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+
+    std::vector<uint8_t> pages;
+    for (uint64_t pageIndex = firstPage; pageIndex < firstPage + pageCount; ++pageIndex)
+    {
+        const BBFPage* page = reader.getPageEntryView(pageTable, (int)pageIndex);
+        const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)page->assetIndex);
+        const uint8_t* data = reader.getAssetDataView(asset);
+        pages.insert(pages.end(), data, data + asset->fileSize);
+    }
+    return pages;
+}
+
+TEST_CASE("BBFReader - Scatter-Gather Export")
+{
+    // Whole guard blocks, so consecutive pages sit back to back
+    createTestBook(OUTPUT, 10, 65536);
+    BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT);
+
+    std::ifstream in(PETRIFIEDOUTPUT, std::ios::binary);
+    std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+    BBFReader reader(PETRIFIEDOUTPUT);
+    BBFExportList list;
+
+    SECTION("Pages keep their order, and touching assets merge")
+    {
+        REQUIRE(reader.exportPages(0, 12, &list));
+        CHECK(list.spanCount < 12);
+        CHECK(list.spans[0].fileDescriptor != -1);
+        CHECK(sendToFile(reader, &list) == concatPages(reader, 0, 12));
+
+        // Pages 10 and 11 share an asset, so they can't merge
+        BBFReader::freeExportList(&list);
+        REQUIRE(reader.exportPages(10, 2, &list));
+        CHECK(list.spanCount == 2);
+        CHECK(list.spans[0].fileOffset == list.spans[1].fileOffset);
+
+        struct iovec* iovecs = nullptr;
+        uint64_t iovecCount = 0;
+        REQUIRE(reader.exportIovecs(&list, &iovecs, &iovecCount));
+        CHECK(iovecCount == 2);
+        CHECK(memcmp(iovecs[1].iov_base, reader.getAssetDataView(list.spans[1].bookOffset), iovecs[1].iov_len) == 0);
+        free(iovecs);
+
+        BBFReader::freeExportList(&list);
+        CHECK_FALSE(reader.exportPages(11, 2, &list));
+        CHECK(list.spans == nullptr);
+    }
+
+    SECTION("Section")
+    {
+        uint64_t firstPage = 0;
+        uint64_t pageCount = 0;
+        REQUIRE(reader.getSectionPageRange("Chapter 2", &firstPage, &pageCount));
+        REQUIRE(reader.exportSection("Chapter 2", &list));
+        CHECK(sendToFile(reader, &list) == concatPages(reader, firstPage, pageCount));
+        CHECK_FALSE(reader.exportSection("Missing", &list));
+    }
+
+    SECTION("Whole book, from memory and from inside a larger file")
+    {
+        REQUIRE(reader.exportBook(&list));
+        CHECK(sendToFile(reader, &list) == book);
+        BBFReader::freeExportList(&list);
+
+        BBFReader memoryReader(book.data(), book.size());
+        REQUIRE(memoryReader.exportBook(&list));
+        CHECK(list.spans[0].fileDescriptor == -1);
+        CHECK(sendToFile(memoryReader, &list) == book);
+        BBFReader::freeExportList(&list);
+
+        const char* packName = "export_pack.bin";
+        {
+            std::ofstream out(packName, std::ios::binary);
+            std::vector<uint8_t> junk(777, 'J');
+            out.write((const char*)junk.data(), junk.size());
+            out.write((const char*)book.data(), book.size());
+        }
+        int packFile = open(packName, O_RDONLY);
+        REQUIRE(packFile != -1);
+        {
+            BBFReader packReader(packFile, 777, book.size());
+            REQUIRE(packReader.exportPages(0, 12, &list));
+            CHECK(list.spans[0].fileOffset == list.spans[0].bookOffset + 777);
+            CHECK(sendToFile(packReader, &list) == concatPages(reader, 0, 12));
+        }
+        close(packFile);
+        deleteFile(packName);
+    }
+
+    BBFReader::freeExportList(&list);
+    deleteFile(OUTPUT);
+    deleteFile(PETRIFIEDOUTPUT);
+}
+#endif
+
+#ifdef __linux__
+static int connectLoopback(uint16_t port)
+{
+    int socketFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(port);
+    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (socketFd != -1 && connect(socketFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) != 0)
+    {
+        close(socketFd);
+        return -1;
+    }
+    return socketFd;
+}
+
+// Minimal keep-alive client. Returns the status code, or -1 if the connection failed.
+static int httpGet(int socketFd, const std::string& path, const std::string& extraHeaders, std::string* headers, std::vector<uint8_t>* body, bool headOnly = false)
+{
+    std::string request = std::string(headOnly ? "HEAD " : "GET ") + path + " HTTP/1.1\r\nHost: localhost\r\n" + extraHeaders + "\r\n";
+    if (send(socketFd, request.data(), request.size(), MSG_NOSIGNAL) != (ssize_t)request.size())
+    {
+        return -1;
+    }
+
+    std::string response;
+    char readBuffer[65536];
+    size_t headerEnd = std::string::npos;
+    while ((headerEnd = response.find("\r\n\r\n")) == std::string::npos)
+    {
+        ssize_t readBytes = recv(socketFd, readBuffer, sizeof(readBuffer), 0);
+        if (readBytes <= 0)
+        {
+            return -1;
+        }
+        response.append(readBuffer, (size_t)readBytes);
+    }
+
+    *headers = response.substr(0, headerEnd + 4);
+    size_t lengthAt = headers->find("Content-Length: ");
+    size_t contentLength = (lengthAt == std::string::npos || headOnly) ? 0 : (size_t)strtoull(headers->c_str() + lengthAt + 16, nullptr, 10);
+
+    body->assign(response.begin() + headerEnd + 4, response.end());
+    while (body->size() < contentLength)
+    {
+        ssize_t readBytes = recv(socketFd, readBuffer, sizeof(readBuffer), 0);
+        if (readBytes <= 0)
+        {
+            return -1;
+        }
+        body->insert(body->end(), readBuffer, readBuffer + readBytes);
+    }
+
+    return atoi(headers->c_str() + 9);
+}
+
+TEST_CASE("BBFServer - Loopback")
+{
+    const char* serveDir = "serve_books";
+    mkdir(serveDir, 0755);
+    createTestBook("serve_books/comic.bbf", 6, 20000);
+
+    BBFReader reference("serve_books/comic.bbf");
+    BBFFooter* f = reference.getFooterView(reference.getHeaderView()->footerOffset);
+    const uint8_t* pageTable = reference.getPageTableView(f->pageOffset);
+    const uint8_t* assetTable = reference.getAssetTableView(f->assetOffset);
+
+    BBFServerConfig serverConfig;
+    serverConfig.bookDir = serveDir;
+    serverConfig.port = 0;
+    serverConfig.workerCount = 2;
+    serverConfig.maxOpenBooks = 1;
+
+    BBFServer server(serverConfig);
+    REQUIRE(server.start());
+    REQUIRE(server.getPort() != 0);
+
+    int socketFd = connectLoopback(server.getPort());
+    REQUIRE(socketFd != -1);
+
+    std::string headers;
+    std::vector<uint8_t> body;
+
+    // Everything below reuses one keep-alive connection
+    CHECK(httpGet(socketFd, "/books", "", &headers, &body) == 200);
+    CHECK(std::string(body.begin(), body.end()) == "{\"books\":[\"comic.bbf\"]}\n");
+
+    CHECK(httpGet(socketFd, "/comic.bbf/toc", "", &headers, &body) == 200);
+    std::string toc(body.begin(), body.end());
+    CHECK(toc.find("\"pages\":8") != std::string::npos);
+    CHECK(toc.find("{\"title\":\"Chapter 2\",\"page\":3,\"parent\":\"Volume 1\"}") != std::string::npos);
+    CHECK(toc.find("{\"key\":\"Title\",\"value\":\"Test Book\",\"parent\":null}") != std::string::npos);
+
+    for (uint64_t pageIndex = 0; pageIndex < f->pageCount; ++pageIndex)
+    {
+        const BBFPage* page = reference.getPageEntryView(pageTable, (int)pageIndex);
+        const BBFAsset* asset = reference.getAssetEntryView(assetTable, (int)page->assetIndex);
+        const uint8_t* expected = reference.getAssetDataView(asset);
+
+        REQUIRE(httpGet(socketFd, "/comic.bbf/page/" + std::to_string(pageIndex), "", &headers, &body) == 200);
+        CHECK(body.size() == asset->fileSize);
+        CHECK(memcmp(body.data(), expected, body.size()) == 0);
+
+        char entityTag[40];
+        snprintf(entityTag, sizeof(entityTag), "\"%016llx%016llx\"", (unsigned long long)asset->assetHash[1], (unsigned long long)asset->assetHash[0]);
+        CHECK(headers.find(std::string("ETag: ") + entityTag) != std::string::npos);
+        CHECK(httpGet(socketFd, "/comic.bbf/page/" + std::to_string(pageIndex), std::string("If-None-Match: ") + entityTag + "\r\n", &headers, &body) == 304);
+        CHECK(body.empty());
+    }
+
+    SECTION("Ranges")
+    {
+        const BBFAsset* asset = reference.getAssetEntryView(assetTable, (int)reference.getPageEntryView(pageTable, 2)->assetIndex);
+        const uint8_t* expected = reference.getAssetDataView(asset);
+
+        CHECK(httpGet(socketFd, "/comic.bbf/page/2", "Range: bytes=100-199\r\n", &headers, &body) == 206);
+        CHECK(body.size() == 100);
+        CHECK(memcmp(body.data(), expected + 100, 100) == 0);
+        CHECK(headers.find("Content-Range: bytes 100-199/20000") != std::string::npos);
+
+        CHECK(httpGet(socketFd, "/comic.bbf/page/2", "Range: bytes=-50\r\n", &headers, &body) == 206);
+        CHECK(memcmp(body.data(), expected + 19950, 50) == 0);
+
+        CHECK(httpGet(socketFd, "/comic.bbf/page/2", "Range: bytes=19990-\r\n", &headers, &body) == 206);
+        CHECK(body.size() == 10);
+
+        CHECK(httpGet(socketFd, "/comic.bbf/page/2", "Range: bytes=20000-\r\n", &headers, &body) == 416);
+    }
+
+    SECTION("Errors and HEAD")
+    {
+        CHECK(httpGet(socketFd, "/comic.bbf/page/8", "", &headers, &body) == 404);
+        CHECK(httpGet(socketFd, "/missing.bbf/toc", "", &headers, &body) == 404);
+        CHECK(httpGet(socketFd, "/..%2fcomic.bbf/toc", "", &headers, &body) == 404);
+        CHECK(httpGet(socketFd, "/comic.bbf/nothing", "", &headers, &body) == 404);
+
+        CHECK(httpGet(socketFd, "/comic.bbf/page/0", "", &headers, &body, true) == 200);
+        CHECK(headers.find("Content-Length: 20000") != std::string::npos);
+        CHECK(httpGet(socketFd, "/comic.bbf/page/1", "", &headers, &body) == 200);
+        CHECK(body.size() == 20000);
+    }
+
+    SECTION("Second book evicts the first")
+    {
+        createTestBook("serve_books/other.bbf", 2, 5000);
+        CHECK(httpGet(socketFd, "/other.bbf/page/1", "", &headers, &body) == 200);
+        CHECK(body.size() == 5000);
+        CHECK(httpGet(socketFd, "/comic.bbf/page/0", "", &headers, &body) == 200);
+        CHECK(body.size() == 20000);
+        deleteFile("serve_books/other.bbf");
+    }
+
+    close(socketFd);
+    server.stop();
+    server.wait();
+    CHECK(server.getRequestCount() > 0);
+
+    deleteFile("serve_books/comic.bbf");
+    rmdir(serveDir);
+}
+
+TEST_CASE("BBFServer - Slow Client")
+{
+    const char* serveDir = "slow_books";
+    mkdir(serveDir, 0755);
+    createTestBook("slow_books/big.bbf", 1, 8 * 1024 * 1024);
+
+    // One worker, so a client that stops reading mid-page would be the only thing it does
+    BBFServerConfig serverConfig;
+    serverConfig.bookDir = serveDir;
+    serverConfig.port = 0;
+    serverConfig.workerCount = 1;
+
+    BBFServer server(serverConfig);
+    REQUIRE(server.start());
+
+    int stalledFd = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(stalledFd != -1);
+    int receiveSize = 4096;
+    setsockopt(stalledFd, SOL_SOCKET, SO_RCVBUF, &receiveSize, sizeof(receiveSize));
+    struct sockaddr_in serverAddr;
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(server.getPort());
+    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(connect(stalledFd, (struct sockaddr*)&serverAddr, sizeof(serverAddr)) == 0);
+
+    std::string stalledRequest = "GET /big.bbf/page/0 HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE(send(stalledFd, stalledRequest.data(), stalledRequest.size(), MSG_NOSIGNAL) == (ssize_t)stalledRequest.size());
+
+    // The page is waiting on epoll, so the worker is free for this one
+    int socketFd = connectLoopback(server.getPort());
+    REQUIRE(socketFd != -1);
+    struct timeval receiveTimeout = { 5, 0 };
+    setsockopt(socketFd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+
+    std::string headers;
+    std::vector<uint8_t> body;
+    CHECK(httpGet(socketFd, "/books", "", &headers, &body) == 200);
+    CHECK(std::string(body.begin(), body.end()) == "{\"books\":[\"big.bbf\"]}\n");
+
+    // Once the stalled client reads, its page arrives whole
+    setsockopt(stalledFd, SOL_SOCKET, SO_RCVTIMEO, &receiveTimeout, sizeof(receiveTimeout));
+    std::string stalledResponse;
+    char readBuffer[65536];
+    size_t headerEnd = std::string::npos;
+    while (headerEnd == std::string::npos || stalledResponse.size() < headerEnd + 4 + 8 * 1024 * 1024)
+    {
+        ssize_t readBytes = recv(stalledFd, readBuffer, sizeof(readBuffer), 0);
+        if (readBytes <= 0)
+        {
+            break;
+        }
+        stalledResponse.append(readBuffer, (size_t)readBytes);
+        headerEnd = stalledResponse.find("\r\n\r\n");
+    }
+    REQUIRE(headerEnd != std::string::npos);
+    CHECK(stalledResponse.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    CHECK(stalledResponse.size() == headerEnd + 4 + 8 * 1024 * 1024);
+
+    close(socketFd);
+    close(stalledFd);
+    server.stop();
+    server.wait();
+
+    deleteFile("slow_books/big.bbf");
+    rmdir(serveDir);
+}
+#endif
+
+TEST_CASE("BBFReader - Move Only")
+{
+    createTestBook(OUTPUT, 4, 10000);
+
+    BBFReader first(OUTPUT);
+    BBFFooter* footer = first.getFooterView(first.getHeaderView()->footerOffset);
+    REQUIRE(footer);
+    uint64_t pageCount = footer->pageCount;
+
+    BBFReader second(std::move(first));
+    CHECK(first.getHeaderView() == nullptr);
+    CHECK(first.getBackend() == nullptr);
+    REQUIRE(second.checkMagic(second.getHeaderView()));
+    CHECK(second.getFooterView(second.getHeaderView()->footerOffset)->pageCount == pageCount);
+
+    // Into a container, and back out by move assignment
+    std::vector<BBFReader> readers;
+    readers.push_back(std::move(second));
+    readers.emplace_back(OUTPUT);
+    CHECK(readers[0].checkMagic(readers[0].getHeaderView()));
+    CHECK(readers[1].checkMagic(readers[1].getHeaderView()));
+
+    BBFReader third(OUTPUT);
+    third = std::move(readers[0]);
+    CHECK(third.checkMagic(third.getHeaderView()));
+    CHECK(readers[0].getHeaderView() == nullptr);
+
+    deleteFile(OUTPUT);
+}
+
+TEST_CASE("BBFReaderPool - Sharing and Eviction")
+{
+    createTestBook("pool_a.bbf", 3, 10000);
+    createTestBook("pool_b.bbf", 3, 20000);
+    createTestBook("pool_c.bbf", 3, 30000);
+
+    BBFReaderPool pool(2);
+
+    SECTION("Handles share a reader")
+    {
+        BBFReaderHandle first = pool.acquire("pool_a.bbf");
+        BBFReaderHandle second = pool.acquire("pool_a.bbf");
+        REQUIRE(first);
+        CHECK(first.get() == second.get());
+        CHECK(first.getFooter()->pageCount == 5);
+        CHECK(pool.getHits() == 1);
+        CHECK(pool.getMisses() == 1);
+
+        // Moving transfers the reference
+        BBFReaderHandle third = std::move(first);
+        CHECK_FALSE(first);
+        CHECK(third.get() == second.get());
+
+        CHECK_FALSE(pool.acquire("pool_missing.bbf"));
+        CHECK_FALSE(pool.acquire("."));
+    }
+
+    SECTION("Idle readers are evicted, busy ones aren't")
+    {
+        BBFReaderHandle heldA = pool.acquire("pool_a.bbf");
+        pool.acquire("pool_b.bbf");
+        CHECK(pool.getOpenCount() == 2);
+
+        // b is idle, so it makes room for c
+        BBFReaderHandle heldC = pool.acquire("pool_c.bbf");
+        CHECK(pool.getOpenCount() == 2);
+        CHECK(pool.getEvictions() == 1);
+
+        // Both busy. Over the limit until one is dropped.
+        BBFReaderHandle heldB = pool.acquire("pool_b.bbf");
+        CHECK(pool.getOpenCount() == 3);
+        heldA.reset();
+        CHECK(pool.getOpenCount() == 2);
+
+        pool.setLimits(8, 1);
+        heldB.reset();
+        heldC.reset();
+        CHECK(pool.getOpenCount() == 0);
+        CHECK(pool.getMappedBytes() == 0);
+    }
+
+    SECTION("A rewritten book gets a fresh reader")
+    {
+        BBFReaderHandle oldHandle = pool.acquire("pool_a.bbf");
+        REQUIRE(oldHandle);
+        uint64_t oldPages = oldHandle.getFooter()->pageCount;
+
+        // Replace it under the same name. New inode, new size.
+        createTestBook("pool_new.bbf", 6, 10000);
+        std::rename("pool_new.bbf", "pool_a.bbf");
+
+        BBFReaderHandle newHandle = pool.acquire("pool_a.bbf");
+        REQUIRE(newHandle);
+        CHECK(newHandle.get() != oldHandle.get());
+        CHECK(newHandle.getFooter()->pageCount == 8);
+        CHECK(oldHandle.getFooter()->pageCount == oldPages);
+        CHECK(oldHandle->checkMagic(oldHandle->getHeaderView()));
+
+        CHECK(pool.getOpenCount() == 2);
+        oldHandle.reset();
+        CHECK(pool.getOpenCount() == 1);
+    }
+
+    pool.purge();
+    CHECK(pool.getOpenCount() == 0);
+
+    deleteFile("pool_a.bbf");
+    deleteFile("pool_b.bbf");
+    deleteFile("pool_c.bbf");
+}
+
+struct AsyncCheck
+{
+    BBFReader* reader;
+    uint32_t completed;
+    uint32_t mismatches;
+};
+
+static void checkFetchedAsset(void* userData, uint64_t assetIndex, uint8_t* buffer, int64_t result)
+{
+    AsyncCheck* check = (AsyncCheck*)userData;
+    BBFHeader* h = check->reader->getHeaderView();
+    BBFFooter* f = check->reader->getFooterView(h->footerOffset);
+    const BBFAsset* asset = check->reader->getAssetEntryView(check->reader->getAssetTableView(f->assetOffset), (int)assetIndex);
+
+    XXH128_hash_t hash = XXH3_128bits(buffer, (size_t)asset->fileSize);
+    if (result != (int64_t)asset->fileSize || hash.low64 != asset->assetHash[0] || hash.high64 != asset->assetHash[1])
+    {
+        check->mismatches++;
+    }
+    check->completed++;
+}
+
+static void fetchEveryAsset(BBFAsyncFetcher& fetcher, BBFReader& reader)
+{
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+
+    std::vector<std::vector<uint8_t>> buffers(f->assetCount);
+    AsyncCheck check = { &reader, 0, 0 };
+
+    uint64_t assetIterator = 0;
+    for (; assetIterator < f->assetCount; ++assetIterator)
+    {
+        const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)assetIterator);
+        buffers[assetIterator].resize((size_t)asset->fileSize);
+
+        // Queue is shallower than the book, so make room as we go
+        while (!fetcher.fetchAsset(&reader, assetIterator, buffers[assetIterator].data(), asset->fileSize, checkFetchedAsset, &check))
+        {
+            REQUIRE(fetcher.getInFlight() == fetcher.getQueueDepth());
+            fetcher.poll(1);
+        }
+    }
+
+    while (fetcher.getInFlight() > 0)
+    {
+        fetcher.poll(1);
+    }
+
+    CHECK(check.completed == f->assetCount);
+    CHECK(check.mismatches == 0);
+
+    // Bad index, or a buffer that's too small
+    uint8_t small[16];
+    CHECK_FALSE(fetcher.fetchAsset(&reader, f->assetCount, small, sizeof(small), checkFetchedAsset, &check));
+    CHECK_FALSE(fetcher.fetchAsset(&reader, 0, small, sizeof(small), checkFetchedAsset, &check));
+}
+
+static void storeFetchResult(void* userData, uint64_t assetIndex, uint8_t* buffer, int64_t result)
+{
+    (void)assetIndex;
+    (void)buffer;
+    *(int64_t*)userData = result;
+}
+
+TEST_CASE("BBFAsyncFetcher - Fetch Assets")
+{
+    createTestBook(OUTPUT, 12, 100000);
+    BBFReader reader(OUTPUT);
+
+    SECTION("io_uring, if the kernel lets us")
+    {
+        BBFAsyncFetcher fetcher(4);
+        fetchEveryAsset(fetcher, reader);
+    }
+
+    SECTION("Thread pool")
+    {
+        BBFAsyncFetcher fetcher(4, 2, false);
+        CHECK_FALSE(fetcher.isUsingIoUring());
+        fetchEveryAsset(fetcher, reader);
+    }
+
+    SECTION("Pread backend")
+    {
+        BBFPreadBackend backend(OUTPUT);
+        BBFReader preadReader(&backend);
+        BBFAsyncFetcher fetcher(8);
+        fetchEveryAsset(fetcher, preadReader);
+    }
+
+    SECTION("No file behind the reader")
+    {
+        std::ifstream in(OUTPUT, std::ios::binary);
+        std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        BBFReader memoryReader(book.data(), book.size());
+        BBFAsyncFetcher fetcher(8);
+        fetchEveryAsset(fetcher, memoryReader);
+    }
+
+#ifdef __linux__
+    SECTION("io_uring_enter failing for good")
+    {
+        BBFAsyncFetcher fetcher(4);
+        if (fetcher.isUsingIoUring())
+        {
+            // The newest io_uring fd is this fetcher's. With /dev/null in its place, io_uring_enter fails outright.
+            int ringFd = -1;
+            DIR* fdDir = opendir("/proc/self/fd");
+            REQUIRE(fdDir);
+            struct dirent* entry = nullptr;
+            while ((entry = readdir(fdDir)) != nullptr)
+            {
+                char linkPath[300];
+                char linkTarget[64] = {};
+                snprintf(linkPath, sizeof(linkPath), "/proc/self/fd/%s", entry->d_name);
+                if (readlink(linkPath, linkTarget, sizeof(linkTarget) - 1) > 0 && strcmp(linkTarget, "anon_inode:[io_uring]") == 0)
+                {
+                    ringFd = std::max(ringFd, atoi(entry->d_name));
+                }
+            }
+            closedir(fdDir);
+            REQUIRE(ringFd != -1);
+
+            int nullFd = open("/dev/null", O_RDONLY);
+            REQUIRE(dup2(nullFd, ringFd) == ringFd);
+            close(nullFd);
+
+            BBFHeader* h = reader.getHeaderView();
+            BBFFooter* f = reader.getFooterView(h->footerOffset);
+            const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+            std::vector<std::vector<uint8_t>> buffers(3);
+            int64_t results[3] = { 1, 1, 1 };
+            for (uint64_t assetIterator = 0; assetIterator < 3; ++assetIterator)
+            {
+                const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)assetIterator);
+                buffers[assetIterator].resize((size_t)asset->fileSize);
+                REQUIRE(fetcher.fetchAsset(&reader, assetIterator, buffers[assetIterator].data(), asset->fileSize, storeFetchResult, &results[assetIterator]));
+            }
+
+            // Every read fails instead of waiting forever, and the fetcher carries on with threads
+            while (fetcher.getInFlight() > 0)
+            {
+                fetcher.poll(1);
+            }
+            CHECK(results[0] < 0);
+            CHECK(results[1] < 0);
+            CHECK(results[2] < 0);
+            CHECK_FALSE(fetcher.isUsingIoUring());
+            fetchEveryAsset(fetcher, reader);
+        }
+    }
+#endif
+
+    deleteFile(OUTPUT);
+}
+
+static void checkProbeMatchesReader(const char* bookPath, uint32_t maxReads)
+{
+    const char* metaKeys[2] = { "Title", "Missing" };
+    BBFProbeResult probe;
+    REQUIRE(BBFProbe::probeBook(bookPath, &probe, metaKeys, 2));
+
+    BBFReader reader(bookPath);
+    BBFHeader* header = reader.getHeaderView();
+    BBFFooter* footer = reader.getFooterView(header->footerOffset);
+    REQUIRE(footer);
+
+    CHECK(probe.valid);
+    CHECK(probe.version == header->version);
+    CHECK(probe.headerFlags == header->flags);
+    CHECK(probe.alignment == header->alignment);
+    CHECK(probe.assetCount == footer->assetCount);
+    CHECK(probe.pageCount == footer->pageCount);
+    CHECK(probe.sectionCount == footer->sectionCount);
+    CHECK(probe.metaCount == footer->metaCount);
+    CHECK(probe.footerHash == footer->footerHash);
+    CHECK(probe.fileSize == reader.getBackend()->getSize());
+
+    REQUIRE(probe.metaValues);
+    REQUIRE(probe.metaValues[0]);
+    CHECK(std::string(probe.metaValues[0]) == "Test Book");
+    CHECK(probe.metaValues[1] == nullptr);
+    CHECK(probe.readCount <= maxReads);
+
+    BBFProbe::freeProbeResult(&probe);
+}
+
+TEST_CASE("BBFProbe - Header Only Probe")
+{
+    createTestBook(OUTPUT, 6, 10000);
+
+    SECTION("Plain book: header, then the tail")
+    {
+        checkProbeMatchesReader(OUTPUT, 2);
+    }
+
+    SECTION("Petrified book: one read")
+    {
+        REQUIRE(BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT));
+        checkProbeMatchesReader(PETRIFIEDOUTPUT, 1);
+        deleteFile(PETRIFIEDOUTPUT);
+    }
+
+    SECTION("Petrified book with an index bigger than the first read")
+    {
+        createTestBook("probe_big.bbf", 400, 16);
+        REQUIRE(BBFBuilder::petrifyFile("probe_big.bbf", PETRIFIEDOUTPUT));
+        checkProbeMatchesReader(PETRIFIEDOUTPUT, 2);
+        deleteFile("probe_big.bbf");
+        deleteFile(PETRIFIEDOUTPUT);
+    }
+
+    SECTION("Counts without metadata")
+    {
+        BBFProbeResult probe;
+        REQUIRE(BBFProbe::probeBook(OUTPUT, &probe));
+        CHECK(probe.pageCount == 8);
+        CHECK(probe.metaValues == nullptr);
+        BBFProbe::freeProbeResult(&probe);
+    }
+
+    SECTION("Not a book")
+    {
+        BBFProbeResult probe;
+        CHECK_FALSE(BBFProbe::probeBook("probe_missing.bbf", &probe));
+        CHECK_FALSE(probe.valid);
+
+        createTestFile("probe_junk.bbf", 5000, 'J');
+        CHECK_FALSE(BBFProbe::probeBook("probe_junk.bbf", &probe));
+        deleteFile("probe_junk.bbf");
+
+        // Footer offset points past the end
+        std::ifstream in(OUTPUT, std::ios::binary);
+        std::vector<char> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::ofstream truncated("probe_short.bbf", std::ios::binary);
+        truncated.write(book.data(), (std::streamsize)(book.size() - 100));
+        truncated.close();
+        CHECK_FALSE(BBFProbe::probeBook("probe_short.bbf", &probe));
+        deleteFile("probe_short.bbf");
+    }
+
+    deleteFile(OUTPUT);
+}
+
+TEST_CASE("BBFProbe - Directory Batch")
+{
+    std::filesystem::remove_all("probe_library");
+    std::filesystem::create_directory("probe_library");
+    createTestBook("probe_library/c.bbf", 2, 1000);
+    createTestBook("probe_library/a.bbf", 4, 1000);
+    createTestBook("probe_library/b.bbf", 6, 1000);
+    createTestFile("probe_library/broken.bbf", 100, 'X');
+    createTestFile("probe_library/notes.txt", 100, 'X');
+
+    const char* metaKeys[1] = { "Title" };
+    BBFProbeBatch batch;
+    REQUIRE(BBFProbe::probeDirectory("probe_library", &batch, metaKeys, 1, 3));
+    REQUIRE(batch.count == 4);
+
+    CHECK(std::string(batch.paths[0]) == "probe_library/a.bbf");
+    CHECK(std::string(batch.paths[2]) == "probe_library/broken.bbf");
+    CHECK(batch.results[0].pageCount == 6);
+    CHECK(batch.results[1].pageCount == 8);
+    CHECK_FALSE(batch.results[2].valid);
+    CHECK(batch.results[3].pageCount == 4);
+    CHECK(std::string(batch.results[3].metaValues[0]) == "Test Book");
+    BBFProbe::freeProbeBatch(&batch);
+    CHECK(batch.count == 0);
+
+    CHECK_FALSE(BBFProbe::probeDirectory("probe_library_missing", &batch));
+
+    std::filesystem::remove_all("probe_library");
+}
+
+TEST_CASE("BBFCatalog - Build, Search and Refresh")
+{
+    std::filesystem::remove_all("catalog_lib");
+    std::filesystem::create_directory("catalog_lib");
+    createTestBook("catalog_lib/a.bbf", 2, 1000);
+    createTestBook("catalog_lib/b.bbf", 4, 1000);
+    createTestFile("catalog_lib/broken.bbf", 100, 'X');
+    {
+        BBFBuilder bbfBuilder("catalog_lib/c.bbf");
+        createTestFile("catalog_page.png", 1000, 'C');
+        bbfBuilder.addPage("catalog_page.png");
+        deleteFile("catalog_page.png");
+        bbfBuilder.addMeta("Title", "The Dispossessed");
+        bbfBuilder.addMeta("Author", "Ursula K. Le Guin");
+        bbfBuilder.addMeta("Tags", "sci-fi, Anarchism, sci-fi");
+        REQUIRE(bbfBuilder.finalize());
+    }
+
+    BBFCatalogStats stats;
+    REQUIRE(BBFCatalog::build("catalog_lib", "catalog_test.bbfcat", "catalog_test.bbfcat", &stats, 2));
+    CHECK(stats.booksListed == 4);
+    CHECK(stats.booksProbed == 4);
+    CHECK(stats.booksReused == 0);
+    CHECK(stats.booksFailed == 1);
+
+    {
+        BBFCatalog catalog("catalog_test.bbfcat");
+        REQUIRE(catalog.isValid());
+        REQUIRE(catalog.getBookCount() == 3);
+
+        uint64_t bookC = catalog.findBook("catalog_lib/c.bbf");
+        REQUIRE(bookC == 2);
+        CHECK(catalog.findBook("catalog_lib/broken.bbf") == 0xFFFFFFFFFFFFFFFF);
+        CHECK(catalog.getBook(0)->pageCount == 4);
+        CHECK(catalog.getBook(1)->pageCount == 6);
+        CHECK(catalog.getBook(bookC)->metaCount == 3);
+        CHECK(std::string(catalog.getMetaValue(bookC, "Author")) == "Ursula K. Le Guin");
+        CHECK(catalog.getMetaValue(bookC, "Publisher") == nullptr);
+
+        BBFProbeResult probe;
+        REQUIRE(BBFProbe::probeBook("catalog_lib/b.bbf", &probe));
+        CHECK(catalog.getBook(1)->footerHash == probe.footerHash);
+        BBFProbe::freeProbeResult(&probe);
+
+        uint64_t results[8];
+        CHECK(catalog.search("test book", results, 8) == 2);
+        CHECK(results[0] == 0);
+        CHECK(results[1] == 1);
+        CHECK(catalog.search("URSULA guin", results, 8) == 1);
+        CHECK(results[0] == bookC);
+        CHECK(catalog.search("ursula test", results, 8) == 0);
+        CHECK(catalog.search("nothing", results, 8) == 0);
+        CHECK(catalog.search("", results, 8) == 0);
+
+        // The repeated tag is one posting
+        const uint64_t* postings = nullptr;
+        CHECK(catalog.findTerm("Sci", &postings) == 1);
+        CHECK(postings[0] == bookC);
+    }
+
+    SECTION("Refresh only probes what changed")
+    {
+        REQUIRE(BBFCatalog::build("catalog_lib", "catalog_test.bbfcat", "catalog_test.bbfcat", &stats));
+        CHECK(stats.booksReused == 3);
+        CHECK(stats.booksProbed == 1); // broken.bbf is never catalogued, so it's always retried
+
+        createTestBook("catalog_lib/b.bbf", 7, 1000);
+        deleteFile("catalog_lib/a.bbf");
+        REQUIRE(BBFCatalog::build("catalog_lib", "catalog_test.bbfcat", "catalog_test.bbfcat", &stats));
+        CHECK(stats.booksReused == 1);
+        CHECK(stats.booksProbed == 2);
+
+        BBFCatalog catalog("catalog_test.bbfcat");
+        REQUIRE(catalog.getBookCount() == 2);
+        CHECK(catalog.getBook(0)->pageCount == 9);
+        CHECK(std::string(catalog.getMetaValue(1, "Title")) == "The Dispossessed");
+
+        uint64_t results[8];
+        CHECK(catalog.search("anarchism", results, 8) == 1);
+        CHECK(results[0] == 1);
+    }
+
+    SECTION("Corrupt catalogs are rejected")
+    {
+        std::fstream corrupt("catalog_test.bbfcat", std::ios::binary | std::ios::in | std::ios::out);
+        corrupt.seekp(200);
+        corrupt.put('Z');
+        corrupt.close();
+
+        BBFCatalog catalog("catalog_test.bbfcat");
+        CHECK_FALSE(catalog.isValid());
+        CHECK(catalog.getBookCount() == 0);
+        CHECK(catalog.getBook(0) == nullptr);
+        CHECK(catalog.findBook("catalog_lib/a.bbf") == 0xFFFFFFFFFFFFFFFF);
+
+        // A broken previous catalog just means probing everything
+        REQUIRE(BBFCatalog::build("catalog_lib", "catalog_test.bbfcat", "catalog_test.bbfcat", &stats));
+        CHECK(stats.booksProbed == 4);
+        CHECK(BBFCatalog("catalog_test.bbfcat").isValid());
+    }
+
+    deleteFile("catalog_test.bbfcat");
+    std::filesystem::remove_all("catalog_lib");
+}
+
+static void checkResidencyReport(BBFReader& reader)
+{
+    BBFResidencyReport report;
+    REQUIRE(reader.residency(&report));
+
+    BBFFooter* footer = reader.getFooterView(reader.getHeaderView()->footerOffset);
+    REQUIRE(report.pageCount == footer->pageCount);
+    REQUIRE(report.sectionCount == footer->sectionCount);
+    CHECK(report.totalBytes == reader.getBackend()->getSize());
+    CHECK(report.residentBytes <= report.totalBytes);
+
+    // Just warmed, so every page is in the cache
+    uint64_t allPageBytes = 0;
+    uint64_t pageIterator = 0;
+    for (; pageIterator < report.pageCount; pageIterator++)
+    {
+        CHECK(report.pageBytes[pageIterator] > 0);
+        CHECK(report.pageResident[pageIterator] == report.pageBytes[pageIterator]);
+        allPageBytes += report.pageBytes[pageIterator];
+    }
+
+    // Volume 1 holds every page but the dupes in Extras
+    CHECK(report.sectionBytes[0] == allPageBytes - report.pageBytes[report.pageCount - 1] - report.pageBytes[report.pageCount - 2]);
+    CHECK(report.sectionBytes[1] + report.sectionBytes[2] == report.sectionBytes[0]);
+    CHECK(report.sectionResident[3] == report.sectionBytes[3]);
+
+    BBFReader::freeResidencyReport(&report);
+    CHECK(report.pageResident == nullptr);
+}
+
+TEST_CASE("BBFReader - Residency and Warm Up")
+{
+    createTestBook(OUTPUT, 10, 300000);
+
+    SECTION("Mapped book")
+    {
+        BBFReader reader(OUTPUT);
+        CHECK(reader.warmSection("Chapter 2", 2));
+        CHECK_FALSE(reader.warmSection("Missing"));
+        REQUIRE(reader.warm(0, 12, 3));
+        checkResidencyReport(reader);
+    }
+
+    SECTION("Pread backend maps the file just to ask")
+    {
+        BBFPreadBackend backend(OUTPUT);
+        BBFReader reader(&backend);
+        REQUIRE(reader.warm(0, 12, 4));
+        checkResidencyReport(reader);
+    }
+
+    SECTION("Book in memory")
+    {
+        std::ifstream in(OUTPUT, std::ios::binary);
+        std::vector<uint8_t> book((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        BBFReader reader(book.data(), book.size());
+        REQUIRE(reader.warm(0, 12, 4));
+        checkResidencyReport(reader);
+        CHECK_FALSE(reader.warm(5, 100));
+    }
+
+    deleteFile(OUTPUT);
+}
+
+static std::vector<uint8_t> readWholeFile(const char* path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE("BBFBuilder - Petrify In Place")
+{
+    createTestBook(OUTPUT, 10, 300000);
+    std::filesystem::copy_file(OUTPUT, "inplace.bbf", std::filesystem::copy_options::overwrite_existing);
+
+    SECTION("Matches a copied petrify byte for byte")
+    {
+        REQUIRE(BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT));
+        REQUIRE(BBFBuilder::petrifyInPlace("inplace.bbf"));
+        CHECK_FALSE(std::filesystem::exists("inplace.bbf.bbfjournal"));
+        CHECK_FALSE(std::filesystem::exists("petrified.bbf.tmp"));
+
+        std::vector<uint8_t> copied = readWholeFile(PETRIFIEDOUTPUT);
+        std::vector<uint8_t> inPlace = readWholeFile("inplace.bbf");
+        REQUIRE(copied.size() == inPlace.size());
+        CHECK(copied == inPlace);
+
+        BBFReader reader("inplace.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        REQUIRE(h);
+        CHECK((h->flags & BBF::BBF_PETRIFICATION_FLAG) != 0);
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        REQUIRE(f);
+        REQUIRE(f->assetCount == 11);
+        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+        uint64_t assetIterator = 0;
+        for (; assetIterator < f->assetCount; ++assetIterator)
+        {
+            const BBFAsset* asset = reader.getAssetEntryView(aTable, (int)assetIterator);
+            XXH128_hash_t calcHash = reader.computeAssetHash(asset);
+            CHECK(calcHash.low64 == asset->assetHash[0]);
+            CHECK(calcHash.high64 == asset->assetHash[1]);
+        }
+
+        // Already petrified
+        CHECK_FALSE(BBFBuilder::petrifyInPlace("inplace.bbf"));
+        CHECK_FALSE(std::filesystem::exists("inplace.bbf.bbfjournal"));
+    }
+
+    SECTION("A damaged journal leaves the book alone")
+    {
+        createTestFile("inplace.bbf.bbfjournal", 512, 'J');
+        std::vector<uint8_t> before = readWholeFile("inplace.bbf");
+        CHECK_FALSE(BBFBuilder::petrifyInPlace("inplace.bbf"));
+        CHECK(readWholeFile("inplace.bbf") == before);
+        deleteFile("inplace.bbf.bbfjournal");
+    }
+
+    SECTION("Temp files are unique and cleaned up")
+    {
+        REQUIRE(BBFBuilder::petrifyFile(OUTPUT, "petrified_a.bbf"));
+        REQUIRE(BBFBuilder::petrifyFile(OUTPUT, "petrified_b.bbf"));
+        CHECK(readWholeFile("petrified_a.bbf") == readWholeFile("petrified_b.bbf"));
+
+        for (const auto& entry : std::filesystem::directory_iterator("."))
+        {
+            CHECK(entry.path().filename().string().find(".petrify.") == std::string::npos);
+        }
+        deleteFile("petrified_a.bbf");
+        deleteFile("petrified_b.bbf");
+    }
+
+    deleteFile("inplace.bbf");
+    deleteFile(OUTPUT);
+}
+
+TEST_CASE("BBFBuilder - Petrify Keeps Alignment")
+{
+    // Big pages get the full alignment, small ones go in reams
+    auto buildBook = [](const char* bookName, uint32_t alignment)
+    {
+        BBFBuilder builder(bookName, alignment);
+        int pageIterator = 0;
+        for (; pageIterator < 6; ++pageIterator)
+        {
+            std::string name = "align_page_" + std::to_string(pageIterator) + ".png";
+            createRandomFile(name, (pageIterator % 2) ? 1000 + pageIterator : 100000 + pageIterator);
+            builder.addPage(name.c_str());
+            deleteFile(name);
+        }
+        builder.addMeta("Title", "Aligned");
+        return builder.finalize();
+    };
+
+    uint32_t alignment = GENERATE(12u, 16u);
+    REQUIRE(buildBook(OUTPUT, alignment));
+    {
+        BBFReader reader(OUTPUT);
+        CHECK(reader.findMisalignedAssets(nullptr, 0) == 0);
+        CHECK(reader.getAssetAlignment(0) == (1ULL << alignment));
+        CHECK(reader.getAssetAlignment(1) == 8);
+        CHECK(reader.getAssetAlignment(100) == 0);
+    }
+
+    REQUIRE(BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT));
+    {
+        BBFReader reader(PETRIFIEDOUTPUT);
+        CHECK(reader.findMisalignedAssets(nullptr, 0) == 0);
+        const BBFAsset* first = reader.getAssetEntryView(reader.getAssetTableView(reader.getFooterView(64)->assetOffset), 0);
+        REQUIRE(first);
+        CHECK(first->fileOffset % (1ULL << alignment) == 0);
+    }
+
+    // In place gives the same bytes, and drops the old index off the end
+    REQUIRE(BBFBuilder::petrifyInPlace(OUTPUT));
+    CHECK(readWholeFile(OUTPUT) == readWholeFile(PETRIFIEDOUTPUT));
+
+    // A shifted asset gets reported
+    {
+        std::vector<uint8_t> book = readWholeFile(PETRIFIEDOUTPUT);
+        BBFFooter footer;
+        memcpy(&footer, book.data() + sizeof(BBFHeader), sizeof(BBFFooter));
+        BBFAsset asset;
+        memcpy(&asset, book.data() + footer.assetOffset + 2 * sizeof(BBFAsset), sizeof(BBFAsset));
+        asset.fileOffset += 4;
+        memcpy(book.data() + footer.assetOffset + 2 * sizeof(BBFAsset), &asset, sizeof(BBFAsset));
+
+        BBFReader reader(book.data(), book.size());
+        uint64_t misaligned[4] = {};
+        CHECK(reader.findMisalignedAssets(misaligned, 4) == 1);
+        CHECK(misaligned[0] == 2);
+    }
+
+    deleteFile(OUTPUT);
+    deleteFile(PETRIFIEDOUTPUT);
+}
+
+TEST_CASE("BBFDataMover - Copy Paths")
+{
+    createRandomFile("move_source.bin", 3 * 1024 * 1024 + 123);
+    std::vector<uint8_t> source = readWholeFile("move_source.bin");
+
+    #ifdef _WIN32
+        int sourceFd = _open("move_source.bin", _O_RDONLY | _O_BINARY);
+        int destFd = _open("move_dest.bin", _O_RDWR | _O_CREAT | _O_TRUNC | _O_BINARY, 0644);
+    #else
+        int sourceFd = open("move_source.bin", O_RDONLY);
+        int destFd = open("move_dest.bin", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    #endif
+    REQUIRE(sourceFd >= 0);
+    REQUIRE(destFd >= 0);
+
+    bool buffered = GENERATE(false, true);
+    BBFDataMover dataMover(sourceFd, destFd);
+    if (buffered)
+    {
+        dataMover.disable(BBFCopyMethod::REFLINK);
+        dataMover.disable(BBFCopyMethod::KERNEL);
+    }
+
+    // Block aligned, ragged, and shifted ranges, plus an empty one
+    REQUIRE(dataMover.copy(0, 0, 1024 * 1024 + 7));
+    REQUIRE(dataMover.copy(1024 * 1024 + 7, 1024 * 1024 + 7, 1024 * 1024 + 100));
+    REQUIRE(dataMover.copy(2 * 1024 * 1024 + 107, 2 * 1024 * 1024 + 107 + 4096 + 3, 1024 * 1024 + 16));
+    REQUIRE(dataMover.copy(0, 0, 0));
+    if (buffered)
+    {
+        CHECK(dataMover.getLastMethod() == BBFCopyMethod::NONE);
+    }
+
+    const BBFCopyStats& stats = dataMover.getStats();
+    CHECK(stats.copyCount == 4);
+    CHECK(stats.reflinkBytes + stats.kernelBytes + stats.bufferedBytes == 3 * 1024 * 1024 + 123);
+    if (buffered)
+    {
+        CHECK(stats.bufferedBytes == 3 * 1024 * 1024 + 123);
+    }
+
+    #ifdef _WIN32
+        _close(sourceFd);
+        _close(destFd);
+    #else
+        close(sourceFd);
+        close(destFd);
+    #endif
+
+    std::vector<uint8_t> dest = readWholeFile("move_dest.bin");
+    REQUIRE(dest.size() == 3 * 1024 * 1024 + 107 + 4099 + 16);
+    CHECK(memcmp(dest.data(), source.data(), 2 * 1024 * 1024 + 107) == 0);
+    CHECK(memcmp(dest.data() + 2 * 1024 * 1024 + 107 + 4099, source.data() + 2 * 1024 * 1024 + 107, 1024 * 1024 + 16) == 0);
+
+    // Petrify reports how its data moved
+    createTestBook(OUTPUT, 4, 100000);
+    BBFCopyStats petrifyStats;
+    REQUIRE(BBFBuilder::petrifyFile(OUTPUT, PETRIFIEDOUTPUT, &petrifyStats));
+    CHECK(petrifyStats.copyCount == 1);
+    CHECK(petrifyStats.reflinkBytes + petrifyStats.kernelBytes + petrifyStats.bufferedBytes > 4 * 100000);
+    {
+        BBFReader reader(PETRIFIEDOUTPUT);
+        CHECK(reader.findMisalignedAssets(nullptr, 0) == 0);
+    }
+
+    deleteFile("move_source.bin");
+    deleteFile("move_dest.bin");
+    deleteFile(OUTPUT);
+    deleteFile(PETRIFIEDOUTPUT);
+}
+
+static void checkBookHashes(const char* bookName, uint64_t assetCount, uint64_t pageCount)
+{
+    BBFReader reader(bookName);
+    BBFHeader* h = reader.getHeaderView();
+    REQUIRE(h);
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    REQUIRE(f);
+    CHECK(f->assetCount == assetCount);
+    CHECK(f->pageCount == pageCount);
+
+    const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+    uint64_t assetIterator = 0;
+    for (; assetIterator < f->assetCount; ++assetIterator)
+    {
+        const BBFAsset* asset = reader.getAssetEntryView(aTable, (int)assetIterator);
+        REQUIRE(asset);
+        XXH128_hash_t calcHash = reader.computeAssetHash(asset);
+        CHECK(calcHash.low64 == asset->assetHash[0]);
+        CHECK(calcHash.high64 == asset->assetHash[1]);
+    }
+    CHECK(reader.findMisalignedAssets(nullptr, 0) == 0);
+}
+
+TEST_CASE("BBFBuilder - Repack")
+{
+    createTestBook(OUTPUT, 8, 50000);
+
+    SECTION("New layout, same book")
+    {
+        bool petrify = GENERATE(false, true);
+        BBFCopyStats copyStats;
+        REQUIRE(BBFBuilder::repackFile(OUTPUT, "repacked.bbf", 16, 12, BBF::BBF_VARIABLE_REAM_SIZE_FLAG, petrify, &copyStats));
+        CHECK(copyStats.reflinkBytes + copyStats.kernelBytes + copyStats.bufferedBytes >= 9 * 50000);
+        CHECK(copyStats.copyCount == 9); // Petrified on the same pass, no second copy
+        checkBookHashes("repacked.bbf", 9, 10);
+
+        BBFReader reader("repacked.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        CHECK(h->alignment == 16);
+        CHECK(h->reamSize == 12);
+        CHECK(((h->flags & BBF::BBF_PETRIFICATION_FLAG) != 0) == petrify);
+        CHECK((h->footerOffset == sizeof(BBFHeader)) == petrify);
+
+        uint64_t firstPage = 0;
+        uint64_t pageCount = 0;
+        REQUIRE(reader.getSectionPageRange("Chapter 2", &firstPage, &pageCount));
+        CHECK(firstPage == 4);
+        CHECK(pageCount == 4);
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        const BBFMeta* meta = reader.getMetaEntryView(reader.getMetadataView(f->metaOffset), 0);
+        REQUIRE(meta);
+        CHECK(std::string(reader.getStringView(meta->valueOffset)) == "Test Book");
+    }
+
+    SECTION("Unused assets dropped, duplicates merged")
+    {
+        std::vector<uint8_t> book = readWholeFile(OUTPUT);
+        BBFHeader header;
+        memcpy(&header, book.data(), sizeof(BBFHeader));
+        BBFFooter footer;
+        memcpy(&footer, book.data() + header.footerOffset, sizeof(BBFFooter));
+
+        // Page 1 uses asset 0, so asset 1 is unused. Asset 3 claims asset 2's hash.
+        BBFPage page;
+        memcpy(&page, book.data() + footer.pageOffset + sizeof(BBFPage), sizeof(BBFPage));
+        page.assetIndex = 0;
+        memcpy(book.data() + footer.pageOffset + sizeof(BBFPage), &page, sizeof(BBFPage));
+        memcpy(book.data() + footer.assetOffset + 3 * sizeof(BBFAsset) + offsetof(BBFAsset, assetHash),
+               book.data() + footer.assetOffset + 2 * sizeof(BBFAsset) + offsetof(BBFAsset, assetHash), 16);
+
+        std::ofstream out("legacy.bbf", std::ios::binary);
+        out.write((const char*)book.data(), (std::streamsize)book.size());
+        out.close();
+
+        REQUIRE(BBFBuilder::repackFile("legacy.bbf", "legacy.bbf", 12, 16, 0));
+        BBFReader reader("legacy.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        CHECK(f->assetCount == 7);
+        CHECK(f->pageCount == 10);
+        const uint8_t* pTable = reader.getPageTableView(f->pageOffset);
+        CHECK(reader.getPageEntryView(pTable, 1)->assetIndex == 0);
+        CHECK(reader.getPageEntryView(pTable, 3)->assetIndex == reader.getPageEntryView(pTable, 2)->assetIndex);
+        deleteFile("legacy.bbf");
+    }
+
+    deleteFile("repacked.bbf");
+    deleteFile(OUTPUT);
+}
+
+TEST_CASE("BBFBuilder - Merge")
+{
+    createTestBook("merge_a.bbf", 4, 50000);
+    createTestBook("merge_b.bbf", 6, 50000);
+
+    const char* inputs[] = { "merge_a.bbf", "merge_b.bbf" };
+    const char* volumes[] = { "Volume A", "Volume B" };
+    BBFCopyStats copyStats;
+    REQUIRE(BBFBuilder::mergeFiles(inputs, 2, "omnibus.bbf", volumes, 12, 16, BBF::BBF_VARIABLE_REAM_SIZE_FLAG, false, &copyStats));
+
+    // The duplicate page is the same in both books, so it's stored once
+    checkBookHashes("omnibus.bbf", 5 + 7 - 1, 6 + 8);
+    CHECK(copyStats.copyCount == 11);
+
+    BBFReader reader("omnibus.bbf");
+    uint64_t firstPage = 0;
+    uint64_t pageCount = 0;
+    REQUIRE(reader.getSectionPageRange("Volume A", &firstPage, &pageCount));
+    CHECK(firstPage == 0);
+    CHECK(pageCount == 6);
+    REQUIRE(reader.getSectionPageRange("Volume B", &firstPage, &pageCount));
+    CHECK(firstPage == 6);
+    CHECK(pageCount == 8);
+
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    REQUIRE(f->sectionCount == 10);
+    const uint8_t* sTable = reader.getSectionTableView(f->sectionOffset);
+
+    // Volume B's own sections are rebased and hang off it
+    const BBFSection* section = reader.getSectionEntryView(sTable, 5);
+    CHECK(std::string(reader.getStringView(section->sectionTitleOffset)) == "Volume B");
+    section = reader.getSectionEntryView(sTable, 6);
+    CHECK(std::string(reader.getStringView(section->sectionTitleOffset)) == "Volume 1");
+    CHECK(std::string(reader.getStringView(section->sectionParentOffset)) == "Volume B");
+    CHECK(section->sectionStartIndex == 6);
+    section = reader.getSectionEntryView(sTable, 8);
+    CHECK(std::string(reader.getStringView(section->sectionTitleOffset)) == "Chapter 2");
+    CHECK(section->sectionStartIndex == 6 + 3);
+
+    REQUIRE(f->metaCount == 2);
+    const BBFMeta* meta = reader.getMetaEntryView(reader.getMetadataView(f->metaOffset), 1);
+    CHECK(std::string(reader.getStringView(meta->parentOffset)) == "Volume B");
+
+    // Petrified on the same pass
+    BBFCopyStats petrifyStats;
+    REQUIRE(BBFBuilder::mergeFiles(inputs, 2, "omnibus_p.bbf", volumes, 12, 16, BBF::BBF_VARIABLE_REAM_SIZE_FLAG, true, &petrifyStats));
+    checkBookHashes("omnibus_p.bbf", 5 + 7 - 1, 6 + 8);
+    CHECK(petrifyStats.copyCount == 11);
+    {
+        BBFReader petrified("omnibus_p.bbf");
+        BBFHeader* ph = petrified.getHeaderView();
+        REQUIRE(ph);
+        CHECK((ph->flags & BBF::BBF_PETRIFICATION_FLAG) != 0);
+        CHECK(ph->footerOffset == sizeof(BBFHeader));
+        REQUIRE(petrified.getSectionPageRange("Volume B", &firstPage, &pageCount));
+        CHECK(firstPage == 6);
+    }
+    deleteFile("omnibus_p.bbf");
+
+    deleteFile("merge_a.bbf");
+    deleteFile("merge_b.bbf");
+    deleteFile("omnibus.bbf");
+}
+
+TEST_CASE("BBFBuilder - Split")
+{
+    createTestBook("split_a.bbf", 4, 50000);
+    createTestBook("split_b.bbf", 6, 50000);
+
+    const char* inputs[] = { "split_a.bbf", "split_b.bbf" };
+    const char* volumes[] = { "Volume A", "Volume B" };
+    REQUIRE(BBFBuilder::mergeFiles(inputs, 2, "split_omni.bbf", volumes, 12, 16, BBF::BBF_VARIABLE_REAM_SIZE_FLAG));
+
+    SECTION("Top level")
+    {
+        uint64_t bookCount = 0;
+        REQUIRE(BBFBuilder::splitFile("split_omni.bbf", ".", 1, 2, nullptr, &bookCount));
+        CHECK(bookCount == 2);
+
+        checkBookHashes("Volume A.bbf", 5, 6);
+        checkBookHashes("Volume B.bbf", 7, 8);
+
+        BBFReader reader("Volume B.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        CHECK((h->flags & BBF::BBF_VARIABLE_REAM_SIZE_FLAG) != 0);
+        CHECK(h->alignment == 12);
+
+        // The volume is the top section again, the rest keep their parents
+        REQUIRE(f->sectionCount == 5);
+        const uint8_t* sTable = reader.getSectionTableView(f->sectionOffset);
+        const BBFSection* section = reader.getSectionEntryView(sTable, 0);
+        CHECK(std::string(reader.getStringView(section->sectionTitleOffset)) == "Volume B");
+        CHECK(section->sectionParentOffset == 0xFFFFFFFFFFFFFFFF);
+        section = reader.getSectionEntryView(sTable, 3);
+        CHECK(std::string(reader.getStringView(section->sectionTitleOffset)) == "Chapter 2");
+        CHECK(std::string(reader.getStringView(section->sectionParentOffset)) == "Volume 1");
+        CHECK(section->sectionStartIndex == 3);
+
+        // Only Volume B's title, now book level
+        REQUIRE(f->metaCount == 1);
+        const BBFMeta* meta = reader.getMetaEntryView(reader.getMetadataView(f->metaOffset), 0);
+        CHECK(std::string(reader.getStringView(meta->valueOffset)) == "Test Book");
+        CHECK(meta->parentOffset == 0xFFFFFFFFFFFFFFFF);
+
+        deleteFile("Volume A.bbf");
+        deleteFile("Volume B.bbf");
+    }
+
+    SECTION("Nested, repeated titles")
+    {
+        uint64_t bookCount = 0;
+        REQUIRE(BBFBuilder::splitFile("split_omni.bbf", ".", 2, 4, nullptr, &bookCount));
+        CHECK(bookCount == 4);
+
+        checkBookHashes("Volume 1.bbf", 4, 4);
+        checkBookHashes("Extras.bbf", 1, 2);
+        checkBookHashes("Volume 1 (2).bbf", 6, 6);
+        checkBookHashes("Extras (2).bbf", 1, 2);
+
+        BBFReader reader("Volume 1 (2).bbf");
+        uint64_t firstPage = 0;
+        uint64_t pageCount = 0;
+        REQUIRE(reader.getSectionPageRange("Chapter 2", &firstPage, &pageCount));
+        CHECK(firstPage == 3);
+        CHECK(pageCount == 3);
+
+        deleteFile("Volume 1.bbf");
+        deleteFile("Extras.bbf");
+        deleteFile("Volume 1 (2).bbf");
+        deleteFile("Extras (2).bbf");
+    }
+
+    deleteFile("split_a.bbf");
+    deleteFile("split_b.bbf");
+    deleteFile("split_omni.bbf");
+}
+
+TEST_CASE("BBFPatch - Diff and Apply")
+{
+    createTestBook("patch_old.bbf", 6, 50000);
 
-    BBFReader reader(OUTPUT);
+    // Next revision: page 3 redrawn, everything else as it was
+    {
+        BBFReader oldBook("patch_old.bbf");
+        BBFBuilder builder("patch_new.bbf");
+        createRandomFile("patch_fix.png", 50000);
+        int pageIterator = 0;
+        for (; pageIterator < 8; pageIterator++)
+        {
+            if (pageIterator == 3)
+            {
+                REQUIRE(builder.addPage("patch_fix.png"));
+                continue;
+            }
+            REQUIRE(builder.addPageFrom(&oldBook, pageIterator));
+        }
+        deleteFile("patch_fix.png");
+        builder.addSection("Volume 1", 0);
+        builder.addMeta("Title", "Test Book (Second Edition)");
+        REQUIRE(builder.finalize());
+    }
 
-    BBFHeader* header = reader.getHeaderView();
-    REQUIRE(header != nullptr);
-    CHECK(reader.checkMagic(header) == true);
-    CHECK(header->version == BBF::VERSION);
+    BBFPatchStats patchStats;
+    REQUIRE(BBFPatch::diff("patch_old.bbf", "patch_new.bbf", "patch.bbfp", &patchStats));
+    CHECK(patchStats.assetsReused == 6);
+    CHECK(patchStats.assetsShipped == 1);
+    CHECK(patchStats.reusedBytes == 6 * 50000);
+    CHECK(patchStats.patchSize < 2 * 50000);
 
-    BBFFooter* footer = reader.getFooterView(header->footerOffset);
-    REQUIRE(footer != nullptr);
+    SECTION("Rebuilds the new book exactly")
+    {
+        REQUIRE(BBFPatch::apply("patch_old.bbf", "patch.bbfp", "patch_out.bbf"));
+        CHECK(readWholeFile("patch_out.bbf") == readWholeFile("patch_new.bbf"));
+        checkBookHashes("patch_out.bbf", 7, 8);
+        deleteFile("patch_out.bbf");
+    }
 
-    CHECK(footer->assetCount == 1);
-    CHECK(footer->pageCount == 1);
+    SECTION("Refuses the wrong book")
+    {
+        CHECK_FALSE(BBFPatch::apply("patch_new.bbf", "patch.bbfp", "patch_out.bbf"));
+    }
+
+    SECTION("Refuses a damaged patch")
+    {
+        std::vector<uint8_t> patchBytes = readWholeFile("patch.bbfp");
+        patchBytes[sizeof(BBFPatchHeader) + 10] ^= 0x5A;
+        FILE* patchFile = fopen("patch.bbfp", "wb");
+        fwrite(patchBytes.data(), 1, patchBytes.size(), patchFile);
+        fclose(patchFile);
+        CHECK_FALSE(BBFPatch::apply("patch_old.bbf", "patch.bbfp", "patch_out.bbf"));
+    }
+
+    deleteFile("patch_old.bbf");
+    deleteFile("patch_new.bbf");
+    deleteFile("patch.bbfp");
 }
 
-TEST_CASE("BBFReader - Reading Asset Data")
+TEST_CASE("BBFCbz - Import")
 {
-    const std::string content = "THIS_IS_IMAGE_DATA";
-    createTestFileContent("img.png", 100, content);
-    
-    BBFBuilder bbfBuilder(OUTPUT);
-    bbfBuilder.addPage("img.png");
-    bbfBuilder.finalize();
-    deleteFile("img.png");
+    CHECK(BBFCbz::compareNatural("page2.png", "page10.png") < 0);
+    CHECK(BBFCbz::compareNatural("Page10.png", "page9.png") > 0);
+    CHECK(BBFCbz::compareNatural("ch1/p3.png", "ch2/p1.png") < 0);
+
+    // Stored in reverse, so natural order has to put them back
+    std::vector<std::string> pageFiles;
+    int pageIterator = 10;
+    for (; pageIterator >= 1; pageIterator--)
+    {
+        std::string name = "page" + std::to_string(pageIterator) + ".png";
+        createRandomFile(name, 20000 + pageIterator * 100);
+        pageFiles.push_back(name);
+    }
+    createTestFile("ComicInfo.xml", 64, 'x');
+    pageFiles.push_back("ComicInfo.xml");
 
-    BBFReader reader(OUTPUT);
-    BBFHeader* h = reader.getHeaderView();
-    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    int level = GENERATE(0, 6);
+    writeZip("import.cbz", pageFiles, level);
 
-    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
-    REQUIRE(assetTable != nullptr);
+    BBFCbzStats cbzStats;
+    REQUIRE(BBFCbz::importFile("import.cbz", "import.bbf", nullptr, &cbzStats));
+    CHECK(cbzStats.entriesSkipped == 1);
+    CHECK(cbzStats.pagesStored == (level == 0 ? 10u : 0u));
+    CHECK(cbzStats.pagesInflated == (level == 0 ? 0u : 10u));
+    checkBookHashes("import.bbf", 10, 10);
 
-    const BBFAsset* asset = reader.getAssetEntryView((uint8_t*)assetTable, 0);
-    REQUIRE(asset != nullptr);
-    CHECK(asset->fileSize == 100);
+    {
+        BBFReader reader("import.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        const uint8_t* pTable = reader.getPageTableView(f->pageOffset);
+        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+        for (pageIterator = 0; pageIterator < 10; pageIterator++)
+        {
+            std::string name = "page" + std::to_string(pageIterator + 1) + ".png";
+            std::vector<uint8_t> expected = readWholeFile(name.c_str());
+            const BBFAsset* asset = reader.getAssetEntryView(aTable, (int)reader.getPageEntryView(pTable, pageIterator)->assetIndex);
+            REQUIRE(asset->fileSize == expected.size());
+            CHECK(memcmp(reader.getAssetDataView(asset), expected.data(), expected.size()) == 0);
+            CHECK(asset->type == (uint8_t)BBF::BBFMediaType::PNG);
+        }
+    }
 
-    const uint8_t* data = reader.getAssetDataView(asset->fileOffset);
-    REQUIRE(data != nullptr);
+    SECTION("Several at once")
+    {
+        writeZip("import_b.cbz", pageFiles, level);
+        const char* cbzPaths[] = { "import.cbz", "import_b.cbz" };
+        const char* bbfPaths[] = { "import_many_a.bbf", "import_many_b.bbf" };
+        BBFCbzStats manyStats;
+        REQUIRE(BBFCbz::importFiles(cbzPaths, bbfPaths, 2, nullptr, 2, &manyStats));
+        CHECK(manyStats.archivesConverted == 2);
+        CHECK(readWholeFile("import_many_a.bbf") == readWholeFile("import_many_b.bbf"));
+        deleteFile("import_b.cbz");
+        deleteFile("import_many_a.bbf");
+        deleteFile("import_many_b.bbf");
+    }
 
-    CHECK(memcmp(data, content.c_str(), content.length()) == 0);
+    SECTION("Not an archive")
+    {
+        CHECK_FALSE(BBFCbz::importFile("ComicInfo.xml", "import_bad.bbf"));
+        FILE* badBook = fopen("import_bad.bbf", "rb");
+        CHECK(badBook == nullptr);
+        if (badBook) fclose(badBook);
+    }
+
+    for (const std::string& name : pageFiles)
+    {
+        deleteFile(name);
+    }
+    deleteFile("import.cbz");
+    deleteFile("import.bbf");
 }
 
-TEST_CASE("BBFReader - Metadata and Strings")
+TEST_CASE("BBFCbz - Export")
 {
-    BBFBuilder bbfBuilder(OUTPUT);
-
-    createTestFile("test.png", 1024);
-    bbfBuilder.addPage("test.png");
-    deleteFile("test.png");
+    // Slice-by-8 against miniz's CRC, across the 8 byte boundaries
+    std::vector<uint8_t> crcData(1000);
+    size_t byteIterator = 0;
+    for (; byteIterator < crcData.size(); byteIterator++)
+    {
+        crcData[byteIterator] = (uint8_t)(byteIterator * 131 + 7);
+    }
+    size_t crcLength = GENERATE(0u, 1u, 7u, 8u, 9u, 999u);
+    CHECK(BBFCbz::crc32(0, crcData.data(), crcLength) == (uint32_t)mz_crc32(MZ_CRC32_INIT, crcData.data(), crcLength));
+    CHECK(BBFCbz::crc32(BBFCbz::crc32(0, crcData.data(), 5), crcData.data() + 5, 995) == BBFCbz::crc32(0, crcData.data(), 1000));
 
-    bbfBuilder.addMeta("TestKey", "TestVal", "TestParent");
-    bbfBuilder.finalize();
+    createTestBook("export.bbf", 6, 30000);
 
-    BBFReader reader(OUTPUT);
-    BBFHeader* h = reader.getHeaderView();
-    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    BBFCbzExportStats exportStats;
+    REQUIRE(BBFCbz::exportFile("export.bbf", "export.cbz", &exportStats));
+    CHECK(exportStats.pagesWritten == 8);
+    CHECK(exportStats.assetsChecksummed == 7); // The duplicate page is summed once
 
-    REQUIRE(f->metaCount == 1);
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    REQUIRE(mz_zip_reader_init_file(&zip, "export.cbz", 0));
+    REQUIRE(mz_zip_reader_get_num_files(&zip) == 8);
+
+    // Folder per innermost section, numbered in book order
+    char entryName[256];
+    mz_zip_reader_get_filename(&zip, 0, entryName, sizeof(entryName));
+    CHECK(std::string(entryName) == "01 Chapter 1/0001.png");
+    mz_zip_reader_get_filename(&zip, 3, entryName, sizeof(entryName));
+    CHECK(std::string(entryName) == "02 Chapter 2/0004.png");
+    mz_zip_reader_get_filename(&zip, 7, entryName, sizeof(entryName));
+    CHECK(std::string(entryName) == "03 Extras/0008.png");
 
-    const uint8_t* metaTable = reader.getMetadataView(f->metaOffset);
-    REQUIRE(metaTable != nullptr);
+    {
+        BBFReader reader("export.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        const uint8_t* pTable = reader.getPageTableView(f->pageOffset);
+        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
 
-    const BBFMeta* metaEntry = reader.getMetaEntryView((uint8_t*)metaTable, 0);
-    REQUIRE(metaEntry != nullptr);
+        mz_uint entryIterator = 0;
+        for (; entryIterator < 8; entryIterator++)
+        {
+            // miniz checks the CRC on extraction
+            size_t entrySize = 0;
+            void* entryData = mz_zip_reader_extract_to_heap(&zip, entryIterator, &entrySize, 0);
+            REQUIRE(entryData != nullptr);
+            const BBFAsset* asset = reader.getAssetEntryView(aTable, (int)reader.getPageEntryView(pTable, (int)entryIterator)->assetIndex);
+            REQUIRE(entrySize == asset->fileSize);
+            CHECK(memcmp(entryData, reader.getAssetDataView(asset), entrySize) == 0);
+            mz_free(entryData);
+        }
+    }
+    mz_zip_reader_end(&zip);
 
-    const char* key = reader.getStringView(metaEntry->keyOffset);
-    const char* val = reader.getStringView(metaEntry->valueOffset);
-    const char* parent = reader.getStringView(metaEntry->parentOffset);
+    // And back: same pages, sections from the folders
+    REQUIRE(BBFCbz::importFile("export.cbz", "export_back.bbf"));
+    checkBookHashes("export_back.bbf", 7, 8);
+    {
+        BBFReader back("export_back.bbf");
+        uint64_t firstPage = 0;
+        uint64_t pageCount = 0;
+        REQUIRE(back.getSectionPageRange("02 Chapter 2", &firstPage, &pageCount));
+        CHECK(firstPage == 3);
+        CHECK(pageCount == 3);
+    }
 
-    REQUIRE(std::string(key) == "TestKey");
-    REQUIRE(std::string(val) == "TestVal");
-    REQUIRE(std::string(parent) == "TestParent");
+    deleteFile("export.bbf");
+    deleteFile("export.cbz");
+    deleteFile("export_back.bbf");
 }
 
-TEST_CASE("BBFReader - Verify Hashes")
+// One ustar member: header, data, padding to the next block
+static void appendTarMember(std::vector<uint8_t>& tar, const std::string& name, const std::vector<uint8_t>& data, char typeFlag = '0')
 {
-    createTestFile("hash_test.png", 512, 'X'); // Fill with 'X'
-    BBFBuilder builder(OUTPUT);
-    builder.addPage("hash_test.png");
-    builder.finalize();
-    deleteFile("hash_test.png");
-
-    BBFReader reader(OUTPUT);
-    BBFHeader* h = reader.getHeaderView();
-    BBFFooter* f = reader.getFooterView(h->footerOffset);
-    const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
-    const BBFAsset* asset = reader.getAssetEntryView((uint8_t*)aTable, 0);
-
-    XXH128_hash_t calcHash = reader.computeAssetHash(asset);
+    uint8_t header[512] = {};
+    memcpy(header, name.c_str(), name.size());
+    memcpy(header + 100, "0000644", 8);
+    snprintf((char*)header + 124, 12, "%011llo", (unsigned long long)data.size());
+    header[156] = (uint8_t)typeFlag;
+    memcpy(header + 257, "ustar\0" "00", 8);
+
+    memset(header + 148, ' ', 8);
+    unsigned int checksum = 0;
+    for (uint8_t headerByte : header)
+    {
+        checksum += headerByte;
+    }
+    snprintf((char*)header + 148, 8, "%06o", checksum);
 
-    REQUIRE(calcHash.low64 == asset->assetHash[0]);
-    REQUIRE(calcHash.high64 == asset->assetHash[1]);
+    tar.insert(tar.end(), header, header + 512);
+    tar.insert(tar.end(), data.begin(), data.end());
+    tar.resize((tar.size() + 511) & ~(size_t)511, 0);
 }
 
-TEST_CASE("BBFReader - Check Bounds")
+TEST_CASE("BBFTar - Import")
 {
-    BBFBuilder builder(OUTPUT);
-    createTestFile("test.png", 10);
-    builder.addPage("test.png"); 
-    builder.finalize();
-    deleteFile("test.png");
-
-    BBFReader reader(OUTPUT);
-    BBFHeader* h = reader.getHeaderView();
-    BBFFooter* f = reader.getFooterView(h->footerOffset);
-    
-    SECTION("Invalid Footer Offset")
+    std::mt19937 rng(50);
+    std::vector<std::vector<uint8_t>> pages(4);
+    for (std::vector<uint8_t>& page : pages)
     {
-        CHECK(reader.getFooterView(99999999) == nullptr);
+        page.resize(10000 + rng() % 5000);
+        for (uint8_t& pageByte : page)
+        {
+            pageByte = (uint8_t)rng();
+        }
     }
 
-    SECTION("Asset Index Out of Bounds") 
+    // Two folders, a duplicate, a text file, and a pax path too long for the ustar header
+    std::string longName = "./v2/" + std::string(150, 'l') + ".png";
+    std::string paxRecord = "path=" + longName + "\n";
+    std::string paxLength = std::to_string(paxRecord.size() + 4);
+    paxRecord = paxLength + " " + paxRecord;
+
+    std::vector<uint8_t> tar;
+    appendTarMember(tar, "./v1/", {}, '5');
+    appendTarMember(tar, "./v1/p1.png", pages[0]);
+    appendTarMember(tar, "./v1/p2.png", pages[1]);
+    appendTarMember(tar, "./v1/p3.png", pages[2]);
+    appendTarMember(tar, "./v2/p1.png", pages[1]);
+    appendTarMember(tar, "./v2/notes.txt", std::vector<uint8_t>(100, 'n'));
+    appendTarMember(tar, "PaxHeaders/long", std::vector<uint8_t>(paxRecord.begin(), paxRecord.end()), 'x');
+    appendTarMember(tar, "ignored.bin", pages[3]);
+    tar.resize(tar.size() + 1024, 0);
+
     {
-        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
-        CHECK_FALSE(reader.getAssetEntryView((uint8_t*)aTable, 1) == nullptr);
-        CHECK(reader.getAssetEntryView((uint8_t*)aTable, -1) == nullptr);
+        std::ofstream tarFile("import.tar", std::ios::binary);
+        tarFile.write((const char*)tar.data(), (std::streamsize)tar.size());
     }
 
-    SECTION("Invalid String Offset") 
+    FILE* tarStream = fopen("import.tar", "rb");
+    REQUIRE(tarStream != nullptr);
+    BBFTarStats tarStats;
+    bool importOk = BBFTar::importStream(tarStream, "import.tar", "import_tar.bbf", nullptr, &tarStats);
+    fclose(tarStream);
+    REQUIRE(importOk);
+
+    CHECK(tarStats.membersRead == 8);
+    CHECK(tarStats.pagesAdded == 5);
+    CHECK(tarStats.membersSkipped == 3);
+    CHECK(tarStats.bytesRead == tar.size() - 512); // Stops at the first zero block
+    checkBookHashes("import_tar.bbf", 4, 5);
+
     {
-        CHECK(reader.getStringView(99999999) == nullptr);
+        BBFReader reader("import_tar.bbf");
+        BBFHeader* h = reader.getHeaderView();
+        BBFFooter* f = reader.getFooterView(h->footerOffset);
+        const uint8_t* pTable = reader.getPageTableView(f->pageOffset);
+        const uint8_t* aTable = reader.getAssetTableView(f->assetOffset);
+        const int expectedPages[] = { 0, 1, 2, 1, 3 };
+        int pageIterator = 0;
+        for (; pageIterator < 5; pageIterator++)
+        {
+            const std::vector<uint8_t>& expected = pages[expectedPages[pageIterator]];
+            const BBFAsset* asset = reader.getAssetEntryView(aTable, (int)reader.getPageEntryView(pTable, pageIterator)->assetIndex);
+            REQUIRE(asset->fileSize == expected.size());
+            CHECK(memcmp(reader.getAssetDataView(asset), expected.data(), expected.size()) == 0);
+            CHECK(asset->type == (uint8_t)BBF::BBFMediaType::PNG);
+        }
+
+        REQUIRE(f->sectionCount == 2);
+        const uint8_t* sTable = reader.getSectionTableView(f->sectionOffset);
+        CHECK(std::string(reader.getStringView(reader.getSectionEntryView(sTable, 0)->sectionTitleOffset)) == "v1");
+        CHECK(reader.getSectionEntryView(sTable, 0)->sectionStartIndex == 0);
+        CHECK(std::string(reader.getStringView(reader.getSectionEntryView(sTable, 1)->sectionTitleOffset)) == "v2");
+        CHECK(reader.getSectionEntryView(sTable, 1)->sectionStartIndex == 3);
     }
 
-    SECTION("Invalid Data View") 
+    SECTION("Stream cut short")
     {
-        CHECK(reader.getAssetDataView(99999999) == nullptr);
+        {
+            std::ofstream tarFile("import_cut.tar", std::ios::binary);
+            tarFile.write((const char*)tar.data(), 3000);
+        }
+        CHECK_FALSE(BBFTar::importFile("import_cut.tar", "import_cut.bbf"));
+        FILE* badBook = fopen("import_cut.bbf", "rb");
+        CHECK(badBook == nullptr);
+        if (badBook) fclose(badBook);
+        deleteFile("import_cut.tar");
     }
-}
 
+    deleteFile("import.tar");
+    deleteFile("import_tar.bbf");
+}
 
 // Performance
 TEST_CASE("Performance Benchmarks", "[Benchmark]")
@@ -737,3 +2962,304 @@ TEST_CASE("BBF versus ZIP Benchmarks", "[Compmark]")
     deleteFile("bench_batch.zip");
     deleteFile("bench_batch_petrified.bbf");
 }
+
+// Read a recorded page trace (whitespace separated page indices)
+std::vector<uint64_t> loadTrace(const std::string& tracePath)
+{
+    std::vector<uint64_t> trace;
+    std::ifstream iF(tracePath);
+    uint64_t pageIndex = 0;
+    while (iF >> pageIndex)
+    {
+        trace.push_back(pageIndex);
+    }
+    return trace;
+}
+
+// Drop the book from the page cache so every replay starts cold.
+void dropFileCache(const char* fileName)
+{
+    #ifndef _WIN32
+    int fd = open(fileName, O_RDONLY);
+    if (fd != -1)
+    {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+    #endif
+}
+
+uint64_t replayTrace(BBFReader& reader, const std::vector<uint64_t>& trace, BBFReadSession* session)
+{
+    BBFHeader* h = reader.getHeaderView();
+    BBFFooter* f = reader.getFooterView(h->footerOffset);
+    const uint8_t* pageTable = reader.getPageTableView(f->pageOffset);
+    const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+
+    // Touch every 4K of each page, like a decoder would.
+    uint64_t checksum = 0;
+    for (uint64_t pageIndex : trace)
+    {
+        if (session)
+        {
+            session->onPageAccess(pageIndex);
+        }
+
+        const BBFPage* page = reader.getPageEntryView(pageTable, (int)pageIndex);
+        const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)page->assetIndex);
+        const uint8_t* data = reader.getAssetDataView(asset->fileOffset);
+
+        for (uint64_t byteIterator = 0; byteIterator < asset->fileSize; byteIterator += 4096)
+        {
+            checksum += data[byteIterator];
+        }
+    }
+    return checksum;
+}
+
+// Replays page traces with and without a BBFReadSession.
+// Set BBF_TRACE=<file> to replay a trace recorded from a real reader.
+TEST_CASE("Read Session Replay Benchmarks", "[Sessionmark]")
+{
+    const char* sessionBook = "session_bench.bbf";
+    const int PAGE_COUNT = 240;
+    createTestBook(sessionBook, PAGE_COUNT, 512 * 1024);
+
+    std::vector<std::pair<std::string, std::vector<uint64_t>>> traces;
+
+    // Straight read with the odd look back
+    std::vector<uint64_t> linear;
+    for (uint64_t pageIndex = 0; pageIndex < (uint64_t)PAGE_COUNT; ++pageIndex)
+    {
+        linear.push_back(pageIndex);
+        if (pageIndex % 17 == 16)
+        {
+            linear.push_back(pageIndex - 1);
+            linear.push_back(pageIndex);
+        }
+    }
+    traces.push_back({"Linear", linear});
+
+    // Skim a chapter backwards, then jump around the book
+    std::vector<uint64_t> browse;
+    for (uint64_t pageIndex = PAGE_COUNT / 2; pageIndex > PAGE_COUNT / 4; --pageIndex)
+    {
+        browse.push_back(pageIndex);
+    }
+    std::mt19937 gen(1500);
+    for (int jumpIterator = 0; jumpIterator < 8; ++jumpIterator)
+    {
+        uint64_t start = gen() % (PAGE_COUNT - 10);
+        for (uint64_t pageIndex = start; pageIndex < start + 10; ++pageIndex)
+        {
+            browse.push_back(pageIndex);
+        }
+    }
+    traces.push_back({"Browse", browse});
+
+    if (const char* tracePath = std::getenv("BBF_TRACE"))
+    {
+        std::vector<uint64_t> recorded = loadTrace(tracePath);
+        recorded.erase(std::remove_if(recorded.begin(), recorded.end(), [&](uint64_t p) { return p >= (uint64_t)PAGE_COUNT; }), recorded.end());
+        traces.push_back({"Recorded", recorded});
+    }
+
+    for (const auto& trace : traces)
+    {
+        BENCHMARK_ADVANCED("Replay " + trace.first + " (mmap only)")(Catch::Benchmark::Chronometer meter)
+        {
+            meter.measure([&]
+            {
+                dropFileCache(sessionBook);
+                BBFReader reader(sessionBook);
+                return replayTrace(reader, trace.second, nullptr);
+            });
+        };
+
+        BENCHMARK_ADVANCED("Replay " + trace.first + " (BBFReadSession)")(Catch::Benchmark::Chronometer meter)
+        {
+            meter.measure([&]
+            {
+                dropFileCache(sessionBook);
+                BBFReader reader(sessionBook);
+                BBFReadSession session(&reader);
+                return replayTrace(reader, trace.second, &session);
+            });
+        };
+    }
+
+    deleteFile(sessionBook);
+}
+
+struct AsyncBenchState
+{
+    uint64_t checksum;
+    std::vector<uint8_t*> freeBuffers;
+};
+
+static void countFetched(void* userData, uint64_t assetIndex, uint8_t* buffer, int64_t result)
+{
+    (void)assetIndex;
+    AsyncBenchState* state = (AsyncBenchState*)userData;
+    state->checksum += (result > 0) ? XXH3_64bits(buffer, (size_t)result) : 0;
+    state->freeBuffers.push_back(buffer);
+}
+
+TEST_CASE("Async Fetch Benchmarks", "[Asyncmark]")
+{
+    const char* asyncBook = "async_bench.bbf";
+    const int PAGE_COUNT = 512;
+    const uint32_t QUEUE_DEPTH = 64;
+    createTestBook(asyncBook, PAGE_COUNT, 256 * 1024);
+
+    // Random page order, cold cache, like a server answering many readers at once
+    std::vector<uint64_t> order(PAGE_COUNT);
+    for (uint64_t pageIndex = 0; pageIndex < (uint64_t)PAGE_COUNT; ++pageIndex)
+    {
+        order[pageIndex] = pageIndex;
+    }
+    std::mt19937 gen(3400);
+    std::shuffle(order.begin(), order.end(), gen);
+
+    BENCHMARK_ADVANCED("Cold random pages (mmap)")(Catch::Benchmark::Chronometer meter)
+    {
+        meter.measure([&]
+        {
+            dropFileCache(asyncBook);
+            BBFReader reader(asyncBook);
+            BBFFooter* f = reader.getFooterView(reader.getHeaderView()->footerOffset);
+            const uint8_t* pageTable = reader.getPageTableView(f->pageOffset);
+            const uint8_t* assetTable = reader.getAssetTableView(f->assetOffset);
+
+            uint64_t checksum = 0;
+            for (uint64_t pageIndex : order)
+            {
+                const BBFPage* page = reader.getPageEntryView(pageTable, (int)pageIndex);
+                const BBFAsset* asset = reader.getAssetEntryView(assetTable, (int)page->assetIndex);
+                checksum += XXH3_64bits(reader.getAssetDataView(asset), (size_t)asset->fileSize);
+            }
+            return checksum;
+        });
+    };
+
+    for (int ringIterator = 0; ringIterator < 2; ++ringIterator)
+    {
+        bool useRing = (ringIterator == 0);
+        BENCHMARK_ADVANCED(std::string("Cold random pages (async, ") + (useRing ? "io_uring" : "threads") + ")")(Catch::Benchmark::Chronometer meter)
+        {
+            BBFAsyncFetcher fetcher(QUEUE_DEPTH, 8, useRing);
+            std::vector<std::vector<uint8_t>> buffers(QUEUE_DEPTH, std::vector<uint8_t>(256 * 1024));
+
+            meter.measure([&]
+            {
+                dropFileCache(asyncBook);
+                BBFReader reader(asyncBook);
+                BBFFooter* f = reader.getFooterView(reader.getHeaderView()->footerOffset);
+                const uint8_t* pageTable = reader.getPageTableView(f->pageOffset);
+
+                // Keep the queue full. Buffers come back through the callback once reported.
+                AsyncBenchState state;
+                state.checksum = 0;
+                for (auto& buffer : buffers)
+                {
+                    state.freeBuffers.push_back(buffer.data());
+                }
+
+                for (uint64_t pageIndex : order)
+                {
+                    const BBFPage* page = reader.getPageEntryView(pageTable, (int)pageIndex);
+                    while (state.freeBuffers.empty())
+                    {
+                        fetcher.poll(1);
+                    }
+                    uint8_t* buffer = state.freeBuffers.back();
+                    state.freeBuffers.pop_back();
+                    fetcher.fetchAsset(&reader, page->assetIndex, buffer, 256 * 1024, countFetched, &state);
+                }
+                while (fetcher.getInFlight() > 0)
+                {
+                    fetcher.poll(1);
+                }
+                return state.checksum;
+            });
+        };
+    }
+
+    deleteFile(asyncBook);
+}
+
+#ifdef __linux__
+TEST_CASE("Page Server Load Benchmark", "[Servemark]")
+{
+    const char* serveDir = "servemark_books";
+    const int PAGE_COUNT = 200;
+    const int CLIENT_COUNT = 16;
+    const int REQUESTS_PER_CLIENT = 2000;
+
+    mkdir(serveDir, 0755);
+    createTestBook("servemark_books/load.bbf", PAGE_COUNT, 128 * 1024);
+
+    BBFServerConfig serverConfig;
+    serverConfig.bookDir = serveDir;
+    serverConfig.port = 0;
+    serverConfig.workerCount = 8;
+
+    BBFServer server(serverConfig);
+    REQUIRE(server.start());
+
+    // Keep-alive clients hammering random pages
+    std::vector<std::vector<double>> latencies(CLIENT_COUNT);
+    std::vector<int> failures(CLIENT_COUNT, 0);
+    std::vector<std::thread> clients;
+
+    auto loadStart = std::chrono::steady_clock::now();
+    for (int clientIterator = 0; clientIterator < CLIENT_COUNT; ++clientIterator)
+    {
+        clients.emplace_back([&, clientIterator]
+        {
+            std::mt19937 gen(clientIterator);
+            int socketFd = connectLoopback(server.getPort());
+            std::string headers;
+            std::vector<uint8_t> body;
+
+            for (int requestIterator = 0; requestIterator < REQUESTS_PER_CLIENT; ++requestIterator)
+            {
+                std::string path = "/load.bbf/page/" + std::to_string(gen() % PAGE_COUNT);
+                auto requestStart = std::chrono::steady_clock::now();
+                if (httpGet(socketFd, path, "", &headers, &body) != 200)
+                {
+                    failures[clientIterator]++;
+                    break;
+                }
+                latencies[clientIterator].push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - requestStart).count());
+            }
+            close(socketFd);
+        });
+    }
+
+    for (auto& client : clients)
+    {
+        client.join();
+    }
+    double loadSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - loadStart).count();
+
+    std::vector<double> allLatencies;
+    for (auto& clientLatencies : latencies)
+    {
+        allLatencies.insert(allLatencies.end(), clientLatencies.begin(), clientLatencies.end());
+    }
+    std::sort(allLatencies.begin(), allLatencies.end());
+
+    CHECK(std::count(failures.begin(), failures.end(), 0) == CLIENT_COUNT);
+    REQUIRE(!allLatencies.empty());
+
+    printf("[Servemark] %d clients, %zu requests of 128 KiB pages\n", CLIENT_COUNT, allLatencies.size());
+    printf("[Servemark] %.0f req/s, p50 %.0f us, p99 %.0f us\n", allLatencies.size() / loadSeconds,
+        allLatencies[allLatencies.size() / 2], allLatencies[(allLatencies.size() * 99) / 100]);
+
+    server.stop();
+    server.wait();
+    deleteFile("servemark_books/load.bbf");
+    rmdir(serveDir);
+}
+#endif
@@ -5,6 +5,7 @@
 extern "C"
 {
     LIBBBF_API BBFReader* create_bbf_reader(const char* file) { return new BBFReader(file); }
+    LIBBBF_API BBFReader* create_bbf_reader_from_buffer(const uint8_t* data, size_t size) { return new BBFReader(data, size); }
     LIBBBF_API void close_bbf_reader(BBFReader* bbfreader) { if (bbfreader) delete bbfreader; }
 
     LIBBBF_API BBFHeader* get_bbf_header(BBFReader* bbfreader) { return bbfreader ? bbfreader->getHeaderView() : nullptr; }
@@ -116,12 +116,16 @@ namespace BBF
 
     // Muxer Constants
     constexpr static uint32_t DEFAULT_GUARD_ALIGNMENT = 12; // pow2. Boundary size (Alignment) [4096]
+    constexpr static uint32_t MAX_GUARD_ALIGNMENT = 24; // pow2. Largest alignment petrify will pad to [16MB]
+    constexpr static uint64_t PETRIFY_BLOCK_SIZE = 16777216; // In-place petrify moves data this many bytes at a time. [16MB]
     constexpr static uint64_t DEFAULT_SMALL_REAM_THRESHOLD = 16; // Pow 2. Small ream threshold (Group of pages) for Variable Alignment. [65536]
     
     // Reader constants
     constexpr static uint64_t MAX_BALE_SIZE = 16000000; // Maximum number of bytes the index region must be before we get suspicious.
     //constexpr static uint8_t MAX_METADATA_DEPTH = 256; // So we don't go crazy while checking metadata entries
     constexpr static uint64_t MAX_FORME_SIZE = 2048; // Maximum string length in the string pool
+    constexpr static uint64_t MAX_PREFETCH_GAP = 65536; // Prefetch ranges closer than this many bytes get merged.
+    constexpr static uint64_t WARM_CHUNK_SIZE = 1048576; // warm() splits ranges into reads of this size.
     
 
     enum class BBFMediaType: uint8_t
@@ -137,6 +141,14 @@ namespace BBF
         JPG = 0x09
     };
 
+    // Access pattern hints for the asset data region (madvise)
+    enum class BBFAccessPattern: uint8_t
+    {
+        NORMAL = 0x00,
+        SEQUENTIAL = 0x01,
+        RANDOM = 0x02
+    };
+
     // BBF Version
     constexpr static uint16_t VERSION = 3;
 }
@@ -1,5 +1,10 @@
 #include "libbbf.h"
 #include "bbfcodec.h"
+#include "bbfserve.h"
+#include "bbfcatalog.h"
+#include "bbfpatch.h"
+#include "bbfcbz.h"
+#include "bbftar.h"
 #include "xxhash.h"
 
 #include <stdio.h>
@@ -12,6 +17,7 @@
 #else
 #include <dirent.h>
 #include <string.h>
+#include <signal.h>
 #endif
 
 #define MAX_ENTRIES 256 // Not using vector.
@@ -205,6 +211,16 @@ const char* helpText =
 "  --verify     Validate XXH3-128/64 hashes\n"
 "  --extract    Unpack contents to disk\n"
 "  --petrify    Linearize BBF file for faster reading\n"
+"  --serve      Serve a folder of BBF files over HTTP\n"
+"  --catalog    Catalog a folder of BBF files (<DIR> <OUT.bbfcat>)\n"
+"  --repack     Rewrite a BBF with a new layout (<IN.bbf> <OUT.bbf>)\n"
+"  --merge      Merge BBF files into one (<A.bbf> <B.bbf>... -o <OUT.bbf>)\n"
+"  --split      Split a BBF into one book per section (<IN.bbf> [OUT_DIR])\n"
+"  --diff       Patch from one revision to the next (<OLD.bbf> <NEW.bbf> -o <OUT.bbfp>)\n"
+"  --patch      Apply a patch (<OLD.bbf> <PATCH.bbfp> -o <NEW.bbf>)\n"
+"  --from-cbz   Convert CBZ archives (<IN.cbz> <OUT.bbf>, or <A.cbz>... --outdir=DIR)\n"
+"  --to-cbz     Export a BBF as a stored CBZ (<IN.bbf> <OUT.cbz|->)\n"
+"  --from-tar   Mux a tar stream, page by page as it arrives (<IN.tar|-> <OUT.bbf>)\n"
 "\n"
 "MUXER OPTIONS:\n"
 "  --meta=K:V[:P]         Add metadata (Key:Value[:Parent])\n"
@@ -224,9 +240,53 @@ const char* helpText =
 "  --write-meta[=F]    Dump metadata to file [default: path.txt]\n"
 "  --write-hashes[=F]  Dump hashes to file [default: hashes.txt]\n"
 "\n"
+"SERVE OPTIONS:\n"
+"  --port=<N>          Listen on port N [default: 8080]\n"
+"  --bind=<ADDR>       Listen on address [default: 127.0.0.1]\n"
+"  --threads=<N>       Worker threads [default: 4]\n"
+"\n"
+"PETRIFY OPTIONS:\n"
+"  --petrify=<OUT>     Write the petrified copy to OUT\n"
+"  --in-place          Petrify the file itself, no second copy (resumable)\n"
+"\n"
+"REPACK OPTIONS:\n"
+"  --alignment, --ream-size, --variable-ream-size   New layout, as when muxing\n"
+"  --petrify           Petrify the result\n"
+"  Unused assets are dropped and duplicates merged. Stored hashes are reused.\n"
+"\n"
+"MERGE OPTIONS:\n"
+"  -o, --output=<FILE>  Output book\n"
+"  --alignment, --ream-size, --variable-ream-size, --petrify   As for --repack\n"
+"  Each input becomes a top level section, named by its Title (or file name).\n"
+"\n"
+"DIFF / PATCH OPTIONS:\n"
+"  -o, --output=<FILE>  Patch (--diff) or rebuilt book (--patch). Can be the old book.\n"
+"  Unchanged assets are matched by hash and copied from the old book.\n"
+"\n"
+"FROM-CBZ OPTIONS:\n"
+"  --outdir=<PATH>     Convert every input to PATH/<name>.bbf\n"
+"  --threads=<N>       Archives converted at once [default: 4]\n"
+"  --zip-order         Keep the archive's page order [default: natural sort]\n"
+"  --alignment, --ream-size, --variable-ream-size   As when muxing\n"
+"\n"
+"FROM-TAR OPTIONS:\n"
+"  - reads stdin, e.g. tar -cf - pages/ | bbfmux --from-tar - book.bbf\n"
+"  Pages keep the stream's order. Folders become sections.\n"
+"  --alignment, --ream-size, --variable-ream-size   As when muxing\n"
+"\n"
+"SPLIT OPTIONS:\n"
+"  --by-section[=N]    Split at section depth N [default: 1, top level]\n"
+"  --outdir=<PATH>     Write <Section Title>.bbf files here [default: .]\n"
+"  --threads=<N>       Books written at once [default: 4]\n"
+"\n"
+"CATALOG OPTIONS:\n"
+"  --threads=<N>       Probe threads [default: 8]\n"
+"  An existing catalog is refreshed: only new or changed books are read.\n"
+"\n"
 // --footer hash isn't done yet.
 "INFO FLAGS:\n"
 "  --hashes, --footer, --sections, --counts, --header, --metadata, --offsets\n"
+"  --residency         Page cache residency per section (and per page with --pages)\n"
 "\n"
 "NOTE: Use '%c' as delimiter on this system.\n";
 
@@ -247,6 +307,8 @@ struct Section
 struct Config 
 {
     char* bbfFolder;
+    char* inputFiles[MAX_ENTRIES]; // Every positional argument
+    uint64_t inputCount;
 
     char* sectionBlock;
     char* metaBlock;
@@ -258,7 +320,17 @@ struct Config
         INFO,
         VERIFY,
         PETRIFY,
-        EXTRACT 
+        EXTRACT,
+        SERVE,
+        CATALOG,
+        REPACK,
+        MERGE,
+        SPLIT,
+        DIFF,
+        PATCH,
+        FROM_CBZ,
+        TO_CBZ,
+        FROM_TAR
     } mode;
     
     // Global Mux Settings
@@ -283,8 +355,51 @@ struct Config
         struct 
         {
             char* outputFile;
+            bool inPlace;
         } petrify;
 
+        struct
+        {
+            char* bindAddress;
+            uint16_t port;
+            uint32_t threads;
+        } serve;
+
+        struct
+        {
+            uint32_t threads;
+        } catalog;
+
+        struct
+        {
+            bool petrify;
+        } repack;
+
+        struct
+        {
+            char* outputFile;
+            bool petrify;
+        } merge;
+
+        struct
+        {
+            char* outdir;
+            uint32_t depth;
+            uint32_t threads;
+        } split;
+
+        struct
+        {
+            char* outputFile;
+        } patch;
+
+        struct
+        {
+            char* outdir;
+            uint32_t threads;
+            bool archiveOrder;
+        } cbz;
+
         struct 
         {
             char* sectionName;
@@ -315,6 +430,7 @@ struct Config
             bool showFooter;
             bool showStringPool;
             bool showOffsets;
+            bool showResidency;
         } info;
     };
 };
@@ -335,8 +451,14 @@ int main(int argc, char** argv)
     {
         char* arg = argv[iterator];
 
-        if (*arg != '-') 
+        // A lone '-' is stdin/stdout, not an option
+        if (*arg != '-' || arg[1] == '\0') 
         {
+            if (cfg.inputCount < MAX_ENTRIES)
+            {
+                cfg.inputFiles[cfg.inputCount++] = arg;
+            }
+
             if (cfg.bbfFolder == nullptr) 
             {
                 cfg.bbfFolder = arg;
@@ -366,9 +488,67 @@ int main(int argc, char** argv)
                 cfg.mode = Config::VERIFY;
                 break;
             case val32("--petrify"): 
+                // Repack can petrify its output
+                if (cfg.mode == Config::REPACK)
+                {
+                    cfg.repack.petrify = true;
+                    break;
+                }
+                if (cfg.mode == Config::MERGE)
+                {
+                    cfg.merge.petrify = true;
+                    break;
+                }
                 cfg.mode = Config::PETRIFY; 
                 if (*val) cfg.petrify.outputFile = val;
                 break;
+            case val32("--merge"):
+                cfg.mode = Config::MERGE;
+                break;
+            case val32("-o"):
+            case val32("--output"):
+            {
+                char* outPath = *val ? val : ((iterator + 1 < argc) ? argv[++iterator] : nullptr);
+                if (cfg.mode == Config::MERGE) cfg.merge.outputFile = outPath;
+                else if (cfg.mode == Config::DIFF || cfg.mode == Config::PATCH) cfg.patch.outputFile = outPath;
+                else cfg.muxer.outputFile = outPath;
+                break;
+            }
+            case val32("--diff"):
+                cfg.mode = Config::DIFF;
+                break;
+            case val32("--patch"):
+                cfg.mode = Config::PATCH;
+                break;
+            case val32("--from-cbz"):
+                cfg.mode = Config::FROM_CBZ;
+                break;
+            case val32("--to-cbz"):
+                cfg.mode = Config::TO_CBZ;
+                break;
+            case val32("--from-tar"):
+                cfg.mode = Config::FROM_TAR;
+                break;
+            case val32("--zip-order"): cfg.cbz.archiveOrder = true; break;
+            case val32("--split"):
+                cfg.mode = Config::SPLIT;
+                break;
+            case val32("--by-section"):
+                cfg.mode = Config::SPLIT;
+                if (*val) cfg.split.depth = (uint32_t)atoi(val);
+                break;
+            case val32("--repack"):
+                if (cfg.mode == Config::PETRIFY) cfg.repack.petrify = true;
+                cfg.mode = Config::REPACK;
+                break;
+            case val32("--serve"):
+                cfg.mode = Config::SERVE;
+                if (*val) cfg.bbfFolder = val;
+                break;
+            case val32("--catalog"):
+                cfg.mode = Config::CATALOG;
+                if (*val) cfg.bbfFolder = val;
+                break;
 
             case val32("--help"): 
                 printf(helpText, DELIMETER); 
@@ -428,7 +608,11 @@ int main(int argc, char** argv)
             case val32("--rangekey"):     cfg.extract.rangeKey = val; break;
             case val32("--write-meta"):   cfg.extract.metaOut = *val ? val : (char*)"path.txt"; break;
             case val32("--write-hashes"): cfg.extract.hashOut = *val ? val : (char*)"hashes.txt"; break;
-            case val32("--outdir"): cfg.extract.outdir = val; break;
+            case val32("--outdir"):
+                if (cfg.mode == Config::SPLIT) cfg.split.outdir = val;
+                else if (cfg.mode == Config::FROM_CBZ) cfg.cbz.outdir = val;
+                else cfg.extract.outdir = val;
+                break;
             // Extract + verify
             case val32("--asset"): 
                 if (cfg.mode == Config::EXTRACT) cfg.extract.assetIndex = (uint64_t)atoi(val);
@@ -445,6 +629,19 @@ int main(int argc, char** argv)
             case val32("--footer"):   cfg.info.showFooter = true; break;
             case val32("--strings"):  cfg.info.showStringPool = true; break;
             case val32("--offsets"):  cfg.info.showOffsets = true; break;
+            case val32("--residency"): cfg.info.showResidency = true; break;
+
+            case val32("--in-place"): cfg.petrify.inPlace = true; break;
+
+            // serve exclusive args
+            case val32("--port"):    cfg.serve.port = (uint16_t)atoi(val); break;
+            case val32("--bind"):    cfg.serve.bindAddress = val; break;
+            case val32("--threads"):
+                if (cfg.mode == Config::CATALOG) cfg.catalog.threads = (uint32_t)atoi(val);
+                else if (cfg.mode == Config::SPLIT) cfg.split.threads = (uint32_t)atoi(val);
+                else if (cfg.mode == Config::FROM_CBZ) cfg.cbz.threads = (uint32_t)atoi(val);
+                else cfg.serve.threads = (uint32_t)atoi(val);
+                break;
         }
     }
 
@@ -672,6 +869,9 @@ int main(int argc, char** argv)
             printf("Ream Size:    %u (Pow2) -> %u bytes\n", pHeader->reamSize, (1 << pHeader->reamSize));
             printf("Footer Offset:   %" PRIu64 "\n", pHeader->footerOffset);
 
+            uint64_t misalignedCount = bbfReader.findMisalignedAssets(nullptr, 0);
+            printf("Misaligned:   %" PRIu64 " assets\n", misalignedCount);
+
             // free
             pHeader = nullptr;
         }
@@ -851,19 +1051,73 @@ int main(int argc, char** argv)
             assetTable = nullptr;
         }
 
+        if (cfg.info.showResidency)
+        {
+            BBFResidencyReport report;
+            if (!bbfReader.residency(&report))
+            {
+                printf("[BBFMUX] Unable to read page cache residency.\n");
+                return 1;
+            }
+
+            printf("\n=== Residency ===\n");
+            printf("Book: %" PRIu64 " / %" PRIu64 " bytes (%.1f%%)\n", report.residentBytes, report.totalBytes,
+                report.totalBytes ? 100.0 * (double)report.residentBytes / (double)report.totalBytes : 0.0);
+
+            const uint8_t* sectionTable = bbfReader.getSectionTableView(pFooter->sectionOffset);
+            uint64_t sectionIterator = 0;
+            for (; sectionIterator < report.sectionCount; sectionIterator++)
+            {
+                const BBFSection* section = bbfReader.getSectionEntryView(sectionTable, (int)sectionIterator);
+                const char* sectionName = section ? bbfReader.getStringView(section->sectionTitleOffset) : nullptr;
+
+                printf("  %-24s %12" PRIu64 " / %-12" PRIu64 " (%.1f%%)\n", sectionName ? sectionName : "<CORRUPT KEY>",
+                    report.sectionResident[sectionIterator], report.sectionBytes[sectionIterator],
+                    report.sectionBytes[sectionIterator] ? 100.0 * (double)report.sectionResident[sectionIterator] / (double)report.sectionBytes[sectionIterator] : 0.0);
+            }
+
+            if (cfg.info.showPages)
+            {
+                printf("Page | Resident     | Size\n");
+                printf("-----|--------------|-------------\n");
+                uint64_t pageIterator = 0;
+                for (; pageIterator < report.pageCount; pageIterator++)
+                {
+                    printf("%4" PRIu64 " | %12" PRIu64 " | %12" PRIu64 "\n", pageIterator, report.pageResident[pageIterator], report.pageBytes[pageIterator]);
+                }
+            }
+
+            BBFReader::freeResidencyReport(&report);
+        }
+
     }
 
     if (cfg.mode == Config::PETRIFY)
     {
 
-        if (!cfg.petrify.outputFile)
+        bool petSuccess = false;
+        if (cfg.petrify.inPlace)
         {
-            printf("[BBFMUX] No file selected for petrification.\n");
-            return 1;
+            printf("[BBFMUX] Petrifying %s in place...\n", cfg.bbfFolder);
+            petSuccess = BBFBuilder::petrifyInPlace(cfg.bbfFolder);
+        }
+        else
+        {
+            if (!cfg.petrify.outputFile)
+            {
+                printf("[BBFMUX] No file selected for petrification.\n");
+                return 1;
+            }
+
+            printf("[BBFMUX] Petrifying %s to %s...\n", cfg.bbfFolder, cfg.petrify.outputFile);
+            BBFCopyStats copyStats;
+            petSuccess = BBFBuilder::petrifyFile(cfg.bbfFolder, cfg.petrify.outputFile, &copyStats);
+            if (petSuccess)
+            {
+                printf("[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n", copyStats.reflinkBytes, copyStats.kernelBytes, copyStats.bufferedBytes);
+            }
         }
 
-        printf("[BBFMUX] Petrifying %s to %s...\n", cfg.bbfFolder, cfg.petrify.outputFile);
-        bool petSuccess = BBFBuilder::petrifyFile(cfg.bbfFolder, cfg.petrify.outputFile);
         if (petSuccess)
         {
             printf("[BBFMUX] Success.\n");
@@ -877,6 +1131,393 @@ int main(int argc, char** argv)
     }
 
 
+    if (cfg.mode == Config::SERVE)
+    {
+    #ifndef __linux__
+        printf("[BBFMUX] --serve needs Linux (epoll).\n");
+        return 1;
+    #else
+        if (!cfg.bbfFolder)
+        {
+            printf("[BBFMUX] No folder selected to serve.\n");
+            return 1;
+        }
+
+        BBFServerConfig serverConfig;
+        serverConfig.bookDir = cfg.bbfFolder;
+        serverConfig.port = cfg.serve.port ? cfg.serve.port : 8080;
+        serverConfig.workerCount = cfg.serve.threads ? cfg.serve.threads : 4;
+        if (cfg.serve.bindAddress) serverConfig.bindAddress = cfg.serve.bindAddress;
+
+        static BBFServer* activeServer = nullptr;
+        BBFServer server(serverConfig);
+        if (!server.start())
+        {
+            printf("[BBFMUX] Failed to start server.\n");
+            return 1;
+        }
+
+        // Ctrl+C stops cleanly
+        activeServer = &server;
+        signal(SIGINT, [](int) { activeServer->stop(); });
+        signal(SIGTERM, [](int) { activeServer->stop(); });
+
+        printf("[BBFMUX] Serving %s on http://%s:%u/\n", cfg.bbfFolder, serverConfig.bindAddress, (unsigned)server.getPort());
+        server.wait();
+        printf("[BBFMUX] Stopped after %" PRIu64 " requests.\n", server.getRequestCount());
+        return 0;
+    #endif
+    }
+
+    if (cfg.mode == Config::REPACK)
+    {
+        if (!cfg.bbfFolder || !cfg.muxer.outputFile)
+        {
+            printf("[BBFMUX] --repack needs an input and an output book.\n");
+            return 1;
+        }
+
+        uint32_t headerFlags = 0;
+        if (cfg.muxer.variableReamSize)
+        {
+            headerFlags |= BBF::BBF_VARIABLE_REAM_SIZE_FLAG;
+        }
+
+        printf("[BBFMUX] Repacking %s to %s...\n", cfg.bbfFolder, cfg.muxer.outputFile);
+        BBFCopyStats copyStats;
+        if (!BBFBuilder::repackFile(cfg.bbfFolder, cfg.muxer.outputFile, cfg.muxer.alignment, (uint32_t)cfg.muxer.reamSize, headerFlags, cfg.repack.petrify, &copyStats))
+        {
+            printf("[BBFMUX] Failed to repack %s.\n", cfg.bbfFolder);
+            return 1;
+        }
+
+        BBFReader before(cfg.bbfFolder);
+        BBFReader after(cfg.muxer.outputFile);
+        BBFHeader* beforeHeader = before.getHeaderView();
+        BBFHeader* afterHeader = after.getHeaderView();
+        BBFFooter* beforeFooter = beforeHeader ? before.getFooterView(beforeHeader->footerOffset) : nullptr;
+        BBFFooter* afterFooter = afterHeader ? after.getFooterView(afterHeader->footerOffset) : nullptr;
+        if (beforeFooter && afterFooter)
+        {
+            printf("[BBFMUX] Assets: %" PRIu64 " -> %" PRIu64 ", pages: %" PRIu64 "\n", beforeFooter->assetCount, afterFooter->assetCount, afterFooter->pageCount);
+        }
+        printf("[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n", copyStats.reflinkBytes, copyStats.kernelBytes, copyStats.bufferedBytes);
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::MERGE)
+    {
+        if (cfg.inputCount == 0 || !cfg.merge.outputFile)
+        {
+            printf("[BBFMUX] --merge needs input books and -o <OUT.bbf>.\n");
+            return 1;
+        }
+
+        // Volume names: the book's Title, or its file name. Repeats get a number.
+        char** volumeNames = (char**)calloc(cfg.inputCount, sizeof(char*));
+        uint64_t inputIterator = 0;
+        for (; inputIterator < cfg.inputCount; inputIterator++)
+        {
+            const char* baseName = nullptr;
+            BBFReader volume(cfg.inputFiles[inputIterator]);
+            BBFHeader* vHeader = volume.getHeaderView();
+            BBFFooter* vFooter = vHeader ? volume.getFooterView(vHeader->footerOffset) : nullptr;
+            if (!vFooter)
+            {
+                printf("[BBFMUX] Unable to read %s.\n", cfg.inputFiles[inputIterator]);
+                return 1;
+            }
+
+            const uint8_t* metaTable = volume.getMetadataView(vFooter->metaOffset);
+            uint64_t metaIterator = 0;
+            for (; metaIterator < vFooter->metaCount && !baseName; metaIterator++)
+            {
+                const BBFMeta* meta = volume.getMetaEntryView(metaTable, (int)metaIterator);
+                const char* keyName = meta ? volume.getStringView(meta->keyOffset) : nullptr;
+                if (keyName && strcmp(keyName, "Title") == 0)
+                {
+                    baseName = volume.getStringView(meta->valueOffset);
+                }
+            }
+
+            // File name without directory or extension
+            size_t nameLength = 0;
+            if (!baseName)
+            {
+                baseName = cfg.inputFiles[inputIterator];
+                const char* sepCursor = baseName;
+                for (; *sepCursor; sepCursor++)
+                {
+                    if (*sepCursor == '/' || *sepCursor == '\\') baseName = sepCursor + 1;
+                }
+                const char* dotPos = strrchr(baseName, '.');
+                nameLength = dotPos && dotPos != baseName ? (size_t)(dotPos - baseName) : strlen(baseName);
+            }
+            else
+            {
+                nameLength = strlen(baseName);
+            }
+
+            volumeNames[inputIterator] = (char*)malloc(nameLength + 24);
+            memcpy(volumeNames[inputIterator], baseName, nameLength);
+            volumeNames[inputIterator][nameLength] = '\0';
+
+            uint64_t repeatCount = 1;
+            uint64_t earlierIterator = 0;
+            for (; earlierIterator < inputIterator; earlierIterator++)
+            {
+                if (strncmp(volumeNames[earlierIterator], volumeNames[inputIterator], nameLength) == 0 &&
+                    (volumeNames[earlierIterator][nameLength] == '\0' || strncmp(volumeNames[earlierIterator] + nameLength, " (", 2) == 0))
+                {
+                    repeatCount++;
+                }
+            }
+            if (repeatCount > 1)
+            {
+                snprintf(volumeNames[inputIterator] + nameLength, 24, " (%" PRIu64 ")", repeatCount);
+            }
+        }
+
+        uint32_t headerFlags = 0;
+        if (cfg.muxer.variableReamSize)
+        {
+            headerFlags |= BBF::BBF_VARIABLE_REAM_SIZE_FLAG;
+        }
+
+        printf("[BBFMUX] Merging %" PRIu64 " books into %s...\n", cfg.inputCount, cfg.merge.outputFile);
+        BBFCopyStats copyStats;
+        bool mergeOk = BBFBuilder::mergeFiles((const char* const*)cfg.inputFiles, (uint32_t)cfg.inputCount, cfg.merge.outputFile, (const char* const*)volumeNames,
+                                              cfg.muxer.alignment, (uint32_t)cfg.muxer.reamSize, headerFlags, cfg.merge.petrify, &copyStats);
+
+        for (inputIterator = 0; inputIterator < cfg.inputCount; inputIterator++)
+        {
+            if (mergeOk) printf("[BBFMUX]   %s -> \"%s\"\n", cfg.inputFiles[inputIterator], volumeNames[inputIterator]);
+            free(volumeNames[inputIterator]);
+        }
+        free(volumeNames);
+
+        if (!mergeOk)
+        {
+            printf("[BBFMUX] Failed to merge.\n");
+            return 1;
+        }
+
+        printf("[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n", copyStats.reflinkBytes, copyStats.kernelBytes, copyStats.bufferedBytes);
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::DIFF)
+    {
+        if (cfg.inputCount != 2 || !cfg.patch.outputFile)
+        {
+            printf("[BBFMUX] Usage: bbfmux --diff <OLD.bbf> <NEW.bbf> -o <OUT.bbfp>\n");
+            return 1;
+        }
+
+        printf("[BBFMUX] Diffing %s against %s...\n", cfg.inputFiles[1], cfg.inputFiles[0]);
+        BBFPatchStats patchStats;
+        if (!BBFPatch::diff(cfg.inputFiles[0], cfg.inputFiles[1], cfg.patch.outputFile, &patchStats))
+        {
+            printf("[BBFMUX] Failed to diff.\n");
+            return 1;
+        }
+
+        printf("[BBFMUX] Assets: %" PRIu64 " reused (%" PRIu64 " bytes), %" PRIu64 " shipped.\n", patchStats.assetsReused, patchStats.reusedBytes, patchStats.assetsShipped);
+        printf("[BBFMUX] Patch: %" PRIu64 " bytes (%" PRIu64 " new data, %" PRIu64 " zero fill).\n", patchStats.patchSize, patchStats.literalBytes, patchStats.zeroBytes);
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::PATCH)
+    {
+        if (cfg.inputCount != 2 || !cfg.patch.outputFile)
+        {
+            printf("[BBFMUX] Usage: bbfmux --patch <OLD.bbf> <PATCH.bbfp> -o <NEW.bbf>\n");
+            return 1;
+        }
+
+        printf("[BBFMUX] Patching %s with %s...\n", cfg.inputFiles[0], cfg.inputFiles[1]);
+        BBFCopyStats copyStats;
+        if (!BBFPatch::apply(cfg.inputFiles[0], cfg.inputFiles[1], cfg.patch.outputFile, &copyStats))
+        {
+            printf("[BBFMUX] Failed to patch.\n");
+            return 1;
+        }
+
+        printf("[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n", copyStats.reflinkBytes, copyStats.kernelBytes, copyStats.bufferedBytes);
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::TO_CBZ)
+    {
+        if (cfg.inputCount != 2)
+        {
+            printf("[BBFMUX] Usage: bbfmux --to-cbz <IN.bbf> <OUT.cbz>, or - for stdout\n");
+            return 1;
+        }
+
+        // stdout may be the archive, so progress goes to stderr
+        BBFCbzExportStats exportStats;
+        fprintf(stderr, "[BBFMUX] Exporting %s to %s...\n", cfg.inputFiles[0], strcmp(cfg.inputFiles[1], "-") == 0 ? "stdout" : cfg.inputFiles[1]);
+        if (!BBFCbz::exportFile(cfg.inputFiles[0], cfg.inputFiles[1], &exportStats))
+        {
+            fprintf(stderr, "[BBFMUX] Failed to export %s.\n", cfg.inputFiles[0]);
+            return 1;
+        }
+
+        fprintf(stderr, "[BBFMUX] %" PRIu64 " pages, %" PRIu64 " assets checksummed, %" PRIu64 " bytes.\n", exportStats.pagesWritten, exportStats.assetsChecksummed, exportStats.archiveSize);
+        fprintf(stderr, "[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n",
+                exportStats.copyStats.reflinkBytes, exportStats.copyStats.kernelBytes, exportStats.copyStats.bufferedBytes);
+        fprintf(stderr, "[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::FROM_TAR)
+    {
+        if (cfg.inputCount != 2)
+        {
+            printf("[BBFMUX] Usage: bbfmux --from-tar <IN.tar> <OUT.bbf>, or - for stdin\n");
+            return 1;
+        }
+
+        BBFTarOptions tarOptions;
+        tarOptions.alignment = cfg.muxer.alignment;
+        tarOptions.reamSize = (uint32_t)cfg.muxer.reamSize;
+        tarOptions.hFlags = cfg.muxer.variableReamSize ? BBF::BBF_VARIABLE_REAM_SIZE_FLAG : 0;
+
+        BBFTarStats tarStats;
+        const char* tarName = strcmp(cfg.inputFiles[0], "-") == 0 ? "stdin" : cfg.inputFiles[0];
+        printf("[BBFMUX] Muxing %s to %s...\n", tarName, cfg.inputFiles[1]);
+        bool tarOk = BBFTar::importFile(cfg.inputFiles[0], cfg.inputFiles[1], &tarOptions, &tarStats);
+
+        printf("[BBFMUX] %" PRIu64 " members, %" PRIu64 " pages, %" PRIu64 " skipped, %" PRIu64 " bytes read.\n",
+               tarStats.membersRead, tarStats.pagesAdded, tarStats.membersSkipped, tarStats.bytesRead);
+        if (!tarOk)
+        {
+            printf("[BBFMUX] Failed to mux %s.\n", tarName);
+            return 1;
+        }
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::FROM_CBZ)
+    {
+        if (cfg.inputCount == 0 || (!cfg.cbz.outdir && cfg.inputCount != 2))
+        {
+            printf("[BBFMUX] Usage: bbfmux --from-cbz <IN.cbz> <OUT.bbf>, or <A.cbz> <B.cbz>... --outdir=<DIR>\n");
+            return 1;
+        }
+
+        BBFCbzOptions cbzOptions;
+        cbzOptions.archiveOrder = cfg.cbz.archiveOrder;
+        cbzOptions.alignment = cfg.muxer.alignment;
+        cbzOptions.reamSize = (uint32_t)cfg.muxer.reamSize;
+        cbzOptions.hFlags = cfg.muxer.variableReamSize ? BBF::BBF_VARIABLE_REAM_SIZE_FLAG : 0;
+
+        BBFCbzStats cbzStats;
+        bool cbzOk = false;
+        if (!cfg.cbz.outdir)
+        {
+            printf("[BBFMUX] Converting %s to %s...\n", cfg.inputFiles[0], cfg.inputFiles[1]);
+            cbzOk = BBFCbz::importFile(cfg.inputFiles[0], cfg.inputFiles[1], &cbzOptions, &cbzStats);
+        }
+        else
+        {
+            // <outdir>/<archive name>.bbf
+            char** outPaths = (char**)calloc(cfg.inputCount, sizeof(char*));
+            uint64_t inputIterator = 0;
+            for (; inputIterator < cfg.inputCount; inputIterator++)
+            {
+                const char* baseName = cfg.inputFiles[inputIterator];
+                const char* sepCursor = baseName;
+                for (; *sepCursor; sepCursor++)
+                {
+                    if (*sepCursor == '/' || *sepCursor == '\\') baseName = sepCursor + 1;
+                }
+                const char* dotPos = strrchr(baseName, '.');
+                size_t nameLength = dotPos && dotPos != baseName ? (size_t)(dotPos - baseName) : strlen(baseName);
+
+                size_t pathLength = strlen(cfg.cbz.outdir) + nameLength + 6;
+                outPaths[inputIterator] = (char*)malloc(pathLength);
+                snprintf(outPaths[inputIterator], pathLength, "%s/%.*s.bbf", cfg.cbz.outdir, (int)nameLength, baseName);
+            }
+
+            uint32_t cbzThreads = cfg.cbz.threads ? cfg.cbz.threads : 4;
+            printf("[BBFMUX] Converting %" PRIu64 " archives into %s...\n", cfg.inputCount, cfg.cbz.outdir);
+            cbzOk = BBFCbz::importFiles((const char* const*)cfg.inputFiles, (const char* const*)outPaths, (uint32_t)cfg.inputCount, &cbzOptions, cbzThreads, &cbzStats);
+
+            for (inputIterator = 0; inputIterator < cfg.inputCount; inputIterator++)
+            {
+                free(outPaths[inputIterator]);
+            }
+            free(outPaths);
+        }
+
+        printf("[BBFMUX] Converted %" PRIu64 " archives: %" PRIu64 " pages copied as stored, %" PRIu64 " inflated, %" PRIu64 " entries skipped.\n",
+               cbzStats.archivesConverted, cbzStats.pagesStored, cbzStats.pagesInflated, cbzStats.entriesSkipped);
+        if (!cbzOk)
+        {
+            printf("[BBFMUX] Failed to convert.\n");
+            return 1;
+        }
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::SPLIT)
+    {
+        if (!cfg.bbfFolder)
+        {
+            printf("[BBFMUX] --split needs an input book.\n");
+            return 1;
+        }
+
+        const char* outDir = cfg.split.outdir ? cfg.split.outdir : (cfg.muxer.outputFile ? cfg.muxer.outputFile : ".");
+        uint32_t splitDepth = cfg.split.depth ? cfg.split.depth : 1;
+        uint32_t splitThreads = cfg.split.threads ? cfg.split.threads : 4;
+
+        printf("[BBFMUX] Splitting %s at section depth %u into %s...\n", cfg.bbfFolder, splitDepth, outDir);
+        BBFCopyStats copyStats;
+        uint64_t bookCount = 0;
+        if (!BBFBuilder::splitFile(cfg.bbfFolder, outDir, splitDepth, splitThreads, &copyStats, &bookCount))
+        {
+            printf("[BBFMUX] Failed to split %s.\n", cfg.bbfFolder);
+            return 1;
+        }
+
+        printf("[BBFMUX] Wrote %" PRIu64 " books.\n", bookCount);
+        printf("[BBFMUX] Data moved: %" PRIu64 " bytes reflinked, %" PRIu64 " by copy_file_range, %" PRIu64 " buffered.\n", copyStats.reflinkBytes, copyStats.kernelBytes, copyStats.bufferedBytes);
+        printf("[BBFMUX] Success.\n");
+        return 0;
+    }
+
+    if (cfg.mode == Config::CATALOG)
+    {
+        if (!cfg.bbfFolder || !cfg.muxer.outputFile)
+        {
+            printf("[BBFMUX] Usage: bbfmux --catalog <DIR> <OUT.bbfcat>\n");
+            return 1;
+        }
+
+        // Refresh in place if the catalog is already there
+        BBFCatalogStats catalogStats;
+        uint32_t probeThreads = cfg.catalog.threads ? cfg.catalog.threads : 8;
+        printf("[BBFMUX] Cataloging %s into %s...\n", cfg.bbfFolder, cfg.muxer.outputFile);
+        if (!BBFCatalog::build(cfg.bbfFolder, cfg.muxer.outputFile, cfg.muxer.outputFile, &catalogStats, probeThreads))
+        {
+            printf("[BBFMUX] Failed to catalog %s.\n", cfg.bbfFolder);
+            return 1;
+        }
+
+        printf("[BBFMUX] %" PRIu64 " books: %" PRIu64 " unchanged, %" PRIu64 " probed, %" PRIu64 " skipped.\n",
+               catalogStats.booksListed, catalogStats.booksReused, catalogStats.booksProbed, catalogStats.booksFailed);
+        return 0;
+    }
+
     if (cfg.mode == Config::VERIFY)
     {
         BBFReader bbfReader(cfg.bbfFolder);
@@ -1067,6 +1708,24 @@ int main(int argc, char** argv)
                 pAsset = nullptr;
             }
             printf("[BBFMUX] Finished Verifying Hashes\n");
+
+            // Off-boundary assets still read fine, they just lose the point of aligning them
+            uint64_t misaligned[16];
+            uint64_t misalignedCount = bbfReader.findMisalignedAssets(misaligned, 16);
+            uint64_t misalignedIterator = 0;
+            for (; misalignedIterator < misalignedCount && misalignedIterator < 16; misalignedIterator++)
+            {
+                printf("[BBFMUX] [WARN] Asset %" PRIu64 " is not on its %" PRIu64 " byte boundary.\n", misaligned[misalignedIterator], bbfReader.getAssetAlignment(misaligned[misalignedIterator]));
+            }
+            if (misalignedCount > 16)
+            {
+                printf("[BBFMUX] [WARN] ...and %" PRIu64 " more.\n", misalignedCount - 16);
+            }
+            if (misalignedCount == 0)
+            {
+                printf("[BBFMUX] All assets aligned.\n");
+            }
+
             // Free
             assetTable = nullptr;
             pageTable = nullptr;